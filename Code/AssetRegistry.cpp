@@ -0,0 +1,274 @@
+#include "engine.h"
+#include "AssetRegistry.h"
+
+namespace AssetRegistry
+{
+    namespace
+    {
+        const u64 Prime1 = 11400714785074694791ull;
+        const u64 Prime2 = 14029467366897019727ull;
+        const u64 Prime3 = 1609587929392839161ull;
+        const u64 Prime4 = 9650029242287828579ull;
+        const u64 Prime5 = 2870177450012600261ull;
+
+        u64 RotateLeft(u64 x, u32 r)
+        {
+            return (x << r) | (x >> (64 - r));
+        }
+
+        u64 Read64(const u8* p)
+        {
+            u64 value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        u32 Read32(const u8* p)
+        {
+            u32 value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        u64 Round(u64 acc, u64 input)
+        {
+            acc += input * Prime2;
+            acc = RotateLeft(acc, 31);
+            return acc * Prime1;
+        }
+
+        u64 MergeRound(u64 acc, u64 value)
+        {
+            acc ^= Round(0, value);
+            return acc * Prime1 + Prime4;
+        }
+
+        template <typename T>
+        void HashValue(u64& hash, const T& value)
+        {
+            hash = Hash(&value, sizeof(T), hash);
+        }
+    }
+
+    u64 Hash(const void* data, u64 size, u64 seed)
+    {
+        const u8* p = (const u8*)data;
+        const u8* end = p + size;
+        u64 hash;
+
+        if (size >= 32)
+        {
+            u64 v1 = seed + Prime1 + Prime2;
+            u64 v2 = seed + Prime2;
+            u64 v3 = seed;
+            u64 v4 = seed - Prime1;
+            for (; p + 32 <= end; p += 32)
+            {
+                v1 = Round(v1, Read64(p));
+                v2 = Round(v2, Read64(p + 8));
+                v3 = Round(v3, Read64(p + 16));
+                v4 = Round(v4, Read64(p + 24));
+            }
+            hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+            hash = MergeRound(hash, v1);
+            hash = MergeRound(hash, v2);
+            hash = MergeRound(hash, v3);
+            hash = MergeRound(hash, v4);
+        }
+        else
+        {
+            hash = seed + Prime5;
+        }
+
+        hash += size;
+
+        for (; p + 8 <= end; p += 8)
+        {
+            hash ^= Round(0, Read64(p));
+            hash = RotateLeft(hash, 27) * Prime1 + Prime4;
+        }
+        if (p + 4 <= end)
+        {
+            hash ^= (u64)Read32(p) * Prime1;
+            hash = RotateLeft(hash, 23) * Prime2 + Prime3;
+            p += 4;
+        }
+        for (; p < end; ++p)
+        {
+            hash ^= *p * Prime5;
+            hash = RotateLeft(hash, 11) * Prime1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= Prime2;
+        hash ^= hash >> 29;
+        hash *= Prime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    std::string NormalizePath(const char* path)
+    {
+        std::vector<std::string> segments;
+        std::string segment;
+        for (const char* c = path; ; ++c)
+        {
+            if (*c == '/' || *c == '\\' || *c == '\0')
+            {
+                if (segment == "..")
+                {
+                    if (!segments.empty() && segments.back() != "..")
+                        segments.pop_back();
+                    else
+                        segments.push_back(segment);
+                }
+                else if (!segment.empty() && segment != ".")
+                {
+                    segments.push_back(segment);
+                }
+                segment.clear();
+
+                if (*c == '\0')
+                    break;
+            }
+            else
+            {
+                segment += (char)tolower(*c);
+            }
+        }
+
+        std::string normalized;
+        for (u32 i = 0; i < segments.size(); ++i)
+        {
+            if (i > 0)
+                normalized += '/';
+            normalized += segments[i];
+        }
+        return normalized;
+    }
+
+    u64 HashPath(const char* path)
+    {
+        const std::string normalized = NormalizePath(path);
+        return Hash(normalized.data(), normalized.size());
+    }
+
+    u64 HashFile(const char* path, u64* outSize)
+    {
+        MappedFile file = MapFile(path);
+        const u64 hash = file.data ? Hash(file.data, file.size) : 0;
+        if (outSize)
+            *outSize = file.size;
+        UnmapFile(file);
+        return hash;
+    }
+
+    u32 FindTexture(Registry& registry, const char* path)
+    {
+        return FindTexture(registry, HashPath(path));
+    }
+
+    u32 FindTexture(Registry& registry, u64 pathHash)
+    {
+        registry.stats.textureRequests++;
+
+        auto it = registry.texturesByPath.find(pathHash);
+        if (it == registry.texturesByPath.end())
+            return UINT32_MAX;
+
+        registry.stats.texturePathHits++;
+        return it->second;
+    }
+
+    void AddTexture(Registry& registry, const char* path, u32 texIdx)
+    {
+        AddTexture(registry, HashPath(path), texIdx);
+    }
+
+    void AddTexture(Registry& registry, u64 pathHash, u32 texIdx)
+    {
+        registry.texturesByPath[pathHash] = texIdx;
+    }
+
+    u32 MergeTexture(App* app, u32 texIdx, u64 contentHash, u64 sourceSize)
+    {
+        Registry& registry = app->registry;
+        if (contentHash == 0)
+            return texIdx;
+
+        auto it = registry.texturesByContent.find(contentHash);
+        if (it == registry.texturesByContent.end())
+        {
+            registry.texturesByContent[contentHash] = texIdx;
+            return texIdx;
+        }
+
+        const u32 sharedIdx = it->second;
+        if (sharedIdx == texIdx)
+            return texIdx;
+
+        registry.stats.textureContentHits++;
+        registry.stats.textureBytesSaved += sourceSize;
+
+        // Later requests for the paths of texIdx and the materials already using it get the shared one
+        for (auto& entry : registry.texturesByPath)
+        {
+            if (entry.second == texIdx)
+                entry.second = sharedIdx;
+        }
+
+        for (u32 m = 0; m < app->materials.size(); ++m)
+        {
+            Material& material = app->materials[m];
+            u32* slots[] = { &material.albedoTextureIdx, &material.emissiveTextureIdx, &material.normalsTextureIdx, &material.bumpTextureIdx, &material.ormTextureIdx };
+
+            bool remapped = false;
+            for (u32* slot : slots)
+            {
+                if (*slot == texIdx)
+                {
+                    *slot = sharedIdx;
+                    remapped = true;
+                }
+            }
+            if (remapped)
+                registry.materialsByHash.emplace(HashMaterial(material), m);
+        }
+
+        return sharedIdx;
+    }
+
+    u64 HashMaterial(const Material& material)
+    {
+        // The name is left out, exported materials often differ by name only
+        u64 hash = 0;
+        HashValue(hash, material.albedo);
+        HashValue(hash, material.emissive);
+        HashValue(hash, material.smoothness);
+        HashValue(hash, material.albedoTextureIdx);
+        HashValue(hash, material.emissiveTextureIdx);
+        HashValue(hash, material.normalsTextureIdx);
+        HashValue(hash, material.bumpTextureIdx);
+        HashValue(hash, material.ormTextureIdx);
+        return hash;
+    }
+
+    u32 AddMaterial(App* app, const Material& material)
+    {
+        Registry& registry = app->registry;
+        registry.stats.materialRequests++;
+
+        const u64 hash = HashMaterial(material);
+        auto it = registry.materialsByHash.find(hash);
+        if (it != registry.materialsByHash.end())
+        {
+            registry.stats.materialHits++;
+            return it->second;
+        }
+
+        const u32 materialIdx = app->materials.size();
+        app->materials.push_back(material);
+        registry.materialsByHash[hash] = materialIdx;
+        return materialIdx;
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef ASSET_REGISTRY_FUNC
+#define ASSET_REGISTRY_FUNC
+
+#include "Globals.h"
+
+#include <unordered_map>
+
+struct App;
+
+namespace AssetRegistry
+{
+    struct Stats
+    {
+        u32 textureRequests;
+        u32 texturePathHits;    // Same normalized path as a loaded texture
+        u32 textureContentHits; // Other path, same bytes, merged once decoded
+        u64 textureBytesSaved;  // Source bytes of the merged textures, not uploaded nor kept resident again
+        u32 materialRequests;
+        u32 materialHits;
+    };
+
+    /**
+     * Textures are found by the hash of their normalized path. The hash of their source bytes is
+     * only known once a decode job read them, copies of an image under other names are merged
+     * into one texture then (see MergeTexture).
+     * Materials are found by the hash of their parameters and texture indices.
+     */
+    struct Registry
+    {
+        std::unordered_map<u64, u32> texturesByPath;
+        std::unordered_map<u64, u32> texturesByContent;
+        std::unordered_map<u64, u32> materialsByHash;
+        Stats                        stats;
+    };
+
+    /**
+     * XXH64, see github.com/Cyan4973/xxHash for the reference implementation.
+     */
+    u64 Hash(const void* data, u64 size, u64 seed = 0);
+
+    /**
+     * Forward slashes, lower case, "." and ".." segments resolved.
+     */
+    std::string NormalizePath(const char* path);
+
+    u64 HashPath(const char* path);
+
+    /**
+     * Hash of the file contents, 0 when it cannot be read.
+     */
+    u64 HashFile(const char* path, u64* outSize = nullptr);
+
+    /**
+     * Returns the texture registered under path, UINT32_MAX if there is none. Never reads the file.
+     */
+    u32 FindTexture(Registry& registry, const char* path);
+
+    /**
+     * Same as FindTexture for textures built from several files, keyed by a hash of their paths.
+     */
+    u32 FindTexture(Registry& registry, u64 pathHash);
+
+    void AddTexture(Registry& registry, const char* path, u32 texIdx);
+
+    void AddTexture(Registry& registry, u64 pathHash, u32 texIdx);
+
+    /**
+     * GL thread, once the sources of texIdx are decoded. Registers texIdx under contentHash, or,
+     * when another texture already has these contents, points the paths and materials of texIdx
+     * to it. Returns the texture that keeps the contents.
+     */
+    u32 MergeTexture(App* app, u32 texIdx, u64 contentHash, u64 sourceSize);
+
+    u64 HashMaterial(const Material& material);
+
+    /**
+     * Returns the index of a material with the same parameters and textures, adding it if needed.
+     */
+    u32 AddMaterial(App* app, const Material& material);
+}
+
+#endif // !ASSET_REGISTRY_FUNC
@@ -0,0 +1,732 @@
+#include "BVH.h"
+#include "platform.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <random>
+
+namespace BVH
+{
+    namespace
+    {
+        const u32 BinCount = 16;
+        const u32 MaxLeafSize = 4;
+        // Cost of visiting an inner node relative to testing one item
+        const f32 TraversalCost = 1.0f;
+        // Past this depth nodes are split by object median, which bounds the tree depth
+        // (and so every traversal stack) to MaxSahDepth + log2(item count).
+        const u32 MaxSahDepth = 64;
+        const u32 MaxStackSize = 128;
+
+        enum Containment
+        {
+            Containment_Outside,
+            Containment_Intersect,
+            Containment_Inside
+        };
+
+        struct Bin
+        {
+            AABB bounds;
+            u32  count;
+        };
+
+        vec3 Centroid(const AABB& aabb)
+        {
+            return (aabb.min + aabb.max) * 0.5f;
+        }
+
+        void ComputeLeafBounds(const Tree& tree, Node& node)
+        {
+            node.bounds = MakeEmptyAABB();
+            for (u32 i = 0; i < node.count; ++i)
+            {
+                GrowAABB(node.bounds, tree.itemBounds[tree.items[node.leftFirst + i]]);
+            }
+        }
+
+        u32 BinIndex(const AABB& aabb, u32 axis, f32 binMin, f32 binScale)
+        {
+            return glm::min(BinCount - 1, (u32)((Centroid(aabb)[axis] - binMin) * binScale));
+        }
+
+        f32 ComputeCost(const Tree& tree)
+        {
+            if (tree.nodes.empty())
+                return 0.0f;
+
+            const f32 rootArea = SurfaceArea(tree.nodes[0].bounds);
+            if (rootArea <= 0.0f)
+                return 0.0f;
+
+            f32 cost = 0.0f;
+            for (const Node& node : tree.nodes)
+            {
+                const f32 area = SurfaceArea(node.bounds);
+                cost += node.count == 0 ? area * TraversalCost : area * node.count;
+            }
+            return cost / rootArea;
+        }
+
+        // Finds the best binned SAH split of a node. Returns false if keeping the node as a leaf is cheaper.
+        bool FindSplit(const Tree& tree, const Node& node, u32& outAxis, u32& outSplitBin, f32& outMin, f32& outScale)
+        {
+            AABB centroidBounds = MakeEmptyAABB();
+            for (u32 i = 0; i < node.count; ++i)
+            {
+                const vec3 c = Centroid(tree.itemBounds[tree.items[node.leftFirst + i]]);
+                centroidBounds.min = glm::min(centroidBounds.min, c);
+                centroidBounds.max = glm::max(centroidBounds.max, c);
+            }
+
+            const f32 nodeArea = SurfaceArea(node.bounds);
+            f32 bestCost = nodeArea * node.count;
+            bool found = false;
+
+            for (u32 axis = 0; axis < 3; ++axis)
+            {
+                const f32 extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+                if (extent <= 0.0f)
+                    continue;
+
+                Bin bins[BinCount];
+                for (u32 b = 0; b < BinCount; ++b)
+                {
+                    bins[b].bounds = MakeEmptyAABB();
+                    bins[b].count = 0;
+                }
+
+                const f32 scale = BinCount / extent;
+                for (u32 i = 0; i < node.count; ++i)
+                {
+                    const AABB& itemBounds = tree.itemBounds[tree.items[node.leftFirst + i]];
+                    const u32 b = BinIndex(itemBounds, axis, centroidBounds.min[axis], scale);
+                    bins[b].count++;
+                    GrowAABB(bins[b].bounds, itemBounds);
+                }
+
+                // Sweep from both sides to get the area and count at each split plane
+                f32 leftArea[BinCount - 1];
+                u32 leftCount[BinCount - 1];
+                f32 rightArea[BinCount - 1];
+                u32 rightCount[BinCount - 1];
+
+                AABB leftBox = MakeEmptyAABB();
+                AABB rightBox = MakeEmptyAABB();
+                u32 leftSum = 0;
+                u32 rightSum = 0;
+                for (u32 b = 0; b < BinCount - 1; ++b)
+                {
+                    leftSum += bins[b].count;
+                    GrowAABB(leftBox, bins[b].bounds);
+                    leftCount[b] = leftSum;
+                    leftArea[b] = leftSum ? SurfaceArea(leftBox) : 0.0f;
+
+                    rightSum += bins[BinCount - 1 - b].count;
+                    GrowAABB(rightBox, bins[BinCount - 1 - b].bounds);
+                    rightCount[BinCount - 2 - b] = rightSum;
+                    rightArea[BinCount - 2 - b] = rightSum ? SurfaceArea(rightBox) : 0.0f;
+                }
+
+                for (u32 b = 0; b < BinCount - 1; ++b)
+                {
+                    const f32 cost = nodeArea * TraversalCost + leftArea[b] * leftCount[b] + rightArea[b] * rightCount[b];
+                    if (leftCount[b] > 0 && rightCount[b] > 0 && cost < bestCost)
+                    {
+                        bestCost = cost;
+                        outAxis = axis;
+                        outSplitBin = b + 1;
+                        outMin = centroidBounds.min[axis];
+                        outScale = scale;
+                        found = true;
+                    }
+                }
+            }
+
+            return found;
+        }
+
+        Containment TestFrustum(const Frustum& frustum, const AABB& aabb)
+        {
+            Containment result = Containment_Inside;
+            for (u32 i = 0; i < 6; ++i)
+            {
+                const vec4& plane = frustum.planes[i];
+                const vec3 normal = vec3(plane);
+
+                // Vertex furthest along the plane normal, and the one furthest against it
+                const vec3 positive = glm::mix(aabb.min, aabb.max, glm::greaterThanEqual(normal, vec3(0.0f)));
+                const vec3 negative = glm::mix(aabb.max, aabb.min, glm::greaterThanEqual(normal, vec3(0.0f)));
+
+                if (glm::dot(normal, positive) + plane.w < 0.0f)
+                    return Containment_Outside;
+                if (glm::dot(normal, negative) + plane.w < 0.0f)
+                    result = Containment_Intersect;
+            }
+            return result;
+        }
+
+        bool IntersectRay(const AABB& aabb, const vec3& origin, const vec3& invDirection, f32 maxDistance, f32& outDistance)
+        {
+            const vec3 t0 = (aabb.min - origin) * invDirection;
+            const vec3 t1 = (aabb.max - origin) * invDirection;
+            const vec3 tmin = glm::min(t0, t1);
+            const vec3 tmax = glm::max(t0, t1);
+
+            const f32 enter = glm::max(glm::max(tmin.x, tmin.y), glm::max(tmin.z, 0.0f));
+            const f32 exit = glm::min(glm::min(tmax.x, tmax.y), glm::min(tmax.z, maxDistance));
+
+            outDistance = enter;
+            return enter <= exit;
+        }
+
+        bool IntersectSphere(const AABB& aabb, const vec3& center, f32 radiusSq)
+        {
+            const vec3 closest = glm::clamp(center, aabb.min, aabb.max);
+            const vec3 delta = closest - center;
+            return glm::dot(delta, delta) <= radiusSq;
+        }
+
+        void CollectSubtree(const Tree& tree, u32 nodeIndex, std::vector<u32>& outItems)
+        {
+            u32 stack[MaxStackSize];
+            u32 stackSize = 0;
+            stack[stackSize++] = nodeIndex;
+
+            while (stackSize > 0)
+            {
+                const Node& node = tree.nodes[stack[--stackSize]];
+                if (node.count > 0)
+                {
+                    outItems.insert(outItems.end(), tree.items.begin() + node.leftFirst, tree.items.begin() + node.leftFirst + node.count);
+                }
+                else
+                {
+                    stack[stackSize++] = node.leftFirst;
+                    stack[stackSize++] = node.leftFirst + 1;
+                }
+            }
+        }
+
+        f64 ElapsedMs(std::chrono::high_resolution_clock::time_point start)
+        {
+            return std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        // Runs random queries against the tree and against a brute force loop over every item,
+        // logging each query whose results differ. Returns the number of mismatching queries.
+        u32 Validate(const Tree& tree, f32 worldSize, const char* stage)
+        {
+            const u32 queryCount = 100;
+
+            std::mt19937 rng(5678);
+            std::uniform_real_distribution<f32> position(-worldSize, worldSize);
+            std::uniform_real_distribution<f32> unit(-1.0f, 1.0f);
+
+            const u32 itemCount = (u32)tree.itemBounds.size();
+            const glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, worldSize);
+
+            std::vector<u32> found;
+            std::vector<u32> expected;
+            u32 mismatches = 0;
+
+            for (u32 i = 0; i < queryCount; ++i)
+            {
+                const vec3 eye(position(rng), position(rng), position(rng));
+                const vec3 target(position(rng), position(rng), position(rng));
+                const Frustum frustum = ExtractFrustum(projection * glm::lookAt(eye, target, vec3(0.0f, 1.0f, 0.0f)));
+
+                found.clear();
+                QueryFrustum(tree, frustum, found);
+                expected.clear();
+                for (u32 item = 0; item < itemCount; ++item)
+                {
+                    if (TestFrustum(frustum, tree.itemBounds[item]) != Containment_Outside)
+                        expected.push_back(item);
+                }
+
+                std::sort(found.begin(), found.end());
+                if (found != expected)
+                {
+                    ELOG("BVH %s: frustum query %u found %u items, brute force %u", stage, i, (u32)found.size(), (u32)expected.size());
+                    mismatches++;
+                }
+            }
+
+            for (u32 i = 0; i < queryCount; ++i)
+            {
+                Ray ray;
+                ray.origin = vec3(position(rng), position(rng), position(rng));
+                ray.direction = glm::normalize(vec3(unit(rng), unit(rng), unit(rng)) + vec3(0.0f, 0.0f, 1e-3f));
+
+                f32 distance;
+                const u32 hit = QueryRay(tree, ray, &distance);
+
+                const vec3 invDirection = 1.0f / ray.direction;
+                u32 expectedHit = UINT32_MAX;
+                f32 expectedDistance = FLT_MAX;
+                for (u32 item = 0; item < itemCount; ++item)
+                {
+                    f32 itemDistance;
+                    if (IntersectRay(tree.itemBounds[item], ray.origin, invDirection, expectedDistance, itemDistance) && itemDistance < expectedDistance)
+                    {
+                        expectedDistance = itemDistance;
+                        expectedHit = item;
+                    }
+                }
+
+                // Items at the same distance are equally valid answers, so compare distances rather than ids
+                if ((hit == UINT32_MAX) != (expectedHit == UINT32_MAX) || (hit != UINT32_MAX && distance != expectedDistance))
+                {
+                    ELOG("BVH %s: ray query %u hit item %d at %f, brute force item %d at %f",
+                        stage, i, (int)hit, distance, (int)expectedHit, expectedDistance);
+                    mismatches++;
+                }
+            }
+
+            for (u32 i = 0; i < queryCount; ++i)
+            {
+                const vec3 center(position(rng), position(rng), position(rng));
+                const f32 radius = 5.0f;
+
+                found.clear();
+                QuerySphere(tree, center, radius, found);
+                expected.clear();
+                for (u32 item = 0; item < itemCount; ++item)
+                {
+                    if (IntersectSphere(tree.itemBounds[item], center, radius * radius))
+                        expected.push_back(item);
+                }
+
+                std::sort(found.begin(), found.end());
+                if (found != expected)
+                {
+                    ELOG("BVH %s: sphere query %u found %u items, brute force %u", stage, i, (u32)found.size(), (u32)expected.size());
+                    mismatches++;
+                }
+            }
+
+            return mismatches;
+        }
+    }
+
+    AABB MakeEmptyAABB()
+    {
+        AABB aabb;
+        aabb.min = vec3(FLT_MAX);
+        aabb.max = vec3(-FLT_MAX);
+        return aabb;
+    }
+
+    void GrowAABB(AABB& aabb, const AABB& other)
+    {
+        aabb.min = glm::min(aabb.min, other.min);
+        aabb.max = glm::max(aabb.max, other.max);
+    }
+
+    f32 SurfaceArea(const AABB& aabb)
+    {
+        const vec3 e = glm::max(aabb.max - aabb.min, vec3(0.0f));
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    void Build(Tree& tree, const std::vector<AABB>& bounds)
+    {
+        const u32 itemCount = (u32)bounds.size();
+
+        tree.itemBounds = bounds;
+        tree.items.resize(itemCount);
+        for (u32 i = 0; i < itemCount; ++i)
+            tree.items[i] = i;
+
+        tree.nodes.clear();
+        tree.refitCount = 0;
+        tree.dirty = false;
+
+        if (itemCount == 0)
+        {
+            tree.builtCost = tree.cost = 0.0f;
+            return;
+        }
+
+        // A binary tree with one item per leaf at most has 2n - 1 nodes
+        tree.nodes.reserve(itemCount * 2);
+        tree.nodes.push_back(Node{ MakeEmptyAABB(), 0, itemCount });
+
+        u32 stack[MaxStackSize];
+        u32 depthStack[MaxStackSize];
+        u32 stackSize = 0;
+        stack[stackSize] = 0;
+        depthStack[stackSize++] = 0;
+
+        while (stackSize > 0)
+        {
+            --stackSize;
+            const u32 nodeIndex = stack[stackSize];
+            const u32 depth = depthStack[stackSize];
+            ComputeLeafBounds(tree, tree.nodes[nodeIndex]);
+
+            Node& node = tree.nodes[nodeIndex];
+            if (node.count <= 1)
+                continue;
+
+            u32 axis = 0;
+            u32 splitBin = 0;
+            f32 binMin = 0.0f;
+            f32 binScale = 0.0f;
+            const bool sahSplit = depth < MaxSahDepth && FindSplit(tree, node, axis, splitBin, binMin, binScale);
+            if (!sahSplit && node.count <= MaxLeafSize)
+                continue;
+
+            if (!sahSplit)
+            {
+                // SAH prefers a leaf but it would be too big (or the tree got too deep):
+                // split by object median along the longest axis
+                const vec3 extent = node.bounds.max - node.bounds.min;
+                axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+                auto first = tree.items.begin() + node.leftFirst;
+                std::nth_element(first, first + node.count / 2, first + node.count, [&tree, axis](u32 a, u32 b)
+                {
+                    return Centroid(tree.itemBounds[a])[axis] < Centroid(tree.itemBounds[b])[axis];
+                });
+
+                const u32 leftCount = node.count / 2;
+                const u32 leftChild = (u32)tree.nodes.size();
+                tree.nodes.push_back(Node{ MakeEmptyAABB(), node.leftFirst, leftCount });
+                tree.nodes.push_back(Node{ MakeEmptyAABB(), node.leftFirst + leftCount, node.count - leftCount });
+                node.leftFirst = leftChild;
+                node.count = 0;
+            }
+            else
+            {
+                // Partition items in place around the chosen bin boundary
+                i32 i = (i32)node.leftFirst;
+                i32 j = i + (i32)node.count - 1;
+                while (i <= j)
+                {
+                    if (BinIndex(tree.itemBounds[tree.items[i]], axis, binMin, binScale) < splitBin)
+                        ++i;
+                    else
+                        std::swap(tree.items[i], tree.items[j--]);
+                }
+
+                const u32 leftCount = (u32)i - node.leftFirst;
+                const u32 leftChild = (u32)tree.nodes.size();
+                tree.nodes.push_back(Node{ MakeEmptyAABB(), node.leftFirst, leftCount });
+                tree.nodes.push_back(Node{ MakeEmptyAABB(), (u32)i, node.count - leftCount });
+                node.leftFirst = leftChild;
+                node.count = 0;
+            }
+
+            ASSERT(stackSize + 2 <= MaxStackSize, "BVH build stack overflow");
+            stack[stackSize] = tree.nodes[nodeIndex].leftFirst;
+            depthStack[stackSize++] = depth + 1;
+            stack[stackSize] = tree.nodes[nodeIndex].leftFirst + 1;
+            depthStack[stackSize++] = depth + 1;
+        }
+
+        // Inner node bounds were computed from all their items on the way down, which is
+        // already tight, but refitting keeps a single source of truth for the bounds.
+        Refit(tree);
+        tree.refitCount = 0;
+        tree.builtCost = tree.cost;
+    }
+
+    void UpdateItem(Tree& tree, u32 item, const AABB& bounds)
+    {
+        AABB& current = tree.itemBounds[item];
+        if (current.min != bounds.min || current.max != bounds.max)
+        {
+            current = bounds;
+            tree.dirty = true;
+        }
+    }
+
+    void Refit(Tree& tree)
+    {
+        // Children are always stored after their parent, so a reverse sweep is bottom-up
+        for (i32 i = (i32)tree.nodes.size() - 1; i >= 0; --i)
+        {
+            Node& node = tree.nodes[i];
+            if (node.count > 0)
+            {
+                ComputeLeafBounds(tree, node);
+            }
+            else
+            {
+                node.bounds = tree.nodes[node.leftFirst].bounds;
+                GrowAABB(node.bounds, tree.nodes[node.leftFirst + 1].bounds);
+            }
+        }
+
+        tree.cost = ComputeCost(tree);
+        tree.refitCount++;
+        tree.dirty = false;
+    }
+
+    bool NeedsRebuild(const Tree& tree)
+    {
+        return tree.refitCount >= BVH_MAX_REFITS_BEFORE_REBUILD ||
+            tree.cost > tree.builtCost * BVH_REBUILD_COST_RATIO;
+    }
+
+    void Maintain(Tree& tree)
+    {
+        if (!tree.dirty)
+            return;
+
+        Refit(tree);
+
+        if (NeedsRebuild(tree))
+        {
+            std::vector<AABB> bounds;
+            bounds.swap(tree.itemBounds);
+            Build(tree, bounds);
+        }
+    }
+
+    Frustum ExtractFrustum(const glm::mat4& viewProjection)
+    {
+        // Gribb/Hartmann: planes are sums/differences of the rows of the clip matrix
+        const glm::mat4 m = glm::transpose(viewProjection);
+
+        Frustum frustum;
+        frustum.planes[0] = m[3] + m[0]; // Left
+        frustum.planes[1] = m[3] - m[0]; // Right
+        frustum.planes[2] = m[3] + m[1]; // Bottom
+        frustum.planes[3] = m[3] - m[1]; // Top
+        frustum.planes[4] = m[3] + m[2]; // Near
+        frustum.planes[5] = m[3] - m[2]; // Far
+
+        for (u32 i = 0; i < 6; ++i)
+        {
+            frustum.planes[i] /= glm::length(vec3(frustum.planes[i]));
+        }
+
+        return frustum;
+    }
+
+    void QueryFrustum(const Tree& tree, const Frustum& frustum, std::vector<u32>& outItems)
+    {
+        if (tree.nodes.empty())
+            return;
+
+        u32 stack[MaxStackSize];
+        u32 stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0)
+        {
+            const u32 nodeIndex = stack[--stackSize];
+            const Node& node = tree.nodes[nodeIndex];
+
+            const Containment containment = TestFrustum(frustum, node.bounds);
+            if (containment == Containment_Outside)
+                continue;
+
+            if (containment == Containment_Inside)
+            {
+                CollectSubtree(tree, nodeIndex, outItems);
+            }
+            else if (node.count > 0)
+            {
+                for (u32 i = 0; i < node.count; ++i)
+                {
+                    const u32 item = tree.items[node.leftFirst + i];
+                    if (TestFrustum(frustum, tree.itemBounds[item]) != Containment_Outside)
+                        outItems.push_back(item);
+                }
+            }
+            else
+            {
+                stack[stackSize++] = node.leftFirst;
+                stack[stackSize++] = node.leftFirst + 1;
+            }
+        }
+    }
+
+    u32 QueryRay(const Tree& tree, const Ray& ray, f32* outDistance)
+    {
+        u32 closestItem = UINT32_MAX;
+        f32 closestDistance = FLT_MAX;
+
+        if (tree.nodes.empty())
+            return closestItem;
+
+        const vec3 invDirection = 1.0f / ray.direction;
+
+        u32 stack[MaxStackSize];
+        u32 stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0)
+        {
+            const Node& node = tree.nodes[stack[--stackSize]];
+
+            f32 distance;
+            if (!IntersectRay(node.bounds, ray.origin, invDirection, closestDistance, distance))
+                continue;
+
+            if (node.count > 0)
+            {
+                for (u32 i = 0; i < node.count; ++i)
+                {
+                    const u32 item = tree.items[node.leftFirst + i];
+                    if (IntersectRay(tree.itemBounds[item], ray.origin, invDirection, closestDistance, distance) && distance < closestDistance)
+                    {
+                        closestDistance = distance;
+                        closestItem = item;
+                    }
+                }
+            }
+            else
+            {
+                // Push the far child first so the near one is visited first and tightens closestDistance
+                f32 leftDistance, rightDistance;
+                const bool hitLeft = IntersectRay(tree.nodes[node.leftFirst].bounds, ray.origin, invDirection, closestDistance, leftDistance);
+                const bool hitRight = IntersectRay(tree.nodes[node.leftFirst + 1].bounds, ray.origin, invDirection, closestDistance, rightDistance);
+
+                if (hitLeft && hitRight)
+                {
+                    const bool leftFirst = leftDistance <= rightDistance;
+                    stack[stackSize++] = leftFirst ? node.leftFirst + 1 : node.leftFirst;
+                    stack[stackSize++] = leftFirst ? node.leftFirst : node.leftFirst + 1;
+                }
+                else if (hitLeft)
+                {
+                    stack[stackSize++] = node.leftFirst;
+                }
+                else if (hitRight)
+                {
+                    stack[stackSize++] = node.leftFirst + 1;
+                }
+            }
+        }
+
+        if (outDistance)
+            *outDistance = closestDistance;
+
+        return closestItem;
+    }
+
+    void QuerySphere(const Tree& tree, const vec3& center, f32 radius, std::vector<u32>& outItems)
+    {
+        if (tree.nodes.empty())
+            return;
+
+        const f32 radiusSq = radius * radius;
+
+        u32 stack[MaxStackSize];
+        u32 stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0)
+        {
+            const Node& node = tree.nodes[stack[--stackSize]];
+            if (!IntersectSphere(node.bounds, center, radiusSq))
+                continue;
+
+            if (node.count > 0)
+            {
+                for (u32 i = 0; i < node.count; ++i)
+                {
+                    const u32 item = tree.items[node.leftFirst + i];
+                    if (IntersectSphere(tree.itemBounds[item], center, radiusSq))
+                        outItems.push_back(item);
+                }
+            }
+            else
+            {
+                stack[stackSize++] = node.leftFirst;
+                stack[stackSize++] = node.leftFirst + 1;
+            }
+        }
+    }
+
+    BenchmarkResult Benchmark(u32 itemCount)
+    {
+        const u32 queryCount = 1000;
+
+        BenchmarkResult result = {};
+        result.itemCount = itemCount;
+
+        // Scatter boxes in a cube whose volume grows with the item count to keep the density constant
+        std::mt19937 rng(1234);
+        const f32 worldSize = 4.0f * std::cbrt((f32)itemCount);
+        std::uniform_real_distribution<f32> position(-worldSize, worldSize);
+        std::uniform_real_distribution<f32> extent(0.25f, 1.0f);
+        std::uniform_real_distribution<f32> unit(-1.0f, 1.0f);
+
+        std::vector<AABB> bounds(itemCount);
+        for (AABB& aabb : bounds)
+        {
+            const vec3 center(position(rng), position(rng), position(rng));
+            const vec3 halfSize(extent(rng), extent(rng), extent(rng));
+            aabb.min = center - halfSize;
+            aabb.max = center + halfSize;
+        }
+
+        Tree tree = {};
+
+        auto start = std::chrono::high_resolution_clock::now();
+        Build(tree, bounds);
+        result.buildMs = ElapsedMs(start);
+        result.nodeCount = (u32)tree.nodes.size();
+        result.mismatches += Validate(tree, worldSize, "after build");
+
+        // Move a tenth of the items, as dragging things around in the editor would
+        for (u32 i = 0; i < itemCount; i += 10)
+        {
+            AABB moved = tree.itemBounds[i];
+            const vec3 offset(unit(rng), unit(rng), unit(rng));
+            moved.min += offset;
+            moved.max += offset;
+            UpdateItem(tree, i, moved);
+        }
+
+        start = std::chrono::high_resolution_clock::now();
+        Refit(tree);
+        result.refitMs = ElapsedMs(start);
+        result.mismatches += Validate(tree, worldSize, "after refit");
+
+        std::vector<u32> found;
+        found.reserve(itemCount);
+
+        const glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, worldSize);
+        start = std::chrono::high_resolution_clock::now();
+        for (u32 i = 0; i < queryCount; ++i)
+        {
+            const vec3 eye(position(rng), position(rng), position(rng));
+            const vec3 target(position(rng), position(rng), position(rng));
+            found.clear();
+            QueryFrustum(tree, ExtractFrustum(projection * glm::lookAt(eye, target, vec3(0.0f, 1.0f, 0.0f))), found);
+        }
+        result.frustumQueryMs = ElapsedMs(start) / queryCount;
+
+        start = std::chrono::high_resolution_clock::now();
+        for (u32 i = 0; i < queryCount; ++i)
+        {
+            Ray ray;
+            ray.origin = vec3(position(rng), position(rng), position(rng));
+            ray.direction = glm::normalize(vec3(unit(rng), unit(rng), unit(rng)) + vec3(0.0f, 0.0f, 1e-3f));
+            QueryRay(tree, ray);
+        }
+        result.rayQueryMs = ElapsedMs(start) / queryCount;
+
+        start = std::chrono::high_resolution_clock::now();
+        for (u32 i = 0; i < queryCount; ++i)
+        {
+            found.clear();
+            QuerySphere(tree, vec3(position(rng), position(rng), position(rng)), 5.0f, found);
+        }
+        result.sphereQueryMs = ElapsedMs(start) / queryCount;
+
+        // Rebuild over the moved items, as Maintain does once refits degrade the tree
+        const std::vector<AABB> movedBounds = tree.itemBounds;
+        Build(tree, movedBounds);
+        result.mismatches += Validate(tree, worldSize, "after rebuild");
+
+        return result;
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef BVH_FUNC
+#define BVH_FUNC
+
+#include "Globals.h"
+
+// Number of refits after which the tree is rebuilt even if its SAH cost
+// did not degrade enough to trigger a rebuild on its own.
+#define BVH_MAX_REFITS_BEFORE_REBUILD 600
+// Ratio between the current and the freshly built SAH cost that triggers a rebuild.
+#define BVH_REBUILD_COST_RATIO 1.5f
+
+namespace BVH
+{
+    struct Node
+    {
+        AABB bounds;
+        u32  leftFirst; // Left child index for inner nodes, first item for leaves
+        u32  count;     // Number of items for leaves, 0 for inner nodes
+    };
+
+    struct Tree
+    {
+        std::vector<Node> nodes;
+        std::vector<u32>  items;      // Item ids in leaf order
+        std::vector<AABB> itemBounds; // Indexed by item id
+        f32               builtCost;  // SAH cost right after the last build
+        f32               cost;       // SAH cost after the last refit
+        u32               refitCount;
+        bool              dirty;
+    };
+
+    struct Frustum
+    {
+        vec4 planes[6];
+    };
+
+    struct Ray
+    {
+        vec3 origin;
+        vec3 direction;
+    };
+
+    struct BenchmarkResult
+    {
+        u32 itemCount;
+        f64 buildMs;
+        f64 refitMs;
+        f64 frustumQueryMs;
+        f64 rayQueryMs;
+        f64 sphereQueryMs;
+        u32 nodeCount;
+        u32 mismatches; // Queries whose results differ from a brute force search
+    };
+
+    AABB MakeEmptyAABB();
+
+    void GrowAABB(AABB& aabb, const AABB& other);
+
+    f32 SurfaceArea(const AABB& aabb);
+
+    /**
+     * Builds the tree from scratch over the given item bounds using a binned SAH.
+     * The item id of each bound is its index in the array.
+     */
+    void Build(Tree& tree, const std::vector<AABB>& bounds);
+
+    /**
+     * Updates the bounds of an item. The tree is not touched until Refit is called.
+     */
+    void UpdateItem(Tree& tree, u32 item, const AABB& bounds);
+
+    /**
+     * Recomputes the bounds of every node bottom-up keeping the topology.
+     */
+    void Refit(Tree& tree);
+
+    /**
+     * Returns true when refits degraded the tree enough to make a rebuild worth it.
+     */
+    bool NeedsRebuild(const Tree& tree);
+
+    /**
+     * Refits the tree if any item moved and rebuilds it when it degraded.
+     */
+    void Maintain(Tree& tree);
+
+    Frustum ExtractFrustum(const glm::mat4& viewProjection);
+
+    void QueryFrustum(const Tree& tree, const Frustum& frustum, std::vector<u32>& outItems);
+
+    /**
+     * Returns the closest item whose bounds are hit by the ray, or UINT32_MAX.
+     */
+    u32 QueryRay(const Tree& tree, const Ray& ray, f32* outDistance = nullptr);
+
+    void QuerySphere(const Tree& tree, const vec3& center, f32 radius, std::vector<u32>& outItems);
+
+    /**
+     * Times build, refit and queries over random items, and checks every query type
+     * against a brute force search after the build, the refit and a forced rebuild.
+     */
+    BenchmarkResult Benchmark(u32 itemCount);
+}
+
+#endif // !BVH_FUNC
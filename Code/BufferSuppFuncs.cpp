@@ -57,4 +57,11 @@ namespace BufferManager
         memcpy((u8*)buffer.data + buffer.head, data, size);
         buffer.head += size;
     }
+
+    void UploadData(const Buffer& buffer, u32 offset, const void* data, u32 size)
+    {
+        ASSERT(offset + size <= (u32)buffer.size, "Upload out of the buffer");
+        glBindBuffer(buffer.type, buffer.handle);
+        glBufferSubData(buffer.type, offset, size, data);
+    }
 }
\ No newline at end of file
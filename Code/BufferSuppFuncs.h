@@ -4,6 +4,9 @@
 #include "Globals.h"
 
 #define CreateConstantBuffer(size) BufferManager::CreateBuffer(size, GL_UNIFORM_BUFFER, GL_STREAM_DRAW)
+#define CreateStaticConstantBuffer(size) BufferManager::CreateBuffer(size, GL_UNIFORM_BUFFER, GL_STATIC_DRAW)
+#define CreateDynamicConstantBuffer(size) BufferManager::CreateBuffer(size, GL_UNIFORM_BUFFER, GL_DYNAMIC_DRAW)
+#define CreateStorageBuffer(size) BufferManager::CreateBuffer(size, GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW)
 #define CreateStaticVertexBuffer(size) BufferManager::CreateBuffer(size, GL_ARRAY_BUFFER, GL_STATIC_DRAW)
 #define CreateStaticIndexBuffer(size) BufferManager::CreateBuffer(size, GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW)
 
@@ -34,6 +37,11 @@ namespace BufferManager
     void AlignHead(Buffer& buffer, u32 alignment);
 
     void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
+
+    /**
+     * Writes size bytes at offset with one glBufferSubData, the buffer must not be mapped.
+     */
+    void UploadData(const Buffer& buffer, u32 offset, const void* data, u32 size);
 }
 
 #endif // !BUFFER_MANAGER_FUNC
\ No newline at end of file
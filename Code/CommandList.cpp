@@ -0,0 +1,306 @@
+#include "CommandList.h"
+
+namespace CommandList
+{
+    namespace
+    {
+        struct BindTextureArgs
+        {
+            u32    unit;
+            GLenum target;
+            GLuint texture;
+        };
+
+        struct BindBufferRangeArgs
+        {
+            GLenum target;
+            u32    index;
+            GLuint buffer;
+            u32    offset;
+            u32    size;
+        };
+
+        struct Uniform1iArgs
+        {
+            GLint location;
+            i32   value;
+        };
+
+        struct Uniform3fArgs
+        {
+            GLint location;
+            vec3  value;
+        };
+
+        struct DrawElementsArgs
+        {
+            GLenum mode;
+            u32    indexCount;
+            GLenum indexType;
+            u32    indexOffset;
+        };
+
+        struct DrawElementsInstancedArgs
+        {
+            GLenum mode;
+            u32    indexCount;
+            GLenum indexType;
+            u32    indexOffset;
+            u32    instanceCount;
+            u32    baseInstance;
+        };
+
+        struct DrawElementsIndirectArgs
+        {
+            GLenum mode;
+            GLenum indexType;
+            GLuint buffer;
+            u32    offset;
+            u32    drawCount;
+            u32    stride;
+        };
+
+        // Every record is 4 byte aligned, so the arguments are read in place
+        template <typename Args>
+        void Push(List& list, CommandType type, const Args& args)
+        {
+            static_assert(sizeof(Args) % sizeof(u32) == 0, "Command arguments must keep the stream 4 byte aligned");
+
+            const size_t head = list.data.size();
+            list.data.resize(head + sizeof(u32) + sizeof(Args));
+            memcpy(list.data.data() + head, &type, sizeof(u32));
+            memcpy(list.data.data() + head + sizeof(u32), &args, sizeof(Args));
+            list.commandCount++;
+        }
+
+        template <typename Args>
+        const Args& Read(const u8*& cursor)
+        {
+            const Args& args = *(const Args*)cursor;
+            cursor += sizeof(Args);
+            return args;
+        }
+
+        // What the replay bound, 0 for unknown
+        struct BoundState
+        {
+            GLuint program;
+            GLuint vao;
+            GLuint textures[COMMAND_TEXTURE_UNITS];
+            GLuint uniformBuffers[COMMAND_BUFFER_BINDINGS];
+            u32    uniformOffsets[COMMAND_BUFFER_BINDINGS];
+            u32    uniformSizes[COMMAND_BUFFER_BINDINGS];
+            GLuint indirectBuffer;
+            u32    activeUnit; // UINT32_MAX for unknown
+        };
+
+        // Tells whether the texture bind changed anything
+        bool ApplyBindTexture(BoundState& state, const BindTextureArgs& args)
+        {
+            if (args.unit < COMMAND_TEXTURE_UNITS && args.target == GL_TEXTURE_2D)
+            {
+                if (state.textures[args.unit] == args.texture && args.texture != 0)
+                    return false;
+                state.textures[args.unit] = args.texture;
+            }
+
+            if (state.activeUnit != args.unit)
+            {
+                glActiveTexture(GL_TEXTURE0 + args.unit);
+                state.activeUnit = args.unit;
+            }
+            glBindTexture(args.target, args.texture);
+            return true;
+        }
+
+        bool ApplyBindBufferRange(BoundState& state, const BindBufferRangeArgs& args)
+        {
+            if (args.target == GL_UNIFORM_BUFFER && args.index < COMMAND_BUFFER_BINDINGS)
+            {
+                if (state.uniformBuffers[args.index] == args.buffer && args.buffer != 0 &&
+                    state.uniformOffsets[args.index] == args.offset && state.uniformSizes[args.index] == args.size)
+                    return false;
+                state.uniformBuffers[args.index] = args.buffer;
+                state.uniformOffsets[args.index] = args.offset;
+                state.uniformSizes[args.index] = args.size;
+            }
+
+            glBindBufferRange(args.target, args.index, args.buffer, args.offset, args.size);
+            return true;
+        }
+    }
+
+    void Clear(List& list)
+    {
+        list.data.clear();
+        list.commandCount = 0;
+    }
+
+    void BindProgram(List& list, GLuint program)
+    {
+        Push(list, COMMAND_BIND_PROGRAM, program);
+    }
+
+    void BindVertexArray(List& list, GLuint vao)
+    {
+        Push(list, COMMAND_BIND_VERTEX_ARRAY, vao);
+    }
+
+    void BindTexture(List& list, u32 unit, GLenum target, GLuint texture)
+    {
+        const BindTextureArgs args = { unit, target, texture };
+        Push(list, COMMAND_BIND_TEXTURE, args);
+    }
+
+    void BindBufferRange(List& list, GLenum target, u32 index, GLuint buffer, u32 offset, u32 size)
+    {
+        const BindBufferRangeArgs args = { target, index, buffer, offset, size };
+        Push(list, COMMAND_BIND_BUFFER_RANGE, args);
+    }
+
+    void Uniform1i(List& list, GLint location, i32 value)
+    {
+        const Uniform1iArgs args = { location, value };
+        Push(list, COMMAND_UNIFORM_1I, args);
+    }
+
+    void Uniform3f(List& list, GLint location, const vec3& value)
+    {
+        const Uniform3fArgs args = { location, value };
+        Push(list, COMMAND_UNIFORM_3F, args);
+    }
+
+    void DrawElements(List& list, GLenum mode, u32 indexCount, GLenum indexType, u32 indexOffset)
+    {
+        const DrawElementsArgs args = { mode, indexCount, indexType, indexOffset };
+        Push(list, COMMAND_DRAW_ELEMENTS, args);
+    }
+
+    void DrawElementsInstanced(List& list, GLenum mode, u32 indexCount, GLenum indexType, u32 indexOffset, u32 instanceCount, u32 baseInstance)
+    {
+        const DrawElementsInstancedArgs args = { mode, indexCount, indexType, indexOffset, instanceCount, baseInstance };
+        Push(list, COMMAND_DRAW_ELEMENTS_INSTANCED, args);
+    }
+
+    void DrawElementsIndirect(List& list, GLenum mode, GLenum indexType, GLuint buffer, u32 offset, u32 drawCount, u32 stride)
+    {
+        const DrawElementsIndirectArgs args = { mode, indexType, buffer, offset, drawCount, stride };
+        Push(list, COMMAND_DRAW_ELEMENTS_INDIRECT, args);
+    }
+
+    void Replay(const List* lists, u32 listCount, Stats* stats)
+    {
+        BoundState state = {};
+        state.activeUnit = UINT32_MAX;
+
+        u32 draws = 0;
+        u32 skipped = 0;
+        for (u32 l = 0; l < listCount; ++l)
+        {
+            const List& list = lists[l];
+            const u8* cursor = list.data.data();
+            const u8* end = cursor + list.data.size();
+            while (cursor < end)
+            {
+                const CommandType type = Read<CommandType>(cursor);
+                switch (type)
+                {
+                case COMMAND_BIND_PROGRAM:
+                {
+                    const GLuint program = Read<GLuint>(cursor);
+                    if (program == state.program && program != 0)
+                    {
+                        skipped++;
+                        break;
+                    }
+                    glUseProgram(program);
+                    state.program = program;
+                }
+                break;
+                case COMMAND_BIND_VERTEX_ARRAY:
+                {
+                    const GLuint vao = Read<GLuint>(cursor);
+                    if (vao == state.vao && vao != 0)
+                    {
+                        skipped++;
+                        break;
+                    }
+                    glBindVertexArray(vao);
+                    state.vao = vao;
+                }
+                break;
+                case COMMAND_BIND_TEXTURE:
+                {
+                    if (!ApplyBindTexture(state, Read<BindTextureArgs>(cursor)))
+                        skipped++;
+                }
+                break;
+                case COMMAND_BIND_BUFFER_RANGE:
+                {
+                    if (!ApplyBindBufferRange(state, Read<BindBufferRangeArgs>(cursor)))
+                        skipped++;
+                }
+                break;
+                case COMMAND_UNIFORM_1I:
+                {
+                    const Uniform1iArgs& args = Read<Uniform1iArgs>(cursor);
+                    glUniform1i(args.location, args.value);
+                }
+                break;
+                case COMMAND_UNIFORM_3F:
+                {
+                    const Uniform3fArgs& args = Read<Uniform3fArgs>(cursor);
+                    glUniform3fv(args.location, 1, glm::value_ptr(args.value));
+                }
+                break;
+                case COMMAND_DRAW_ELEMENTS:
+                {
+                    const DrawElementsArgs& args = Read<DrawElementsArgs>(cursor);
+                    glDrawElements(args.mode, args.indexCount, args.indexType, (void*)(u64)args.indexOffset);
+                    draws++;
+                }
+                break;
+                case COMMAND_DRAW_ELEMENTS_INSTANCED:
+                {
+                    const DrawElementsInstancedArgs& args = Read<DrawElementsInstancedArgs>(cursor);
+                    glDrawElementsInstancedBaseInstance(args.mode, args.indexCount, args.indexType, (void*)(u64)args.indexOffset,
+                        args.instanceCount, args.baseInstance);
+                    draws++;
+                }
+                break;
+                case COMMAND_DRAW_ELEMENTS_INDIRECT:
+                {
+                    const DrawElementsIndirectArgs& args = Read<DrawElementsIndirectArgs>(cursor);
+                    if (state.indirectBuffer != args.buffer || args.buffer == 0)
+                    {
+                        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, args.buffer);
+                        state.indirectBuffer = args.buffer;
+                    }
+                    glMultiDrawElementsIndirect(args.mode, args.indexType, (void*)(u64)args.offset, args.drawCount, args.stride);
+                    draws += args.drawCount;
+                }
+                break;
+                default:
+                    ASSERT(false, "Unknown command in a command list");
+                    cursor = end;
+                }
+            }
+
+            if (stats)
+            {
+                stats->commands += list.commandCount;
+                stats->bytes += (u32)list.data.size();
+            }
+        }
+
+        if (state.indirectBuffer != 0)
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        if (stats)
+        {
+            stats->lists += listCount;
+            stats->draws += draws;
+            stats->skippedBinds += skipped;
+        }
+    }
+}
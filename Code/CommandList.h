@@ -0,0 +1,89 @@
+#ifndef COMMAND_LIST_FUNC
+#define COMMAND_LIST_FUNC
+
+#include "Globals.h"
+
+// Visible entities a recording job covers
+#define COMMAND_RECORD_GRAIN 64
+// Texture units the replay keeps track of, binds to the others are never skipped
+#define COMMAND_TEXTURE_UNITS 16
+// Indexed buffer binding points the replay keeps track of, per target
+#define COMMAND_BUFFER_BINDINGS 8
+
+namespace CommandList
+{
+    enum CommandType : u32
+    {
+        COMMAND_BIND_PROGRAM,
+        COMMAND_BIND_VERTEX_ARRAY,
+        COMMAND_BIND_TEXTURE,
+        COMMAND_BIND_BUFFER_RANGE,
+        COMMAND_UNIFORM_1I,
+        COMMAND_UNIFORM_3F,
+        COMMAND_DRAW_ELEMENTS,
+        COMMAND_DRAW_ELEMENTS_INSTANCED,
+        COMMAND_DRAW_ELEMENTS_INDIRECT,
+        COMMAND_TYPE_COUNT
+    };
+
+    /**
+     * GL calls recorded as a tightly packed stream of small records, a type followed by its
+     * arguments. Recording makes no GL calls so any thread may fill a list in, the GL thread
+     * replays it. Clearing keeps the memory, a list is meant to be reused every frame.
+     */
+    struct List
+    {
+        std::vector<u8> data;
+        u32             commandCount = 0;
+    };
+
+    // Counters of the lists recorded and replayed in a frame, summed over every Replay call
+    struct Stats
+    {
+        f64 recordMs;     // Wall time recording, the work is spread over the job threads
+        f64 replayMs;     // GL thread time replaying
+        u32 lists;
+        u32 commands;
+        u32 bytes;
+        u32 draws;
+        u32 skippedBinds; // Binds of what was already bound, dropped by the replay
+    };
+
+    void Clear(List& list);
+
+    void BindProgram(List& list, GLuint program);
+
+    void BindVertexArray(List& list, GLuint vao);
+
+    void BindTexture(List& list, u32 unit, GLenum target, GLuint texture);
+
+    void BindBufferRange(List& list, GLenum target, u32 index, GLuint buffer, u32 offset, u32 size);
+
+    /**
+     * The uniforms go to the program bound when the command is replayed.
+     */
+    void Uniform1i(List& list, GLint location, i32 value);
+
+    void Uniform3f(List& list, GLint location, const vec3& value);
+
+    void DrawElements(List& list, GLenum mode, u32 indexCount, GLenum indexType, u32 indexOffset);
+
+    /**
+     * Instanced attributes of the bound VAO start at element baseInstance.
+     */
+    void DrawElementsInstanced(List& list, GLenum mode, u32 indexCount, GLenum indexType, u32 indexOffset, u32 instanceCount, u32 baseInstance);
+
+    /**
+     * drawCount DrawElementsIndirectCommand structs read from buffer at offset, stride bytes apart.
+     */
+    void DrawElementsIndirect(List& list, GLenum mode, GLenum indexType, GLuint buffer, u32 offset, u32 drawCount, u32 stride);
+
+    /**
+     * GL thread. Runs the commands of the lists in order, as if the lists were one. The state bound
+     * by the replay is tracked, binding it again is skipped. Whatever was bound before is assumed
+     * to be unknown. Adds to the counters of stats, but the times, when given.
+     */
+    void Replay(const List* lists, u32 listCount, Stats* stats = nullptr);
+}
+
+#endif // !COMMAND_LIST_FUNC
@@ -0,0 +1,182 @@
+#include "Entities.h"
+
+namespace Entities
+{
+    namespace
+    {
+        u32 Find(const ComponentSet& set, u32 slot)
+        {
+            return slot < set.sparse.size() ? set.sparse[slot] : UINT32_MAX;
+        }
+
+        u32 Insert(ComponentSet& set, u32 slot)
+        {
+            ASSERT(Find(set, slot) == UINT32_MAX, "The entity has a component of this kind already");
+
+            if (set.sparse.size() <= slot)
+                set.sparse.resize(slot + 1, UINT32_MAX);
+
+            const u32 denseIndex = (u32)set.owners.size();
+            set.sparse[slot] = denseIndex;
+            set.owners.push_back(slot);
+            return denseIndex;
+        }
+
+        // Returns the dense index the component was at, the last one is moved there
+        u32 Erase(ComponentSet& set, u32 slot)
+        {
+            const u32 denseIndex = Find(set, slot);
+            if (denseIndex == UINT32_MAX)
+                return UINT32_MAX;
+
+            const u32 lastSlot = set.owners.back();
+            set.owners[denseIndex] = lastSlot;
+            set.sparse[lastSlot] = denseIndex;
+            set.owners.pop_back();
+            set.sparse[slot] = UINT32_MAX;
+            return denseIndex;
+        }
+
+        u32 FindTransform(const Registry& registry, u32 slot, Mobility* mobility)
+        {
+            for (u32 m = 0; m < MOBILITY_COUNT; ++m)
+            {
+                const u32 denseIndex = Find(registry.transformSets[m], slot);
+                if (denseIndex != UINT32_MAX)
+                {
+                    if (mobility)
+                        *mobility = (Mobility)m;
+                    return denseIndex;
+                }
+            }
+            return UINT32_MAX;
+        }
+
+        template <typename T>
+        void SwapRemove(std::vector<T>& components, u32 denseIndex)
+        {
+            components[denseIndex] = components.back();
+            components.pop_back();
+        }
+    }
+
+    EntityHandle Create(Registry& registry)
+    {
+        EntityHandle entity;
+        if (!registry.freeSlots.empty())
+        {
+            entity.index = registry.freeSlots.back();
+            registry.freeSlots.pop_back();
+        }
+        else
+        {
+            entity.index = (u32)registry.generations.size();
+            registry.generations.push_back(0);
+        }
+        entity.generation = registry.generations[entity.index];
+        registry.aliveCount++;
+        return entity;
+    }
+
+    void Destroy(Registry& registry, EntityHandle entity)
+    {
+        if (!IsAlive(registry, entity))
+            return;
+
+        RemoveTransform(registry, entity);
+        RemoveRender(registry, entity);
+        RemoveLightProxy(registry, entity);
+
+        registry.generations[entity.index]++;
+        registry.freeSlots.push_back(entity.index);
+        registry.aliveCount--;
+    }
+
+    bool IsAlive(const Registry& registry, EntityHandle entity)
+    {
+        return entity.index < registry.generations.size() && registry.generations[entity.index] == entity.generation;
+    }
+
+    EntityHandle HandleOf(const Registry& registry, u32 slot)
+    {
+        EntityHandle entity;
+        entity.index = slot;
+        entity.generation = registry.generations[slot];
+        return entity;
+    }
+
+    u32 AddTransform(Registry& registry, EntityHandle entity, const vec3& position, const vec3& scale, Mobility mobility)
+    {
+        ASSERT(IsAlive(registry, entity), "Adding a component to a dead entity");
+        ASSERT(FindTransform(registry, entity.index, nullptr) == UINT32_MAX, "The entity has a transform already");
+        Insert(registry.transformSets[mobility], entity.index);
+        return Transforms::Add(registry.transforms[mobility], position, scale);
+    }
+
+    u32 AddRender(Registry& registry, EntityHandle entity, u32 modelIndex)
+    {
+        ASSERT(IsAlive(registry, entity), "Adding a component to a dead entity");
+        registry.renders.push_back({ modelIndex });
+        return Insert(registry.renderSet, entity.index);
+    }
+
+    u32 AddLightProxy(Registry& registry, EntityHandle entity, u32 lightIndex)
+    {
+        ASSERT(IsAlive(registry, entity), "Adding a component to a dead entity");
+        registry.lightProxies.push_back({ lightIndex });
+        return Insert(registry.lightProxySet, entity.index);
+    }
+
+    void RemoveTransform(Registry& registry, EntityHandle entity)
+    {
+        if (!IsAlive(registry, entity))
+            return;
+
+        for (u32 m = 0; m < MOBILITY_COUNT; ++m)
+        {
+            const u32 denseIndex = Erase(registry.transformSets[m], entity.index);
+            if (denseIndex != UINT32_MAX)
+                Transforms::Remove(registry.transforms[m], denseIndex);
+        }
+    }
+
+    void RemoveRender(Registry& registry, EntityHandle entity)
+    {
+        if (!IsAlive(registry, entity))
+            return;
+
+        const u32 denseIndex = Erase(registry.renderSet, entity.index);
+        if (denseIndex != UINT32_MAX)
+            SwapRemove(registry.renders, denseIndex);
+    }
+
+    void RemoveLightProxy(Registry& registry, EntityHandle entity)
+    {
+        if (!IsAlive(registry, entity))
+            return;
+
+        const u32 denseIndex = Erase(registry.lightProxySet, entity.index);
+        if (denseIndex != UINT32_MAX)
+            SwapRemove(registry.lightProxies, denseIndex);
+    }
+
+    u32 TransformIndex(const Registry& registry, EntityHandle entity, Mobility* mobility)
+    {
+        return IsAlive(registry, entity) ? FindTransform(registry, entity.index, mobility) : UINT32_MAX;
+    }
+
+    u32 RenderIndex(const Registry& registry, EntityHandle entity)
+    {
+        return IsAlive(registry, entity) ? Find(registry.renderSet, entity.index) : UINT32_MAX;
+    }
+
+    u32 LightProxyIndex(const Registry& registry, EntityHandle entity)
+    {
+        return IsAlive(registry, entity) ? Find(registry.lightProxySet, entity.index) : UINT32_MAX;
+    }
+
+    u32 TransformOfOwner(const Registry& registry, const ComponentSet& set, u32 denseIndex, Mobility* mobility)
+    {
+        return FindTransform(registry, set.owners[denseIndex], mobility);
+    }
+}
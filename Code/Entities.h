@@ -0,0 +1,111 @@
+#ifndef ENTITIES_FUNC
+#define ENTITIES_FUNC
+
+#include "Globals.h"
+#include "Transforms.h"
+
+namespace Entities
+{
+    /**
+     * Static entities are expected to stay where they are, their instance data is uploaded once
+     * and again only when one of them is edited. Dynamic ones are uploaded every frame.
+     */
+    enum Mobility
+    {
+        MOBILITY_STATIC,
+        MOBILITY_DYNAMIC,
+        MOBILITY_COUNT
+    };
+
+    /**
+     * Sparse set. Maps the slot of an entity to the dense index of its component and back. The
+     * components of a kind are packed by dense index, removing one moves the last one in its place.
+     */
+    struct ComponentSet
+    {
+        std::vector<u32> sparse; // By entity slot, dense index or UINT32_MAX without the component
+        std::vector<u32> owners; // By dense index, entity slot
+    };
+
+    struct RenderComponent
+    {
+        u32 modelIndex;
+    };
+
+    // Entity standing for a light in the scene, its transform follows the light
+    struct LightProxyComponent
+    {
+        u32 lightIndex;
+    };
+
+    /**
+     * Entities and their components. A pass iterates the dense arrays of the components it
+     * needs and goes through the component sets only to reach the other components of an entity.
+     */
+    struct Registry
+    {
+        std::vector<u32>                 generations; // By slot, bumped when the entity in the slot is destroyed
+        std::vector<u32>                 freeSlots;
+        u32                              aliveCount = 0;
+
+        ComponentSet                     transformSets[MOBILITY_COUNT];
+        Transforms::Store                transforms[MOBILITY_COUNT]; // By transformSets dense index, of the same mobility
+
+        ComponentSet                     renderSet;
+        std::vector<RenderComponent>     renders;      // By renderSet dense index
+
+        ComponentSet                     lightProxySet;
+        std::vector<LightProxyComponent> lightProxies; // By lightProxySet dense index
+    };
+
+    /**
+     * Returns a new entity without components. Slots of destroyed entities are reused.
+     */
+    EntityHandle Create(Registry& registry);
+
+    /**
+     * Removes the components of the entity and frees its slot, its handles are dead from now on.
+     */
+    void Destroy(Registry& registry, EntityHandle entity);
+
+    bool IsAlive(const Registry& registry, EntityHandle entity);
+
+    /**
+     * The handle of the entity living in the slot, the slot comes from ComponentSet::owners.
+     */
+    EntityHandle HandleOf(const Registry& registry, u32 slot);
+
+    /**
+     * The Add functions return the dense index of the new component. An entity has one of each at most.
+     */
+    u32 AddTransform(Registry& registry, EntityHandle entity, const vec3& position, const vec3& scale, Mobility mobility);
+
+    u32 AddRender(Registry& registry, EntityHandle entity, u32 modelIndex);
+
+    u32 AddLightProxy(Registry& registry, EntityHandle entity, u32 lightIndex);
+
+    void RemoveTransform(Registry& registry, EntityHandle entity);
+
+    void RemoveRender(Registry& registry, EntityHandle entity);
+
+    void RemoveLightProxy(Registry& registry, EntityHandle entity);
+
+    /**
+     * The Index functions return the dense index of the component of the entity, UINT32_MAX
+     * when it has none or is dead. Dense indices change when components of the kind are removed.
+     * The transform index is into the store of its mobility, which goes to mobility when given.
+     */
+    u32 TransformIndex(const Registry& registry, EntityHandle entity, Mobility* mobility = nullptr);
+
+    u32 RenderIndex(const Registry& registry, EntityHandle entity);
+
+    u32 LightProxyIndex(const Registry& registry, EntityHandle entity);
+
+    /**
+     * Dense index of the transform of the entity owning a component, UINT32_MAX without one.
+     * The mobility of the transform goes to mobility when given.
+     */
+    u32 TransformOfOwner(const Registry& registry, const ComponentSet& set, u32 denseIndex, Mobility* mobility = nullptr);
+}
+
+#endif // !ENTITIES_FUNC
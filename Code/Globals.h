@@ -58,11 +58,19 @@ struct Input {
     ButtonState keys[KEY_COUNT];
 };
 
+struct AABB
+{
+    vec3 min;
+    vec3 max;
+};
+
 struct VertexBufferAttribute
 {
     u8 location;
     u8 componentCount;
     u8 offset;
+    GLenum type = GL_FLOAT;
+    GLboolean normalized = GL_FALSE;
 };
 
 struct VertexBufferLayout
@@ -88,13 +96,28 @@ struct VAO
     GLuint programHandle;
 };
 
+// Positions live in their own tightly packed stream so passes that only
+// need positions (depth, shadows, culling) do not fetch the other attributes
+#define VERTEX_STREAM_POSITION   0
+#define VERTEX_STREAM_ATTRIBUTES 1
+#define VERTEX_STREAM_COUNT      2
+
+struct VertexStream
+{
+    VertexBufferLayout layout;
+    std::vector<u8> data; // Packed as described by layout, see VertexFormat::Compress
+    u32 offset;           // Byte offset of the stream in the mesh vertex buffer
+};
+
 struct SubMesh
 {
-    VertexBufferLayout vertexBufferLayout;
-    std::vector<float> vertices;
+    VertexStream streams[VERTEX_STREAM_COUNT];
     std::vector<u32> indices;
-    u32 vertexOffset;
+    GLenum indexType; // GL_UNSIGNED_SHORT when the submesh has less than 65536 vertices
+    u32 indexCount;
     u32 indexOffset;
+    AABB bounds;
+    f32 uvDensity; // UV units per model space unit, 0 without texture coordinates
 
     std::vector<VAO> vaos;
 };
@@ -102,6 +125,7 @@ struct SubMesh
 struct Mesh
 {
     std::vector<SubMesh>    submeshes;
+    AABB                    bounds;
     GLuint                  vertexBufferHandle;
     GLuint                  indexBufferHandle;
 };
@@ -148,6 +172,8 @@ enum Mode
     Mode_Roughness,
     Mode_Ao,
     Mode_Emissive,
+    Mode_ForwardPlus,
+    Mode_Visibility,
     Mode_Count,
 };
 
@@ -163,6 +189,12 @@ struct String
     u32   len;
 };
 
+// Channels of the packed occlusion/roughness/metallic texture (glTF convention)
+#define ORM_OCCLUSION     0
+#define ORM_ROUGHNESS     1
+#define ORM_METALLIC      2
+#define ORM_CHANNEL_COUNT 3
+
 struct Material
 {
     std::string     name;
@@ -172,11 +204,10 @@ struct Material
     vec3            ao;
     u32             albedoTextureIdx;
     u32             emissiveTextureIdx;
-    u32             specularTextureIdx;
     u32             normalsTextureIdx;
     u32             bumpTextureIdx;
-    u32             shininessTextureIdx;
-    u32             aoTextureIdx;
+    u32             ormTextureIdx;                 // R occlusion, G roughness, B metallic
+    std::string     ormSources[ORM_CHANNEL_COUNT]; // Images packed into ormTextureIdx, empty for constant channels
 };
 
 struct Buffer {
@@ -187,15 +218,18 @@ struct Buffer {
     u32 head;
 };
 
-struct Entity
+// Refers to an entity for as long as it lives, see Entities::IsAlive
+struct EntityHandle
 {
-    vec3 position;
-    vec3 scale;
-    u32 modelIndex;
-    u32 localParamsOffset;
-    u32 localParamsSize;
+    u32 index = UINT32_MAX; // Slot of the entity
+    u32 generation = 0;
 };
 
+inline bool operator==(EntityHandle a, EntityHandle b)
+{
+    return a.index == b.index && a.generation == b.generation;
+}
+
 enum LightType
 {
     LightType_Directional,
@@ -210,7 +244,7 @@ struct Light
     vec3 position;
     float intensity;
     bool selected;
-    int sphere = -1;
+    EntityHandle sphere; // Proxy entity of a point light
 };
 
 struct FrameBuffer
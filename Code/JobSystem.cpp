@@ -0,0 +1,416 @@
+#include "JobSystem.h"
+#include "platform.h"
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+namespace JobSystem
+{
+    namespace
+    {
+        struct ThreadState
+        {
+            WorkStealingDeque          deque;
+            std::thread                thread;
+            const char*                name;
+            bool                       steals; // Workers only, the others run their own jobs
+            u32                        random;
+            std::mutex                 markerMutex;
+            std::vector<ProfileMarker> markers;
+        };
+
+        struct System
+        {
+            // [0] is the main thread, then the workers and the attached threads. Entries are
+            // only appended, so the workers read them without a lock.
+            ThreadState*              threads[JOB_MAX_THREADS];
+            std::atomic<u32>          threadCount;
+            u32                       workerCount;
+            std::mutex                attachMutex;
+            std::atomic<bool>         quit;
+
+            // Jobs from threads without a deque and jobs that did not fit in one
+            std::mutex                sharedMutex;
+            std::deque<Job*>          sharedJobs;
+            std::atomic<u32>          sharedCount;
+
+            std::mutex                glThreadMutex;
+            std::deque<Job*>          glThreadJobs;
+
+            std::mutex                sleepMutex;
+            std::condition_variable   sleepCondition;
+            std::atomic<u32>          sleepingCount;
+
+            FrameProfile              lastFrame;
+            f64                       frameStart;
+        };
+
+        System* TheSystem = nullptr;
+        thread_local u32 CurrentThreadIndex = UINT32_MAX;
+
+        bool Push(WorkStealingDeque& deque, Job* job)
+        {
+            const i64 bottom = deque.bottom.load(std::memory_order_relaxed);
+            const i64 top = deque.top.load(std::memory_order_acquire);
+            if (bottom - top >= JOB_DEQUE_SIZE)
+                return false;
+
+            deque.jobs[bottom & (JOB_DEQUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        Job* Pop(WorkStealingDeque& deque)
+        {
+            const i64 bottom = deque.bottom.load(std::memory_order_relaxed) - 1;
+            deque.bottom.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            i64 top = deque.top.load(std::memory_order_relaxed);
+
+            if (top > bottom)
+            {
+                deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            Job* job = deque.jobs[bottom & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+            if (top == bottom)
+            {
+                // Last job, a thief may be taking it too
+                if (!deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    job = nullptr;
+                deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+            return job;
+        }
+
+        Job* Steal(WorkStealingDeque& deque)
+        {
+            i64 top = deque.top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const i64 bottom = deque.bottom.load(std::memory_order_acquire);
+            if (top >= bottom)
+                return nullptr;
+
+            Job* job = deque.jobs[top & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+            if (!deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr;
+            return job;
+        }
+
+        void WakeWorkers(u32 jobCount)
+        {
+            if (TheSystem->sleepingCount.load() == 0)
+                return;
+
+            if (jobCount == 1)
+                TheSystem->sleepCondition.notify_one();
+            else
+                TheSystem->sleepCondition.notify_all();
+        }
+
+        void Schedule(Job* job)
+        {
+            const u32 threadIndex = CurrentThreadIndex;
+            if (threadIndex == UINT32_MAX || !Push(TheSystem->threads[threadIndex]->deque, job))
+            {
+                std::lock_guard<std::mutex> lock(TheSystem->sharedMutex);
+                TheSystem->sharedJobs.push_back(job);
+                TheSystem->sharedCount++;
+            }
+            WakeWorkers(1);
+        }
+
+        Job* TakeShared()
+        {
+            if (TheSystem->sharedCount.load(std::memory_order_relaxed) == 0)
+                return nullptr;
+
+            std::lock_guard<std::mutex> lock(TheSystem->sharedMutex);
+            if (TheSystem->sharedJobs.empty())
+                return nullptr;
+
+            Job* job = TheSystem->sharedJobs.front();
+            TheSystem->sharedJobs.pop_front();
+            TheSystem->sharedCount--;
+            return job;
+        }
+
+        Job* FindJob(u32 threadIndex)
+        {
+            ThreadState* self = TheSystem->threads[threadIndex];
+            if (Job* job = Pop(self->deque))
+                return job;
+
+            if (!self->steals)
+                return nullptr;
+
+            if (Job* job = TakeShared())
+                return job;
+
+            // Start at a random victim so thieves spread over the deques
+            const u32 threadCount = TheSystem->threadCount.load();
+            self->random = self->random * 1664525u + 1013904223u;
+            const u32 first = (self->random >> 16) % threadCount;
+            for (u32 i = 0; i < threadCount; ++i)
+            {
+                const u32 victim = (first + i) % threadCount;
+                if (victim == threadIndex)
+                    continue;
+                if (Job* job = Steal(TheSystem->threads[victim]->deque))
+                    return job;
+            }
+            return nullptr;
+        }
+
+        void Finish(TaskGroup* group)
+        {
+            if (!group)
+                return;
+
+            // Decremented under the lock, a waiter locks it too before it lets the group go
+            std::vector<Job*> continuations;
+            {
+                std::lock_guard<std::mutex> lock(group->continuationMutex);
+                if (--group->pending == 0)
+                    continuations.swap(group->continuations);
+            }
+            for (Job* job : continuations)
+                Schedule(job);
+        }
+
+        void AddMarker(u32 threadIndex, const char* name, f64 start, f64 end)
+        {
+            if (threadIndex == UINT32_MAX)
+                return;
+
+            ThreadState* self = TheSystem->threads[threadIndex];
+            std::lock_guard<std::mutex> lock(self->markerMutex);
+            if (self->markers.size() < JOB_MAX_MARKERS_PER_THREAD)
+                self->markers.push_back(ProfileMarker{ name, threadIndex, start, end });
+        }
+
+        ThreadState* CreateThreadState(const char* name, bool steals)
+        {
+            const u32 index = TheSystem->threadCount.load();
+            ASSERT(index < JOB_MAX_THREADS, "Too many job system threads");
+
+            ThreadState* state = new ThreadState();
+            state->name = name;
+            state->steals = steals;
+            state->random = index * 2654435761u + 1u;
+            TheSystem->threads[index] = state;
+            TheSystem->threadCount = index + 1;
+            return state;
+        }
+
+        void Execute(Job* job, u32 threadIndex)
+        {
+            const f64 start = glfwGetTime();
+            job->function();
+            const f64 end = glfwGetTime();
+
+            AddMarker(threadIndex, job->name, start, end);
+
+            TaskGroup* group = job->group;
+            delete job;
+            Finish(group);
+        }
+
+        void WorkerMain(u32 threadIndex)
+        {
+            CurrentThreadIndex = threadIndex;
+
+            u32 idleSpins = 0;
+            while (!TheSystem->quit)
+            {
+                if (Job* job = FindJob(threadIndex))
+                {
+                    Execute(job, threadIndex);
+                    idleSpins = 0;
+                    continue;
+                }
+
+                if (++idleSpins < JOB_IDLE_SPINS)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                // A job pushed between the last search and the wait is found on the timeout at worst
+                std::unique_lock<std::mutex> lock(TheSystem->sleepMutex);
+                TheSystem->sleepingCount++;
+                TheSystem->sleepCondition.wait_for(lock, std::chrono::milliseconds(1));
+                TheSystem->sleepingCount--;
+                idleSpins = 0;
+            }
+        }
+    }
+
+    void Init(u32 workerCount)
+    {
+        if (workerCount == 0)
+            workerCount = glm::max(std::thread::hardware_concurrency(), 2u) - 1u;
+        workerCount = glm::min(workerCount, (u32)(JOB_MAX_THREADS - 1 - JOB_MAX_ATTACHED_THREADS));
+
+        TheSystem = new System();
+        TheSystem->workerCount = workerCount;
+        CreateThreadState("Main", false);
+        for (u32 i = 1; i <= workerCount; ++i)
+            CreateThreadState("Worker", true);
+
+        CurrentThreadIndex = 0;
+        for (u32 i = 1; i <= workerCount; ++i)
+            TheSystem->threads[i]->thread = std::thread(WorkerMain, i);
+
+        TheSystem->frameStart = glfwGetTime();
+
+        ILOG("Job system: %u worker threads", workerCount);
+    }
+
+    void Shutdown()
+    {
+        TheSystem->quit = true;
+        TheSystem->sleepCondition.notify_all();
+        for (u32 i = 1; i <= TheSystem->workerCount; ++i)
+            TheSystem->threads[i]->thread.join();
+
+        for (u32 i = 0; i < TheSystem->threadCount; ++i)
+        {
+            ThreadState* state = TheSystem->threads[i];
+            while (Job* job = Pop(state->deque))
+                delete job;
+            delete state;
+        }
+        for (Job* job : TheSystem->sharedJobs)
+            delete job;
+        for (Job* job : TheSystem->glThreadJobs)
+            delete job;
+
+        delete TheSystem;
+        TheSystem = nullptr;
+    }
+
+    void AttachThread(const char* name)
+    {
+        std::lock_guard<std::mutex> lock(TheSystem->attachMutex);
+        CreateThreadState(name, false);
+        CurrentThreadIndex = TheSystem->threadCount - 1;
+    }
+
+    u32 ThreadCount()
+    {
+        return TheSystem->threadCount;
+    }
+
+    u32 ThreadIndex()
+    {
+        return CurrentThreadIndex;
+    }
+
+    void Run(TaskGroup* group, const char* name, JobFunction function, TaskGroup* after)
+    {
+        Job* job = new Job{ std::move(function), name, group };
+        if (group)
+            group->pending++;
+
+        if (after && after->pending > 0)
+        {
+            // Checked again under the lock, the group may have finished meanwhile (see Finish)
+            std::lock_guard<std::mutex> lock(after->continuationMutex);
+            if (after->pending > 0)
+            {
+                after->continuations.push_back(job);
+                return;
+            }
+        }
+
+        Schedule(job);
+    }
+
+    void RunOnGLThread(TaskGroup* group, const char* name, JobFunction function)
+    {
+        Job* job = new Job{ std::move(function), name, group };
+        if (group)
+            group->pending++;
+
+        std::lock_guard<std::mutex> lock(TheSystem->glThreadMutex);
+        TheSystem->glThreadJobs.push_back(job);
+    }
+
+    void RunGLThreadJobs(f64 budgetMs)
+    {
+        const f64 startTime = glfwGetTime();
+        for (;;)
+        {
+            Job* job = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(TheSystem->glThreadMutex);
+                if (TheSystem->glThreadJobs.empty())
+                    return;
+                job = TheSystem->glThreadJobs.front();
+                TheSystem->glThreadJobs.pop_front();
+            }
+
+            Execute(job, CurrentThreadIndex);
+
+            if ((glfwGetTime() - startTime) * 1000.0 > budgetMs)
+                return;
+        }
+    }
+
+    void RecordMarker(const char* name, f64 start, f64 end)
+    {
+        AddMarker(CurrentThreadIndex, name, start, end);
+    }
+
+    bool IsDone(TaskGroup* group)
+    {
+        if (group->pending > 0)
+            return false;
+
+        std::lock_guard<std::mutex> lock(group->continuationMutex);
+        return group->pending == 0;
+    }
+
+    void Wait(TaskGroup* group)
+    {
+        const u32 threadIndex = CurrentThreadIndex;
+        while (group->pending > 0)
+        {
+            Job* job = threadIndex != UINT32_MAX ? FindJob(threadIndex) : TakeShared();
+            if (job)
+                Execute(job, threadIndex);
+            else
+                std::this_thread::yield();
+        }
+
+        // The job that finished the group may still hold its lock
+        std::lock_guard<std::mutex> lock(group->continuationMutex);
+    }
+
+    void EndFrame()
+    {
+        FrameProfile& frame = TheSystem->lastFrame;
+        frame.start = TheSystem->frameStart;
+        frame.end = glfwGetTime();
+        frame.threadCount = TheSystem->threadCount;
+        frame.markers.clear();
+        for (u32 i = 0; i < frame.threadCount; ++i)
+        {
+            ThreadState* state = TheSystem->threads[i];
+            frame.threadNames[i] = state->name;
+            std::lock_guard<std::mutex> lock(state->markerMutex);
+            frame.markers.insert(frame.markers.end(), state->markers.begin(), state->markers.end());
+            state->markers.clear();
+        }
+        TheSystem->frameStart = frame.end;
+    }
+
+    const FrameProfile& LastFrameProfile()
+    {
+        return TheSystem->lastFrame;
+    }
+}
@@ -0,0 +1,173 @@
+#ifndef JOB_SYSTEM_FUNC
+#define JOB_SYSTEM_FUNC
+
+#include "Globals.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+// Jobs a thread can have queued in its deque, a power of two. Extra jobs go to a shared queue.
+#define JOB_DEQUE_SIZE 4096
+#define JOB_MAX_THREADS 64
+// Threads that are not workers but queue jobs, like the render thread (see AttachThread)
+#define JOB_MAX_ATTACHED_THREADS 4
+// Markers a thread records per frame, the ones after that are not profiled
+#define JOB_MAX_MARKERS_PER_THREAD 1024
+// Time the GL thread spends on GL thread jobs every frame (at least one job is run)
+#define JOB_GL_THREAD_BUDGET_MS 8.0
+// Empty job searches before an idle worker goes to sleep
+#define JOB_IDLE_SPINS 64
+
+namespace JobSystem
+{
+    typedef std::function<void()> JobFunction;
+
+    struct TaskGroup;
+
+    struct Job
+    {
+        JobFunction function;
+        const char* name;
+        TaskGroup*  group;
+    };
+
+    /**
+     * Counts the jobs run in it that did not finish yet. Jobs can be made to wait for a group
+     * (see Run), they are queued once its count drops to zero.
+     */
+    struct TaskGroup
+    {
+        std::atomic<u32>  pending;
+        std::mutex        continuationMutex;
+        std::vector<Job*> continuations;
+    };
+
+    /**
+     * Chase-Lev deque. The owner thread pushes and pops at the bottom, the others steal from the top.
+     */
+    struct WorkStealingDeque
+    {
+        std::atomic<i64>  top;
+        std::atomic<i64>  bottom;
+        std::atomic<Job*> jobs[JOB_DEQUE_SIZE];
+    };
+
+    struct ProfileMarker
+    {
+        const char* name;
+        u32         threadIndex;
+        f64         start;
+        f64         end;
+    };
+
+    struct FrameProfile
+    {
+        f64                        start;
+        f64                        end;
+        std::vector<ProfileMarker> markers;
+        u32                        threadCount;
+        const char*                threadNames[JOB_MAX_THREADS];
+    };
+
+    /**
+     * Starts workerCount worker threads, one per core but the main one when 0.
+     * The calling thread becomes the main thread, index 0.
+     */
+    void Init(u32 workerCount = 0);
+
+    /**
+     * Waits for the running jobs, the queued ones are dropped.
+     */
+    void Shutdown();
+
+    /**
+     * Gives the calling thread an index, a deque and a row in the profiler. Like the main thread
+     * it only runs the jobs it queued, in Wait. Meant for threads with frame deadlines (rendering).
+     */
+    void AttachThread(const char* name);
+
+    /**
+     * Main thread plus workers plus attached threads.
+     */
+    u32 ThreadCount();
+
+    /**
+     * 0 on the main thread, then the workers and the attached threads, UINT32_MAX on other threads.
+     */
+    u32 ThreadIndex();
+
+    /**
+     * Queues a job in group (may be NULL), after every job of the after group finished when given.
+     * The name is shown by the profiler and must outlive the frame, a string literal usually.
+     */
+    void Run(TaskGroup* group, const char* name, JobFunction function, TaskGroup* after = nullptr);
+
+    /**
+     * Queues a job that only the thread owning the GL context runs, from RunGLThreadJobs.
+     */
+    void RunOnGLThread(TaskGroup* group, const char* name, JobFunction function);
+
+    /**
+     * GL thread. Runs GL thread jobs until there are none left or budgetMs went by.
+     */
+    void RunGLThreadJobs(f64 budgetMs);
+
+    /**
+     * Adds a marker to the profile of the calling thread, for work that is not a job.
+     */
+    void RecordMarker(const char* name, f64 start, f64 end);
+
+    /**
+     * True once every job of the group finished, the group can be destroyed then.
+     */
+    bool IsDone(TaskGroup* group);
+
+    /**
+     * Runs jobs until every job of the group finished. Workers take any job meanwhile, the main
+     * and attached threads only the ones they queued so a frame never waits behind a long job
+     * of someone else. Never wait on the main or the GL thread for a group with GL thread jobs.
+     */
+    void Wait(TaskGroup* group);
+
+    /**
+     * Main thread, once per frame. Collects the markers of the jobs run since the last call.
+     */
+    void EndFrame();
+
+    const FrameProfile& LastFrameProfile();
+
+    /**
+     * Calls function(begin, end) over [0, count) split in ranges of grainSize items, in parallel,
+     * and returns once all of them are done. A grainSize of 0 picks four ranges per thread.
+     */
+    template <typename Function>
+    void ParallelFor(const char* name, u32 count, u32 grainSize, const Function& function)
+    {
+        if (count == 0)
+            return;
+
+        if (grainSize == 0)
+            grainSize = glm::max(count / (ThreadCount() * 4), 1u);
+
+        if (count <= grainSize)
+        {
+            function(0u, count);
+            return;
+        }
+
+        TaskGroup group;
+        group.pending = 0;
+        for (u32 begin = grainSize; begin < count; begin += grainSize)
+        {
+            const u32 end = glm::min(begin + grainSize, count);
+            Run(&group, name, [&function, begin, end]() { function(begin, end); });
+        }
+
+        // The first range is run here, the others are likely stolen by now
+        function(0u, grainSize);
+        Wait(&group);
+    }
+}
+
+#endif // !JOB_SYSTEM_FUNC
@@ -0,0 +1,119 @@
+#include "LightCulling.h"
+#include "JobSystem.h"
+
+#include <cfloat>
+#include <chrono>
+
+namespace LightCulling
+{
+    namespace
+    {
+        // Tiles a light overlaps, inclusive. Empty when minX > maxX.
+        struct TileRect
+        {
+            i32 minX, minY;
+            i32 maxX, maxY;
+        };
+
+        TileRect ScreenTiles(const LightBounds& light, const glm::mat4& viewProjection, ivec2 displaySize, const Grid& grid)
+        {
+            const TileRect everything = { 0, 0, (i32)grid.tileCountX - 1, (i32)grid.tileCountY - 1 };
+            if (light.radius < 0.0f)
+                return everything;
+
+            // Screen bounds of the corners of the box around the sphere
+            vec2 ndcMin(FLT_MAX);
+            vec2 ndcMax(-FLT_MAX);
+            bool beyondFar = true;
+            u32 behindCamera = 0;
+            for (u32 corner = 0; corner < 8; ++corner)
+            {
+                const vec3 offset((corner & 1) ? light.radius : -light.radius,
+                    (corner & 2) ? light.radius : -light.radius,
+                    (corner & 4) ? light.radius : -light.radius);
+                const vec4 clip = viewProjection * vec4(light.center + offset, 1.0f);
+
+                if (clip.w <= 1e-4f)
+                {
+                    behindCamera++;
+                    continue;
+                }
+
+                const vec3 ndc = vec3(clip) / clip.w;
+                ndcMin = glm::min(ndcMin, vec2(ndc));
+                ndcMax = glm::max(ndcMax, vec2(ndc));
+                beyondFar = beyondFar && ndc.z > 1.0f;
+            }
+
+            // Corners behind the camera have no screen position: the light may cover any tile, or none if it is all behind
+            TileRect rect = { 1, 1, 0, 0 };
+            if (behindCamera == 8)
+                return rect;
+            if (behindCamera > 0)
+                return everything;
+            if (beyondFar || ndcMax.x < -1.0f || ndcMax.y < -1.0f || ndcMin.x > 1.0f || ndcMin.y > 1.0f)
+                return rect;
+
+            const vec2 pixelMin = (glm::clamp(ndcMin, -1.0f, 1.0f) * 0.5f + 0.5f) * vec2(displaySize);
+            const vec2 pixelMax = (glm::clamp(ndcMax, -1.0f, 1.0f) * 0.5f + 0.5f) * vec2(displaySize);
+            rect.minX = glm::clamp((i32)pixelMin.x / LIGHT_TILE_SIZE, 0, (i32)grid.tileCountX - 1);
+            rect.minY = glm::clamp((i32)pixelMin.y / LIGHT_TILE_SIZE, 0, (i32)grid.tileCountY - 1);
+            rect.maxX = glm::clamp((i32)pixelMax.x / LIGHT_TILE_SIZE, 0, (i32)grid.tileCountX - 1);
+            rect.maxY = glm::clamp((i32)pixelMax.y / LIGHT_TILE_SIZE, 0, (i32)grid.tileCountY - 1);
+            return rect;
+        }
+    }
+
+    void Resize(Grid& grid, ivec2 displaySize)
+    {
+        grid.tileCountX = (displaySize.x + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+        grid.tileCountY = (displaySize.y + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+        grid.tiles.resize(grid.tileCountX * grid.tileCountY);
+    }
+
+    void BinLights(Grid& grid, const glm::mat4& viewProjection, ivec2 displaySize, const LightBounds* lights, u32 lightCount, Stats* stats)
+    {
+        ASSERT(lightCount <= MAX_SHADER_LIGHTS, "A tile list does not take more lights");
+        const auto start = std::chrono::high_resolution_clock::now();
+
+        TileRect rects[MAX_SHADER_LIGHTS];
+        for (u32 i = 0; i < lightCount; ++i)
+        {
+            rects[i] = ScreenTiles(lights[i], viewProjection, displaySize, grid);
+        }
+
+        JobSystem::ParallelFor("Bin lights", grid.tileCountY, LIGHT_BIN_JOB_GRAIN, [&](u32 begin, u32 end)
+        {
+            for (u32 y = begin; y < end; ++y)
+            {
+                for (u32 x = 0; x < grid.tileCountX; ++x)
+                {
+                    ShaderLayouts::TileLightList& tile = grid.tiles[y * grid.tileCountX + x];
+                    tile.count = 0;
+                    for (u32 i = 0; i < lightCount; ++i)
+                    {
+                        const TileRect& rect = rects[i];
+                        if ((i32)x >= rect.minX && (i32)x <= rect.maxX && (i32)y >= rect.minY && (i32)y <= rect.maxY)
+                            tile.indices[tile.count++] = i;
+                    }
+                }
+            }
+        });
+
+        if (stats)
+        {
+            stats->binner = BINNER_CPU;
+            stats->tileCount = (u32)grid.tiles.size();
+            stats->lightRefs = 0;
+            for (const ShaderLayouts::TileLightList& tile : grid.tiles)
+                stats->lightRefs += tile.count;
+            stats->binMs = std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+    }
+
+    const char* BinnerName(Binner binner)
+    {
+        static const char* names[BINNER_COUNT] = { "Compute shader", "CPU binner" };
+        return names[binner];
+    }
+}
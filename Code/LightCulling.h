@@ -0,0 +1,63 @@
+#ifndef LIGHT_CULLING_FUNC
+#define LIGHT_CULLING_FUNC
+
+#include "Globals.h"
+#include "ShaderLayouts.h"
+
+// Side in pixels of the screen tiles lights are binned into, the local size of LIGHT_CULLING.glsl
+#define LIGHT_TILE_SIZE 16
+// Tile rows a CPU binning job covers
+#define LIGHT_BIN_JOB_GRAIN 4
+
+namespace LightCulling
+{
+    /**
+     * Who builds the tile light lists. The compute shader bounds every tile by the depth of the
+     * prepass, the CPU binner only by the screen rectangle of the lights, for GL implementations
+     * that run compute shaders slowly or not at all.
+     */
+    enum Binner
+    {
+        BINNER_GPU,
+        BINNER_CPU,
+        BINNER_COUNT
+    };
+
+    // Sphere a light affects, in world space. A negative radius affects everything (directional lights).
+    struct LightBounds
+    {
+        vec3 center;
+        f32  radius;
+    };
+
+    // Tile light lists of the screen, row by row from the bottom left tile, as the shaders read them
+    struct Grid
+    {
+        u32 tileCountX = 0;
+        u32 tileCountY = 0;
+        std::vector<ShaderLayouts::TileLightList> tiles;
+    };
+
+    struct Stats
+    {
+        Binner binner;
+        u32    tileCount;
+        u32    lightRefs; // Lights summed over the tile lists, CPU binner only
+        f64    binMs;     // CPU binner only
+    };
+
+    /**
+     * Sizes the grid for the display, the tile lists keep their contents until the next BinLights.
+     */
+    void Resize(Grid& grid, ivec2 displaySize);
+
+    /**
+     * Fills in the tile light lists, a light lands in every tile its bounds overlap on screen.
+     * Light i of lights is index i of the lists. The tile rows are split across the job threads.
+     */
+    void BinLights(Grid& grid, const glm::mat4& viewProjection, ivec2 displaySize, const LightBounds* lights, u32 lightCount, Stats* stats = nullptr);
+
+    const char* BinnerName(Binner binner);
+}
+
+#endif // !LIGHT_CULLING_FUNC
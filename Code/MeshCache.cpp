@@ -0,0 +1,285 @@
+#include "engine.h"
+#include "MeshCache.h"
+#include "ModelLoaderFuncs.h"
+
+namespace MeshCache
+{
+    namespace
+    {
+        static_assert(MESH_CACHE_TEXTURE_SLOTS == MATERIAL_TEXTURE_SLOT_COUNT, "A material record stores every texture slot");
+
+        void CopyString(char* dst, u32 dstSize, const std::string& src)
+        {
+            const u32 len = glm::min((u32)src.size(), dstSize - 1);
+            memcpy(dst, src.c_str(), len);
+            dst[len] = '\0';
+        }
+
+        bool FileMatches(const char* path, u64 cachedTimestamp, u64 cachedSize, u64 cachedHash)
+        {
+            const u64 timestamp = GetFileLastWriteTimestamp(path);
+
+            // Without the file the cache is all we have
+            if (timestamp == 0 || timestamp == cachedTimestamp)
+                return true;
+
+            // The file was touched, only reimport if its contents changed
+            MappedFile file = MapFile(path);
+            const bool matches = file.data && file.size == cachedSize && HashBytes(file.data, file.size) == cachedHash;
+            UnmapFile(file);
+            return matches;
+        }
+
+        /**
+         * Returns the material library an OBJ source references through its mtllib statement,
+         * relative to the source directory. Empty for other formats. Only the first one is tracked.
+         */
+        std::string FindMaterialLibrary(const char* sourcePath, const MappedFile& source)
+        {
+            const char* text = (const char*)source.data;
+            const char* end = text + source.size;
+            for (const char* line = text; line < end; )
+            {
+                const char* lineEnd = line;
+                while (lineEnd < end && *lineEnd != '\n' && *lineEnd != '\r')
+                    lineEnd++;
+
+                if (lineEnd - line > 7 && strncmp(line, "mtllib", 6) == 0 && (line[6] == ' ' || line[6] == '\t'))
+                {
+                    const char* name = line + 7;
+                    while (name < lineEnd && (*name == ' ' || *name == '\t'))
+                        name++;
+                    const char* nameEnd = lineEnd;
+                    while (nameEnd > name && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t'))
+                        nameEnd--;
+                    if (nameEnd == name)
+                        return std::string();
+
+                    const std::string path(sourcePath);
+                    const size_t slash = path.find_last_of("/\\");
+                    const std::string directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+                    return directory + std::string(name, nameEnd);
+                }
+
+                line = lineEnd + 1;
+            }
+            return std::string();
+        }
+
+        bool IsValid(const MappedFile& file, const char* sourcePath, u32 importFlags)
+        {
+            if (file.size < sizeof(Header))
+                return false;
+
+            const Header& header = *(const Header*)file.data;
+            if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION || header.importFlags != importFlags)
+                return false;
+
+            const u64 tablesEnd = sizeof(Header) + (u64)header.submeshCount * sizeof(SubMeshRecord) + (u64)header.materialCount * sizeof(MaterialRecord);
+            if (tablesEnd > header.vertexDataOffset ||
+                (u64)header.vertexDataOffset + header.vertexDataSize > file.size ||
+                (u64)header.indexDataOffset + header.indexDataSize > file.size)
+                return false;
+
+            const SubMeshRecord* submeshRecords = (const SubMeshRecord*)(file.data + sizeof(Header));
+            for (u32 i = 0; i < header.submeshCount; ++i)
+            {
+                if (submeshRecords[i].materialIndex >= header.materialCount)
+                    return false;
+                for (u32 stream = 0; stream < VERTEX_STREAM_COUNT; ++stream)
+                {
+                    if (submeshRecords[i].streams[stream].attributeCount > MESH_CACHE_MAX_ATTRIBUTES)
+                        return false;
+                }
+            }
+
+            // Materials and texture paths come from the library, an edit there has to invalidate the cache too
+            if (header.materialLibrary[0] != '\0' &&
+                !FileMatches(header.materialLibrary, header.materialLibraryTimestamp, header.materialLibrarySize, header.materialLibraryHash))
+                return false;
+
+            return FileMatches(sourcePath, header.sourceTimestamp, header.sourceSize, header.sourceHash);
+        }
+    }
+
+    u64 HashBytes(const void* data, u64 size)
+    {
+        const u8* bytes = (const u8*)data;
+        u64 hash = 14695981039346656037ull;
+        for (u64 i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::string GetCachePath(const char* sourcePath)
+    {
+        return std::string(sourcePath) + MESH_CACHE_EXTENSION;
+    }
+
+    bool Read(const char* sourcePath, u32 importFlags, ModelLoader::ImportedModel& model)
+    {
+        const std::string cachePath = GetCachePath(sourcePath);
+        MappedFile file = MapFile(cachePath.c_str());
+        if (!file.data)
+            return false;
+
+        if (!IsValid(file, sourcePath, importFlags))
+        {
+            ILOG("%s is out of date", cachePath.c_str());
+            UnmapFile(file);
+            return false;
+        }
+
+        const Header& header = *(const Header*)file.data;
+        const SubMeshRecord* submeshRecords = (const SubMeshRecord*)(file.data + sizeof(Header));
+        const MaterialRecord* materialRecords = (const MaterialRecord*)(submeshRecords + header.submeshCount);
+
+        model.materials.resize(header.materialCount);
+        for (u32 i = 0; i < header.materialCount; ++i)
+        {
+            const MaterialRecord& record = materialRecords[i];
+            ModelLoader::ImportedMaterial& material = model.materials[i];
+            material.material.name = record.name;
+            material.material.albedo = record.albedo;
+            material.material.emissive = record.emissive;
+            material.material.smoothness = record.smoothness;
+            for (u32 slot = 0; slot < MESH_CACHE_TEXTURE_SLOTS; ++slot)
+                material.texturePaths[slot] = record.texturePaths[slot];
+            for (u32 c = 0; c < ORM_CHANNEL_COUNT; ++c)
+                material.material.ormSources[c] = record.ormSources[c];
+        }
+
+        model.mesh.submeshes.resize(header.submeshCount);
+        model.submeshMaterials.resize(header.submeshCount);
+        for (u32 i = 0; i < header.submeshCount; ++i)
+        {
+            const SubMeshRecord& record = submeshRecords[i];
+
+            SubMesh& submesh = model.mesh.submeshes[i];
+            submesh.bounds = record.bounds;
+            submesh.uvDensity = record.uvDensity;
+            submesh.indexType = record.indexType;
+            submesh.indexCount = record.indexCount;
+            submesh.indexOffset = record.indexOffset;
+            for (u32 stream = 0; stream < VERTEX_STREAM_COUNT; ++stream)
+            {
+                const StreamRecord& streamRecord = record.streams[stream];
+                VertexStream& vertexStream = submesh.streams[stream];
+                vertexStream.offset = streamRecord.offset;
+                vertexStream.layout.stride = (u8)streamRecord.stride;
+                for (u32 a = 0; a < streamRecord.attributeCount; ++a)
+                {
+                    const AttributeRecord& attribute = streamRecord.attributes[a];
+                    vertexStream.layout.attributes.push_back(VertexBufferAttribute{ attribute.location, attribute.componentCount, attribute.offset, attribute.type, attribute.normalized });
+                }
+            }
+
+            model.submeshMaterials[i] = record.materialIndex;
+        }
+
+        model.mesh.bounds = header.bounds;
+
+        // The mapped blobs go straight to the driver, the pages are read in as it copies them
+        model.cacheFile = file;
+        model.vertexBlob = file.data + header.vertexDataOffset;
+        model.vertexBlobSize = header.vertexDataSize;
+        model.indexBlob = file.data + header.indexDataOffset;
+        model.indexBlobSize = header.indexDataSize;
+        return true;
+    }
+
+    void Write(const char* sourcePath, u32 importFlags, const ModelLoader::ImportedModel& model)
+    {
+        const Mesh& mesh = model.mesh;
+
+        Header header = {};
+        header.magic = MESH_CACHE_MAGIC;
+        header.version = MESH_CACHE_VERSION;
+        header.importFlags = importFlags;
+        header.submeshCount = mesh.submeshes.size();
+        header.materialCount = model.materials.size();
+        header.vertexDataOffset = sizeof(Header) + header.submeshCount * sizeof(SubMeshRecord) + header.materialCount * sizeof(MaterialRecord);
+        header.vertexDataSize = model.vertexBlobSize;
+        header.indexDataOffset = header.vertexDataOffset + header.vertexDataSize;
+        header.indexDataSize = model.indexBlobSize;
+        header.sourceTimestamp = GetFileLastWriteTimestamp(sourcePath);
+        header.bounds = mesh.bounds;
+
+        MappedFile source = MapFile(sourcePath);
+        header.sourceSize = source.size;
+        header.sourceHash = HashBytes(source.data, source.size);
+        const std::string materialLibrary = FindMaterialLibrary(sourcePath, source);
+        UnmapFile(source);
+
+        if (!materialLibrary.empty())
+        {
+            CopyString(header.materialLibrary, MESH_CACHE_MAX_PATH, materialLibrary);
+            header.materialLibraryTimestamp = GetFileLastWriteTimestamp(materialLibrary.c_str());
+            MappedFile library = MapFile(materialLibrary.c_str());
+            header.materialLibrarySize = library.size;
+            header.materialLibraryHash = HashBytes(library.data, library.size);
+            UnmapFile(library);
+        }
+
+        std::vector<SubMeshRecord> submeshRecords(header.submeshCount);
+        for (u32 i = 0; i < header.submeshCount; ++i)
+        {
+            const SubMesh& submesh = mesh.submeshes[i];
+            SubMeshRecord& record = submeshRecords[i];
+            record.bounds = submesh.bounds;
+            record.uvDensity = submesh.uvDensity;
+            record.materialIndex = model.submeshMaterials[i];
+            record.indexType = submesh.indexType;
+            record.indexCount = submesh.indexCount;
+            record.indexOffset = submesh.indexOffset;
+            for (u32 stream = 0; stream < VERTEX_STREAM_COUNT; ++stream)
+            {
+                const VertexStream& vertexStream = submesh.streams[stream];
+                StreamRecord& streamRecord = record.streams[stream];
+                streamRecord.offset = vertexStream.offset;
+                streamRecord.size = vertexStream.data.size();
+                streamRecord.stride = vertexStream.layout.stride;
+                streamRecord.attributeCount = glm::min((u32)vertexStream.layout.attributes.size(), (u32)MESH_CACHE_MAX_ATTRIBUTES);
+                for (u32 a = 0; a < streamRecord.attributeCount; ++a)
+                {
+                    const VertexBufferAttribute& attribute = vertexStream.layout.attributes[a];
+                    streamRecord.attributes[a] = AttributeRecord{ attribute.location, attribute.componentCount, attribute.offset, attribute.normalized, attribute.type };
+                }
+            }
+        }
+
+        // Slots are stored by path so they resolve to the same texture whatever the load order
+        std::vector<MaterialRecord> materialRecords(header.materialCount);
+        for (u32 i = 0; i < header.materialCount; ++i)
+        {
+            const ModelLoader::ImportedMaterial& material = model.materials[i];
+            MaterialRecord& record = materialRecords[i];
+            CopyString(record.name, MESH_CACHE_MAX_NAME, material.material.name);
+            record.albedo = material.material.albedo;
+            record.emissive = material.material.emissive;
+            record.smoothness = material.material.smoothness;
+            for (u32 slot = 0; slot < MESH_CACHE_TEXTURE_SLOTS; ++slot)
+                CopyString(record.texturePaths[slot], MESH_CACHE_MAX_PATH, material.texturePaths[slot]);
+            for (u32 c = 0; c < ORM_CHANNEL_COUNT; ++c)
+                CopyString(record.ormSources[c], MESH_CACHE_MAX_PATH, material.material.ormSources[c]);
+        }
+
+        const std::string cachePath = GetCachePath(sourcePath);
+        FILE* file = fopen(cachePath.c_str(), "wb");
+        if (!file)
+        {
+            ELOG("fopen() failed writing file %s", cachePath.c_str());
+            return;
+        }
+
+        fwrite(&header, sizeof(Header), 1, file);
+        fwrite(submeshRecords.data(), sizeof(SubMeshRecord), submeshRecords.size(), file);
+        fwrite(materialRecords.data(), sizeof(MaterialRecord), materialRecords.size(), file);
+        fwrite(model.vertexBlob, 1, model.vertexBlobSize, file);
+        fwrite(model.indexBlob, 1, model.indexBlobSize, file);
+        fclose(file);
+    }
+}
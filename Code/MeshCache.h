@@ -0,0 +1,114 @@
+#ifndef MESH_CACHE_FUNC
+#define MESH_CACHE_FUNC
+
+#include "Globals.h"
+
+namespace ModelLoader
+{
+    struct ImportedModel;
+}
+
+// Bump whenever the cached data changes meaning (file layout, vertex format, optimizer...)
+#define MESH_CACHE_VERSION 4
+#define MESH_CACHE_MAGIC 0x4853454D // "MESH"
+#define MESH_CACHE_EXTENSION ".mesh"
+#define MESH_CACHE_MAX_ATTRIBUTES 4
+#define MESH_CACHE_MAX_NAME 64
+#define MESH_CACHE_MAX_PATH 256
+#define MESH_CACHE_TEXTURE_SLOTS 4
+
+namespace MeshCache
+{
+    /**
+     * On-disk layout, little endian:
+     *   Header
+     *   SubMeshRecord[submeshCount]
+     *   MaterialRecord[materialCount]
+     *   vertex blob (GPU ready, uploaded as is)
+     *   index blob  (GPU ready, uploaded as is)
+     */
+    struct Header
+    {
+        u32  magic;
+        u32  version;
+        u32  importFlags;
+        u32  submeshCount;
+        u32  materialCount;
+        u32  vertexDataOffset;
+        u32  vertexDataSize;
+        u32  indexDataOffset;
+        u32  indexDataSize;
+        u64  sourceTimestamp;
+        u64  sourceSize;
+        u64  sourceHash;
+        char materialLibrary[MESH_CACHE_MAX_PATH]; // The mtllib of an OBJ source, empty when the source has none
+        u64  materialLibraryTimestamp;
+        u64  materialLibrarySize;
+        u64  materialLibraryHash;
+        AABB bounds;
+    };
+
+    struct AttributeRecord
+    {
+        u8  location;
+        u8  componentCount;
+        u8  offset;
+        u8  normalized;
+        u32 type;
+    };
+
+    struct StreamRecord
+    {
+        u32             offset;
+        u32             size;
+        u32             stride;
+        u32             attributeCount;
+        AttributeRecord attributes[MESH_CACHE_MAX_ATTRIBUTES];
+    };
+
+    struct SubMeshRecord
+    {
+        AABB         bounds;
+        f32          uvDensity;
+        u32          materialIndex; // Into the material records of the file
+        u32          indexType;
+        u32          indexCount;
+        u32          indexOffset;
+        StreamRecord streams[VERTEX_STREAM_COUNT];
+    };
+
+    struct MaterialRecord
+    {
+        char name[MESH_CACHE_MAX_NAME];
+        vec3 albedo;
+        vec3 emissive;
+        f32  smoothness;
+        char texturePaths[MESH_CACHE_TEXTURE_SLOTS][MESH_CACHE_MAX_PATH]; // Empty when the slot is not used
+        char ormSources[ORM_CHANNEL_COUNT][MESH_CACHE_MAX_PATH];          // Repacked on load, see ModelLoader::LoadORMTexture
+    };
+
+    /**
+     * 64 bit FNV-1a, used to detect source changes that kept the timestamp.
+     */
+    u64 HashBytes(const void* data, u64 size);
+
+    /**
+     * Returns the cache path of a source model (the source path plus MESH_CACHE_EXTENSION).
+     */
+    std::string GetCachePath(const char* sourcePath);
+
+    /**
+     * Reads the model from its cache if the cache is valid for the current source and import
+     * flags. The cache stays mapped in model.cacheFile and the blobs point into it, so they are
+     * handed to the GPU without intermediate copies. Returns false if the model has to be imported.
+     * Makes no GL calls, safe on any thread.
+     */
+    bool Read(const char* sourcePath, u32 importFlags, ModelLoader::ImportedModel& model);
+
+    /**
+     * Writes the cache of an imported model, the blobs as they are uploaded to its buffers.
+     */
+    void Write(const char* sourcePath, u32 importFlags, const ModelLoader::ImportedModel& model);
+}
+
+#endif // !MESH_CACHE_FUNC
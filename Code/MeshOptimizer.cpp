@@ -0,0 +1,315 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+
+namespace MeshOptimizer
+{
+    namespace
+    {
+        struct Cluster
+        {
+            u32 firstTriangle;
+            u32 triangleCount;
+            f32 sortKey;
+        };
+
+        // Returns the next vertex with triangles left to emit once the fanning vertex ran out of them
+        i32 SkipDeadEnd(const std::vector<u32>& live, std::vector<u32>& deadEnd, u32& cursor, u32 vertexCount)
+        {
+            // Recently emitted vertices are likely still in the cache
+            while (!deadEnd.empty())
+            {
+                const u32 d = deadEnd.back();
+                deadEnd.pop_back();
+                if (live[d] > 0)
+                    return (i32)d;
+            }
+
+            // Otherwise take the next vertex in input order
+            while (cursor < vertexCount)
+            {
+                if (live[cursor] > 0)
+                    return (i32)cursor;
+                ++cursor;
+            }
+
+            return -1;
+        }
+    }
+
+    CacheStats AnalyzeVertexCache(const std::vector<u32>& indices, u32 vertexCount, u32 cacheSize)
+    {
+        CacheStats stats = {};
+        stats.triangleCount = (u32)indices.size() / 3;
+        stats.vertexCount = vertexCount;
+
+        // A vertex is in the FIFO if fewer than cacheSize vertices were inserted since it was
+        std::vector<u32> cacheTime(vertexCount, 0);
+        u32 timestamp = cacheSize + 1;
+        for (u32 index : indices)
+        {
+            if (timestamp - cacheTime[index] > cacheSize)
+            {
+                cacheTime[index] = timestamp++;
+                stats.cacheMisses++;
+            }
+        }
+
+        return stats;
+    }
+
+    f32 ACMR(const CacheStats& stats)
+    {
+        return stats.triangleCount ? (f32)stats.cacheMisses / stats.triangleCount : 0.0f;
+    }
+
+    f32 ATVR(const CacheStats& stats)
+    {
+        return stats.vertexCount ? (f32)stats.cacheMisses / stats.vertexCount : 0.0f;
+    }
+
+    void Accumulate(CacheStats& total, const CacheStats& stats)
+    {
+        total.triangleCount += stats.triangleCount;
+        total.vertexCount += stats.vertexCount;
+        total.cacheMisses += stats.cacheMisses;
+    }
+
+    void Accumulate(Report& total, const Report& report)
+    {
+        Accumulate(total.before, report.before);
+        Accumulate(total.after, report.after);
+        total.floatVertexBytes += report.floatVertexBytes;
+        total.packedVertexBytes += report.packedVertexBytes;
+        total.positionVertexBytes += report.positionVertexBytes;
+    }
+
+    void OptimizeVertexCache(std::vector<u32>& indices, u32 vertexCount, std::vector<u32>& outClusters, u32 cacheSize)
+    {
+        const u32 triangleCount = (u32)indices.size() / 3;
+
+        outClusters.clear();
+        outClusters.push_back(0);
+
+        if (triangleCount == 0)
+            return;
+
+        // Vertex -> triangles adjacency, and the number of triangles still to emit per vertex
+        std::vector<u32> live(vertexCount, 0);
+        for (u32 index : indices)
+            live[index]++;
+
+        std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+        for (u32 v = 0; v < vertexCount; ++v)
+            adjacencyOffsets[v + 1] = adjacencyOffsets[v] + live[v];
+
+        std::vector<u32> adjacency(indices.size());
+        std::vector<u32> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (u32 i = 0; i < indices.size(); ++i)
+            adjacency[fill[indices[i]]++] = i / 3;
+
+        std::vector<u32> cacheTime(vertexCount, 0);
+        std::vector<u8> emitted(triangleCount, 0);
+        std::vector<u32> deadEnd;
+        std::vector<u32> candidates;
+        std::vector<u32> output;
+        deadEnd.reserve(indices.size());
+        output.reserve(indices.size());
+
+        u32 timestamp = cacheSize + 1;
+        u32 cursor = 0;
+        i32 fanning = (i32)indices[0];
+
+        while (fanning >= 0)
+        {
+            // Emit every remaining triangle around the fanning vertex
+            candidates.clear();
+            for (u32 a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; ++a)
+            {
+                const u32 t = adjacency[a];
+                if (emitted[t])
+                    continue;
+
+                for (u32 j = 0; j < 3; ++j)
+                {
+                    const u32 v = indices[t * 3 + j];
+                    output.push_back(v);
+                    deadEnd.push_back(v);
+                    candidates.push_back(v);
+                    live[v]--;
+                    if (timestamp - cacheTime[v] > cacheSize)
+                        cacheTime[v] = timestamp++;
+                }
+                emitted[t] = 1;
+            }
+
+            // Next fanning vertex: the oldest candidate that will still be in the cache
+            // after emitting all its triangles
+            i32 next = -1;
+            i32 bestPriority = -1;
+            for (u32 v : candidates)
+            {
+                if (live[v] == 0)
+                    continue;
+
+                i32 priority = 0;
+                if (timestamp - cacheTime[v] + 2 * live[v] <= cacheSize)
+                    priority = (i32)(timestamp - cacheTime[v]);
+
+                if (priority > bestPriority)
+                {
+                    bestPriority = priority;
+                    next = (i32)v;
+                }
+            }
+
+            if (next == -1)
+            {
+                next = SkipDeadEnd(live, deadEnd, cursor, vertexCount);
+
+                const u32 emittedTriangles = (u32)output.size() / 3;
+                if (next != -1 && emittedTriangles != outClusters.back())
+                    outClusters.push_back(emittedTriangles);
+            }
+
+            fanning = next;
+        }
+
+        indices.swap(output);
+    }
+
+    void OptimizeOverdraw(std::vector<u32>& indices, const std::vector<u32>& clusters, const std::vector<float>& vertices, u32 floatStride, const AABB& bounds)
+    {
+        const u32 triangleCount = (u32)indices.size() / 3;
+        const u32 vertexCount = (u32)vertices.size() / floatStride;
+        if (triangleCount == 0)
+            return;
+
+        // Split the hard clusters further wherever their ACMR is already close to the mesh ACMR,
+        // so the sort below has more freedom without hurting cache efficiency much
+        const f32 threshold = ACMR(AnalyzeVertexCache(indices, vertexCount)) * OVERDRAW_CLUSTER_THRESHOLD;
+
+        std::vector<Cluster> softClusters;
+        std::vector<u32> cacheTime(vertexCount, 0);
+        u32 timestamp = VERTEX_CACHE_SIZE + 1;
+
+        for (u32 c = 0; c < clusters.size(); ++c)
+        {
+            const u32 end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+            u32 start = clusters[c];
+            u32 misses = 0;
+
+            // Flush the simulated cache at every cluster start
+            timestamp += VERTEX_CACHE_SIZE + 1;
+
+            for (u32 t = start; t < end; ++t)
+            {
+                for (u32 j = 0; j < 3; ++j)
+                {
+                    const u32 v = indices[t * 3 + j];
+                    if (timestamp - cacheTime[v] > VERTEX_CACHE_SIZE)
+                    {
+                        cacheTime[v] = timestamp++;
+                        misses++;
+                    }
+                }
+
+                if (t + 1 == end || (f32)misses / (t + 1 - start) <= threshold)
+                {
+                    softClusters.push_back(Cluster{ start, t + 1 - start, 0.0f });
+                    start = t + 1;
+                    misses = 0;
+                    timestamp += VERTEX_CACHE_SIZE + 1;
+                }
+            }
+        }
+
+        // Work in the unit cube of the submesh bounds so elongated meshes do not bias the sort
+        const vec3 center = (bounds.min + bounds.max) * 0.5f;
+        const vec3 extent = glm::max((bounds.max - bounds.min) * 0.5f, vec3(1e-6f));
+        const vec3 invExtent = 1.0f / extent;
+
+        for (Cluster& cluster : softClusters)
+        {
+            vec3 centroid(0.0f);
+            vec3 normal(0.0f);
+            f32 area = 0.0f;
+
+            for (u32 t = cluster.firstTriangle; t < cluster.firstTriangle + cluster.triangleCount; ++t)
+            {
+                const vec3 p0 = (glm::make_vec3(&vertices[indices[t * 3 + 0] * floatStride]) - center) * invExtent;
+                const vec3 p1 = (glm::make_vec3(&vertices[indices[t * 3 + 1] * floatStride]) - center) * invExtent;
+                const vec3 p2 = (glm::make_vec3(&vertices[indices[t * 3 + 2] * floatStride]) - center) * invExtent;
+
+                const vec3 n = glm::cross(p1 - p0, p2 - p0);
+                const f32 triangleArea = glm::length(n);
+
+                centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+                normal += n;
+                area += triangleArea;
+            }
+
+            if (area > 0.0f)
+                centroid /= area;
+
+            const f32 normalLength = glm::length(normal);
+            if (normalLength > 0.0f)
+                normal /= normalLength;
+
+            // Clusters facing away from the mesh center are more likely to occlude the rest
+            cluster.sortKey = glm::dot(centroid, normal);
+        }
+
+        std::stable_sort(softClusters.begin(), softClusters.end(), [](const Cluster& a, const Cluster& b)
+        {
+            return a.sortKey > b.sortKey;
+        });
+
+        std::vector<u32> output;
+        output.reserve(indices.size());
+        for (const Cluster& cluster : softClusters)
+        {
+            output.insert(output.end(),
+                indices.begin() + cluster.firstTriangle * 3,
+                indices.begin() + (cluster.firstTriangle + cluster.triangleCount) * 3);
+        }
+
+        indices.swap(output);
+    }
+
+    void OptimizeVertexFetch(std::vector<float>& vertices, u32 floatStride, std::vector<u32>& indices)
+    {
+        const u32 vertexCount = (u32)vertices.size() / floatStride;
+
+        std::vector<u32> remap(vertexCount, UINT32_MAX);
+        std::vector<float> output;
+        output.reserve(vertices.size());
+
+        u32 nextVertex = 0;
+        for (u32& index : indices)
+        {
+            if (remap[index] == UINT32_MAX)
+            {
+                remap[index] = nextVertex++;
+                output.insert(output.end(), vertices.begin() + index * floatStride, vertices.begin() + (index + 1) * floatStride);
+            }
+            index = remap[index];
+        }
+
+        vertices.swap(output);
+    }
+
+    void OptimizeSubMesh(std::vector<float>& vertices, u32 floatStride, std::vector<u32>& indices, const AABB& bounds, Report* report)
+    {
+        if (report)
+            Accumulate(report->before, AnalyzeVertexCache(indices, (u32)vertices.size() / floatStride));
+
+        std::vector<u32> clusters;
+        OptimizeVertexCache(indices, (u32)vertices.size() / floatStride, clusters);
+        OptimizeOverdraw(indices, clusters, vertices, floatStride, bounds);
+        OptimizeVertexFetch(vertices, floatStride, indices);
+
+        if (report)
+            Accumulate(report->after, AnalyzeVertexCache(indices, (u32)vertices.size() / floatStride));
+    }
+}
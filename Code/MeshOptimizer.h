@@ -0,0 +1,66 @@
+#ifndef MESH_OPTIMIZER_FUNC
+#define MESH_OPTIMIZER_FUNC
+
+#include "Globals.h"
+
+// Size of the simulated FIFO post-transform cache used by the optimizer and the stats
+#define VERTEX_CACHE_SIZE 16
+// Clusters are split for overdraw sorting once their ACMR gets this close to the whole mesh ACMR
+#define OVERDRAW_CLUSTER_THRESHOLD 1.05f
+
+namespace MeshOptimizer
+{
+    struct CacheStats
+    {
+        u32 triangleCount;
+        u32 vertexCount;
+        u32 cacheMisses;
+    };
+
+    struct Report
+    {
+        CacheStats before;
+        CacheStats after;
+        u64 floatVertexBytes;    // Vertex data size as imported
+        u64 packedVertexBytes;   // Vertex data size after VertexFormat::Compress
+        u64 positionVertexBytes; // Size of the position streams alone
+    };
+
+    /**
+     * Simulates a FIFO vertex cache. ACMR is misses per triangle, ATVR misses per vertex.
+     */
+    CacheStats AnalyzeVertexCache(const std::vector<u32>& indices, u32 vertexCount, u32 cacheSize = VERTEX_CACHE_SIZE);
+
+    f32 ACMR(const CacheStats& stats);
+
+    f32 ATVR(const CacheStats& stats);
+
+    void Accumulate(CacheStats& total, const CacheStats& stats);
+
+    void Accumulate(Report& total, const Report& report);
+
+    /**
+     * Reorders triangles for vertex cache locality (Tipsify). Returns in outClusters the first
+     * triangle of every run that starts after a dead end, usable by OptimizeOverdraw.
+     */
+    void OptimizeVertexCache(std::vector<u32>& indices, u32 vertexCount, std::vector<u32>& outClusters, u32 cacheSize = VERTEX_CACHE_SIZE);
+
+    /**
+     * Reorders the clusters produced by OptimizeVertexCache so outward facing ones are drawn first.
+     * Positions are read as 3 floats at the start of every vertex of floatStride floats.
+     */
+    void OptimizeOverdraw(std::vector<u32>& indices, const std::vector<u32>& clusters, const std::vector<float>& vertices, u32 floatStride, const AABB& bounds);
+
+    /**
+     * Reorders vertices in the order they are first referenced and remaps the indices accordingly.
+     * Unreferenced vertices are dropped.
+     */
+    void OptimizeVertexFetch(std::vector<float>& vertices, u32 floatStride, std::vector<u32>& indices);
+
+    /**
+     * Runs the whole import optimization stage on an interleaved submesh and accumulates the cache stats.
+     */
+    void OptimizeSubMesh(std::vector<float>& vertices, u32 floatStride, std::vector<u32>& indices, const AABB& bounds, Report* report);
+}
+
+#endif // !MESH_OPTIMIZER_FUNC
@@ -3,11 +3,74 @@
 
 #include <stb_image.h>
 #include <stb_image_write.h>
+#include <assimp/Importer.hpp>
 
+#include <algorithm>
+#include <memory>
 
 #include <iostream>
 namespace ModelLoader
 {
+    namespace
+    {
+        u32 Material::* const TextureSlots[MATERIAL_TEXTURE_SLOT_COUNT] =
+        {
+            &Material::albedoTextureIdx,
+            &Material::emissiveTextureIdx,
+            &Material::normalsTextureIdx,
+            &Material::bumpTextureIdx,
+        };
+
+        const TextureKind TextureSlotKinds[MATERIAL_TEXTURE_SLOT_COUNT] =
+        {
+            TEXTURE_KIND_COLOR,
+            TEXTURE_KIND_COLOR,
+            TEXTURE_KIND_NORMAL,
+            TEXTURE_KIND_NORMAL,
+        };
+
+        // Shown while the streamer loads the slot, an emissive placeholder must not glow
+        u32 App::* const TextureSlotPlaceholders[MATERIAL_TEXTURE_SLOT_COUNT] =
+        {
+            &App::whiteTexIdx,
+            &App::blackTexIdx,
+            &App::normalTexIdx,
+            &App::normalTexIdx,
+        };
+
+        // At most threadCount jobs, each takes the next item until none is left
+        template <typename Function>
+        void ParallelFor(const char* name, u32 count, u32 threadCount, const Function& function)
+        {
+            if (count == 0)
+                return;
+
+            std::atomic<u32> next(0);
+            JobSystem::ParallelFor(name, glm::clamp(threadCount, 1u, count), 1, [&](u32, u32)
+            {
+                for (u32 i = next++; i < count; i = next++)
+                    function(i);
+            });
+        }
+
+        // Same as GetDirectoryPart but off the frame arena, which only the main thread may use
+        std::string GetDirectory(const std::string& path)
+        {
+            const size_t separator = path.find_last_of("/\\");
+            return separator == std::string::npos ? std::string() : path.substr(0, separator);
+        }
+
+        void ReleaseImportedModel(ImportedModel& imported)
+        {
+            if (imported.cacheFile.data)
+                UnmapFile(imported.cacheFile);
+            std::vector<u8>().swap(imported.vertexData);
+            std::vector<u8>().swap(imported.indexData);
+            imported.vertexBlob = nullptr;
+            imported.indexBlob = nullptr;
+        }
+    }
+
     Image LoadImage(const char* filename)
     {
         Image img = {};
@@ -47,8 +110,8 @@ namespace ModelLoader
         glGenTextures(1, &texHandle);
         glBindTexture(GL_TEXTURE_2D, texHandle);
         glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.size.x, image.size.y, 0, dataFormat, dataType, image.pixels);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -58,65 +121,197 @@ namespace ModelLoader
         return texHandle;
     }
 
-    u32 LoadTexture2D(App* app, const char* filepath)
+    u32 LoadTexture2D(App* app, const char* filepath, TextureKind kind)
     {
-        for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
-            if (app->textures[texIdx].filepath == filepath)
-                return texIdx;
-
-        Image image = LoadImage(filepath);
+        const u32 existingTexIdx = AssetRegistry::FindTexture(app->registry, filepath);
+        if (existingTexIdx != UINT32_MAX)
+            return existingTexIdx;
 
-        std::cout << filepath << std::endl;
+        // Use the cooked texture unless the source changed after it was cooked
+        const std::string cookedPath = TextureCooker::CookedPath(filepath, kind);
+        GLuint handle = TextureCooker::LoadCooked(cookedPath.c_str(), kind, GetFileLastWriteTimestamp(filepath));
 
-        if (image.pixels)
+        if (handle == 0)
         {
-            Texture tex = {};
-            tex.handle = CreateTexture2DFromImage(image);
-            tex.filepath = filepath;
-
-            u32 texIdx = app->textures.size();
-            app->textures.push_back(tex);
+            Image image = LoadImage(filepath);
+            if (!image.pixels)
+                return UINT32_MAX;
 
+            handle = TextureCooker::CookAndCreate(image, kind, cookedPath.c_str());
             FreeImage(image);
-            return texIdx;
         }
-        else
+
+        Texture tex = {};
+        tex.handle = handle;
+        tex.filepath = filepath;
+
+        u32 texIdx = app->textures.size();
+        app->textures.push_back(tex);
+        AssetRegistry::AddTexture(app->registry, filepath, texIdx);
+        return texIdx;
+    }
+
+    u32 RequestTexture2D(App* app, const char* filepath, TextureKind kind, u32 placeholderTexIdx)
+    {
+        // The contents are hashed by the decode job, copies under other names are merged then
+        const u32 existingTexIdx = AssetRegistry::FindTexture(app->registry, filepath);
+        if (existingTexIdx != UINT32_MAX)
+            return existingTexIdx;
+
+        if (placeholderTexIdx == UINT32_MAX)
+            placeholderTexIdx = kind == TEXTURE_KIND_NORMAL ? app->normalTexIdx : app->whiteTexIdx;
+
+        Texture tex = {};
+        tex.handle = app->textures[placeholderTexIdx].handle;
+        tex.filepath = filepath;
+
+        u32 texIdx = app->textures.size();
+        app->textures.push_back(tex);
+        AssetRegistry::AddTexture(app->registry, filepath, texIdx);
+
+        TextureStreamer::Request request = {};
+        request.textureIdx = texIdx;
+        request.kind = kind;
+        request.cookedPath = TextureCooker::CookedPath(filepath, kind);
+        request.sources[0] = filepath;
+        request.sourceCount = 1;
+        TextureStreamer::Enqueue(app->textureStreamer, request);
+
+        return texIdx;
+    }
+
+    u32 LoadORMTexture(App* app, const Material& material, const char* directory)
+    {
+        // Channels without a map take a constant, part of the key as it gets baked in
+        const u8 constants[ORM_CHANNEL_COUNT] = { 255, (u8)(glm::clamp(1.0f - material.smoothness, 0.0f, 1.0f) * 255.0f + 0.5f), 0 };
+
+        // Keyed by the paths of the maps, the decode job merges the same maps under other names
+        u64 keyParts[ORM_CHANNEL_COUNT + 1] = {};
+        for (u32 c = 0; c < ORM_CHANNEL_COUNT; ++c)
         {
-            return UINT32_MAX;
+            if (!material.ormSources[c].empty())
+                keyParts[c] = AssetRegistry::HashPath(material.ormSources[c].c_str());
         }
+        keyParts[ORM_CHANNEL_COUNT] = constants[ORM_ROUGHNESS];
+        const u64 key = AssetRegistry::Hash(keyParts, sizeof(keyParts));
+
+        const u32 existingTexIdx = AssetRegistry::FindTexture(app->registry, key);
+        if (existingTexIdx != UINT32_MAX)
+            return existingTexIdx;
+
+        char packedName[32];
+        sprintf(packedName, "ORM_%016llx", (unsigned long long)key);
+        const std::string packedPath = std::string(directory) + "/" + packedName;
+
+        // The constants alone, a single texel that needs no cooking
+        u8 constantTexel[ORM_CHANNEL_COUNT];
+        memcpy(constantTexel, constants, sizeof(constants));
+        Image constantImage = {};
+        constantImage.pixels = constantTexel;
+        constantImage.size = ivec2(1, 1);
+        constantImage.nchannels = ORM_CHANNEL_COUNT;
+        constantImage.stride = ORM_CHANNEL_COUNT;
+        const GLuint constantHandle = CreateTexture2DFromImage(constantImage);
+
+        TextureStreamer::Request request = {};
+        request.kind = TEXTURE_KIND_DATA;
+        request.cookedPath = TextureCooker::CookedPath(packedPath, TEXTURE_KIND_DATA);
+        request.sourceCount = ORM_CHANNEL_COUNT;
+        request.packChannels = true;
+        request.ownedPlaceholder = constantHandle;
+
+        bool hasSources = false;
+        for (u32 c = 0; c < ORM_CHANNEL_COUNT; ++c)
+        {
+            request.sources[c] = material.ormSources[c];
+            request.constants[c] = constants[c];
+            hasSources |= !material.ormSources[c].empty();
+        }
+
+        Texture tex = {};
+        tex.handle = constantHandle;
+        tex.filepath = packedPath;
+
+        u32 texIdx = app->textures.size();
+        app->textures.push_back(tex);
+        AssetRegistry::AddTexture(app->registry, key, texIdx);
+
+        if (hasSources)
+        {
+            request.textureIdx = texIdx;
+            TextureStreamer::Enqueue(app->textureStreamer, request);
+        }
+
+        return texIdx;
     }
 
-    void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+    u32 IndexTypeSize(GLenum indexType)
     {
-        std::vector<float> vertices;
-        std::vector<u32> indices;
+        return indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32);
+    }
 
-        bool hasTexCoords = false;
-        bool hasTangentSpace = false;
+    void ProcessAssimpMesh(const aiMesh* mesh, SubMesh& submesh, MeshOptimizer::Report* report)
+    {
+        const bool hasTexCoords = mesh->mTextureCoords[0] != nullptr;
+        const bool hasTangentSpace = mesh->mTangents != nullptr && mesh->mBitangents != nullptr;
+
+        // create the vertex format
+        VertexBufferLayout vertexBufferLayout = {};
+        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
+        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float) });
+        vertexBufferLayout.stride = 6 * sizeof(float);
+        if (hasTexCoords)
+        {
+            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride });
+            vertexBufferLayout.stride += 2 * sizeof(float);
+        }
+        if (hasTangentSpace)
+        {
+            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride });
+            vertexBufferLayout.stride += 3 * sizeof(float);
+
+            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride });
+            vertexBufferLayout.stride += 3 * sizeof(float);
+        }
+        const u32 floatStride = vertexBufferLayout.stride / sizeof(float);
+
+        u32 indexCount = 0;
+        for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+            indexCount += mesh->mFaces[i].mNumIndices;
+
+        // Sized up front, every vertex and index is written in place
+        std::vector<float> vertices(mesh->mNumVertices * floatStride);
+        std::vector<u32> indices(indexCount);
+
+        AABB bounds = BVH::MakeEmptyAABB();
 
         // process vertices
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
-            vertices.push_back(mesh->mVertices[i].x);
-            vertices.push_back(mesh->mVertices[i].y);
-            vertices.push_back(mesh->mVertices[i].z);
-            vertices.push_back(mesh->mNormals[i].x);
-            vertices.push_back(mesh->mNormals[i].y);
-            vertices.push_back(mesh->mNormals[i].z);
+            float* vertex = &vertices[i * floatStride];
+
+            const vec3 position(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+            bounds.min = glm::min(bounds.min, position);
+            bounds.max = glm::max(bounds.max, position);
 
-            if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+            *vertex++ = mesh->mVertices[i].x;
+            *vertex++ = mesh->mVertices[i].y;
+            *vertex++ = mesh->mVertices[i].z;
+            *vertex++ = mesh->mNormals[i].x;
+            *vertex++ = mesh->mNormals[i].y;
+            *vertex++ = mesh->mNormals[i].z;
+
+            if (hasTexCoords)
             {
-                hasTexCoords = true;
-                vertices.push_back(mesh->mTextureCoords[0][i].x);
-                vertices.push_back(mesh->mTextureCoords[0][i].y);
+                *vertex++ = mesh->mTextureCoords[0][i].x;
+                *vertex++ = mesh->mTextureCoords[0][i].y;
             }
 
-            if (mesh->mTangents != nullptr && mesh->mBitangents)
+            if (hasTangentSpace)
             {
-                hasTangentSpace = true;
-                vertices.push_back(mesh->mTangents[i].x);
-                vertices.push_back(mesh->mTangents[i].y);
-                vertices.push_back(mesh->mTangents[i].z);
+                *vertex++ = mesh->mTangents[i].x;
+                *vertex++ = mesh->mTangents[i].y;
+                *vertex++ = mesh->mTangents[i].z;
 
                 // For some reason ASSIMP gives me the bitangents flipped.
                 // Maybe it's my fault, but when I generate my own geometry
@@ -126,53 +321,69 @@ namespace ModelLoader
                 // I think that (even if the documentation says the opposite)
                 // it returns a left-handed tangent space matrix.
                 // SOLUTION: I invert the components of the bitangent here.
-                vertices.push_back(-mesh->mBitangents[i].x);
-                vertices.push_back(-mesh->mBitangents[i].y);
-                vertices.push_back(-mesh->mBitangents[i].z);
+                *vertex++ = -mesh->mBitangents[i].x;
+                *vertex++ = -mesh->mBitangents[i].y;
+                *vertex++ = -mesh->mBitangents[i].z;
             }
         }
 
         // process indices
+        u32* index = indices.data();
         for (unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
-            aiFace face = mesh->mFaces[i];
+            const aiFace& face = mesh->mFaces[i];
             for (unsigned int j = 0; j < face.mNumIndices; j++)
             {
-                indices.push_back(face.mIndices[j]);
+                *index++ = face.mIndices[j];
             }
         }
 
-        // store the proper (previously proceessed) material for this mesh
-        submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
-
-        // create the vertex format
-        VertexBufferLayout vertexBufferLayout = {};
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
-        vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float) });
-        vertexBufferLayout.stride = 6 * sizeof(float);
+        // UV units per model unit from the summed triangle areas, drives the texture mip residency
+        f32 uvDensity = 0.0f;
         if (hasTexCoords)
         {
-            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride });
-            vertexBufferLayout.stride += 2 * sizeof(float);
+            f64 positionArea = 0.0;
+            f64 uvArea = 0.0;
+            for (u32 i = 0; i + 2 < indices.size(); i += 3)
+            {
+                const u32 i0 = indices[i], i1 = indices[i + 1], i2 = indices[i + 2];
+                const vec3 p0(mesh->mVertices[i0].x, mesh->mVertices[i0].y, mesh->mVertices[i0].z);
+                const vec3 p1(mesh->mVertices[i1].x, mesh->mVertices[i1].y, mesh->mVertices[i1].z);
+                const vec3 p2(mesh->mVertices[i2].x, mesh->mVertices[i2].y, mesh->mVertices[i2].z);
+                const vec2 uv0(mesh->mTextureCoords[0][i0].x, mesh->mTextureCoords[0][i0].y);
+                const vec2 uv1(mesh->mTextureCoords[0][i1].x, mesh->mTextureCoords[0][i1].y);
+                const vec2 uv2(mesh->mTextureCoords[0][i2].x, mesh->mTextureCoords[0][i2].y);
+                const vec2 uvEdge0 = uv1 - uv0;
+                const vec2 uvEdge1 = uv2 - uv0;
+                positionArea += 0.5 * glm::length(glm::cross(p1 - p0, p2 - p0));
+                uvArea += 0.5 * glm::abs(uvEdge0.x * uvEdge1.y - uvEdge0.y * uvEdge1.x);
+            }
+            if (positionArea > 0.0)
+                uvDensity = (f32)sqrt(uvArea / positionArea);
         }
-        if (hasTangentSpace)
-        {
-            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride });
-            vertexBufferLayout.stride += 3 * sizeof(float);
 
-            vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride });
-            vertexBufferLayout.stride += 3 * sizeof(float);
+        // reorder triangles for the vertex cache and overdraw, then vertices for fetch locality
+        MeshOptimizer::OptimizeSubMesh(vertices, floatStride, indices, bounds, report);
+
+        // quantize the optimized vertices into the compact GPU format
+        submesh = SubMesh{};
+        VertexFormat::Compress(vertices, vertexBufferLayout, bounds, submesh.streams);
+
+        if (report)
+        {
+            report->floatVertexBytes += vertices.size() * sizeof(float);
+            report->positionVertexBytes += submesh.streams[VERTEX_STREAM_POSITION].data.size();
+            report->packedVertexBytes += submesh.streams[VERTEX_STREAM_POSITION].data.size() + submesh.streams[VERTEX_STREAM_ATTRIBUTES].data.size();
         }
 
-        // add the submesh into the mesh
-        SubMesh submesh = {};
-        submesh.vertexBufferLayout = vertexBufferLayout;
-        submesh.vertices.swap(vertices);
+        const u32 vertexCount = vertices.size() / floatStride;
+        submesh.indexType = vertexCount <= UINT16_MAX ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
         submesh.indices.swap(indices);
-        myMesh->submeshes.push_back(submesh);
+        submesh.bounds = bounds;
+        submesh.uvDensity = uvDensity;
     }
 
-    void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory)
+    void ProcessAssimpMaterial(const aiMaterial* material, ImportedMaterial& myMaterial, const std::string& directory)
     {
         aiString name;
         aiColor3D diffuseColor;
@@ -188,159 +399,382 @@ namespace ModelLoader
         material->Get(AI_MATKEY_SHININESS, shininess);
         material->Get(AI_MATKEY_COLOR_REFLECTIVE, ao);
 
-        myMaterial.name = name.C_Str();
-        myMaterial.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
-        myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
-        myMaterial.smoothness = shininess / 256.0f;
+        myMaterial.material.name = name.C_Str();
+        myMaterial.material.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
+        myMaterial.material.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
+        myMaterial.material.smoothness = shininess / 256.0f;
+
+        // Only the paths here, the textures are requested on the GL thread
+        const aiTextureType slotTypes[MATERIAL_TEXTURE_SLOT_COUNT] = { aiTextureType_DIFFUSE, aiTextureType_EMISSIVE, aiTextureType_NORMALS, aiTextureType_HEIGHT };
+        const aiTextureType ormTypes[ORM_CHANNEL_COUNT] = { aiTextureType_AMBIENT, aiTextureType_SHININESS, aiTextureType_SPECULAR };
 
         aiString aiFilename;
-        if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
-        {
-            material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.albedoTextureIdx = LoadTexture2D(app, filepath.str);
-        }
-        if (material->GetTextureCount(aiTextureType_EMISSIVE) > 0)
-        {
-            material->GetTexture(aiTextureType_EMISSIVE, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.emissiveTextureIdx = LoadTexture2D(app, filepath.str);
-        }
-        if (material->GetTextureCount(aiTextureType_SPECULAR) > 0)
-        {
-            material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.specularTextureIdx = LoadTexture2D(app, filepath.str);
-        }
-        if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
-        {
-            material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
-        }
-        if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
-        {
-            material->GetTexture(aiTextureType_HEIGHT, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.bumpTextureIdx = LoadTexture2D(app, filepath.str);
-        }
-        if (material->GetTextureCount(aiTextureType_SHININESS) > 0)
+        for (u32 slot = 0; slot < MATERIAL_TEXTURE_SLOT_COUNT; ++slot)
         {
-            material->GetTexture(aiTextureType_SHININESS, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.shininessTextureIdx = LoadTexture2D(app, filepath.str);
+            if (material->GetTextureCount(slotTypes[slot]) > 0)
+            {
+                material->GetTexture(slotTypes[slot], 0, &aiFilename);
+                myMaterial.texturePaths[slot] = directory + "/" + aiFilename.C_Str();
+            }
         }
-        if (material->GetTextureCount(aiTextureType_AMBIENT) > 0)
+        for (u32 c = 0; c < ORM_CHANNEL_COUNT; ++c)
         {
-            material->GetTexture(aiTextureType_AMBIENT, 0, &aiFilename);
-            String filename = MakeString(aiFilename.C_Str());
-            String filepath = MakePath(directory, filename);
-            myMaterial.aoTextureIdx = LoadTexture2D(app, filepath.str);
+            if (material->GetTextureCount(ormTypes[c]) > 0)
+            {
+                material->GetTexture(ormTypes[c], 0, &aiFilename);
+                myMaterial.material.ormSources[c] = directory + "/" + aiFilename.C_Str();
+            }
         }
     }
 
-    void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+    void ProcessAssimpNode(const aiScene* scene, const aiNode* node, std::vector<const aiMesh*>& meshes)
     {
         // process all the node's meshes (if any)
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
         {
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+            meshes.push_back(scene->mMeshes[node->mMeshes[i]]);
         }
 
         // then do the same for each of its children
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+            ProcessAssimpNode(scene, node->mChildren[i], meshes);
         }
     }
 
-    u32 LoadModel(App* app, const char* filename)
+    u32 LoadMaterial(App* app, const ImportedMaterial& imported, const char* directory)
     {
-        const aiScene* scene = aiImportFile(filename,
-            aiProcess_Triangulate |
-            aiProcess_GenSmoothNormals |
-            aiProcess_CalcTangentSpace |
-            aiProcess_JoinIdenticalVertices |
-            aiProcess_PreTransformVertices |
-            aiProcess_ImproveCacheLocality |
-            aiProcess_OptimizeMeshes |
-            aiProcess_SortByPType);
-
-        if (!scene)
-        {
-            ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
-            return UINT32_MAX;
+        Material material = imported.material;
+        for (u32 slot = 0; slot < MATERIAL_TEXTURE_SLOT_COUNT; ++slot)
+        {
+            if (!imported.texturePaths[slot].empty())
+                material.*TextureSlots[slot] = RequestTexture2D(app, imported.texturePaths[slot].c_str(), TextureSlotKinds[slot], app->*TextureSlotPlaceholders[slot]);
         }
+        material.ormTextureIdx = LoadORMTexture(app, material, directory);
+        return AssetRegistry::AddMaterial(app, material);
+    }
 
+    void UploadMesh(Mesh& mesh, const void* vertexData, u32 vertexDataSize, const void* indexData, u32 indexDataSize)
+    {
+        glGenBuffers(1, &mesh.vertexBufferHandle);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
+        glBufferData(GL_ARRAY_BUFFER, vertexDataSize, vertexData, GL_STATIC_DRAW);
+
+        glGenBuffers(1, &mesh.indexBufferHandle);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexDataSize, indexData, GL_STATIC_DRAW);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    u32 ReserveModel(App* app)
+    {
         app->meshes.push_back(Mesh{});
-        Mesh& mesh = app->meshes.back();
         u32 meshIdx = (u32)app->meshes.size() - 1u;
 
         app->models.push_back(Model{});
-        Model& model = app->models.back();
-        model.meshIdx = meshIdx;
-        u32 modelIdx = (u32)app->models.size() - 1u;
+        app->models.back().meshIdx = meshIdx;
+        return (u32)app->models.size() - 1u;
+    }
+
+    void ImportModels(std::deque<ImportedModel>& models, u32 threadCount, bool useCache, const std::function<void(ImportedModel&)>& onReady)
+    {
+        const f64 startTime = glfwGetTime();
+
+        // Models with a valid cache are done at once, Assimp parses the others concurrently.
+        // Each parse gets an importer of its own, which owns the scene and the error string.
+        std::vector<std::unique_ptr<Assimp::Importer>> importers(models.size());
+        std::vector<const aiScene*> scenes(models.size(), nullptr);
+        ParallelFor("Model parse", (u32)models.size(), threadCount, [&](u32 m)
+        {
+            ImportedModel& model = models[m];
+            const char* filename = model.filepath.c_str();
+
+            if (useCache && MeshCache::Read(filename, MODEL_IMPORT_FLAGS, model))
+            {
+                model.ok = true;
+                model.fromCache = true;
+                model.importMs = (glfwGetTime() - startTime) * 1000.0;
+                if (onReady)
+                    onReady(model);
+                return;
+            }
 
-        String directory = GetDirectoryPart(MakeString(filename));
+            importers[m].reset(new Assimp::Importer());
+            scenes[m] = importers[m]->ReadFile(filename, MODEL_IMPORT_FLAGS);
+            if (!scenes[m])
+            {
+                ELOG("Error loading mesh %s: %s", filename, importers[m]->GetErrorString());
+                if (onReady)
+                    onReady(model);
+            }
+        });
 
-        // Create a list of materials
-        u32 baseMeshMaterialIndex = (u32)app->materials.size();
-        for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+        // The meshes of every parsed model are converted in a single pass so that
+        // a model with few large meshes does not leave threads idle
+        struct MeshJob
+        {
+            const aiMesh* mesh;
+            u32           modelIdx;
+            u32           submeshIdx;
+        };
+        std::vector<MeshJob> meshJobs;
+        for (u32 m = 0; m < models.size(); ++m)
         {
-            app->materials.push_back(Material{});
-            Material& material = app->materials.back();
-            ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+            const aiScene* scene = scenes[m];
+            if (!scene)
+                continue;
+
+            ImportedModel& model = models[m];
+            const std::string directory = GetDirectory(model.filepath);
+
+            model.materials.resize(scene->mNumMaterials);
+            for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+                ProcessAssimpMaterial(scene->mMaterials[i], model.materials[i], directory);
+
+            std::vector<const aiMesh*> meshes;
+            ProcessAssimpNode(scene, scene->mRootNode, meshes);
+
+            model.mesh.submeshes.resize(meshes.size());
+            model.submeshMaterials.resize(meshes.size());
+            for (u32 i = 0; i < meshes.size(); ++i)
+            {
+                model.submeshMaterials[i] = meshes[i]->mMaterialIndex;
+                meshJobs.push_back(MeshJob{ meshes[i], m, i });
+            }
         }
 
-        ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
+        // Largest meshes first, the small ones fill the gaps at the end
+        std::sort(meshJobs.begin(), meshJobs.end(), [](const MeshJob& a, const MeshJob& b)
+        {
+            return a.mesh->mNumVertices > b.mesh->mNumVertices;
+        });
 
-        aiReleaseImport(scene);
+        std::vector<MeshOptimizer::Report> reports(meshJobs.size(), MeshOptimizer::Report{});
+        ParallelFor("Mesh convert", (u32)meshJobs.size(), threadCount, [&](u32 j)
+        {
+            const MeshJob& job = meshJobs[j];
+            ProcessAssimpMesh(job.mesh, models[job.modelIdx].mesh.submeshes[job.submeshIdx], &reports[j]);
+        });
 
-        u32 vertexBufferSize = 0;
-        u32 indexBufferSize = 0;
+        for (u32 j = 0; j < meshJobs.size(); ++j)
+            MeshOptimizer::Accumulate(models[meshJobs[j].modelIdx].report, reports[j]);
 
-        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        // Build the GPU ready blobs and write the caches, one model per job
+        ParallelFor("Mesh blobs", (u32)models.size(), threadCount, [&](u32 m)
         {
-            vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-            indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
-        }
+            if (!scenes[m])
+                return;
 
-        glGenBuffers(1, &mesh.vertexBufferHandle);
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-        glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+            importers[m].reset();
 
-        glGenBuffers(1, &mesh.indexBufferHandle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+            ImportedModel& model = models[m];
+            Mesh& mesh = model.mesh;
+
+            mesh.bounds = BVH::MakeEmptyAABB();
+            for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+            {
+                BVH::GrowAABB(mesh.bounds, mesh.submeshes[i].bounds);
+            }
+
+            u64 vertexDataSize = 0;
+            u64 indexDataSize = 0;
+            for (const SubMesh& submesh : mesh.submeshes)
+            {
+                for (u32 stream = 0; stream < VERTEX_STREAM_COUNT; ++stream)
+                    vertexDataSize += submesh.streams[stream].data.size();
+                indexDataSize += BufferManager::Align(submesh.indices.size() * IndexTypeSize(submesh.indexType), sizeof(u32));
+            }
+            model.vertexData.reserve(vertexDataSize);
+            model.indexData.reserve(indexDataSize);
+
+            // every position stream goes first so position only passes walk a contiguous range
+            for (u32 stream = 0; stream < VERTEX_STREAM_COUNT; ++stream)
+            {
+                for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+                {
+                    VertexStream& vertexStream = mesh.submeshes[i].streams[stream];
+                    vertexStream.offset = model.vertexData.size();
+                    model.vertexData.insert(model.vertexData.end(), vertexStream.data.begin(), vertexStream.data.end());
+                }
+            }
+
+            for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+            {
+                SubMesh& submesh = mesh.submeshes[i];
+                submesh.indexCount = submesh.indices.size();
+                submesh.indexOffset = model.indexData.size();
+
+                const u32 indicesSize = submesh.indexCount * IndexTypeSize(submesh.indexType);
+                if (submesh.indexType == GL_UNSIGNED_SHORT)
+                {
+                    const std::vector<u16> shortIndices(submesh.indices.begin(), submesh.indices.end());
+                    model.indexData.insert(model.indexData.end(), (const u8*)shortIndices.data(), (const u8*)shortIndices.data() + indicesSize);
+                }
+                else
+                {
+                    model.indexData.insert(model.indexData.end(), (const u8*)submesh.indices.data(), (const u8*)submesh.indices.data() + indicesSize);
+                }
+
+                // keep every submesh index range 4 byte aligned whatever its index type
+                model.indexData.resize(BufferManager::Align(model.indexData.size(), sizeof(u32)), 0);
+            }
+
+            model.vertexBlob = model.vertexData.data();
+            model.vertexBlobSize = model.vertexData.size();
+            model.indexBlob = model.indexData.data();
+            model.indexBlobSize = model.indexData.size();
+
+            if (useCache)
+                MeshCache::Write(model.filepath.c_str(), MODEL_IMPORT_FLAGS, model);
+
+            // the blobs hold everything the GPU needs from now on
+            for (SubMesh& submesh : mesh.submeshes)
+            {
+                for (u32 stream = 0; stream < VERTEX_STREAM_COUNT; ++stream)
+                    std::vector<u8>().swap(submesh.streams[stream].data);
+                std::vector<u32>().swap(submesh.indices);
+            }
+
+            model.ok = true;
+            model.importMs = (glfwGetTime() - startTime) * 1000.0;
+            if (onReady)
+                onReady(model);
+        });
+    }
+
+    bool FinishModel(App* app, ImportedModel& imported)
+    {
+        const char* filename = imported.filepath.c_str();
+        if (!imported.ok)
+        {
+            ReleaseImportedModel(imported);
+            return false;
+        }
+
+        Model& model = app->models[imported.modelIdx];
+        Mesh& mesh = app->meshes[model.meshIdx];
 
-        u32 indicesOffset = 0;
-        u32 verticesOffset = 0;
+        // Materials are shared with the models loaded before, see AssetRegistry::AddMaterial
+        const std::string directory = GetDirectory(imported.filepath);
+        std::vector<u32> materialIndices(imported.materials.size());
+        for (u32 i = 0; i < imported.materials.size(); ++i)
+            materialIndices[i] = LoadMaterial(app, imported.materials[i], directory.c_str());
 
+        mesh.submeshes.swap(imported.mesh.submeshes);
+        mesh.bounds = imported.mesh.bounds;
+        model.materialIdx.resize(mesh.submeshes.size());
         for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+            model.materialIdx[i] = materialIndices[imported.submeshMaterials[i]];
+
+        // the GPU buffers hold the only copy from now on, as they do for cached models
+        UploadMesh(mesh, imported.vertexBlob, imported.vertexBlobSize, imported.indexBlob, imported.indexBlobSize);
+        ReleaseImportedModel(imported);
+
+        if (imported.fromCache)
         {
-            const void* verticesData = mesh.submeshes[i].vertices.data();
-            const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-            glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-            mesh.submeshes[i].vertexOffset = verticesOffset;
-            verticesOffset += verticesSize;
-
-            const void* indicesData = mesh.submeshes[i].indices.data();
-            const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-            mesh.submeshes[i].indexOffset = indicesOffset;
-            indicesOffset += indicesSize;
+            ILOG("%s: loaded from cache in %.2f ms", filename, imported.importMs);
+            return true;
         }
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        const MeshOptimizer::Report& report = imported.report;
+        ILOG("%s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%u triangles, %u -> %u vertices)", filename,
+            MeshOptimizer::ACMR(report.before), MeshOptimizer::ACMR(report.after),
+            MeshOptimizer::ATVR(report.before), MeshOptimizer::ATVR(report.after),
+            report.after.triangleCount, report.before.vertexCount, report.after.vertexCount);
+        if (report.after.vertexCount > 0)
+        {
+            ILOG("%s: %.1f -> %.1f bytes per vertex (%.1f for position only passes)", filename,
+                (f32)report.floatVertexBytes / report.after.vertexCount, (f32)report.packedVertexBytes / report.after.vertexCount,
+                (f32)report.positionVertexBytes / report.after.vertexCount);
+        }
+        ILOG("%s: imported in %.2f ms", filename, imported.importMs);
+        return true;
+    }
+
+    ImportBatch* StartImport(App* app, const std::vector<std::string>& filepaths, const std::vector<u32>& modelIndices)
+    {
+        ImportBatch* batch = new ImportBatch();
+        for (u32 i = 0; i < filepaths.size(); ++i)
+        {
+            batch->models.emplace_back();
+            batch->models.back().filepath = filepaths[i];
+            batch->models.back().modelIdx = modelIndices[i];
+        }
+
+        // Only the buffer uploads go to the GL thread, in the order the models get ready
+        JobSystem::Run(&batch->importJobs, "Model import", [app, batch]()
+        {
+            ImportModels(batch->models, JobSystem::ThreadCount(), true, [app](ImportedModel& imported)
+            {
+                JobSystem::RunOnGLThread(nullptr, "Model upload", [app, &imported]()
+                {
+                    FinishModel(app, imported);
+                    app->startup.modelsLoaded++;
+                });
+            });
+        });
+        return batch;
+    }
+
+    void DestroyImport(ImportBatch* batch)
+    {
+        if (!batch)
+            return;
+
+        JobSystem::Wait(&batch->importJobs);
+        for (ImportedModel& imported : batch->models)
+            ReleaseImportedModel(imported);
+        delete batch;
+    }
+
+    u32 LoadModel(App* app, const char* filename, u32 modelIdx)
+    {
+        if (modelIdx == UINT32_MAX)
+            modelIdx = ReserveModel(app);
+
+        std::deque<ImportedModel> models(1);
+        models[0].filepath = filename;
+        models[0].modelIdx = modelIdx;
+        ImportModels(models, JobSystem::ThreadCount());
+
+        return FinishModel(app, models[0]) ? modelIdx : UINT32_MAX;
+    }
+
+    ImportBenchmarkResult BenchmarkImport(const std::vector<std::string>& filepaths)
+    {
+        ImportBenchmarkResult result = {};
+        result.modelCount = filepaths.size();
+
+        const u32 maxThreads = JobSystem::ThreadCount();
+        for (u32 threadCount = 1; result.runCount < ARRAY_COUNT(result.threadCounts); threadCount *= 2)
+        {
+            threadCount = glm::min(threadCount, maxThreads);
+
+            std::deque<ImportedModel> models(filepaths.size());
+            for (u32 i = 0; i < filepaths.size(); ++i)
+                models[i].filepath = filepaths[i];
+
+            const f64 startTime = glfwGetTime();
+            ImportModels(models, threadCount, false);
+            const f64 importMs = (glfwGetTime() - startTime) * 1000.0;
+
+            result.meshCount = 0;
+            for (ImportedModel& imported : models)
+            {
+                result.meshCount += imported.mesh.submeshes.size();
+                ReleaseImportedModel(imported);
+            }
+
+            result.threadCounts[result.runCount] = threadCount;
+            result.importMs[result.runCount] = importMs;
+            result.runCount++;
+
+            if (threadCount == maxThreads)
+                break;
+        }
 
-        return modelIdx;
+        return result;
     }
-}
\ No newline at end of file
+}
@@ -5,27 +5,172 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include "Globals.h"
+#include "MeshOptimizer.h"
+#include "VertexFormat.h"
+#include "MeshCache.h"
+#include "TextureCooker.h"
+#include "AssetRegistry.h"
+#include "JobSystem.h"
 //#include <vector>
 
+#include <deque>
+
+// Changing these invalidates every mesh cache
+#define MODEL_IMPORT_FLAGS (aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace | \
+    aiProcess_JoinIdenticalVertices | aiProcess_PreTransformVertices | aiProcess_OptimizeMeshes | aiProcess_SortByPType)
+
 struct App;
+struct ImportBenchmarkResult;
+
+enum MaterialTextureSlot
+{
+    MATERIAL_TEXTURE_ALBEDO,
+    MATERIAL_TEXTURE_EMISSIVE,
+    MATERIAL_TEXTURE_NORMALS,
+    MATERIAL_TEXTURE_BUMP,
+    MATERIAL_TEXTURE_SLOT_COUNT
+};
 
 namespace ModelLoader
 {
+    /**
+     * A material as read from a model file. Its textures are still paths, they become
+     * texture indices once the material is loaded on the GL thread (see LoadMaterial).
+     */
+    struct ImportedMaterial
+    {
+        Material    material;
+        std::string texturePaths[MATERIAL_TEXTURE_SLOT_COUNT]; // Empty when the slot is not used
+    };
+
+    /**
+     * A model imported off the GL thread, from its mesh cache or with Assimp. The blobs are
+     * GPU ready and either point into vertexData/indexData or into the mapped cache file.
+     */
+    struct ImportedModel
+    {
+        std::string                   filepath;
+        u32                           modelIdx;
+
+        bool                          ok;
+        bool                          fromCache;
+        std::vector<ImportedMaterial> materials;
+        std::vector<u32>              submeshMaterials; // Into materials
+        Mesh                          mesh;             // Submeshes and bounds, no buffers yet
+
+        std::vector<u8>               vertexData;
+        std::vector<u8>               indexData;
+        MappedFile                    cacheFile;
+        const u8*                     vertexBlob;
+        u32                           vertexBlobSize;
+        const u8*                     indexBlob;
+        u32                           indexBlobSize;
+
+        MeshOptimizer::Report         report;
+        f64                           importMs;
+    };
+
+    /**
+     * Models imported together by a job. models is a deque so the entries
+     * stay in place while the import fills them in.
+     */
+    struct ImportBatch
+    {
+        std::deque<ImportedModel> models;
+        JobSystem::TaskGroup      importJobs;
+    };
+
     Image LoadImage(const char* filename);
 
     void FreeImage(Image image);
 
     GLuint CreateTexture2DFromImage(Image image);
 
-    u32 LoadTexture2D(App* app, const char* filepath);
+    /**
+     * Loads the cooked version of a texture, cooking it first when it is missing or older than the source.
+     */
+    u32 LoadTexture2D(App* app, const char* filepath, TextureKind kind = TEXTURE_KIND_COLOR);
+
+    /**
+     * Same as LoadTexture2D but the texture is loaded by the texture streamer. The returned texture
+     * shows the placeholder until it is ready, by default the white or flat normal one for its kind.
+     */
+    u32 RequestTexture2D(App* app, const char* filepath, TextureKind kind, u32 placeholderTexIdx = UINT32_MAX);
+
+    /**
+     * Packs the occlusion, roughness and metallic maps of a material into one texture and cooks it
+     * through the texture streamer. Channels without a map get a constant: no occlusion, the material
+     * roughness and no metal. Until it is ready, or when there are no maps, the texture is those constants.
+     */
+    u32 LoadORMTexture(App* app, const Material& material, const char* directory);
+
+    u32 IndexTypeSize(GLenum indexType);
+
+    /**
+     * Converts an Assimp mesh into an optimized and quantized submesh. Touches nothing but its
+     * arguments, so the meshes of a scene are converted in parallel.
+     */
+    void ProcessAssimpMesh(const aiMesh* mesh, SubMesh& submesh, MeshOptimizer::Report* report);
+
+    void ProcessAssimpMaterial(const aiMaterial* material, ImportedMaterial& myMaterial, const std::string& directory);
+
+    /**
+     * Collects the meshes of a node and its children, in drawing order.
+     */
+    void ProcessAssimpNode(const aiScene* scene, const aiNode* node, std::vector<const aiMesh*>& meshes);
+
+    /**
+     * Requests the textures of an imported material and returns the index of the material.
+     */
+    u32 LoadMaterial(App* app, const ImportedMaterial& material, const char* directory);
+
+    /**
+     * Creates the mesh buffers from GPU ready blobs, laid out as described by the submesh streams.
+     */
+    void UploadMesh(Mesh& mesh, const void* vertexData, u32 vertexDataSize, const void* indexData, u32 indexDataSize);
+
+    /**
+     * Adds an empty model, with its empty mesh, for LoadModel to fill in later.
+     */
+    u32 ReserveModel(App* app);
+
+    /**
+     * Imports every model of the list with up to threadCount jobs at once. It makes no GL calls so
+     * any thread may run it. Models are read from their mesh cache if it is valid (and useCache is set).
+     * The others are parsed by Assimp concurrently, then the meshes of all of them are converted
+     * in one parallel pass and the caches written. onReady is called for every model once done.
+     */
+    void ImportModels(std::deque<ImportedModel>& models, u32 threadCount, bool useCache = true,
+        const std::function<void(ImportedModel&)>& onReady = nullptr);
+
+    /**
+     * GL thread. Loads the materials, creates the buffers of an imported model into its
+     * modelIdx and frees what the GPU holds a copy of. Returns false if the import failed.
+     */
+    bool FinishModel(App* app, ImportedModel& imported);
 
-    void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+    /**
+     * Starts importing the models in a job. Every model is finished by a GL thread job
+     * (see JobSystem::RunOnGLThread) as soon as it is ready, which counts it in app->startup.
+     */
+    ImportBatch* StartImport(App* app, const std::vector<std::string>& filepaths, const std::vector<u32>& modelIndices);
 
-    void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory);
+    /**
+     * Waits for the import job, the models not finished yet are released.
+     */
+    void DestroyImport(ImportBatch* batch);
 
-    void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+    /**
+     * Loads a model from its mesh cache, or imports it with Assimp and writes the cache.
+     * The model goes to modelIdx when given (see ReserveModel), to a new model otherwise.
+     */
+    u32 LoadModel(App* app, const char* filename, u32 modelIdx = UINT32_MAX);
 
-    u32 LoadModel(App* app, const char* filename);
+    /**
+     * Times ImportModels on the given models, skipping the mesh caches, with 1, 2, 4...
+     * threads up to the hardware concurrency.
+     */
+    ImportBenchmarkResult BenchmarkImport(const std::vector<std::string>& filepaths);
 }
 
 #endif
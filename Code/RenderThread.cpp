@@ -0,0 +1,249 @@
+#include "RenderThread.h"
+
+#include <imgui_impl_opengl3.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace RenderThread
+{
+    namespace
+    {
+        struct Slot
+        {
+            FramePacket              packet;
+            std::vector<ImDrawList*> drawLists; // Kept from frame to frame, the packet draw data points to them
+        };
+
+        struct State
+        {
+            GLFWwindow*             window;
+            App*                    app;
+            std::thread             thread;
+
+            Slot                    slots[RENDER_PACKET_COUNT];
+
+            std::mutex              mutex;
+            std::condition_variable condition;
+            u64                     submitted; // Packets handed to the render thread
+            u64                     taken;     // Packets whose resources are updated, the main thread goes on then
+            u64                     retired;   // Packets the GPU is done with
+            bool                    quit;
+            Pacing                  pacing;
+            Stats                   stats;
+
+            // Render thread only
+            std::deque<GLsync>      fences;    // One per frame the GPU may still be working on
+        };
+
+        State* TheState = nullptr;
+
+        u32 FramesInFlight(Pacing pacing)
+        {
+            return pacing == PACING_THROUGHPUT ? 2u : 1u;
+        }
+
+        f64 MillisecondsBetween(f64 start, f64 end)
+        {
+            return (end - start) * 1000.0;
+        }
+
+        // Main thread, the ImGui draw lists are overwritten by the next ImGui frame
+        void CopyDrawData(const ImDrawData* source, Slot& slot)
+        {
+            for (int i = (int)slot.drawLists.size(); i < source->CmdListsCount; ++i)
+            {
+                slot.drawLists.push_back(IM_NEW(ImDrawList)(source->CmdLists[i]->_Data));
+            }
+
+            for (int i = 0; i < source->CmdListsCount; ++i)
+            {
+                const ImDrawList* from = source->CmdLists[i];
+                ImDrawList* to = slot.drawLists[i];
+                to->CmdBuffer = from->CmdBuffer;
+                to->IdxBuffer = from->IdxBuffer;
+                to->VtxBuffer = from->VtxBuffer;
+                to->Flags = from->Flags;
+            }
+
+            ImDrawData& copy = slot.packet.imguiDrawData;
+            copy = *source;
+            copy.CmdLists = slot.drawLists.data();
+        }
+
+        // Render thread. Waits on the oldest fences until at most maxFences frames are left on the GPU.
+        void RetireFrames(size_t maxFences)
+        {
+            while (TheState->fences.size() > maxFences)
+            {
+                GLsync fence = TheState->fences.front();
+                TheState->fences.pop_front();
+
+                GLenum result;
+                do
+                {
+                    result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, RENDER_FENCE_TIMEOUT_NS);
+                } while (result == GL_TIMEOUT_EXPIRED);
+                glDeleteSync(fence);
+
+                std::lock_guard<std::mutex> lock(TheState->mutex);
+                TheState->retired++;
+                TheState->condition.notify_all();
+            }
+        }
+
+        void RenderMain()
+        {
+            State* state = TheState;
+            JobSystem::AttachThread("Render");
+            glfwMakeContextCurrent(state->window);
+
+            for (u64 frame = 0;; ++frame)
+            {
+                const f64 waitStart = glfwGetTime();
+
+                // Nothing to draw yet, wait for the GPU meanwhile. The main thread may be waiting
+                // for it too, after switching to PACING_LOW_LATENCY.
+                bool idle;
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    idle = state->submitted == frame;
+                }
+                if (idle)
+                    RetireFrames(0);
+
+                Pacing pacing;
+                {
+                    std::unique_lock<std::mutex> lock(state->mutex);
+                    state->condition.wait(lock, [state, frame]() { return state->submitted > frame || state->quit; });
+                    if (state->submitted == frame)
+                        break;
+                    pacing = state->pacing;
+                }
+
+                // The main thread waits for this part, nothing else touches the resources meanwhile
+                const f64 resourcesStart = glfwGetTime();
+                UpdateRenderResources(state->app);
+                const f64 renderStart = glfwGetTime();
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->taken = frame + 1;
+                    state->condition.notify_all();
+                }
+
+                FramePacket& packet = state->slots[frame % RENDER_PACKET_COUNT].packet;
+                Render(state->app, packet);
+                ImGui_ImplOpenGL3_RenderDrawData(&packet.imguiDrawData);
+                glfwSwapBuffers(state->window);
+                state->fences.push_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+
+                const f64 gpuWaitStart = glfwGetTime();
+                RetireFrames(FramesInFlight(pacing) - 1);
+                const f64 end = glfwGetTime();
+
+                JobSystem::RecordMarker("Render resources", resourcesStart, renderStart);
+                JobSystem::RecordMarker("Render", renderStart, gpuWaitStart);
+
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->stats.packetWaitMs = MillisecondsBetween(waitStart, resourcesStart);
+                state->stats.resourcesMs = MillisecondsBetween(resourcesStart, renderStart);
+                state->stats.renderMs = MillisecondsBetween(renderStart, gpuWaitStart);
+                state->stats.gpuWaitMs = MillisecondsBetween(gpuWaitStart, end);
+                state->stats.commands = state->app->commandStats;
+                state->stats.uploads = state->app->uploadStats;
+                state->stats.lightCulling = state->app->lightCullingStats;
+                state->stats.forwardPasses = state->app->forwardPassStats;
+                state->stats.visibilityBenchmark = state->app->visibilityBenchmark;
+            }
+
+            RetireFrames(0);
+            glfwMakeContextCurrent(nullptr);
+        }
+    }
+
+    void Start(GLFWwindow* window, App* app)
+    {
+        TheState = new State();
+        TheState->window = window;
+        TheState->app = app;
+        TheState->pacing = PACING_THROUGHPUT;
+
+        glfwMakeContextCurrent(nullptr);
+        TheState->thread = std::thread(RenderMain);
+
+        ILOG("Render thread started, %u frame packets", RENDER_PACKET_COUNT);
+    }
+
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(TheState->mutex);
+            TheState->quit = true;
+            TheState->condition.notify_all();
+        }
+        TheState->thread.join();
+
+        glfwMakeContextCurrent(TheState->window);
+
+        for (Slot& slot : TheState->slots)
+        {
+            for (ImDrawList* drawList : slot.drawLists)
+                IM_DELETE(drawList);
+        }
+
+        delete TheState;
+        TheState = nullptr;
+    }
+
+    FramePacket& BeginFrame()
+    {
+        State* state = TheState;
+        const f64 waitStart = glfwGetTime();
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->condition.wait(lock, [state]()
+        {
+            return state->submitted - state->retired < FramesInFlight(state->pacing);
+        });
+        state->stats.mainWaitMs = MillisecondsBetween(waitStart, glfwGetTime());
+
+        // Its previous packet is retired, so the render thread is done with this slot
+        return state->slots[state->submitted % RENDER_PACKET_COUNT].packet;
+    }
+
+    void SubmitFrame(ImDrawData* drawData)
+    {
+        State* state = TheState;
+        Slot& slot = state->slots[state->submitted % RENDER_PACKET_COUNT];
+        CopyDrawData(drawData, slot);
+
+        const f64 waitStart = glfwGetTime();
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->submitted++;
+        state->condition.notify_all();
+        state->condition.wait(lock, [state]() { return state->taken == state->submitted; });
+
+        state->stats.mainWaitMs += MillisecondsBetween(waitStart, glfwGetTime());
+        state->stats.framesInFlight = (u32)(state->submitted - state->retired);
+    }
+
+    void SetPacing(Pacing pacing)
+    {
+        std::lock_guard<std::mutex> lock(TheState->mutex);
+        TheState->pacing = pacing;
+    }
+
+    Pacing GetPacing()
+    {
+        std::lock_guard<std::mutex> lock(TheState->mutex);
+        return TheState->pacing;
+    }
+
+    Stats GetStats()
+    {
+        std::lock_guard<std::mutex> lock(TheState->mutex);
+        return TheState->stats;
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef RENDER_THREAD_FUNC
+#define RENDER_THREAD_FUNC
+
+#include "engine.h"
+
+// Frame packets, the main thread fills one in while the render thread draws the other
+#define RENDER_PACKET_COUNT 2
+// Longest single wait on a GPU fence, the wait starts over until the fence is signaled
+#define RENDER_FENCE_TIMEOUT_NS 100000000ull
+
+namespace RenderThread
+{
+    /**
+     * LOW_LATENCY: a frame starts once the GPU finished the previous one, input is on screen a frame later.
+     * THROUGHPUT: the main thread works on the next frame while the render thread draws one and the GPU
+     * may still be on the one before, nobody waits but input takes up to two more frames to show.
+     */
+    enum Pacing
+    {
+        PACING_LOW_LATENCY,
+        PACING_THROUGHPUT,
+        PACING_COUNT
+    };
+
+    // Milliseconds of the last frame
+    struct Stats
+    {
+        f64 mainWaitMs;   // Main thread waiting for a free packet and for the render thread to take it
+        f64 packetWaitMs; // Render thread waiting for a packet
+        f64 resourcesMs;  // Render thread updating resources while the main thread waits (see UpdateRenderResources)
+        f64 renderMs;     // Render thread drawing and presenting
+        f64 gpuWaitMs;    // Render thread waiting on the fence of an earlier frame
+        u32 framesInFlight;
+        CommandList::Stats commands; // Geometry command lists of the frame
+        UploadStats uploads;
+        LightCulling::Stats lightCulling; // Mode_ForwardPlus only
+        ForwardPassStats forwardPasses;   // Last forward frame
+        VisibilityBenchmarkResult visibilityBenchmark; // Last run
+    };
+
+    /**
+     * Main thread, once Init ran. The GL context moves to the render thread, which draws and
+     * presents every packet submitted from now on.
+     */
+    void Start(GLFWwindow* window, App* app);
+
+    /**
+     * Main thread. Waits for the submitted packets to be drawn and for the GPU to finish them,
+     * then the GL context is current on the calling thread again.
+     */
+    void Stop();
+
+    /**
+     * Main thread. Waits until a packet is free, how long depends on the pacing, and returns it.
+     */
+    FramePacket& BeginFrame();
+
+    /**
+     * Main thread. Copies the ImGui draw data into the packet of BeginFrame and hands it to the render
+     * thread, then waits for it to update the resources (see UpdateRenderResources).
+     */
+    void SubmitFrame(ImDrawData* drawData);
+
+    void SetPacing(Pacing pacing);
+
+    Pacing GetPacing();
+
+    Stats GetStats();
+}
+
+#endif // !RENDER_THREAD_FUNC
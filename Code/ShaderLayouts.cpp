@@ -0,0 +1,124 @@
+#include "ShaderLayouts.h"
+#include "platform.h"
+
+namespace ShaderLayouts
+{
+    namespace
+    {
+        struct MemberOffset
+        {
+            const char* name;
+            u32         offset;
+        };
+
+        const MemberOffset FrameParamsMembers[] = {
+            { "uViewProjection", offsetof(FrameParams, viewProjection) },
+            { "uCameraPosition", offsetof(FrameParams, cameraPosition) },
+        };
+
+
+        // The second light tells the array stride
+        const MemberOffset LightParamsMembers[] = {
+            { "uLightCount", offsetof(LightParams, lightCount) },
+            { "uLight[0].type", offsetof(LightParams, lights[0].type) },
+            { "uLight[0].color", offsetof(LightParams, lights[0].color) },
+            { "uLight[0].direction", offsetof(LightParams, lights[0].direction) },
+            { "uLight[0].position", offsetof(LightParams, lights[0].position) },
+            { "uLight[0].intensity", offsetof(LightParams, lights[0].intensity) },
+            { "uLight[1].type", offsetof(LightParams, lights[1].type) },
+        };
+
+        bool CheckBlock(GLuint program, const char* programName, const char* blockName, u32 blockSize,
+            const MemberOffset* members, u32 memberCount)
+        {
+            const GLuint blockIndex = glGetUniformBlockIndex(program, blockName);
+            if (blockIndex == GL_INVALID_INDEX)
+                return true;
+
+            bool matches = true;
+
+            GLint dataSize = 0;
+            glGetActiveUniformBlockiv(program, blockIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+            if ((u32)dataSize > blockSize)
+            {
+                ELOG("%s: uniform block %s is %d bytes, its struct %u\n", programName, blockName, dataSize, blockSize);
+                matches = false;
+            }
+
+            for (u32 i = 0; i < memberCount; ++i)
+            {
+                GLuint uniformIndex = GL_INVALID_INDEX;
+                glGetUniformIndices(program, 1, &members[i].name, &uniformIndex);
+                if (uniformIndex == GL_INVALID_INDEX)
+                    continue;
+
+                GLint offset = -1;
+                glGetActiveUniformsiv(program, 1, &uniformIndex, GL_UNIFORM_OFFSET, &offset);
+                if ((u32)offset != members[i].offset)
+                {
+                    ELOG("%s: %s.%s is at offset %d, its struct puts it at %u\n", programName, blockName, members[i].name, offset, members[i].offset);
+                    matches = false;
+                }
+            }
+
+            return matches;
+        }
+
+        // Shader storage block holding an unsized array of elementSize byte structs
+        bool CheckStorageArray(GLuint program, const char* programName, const char* blockName, u32 elementSize,
+            const MemberOffset* members, u32 memberCount)
+        {
+            if (glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, blockName) == GL_INVALID_INDEX)
+                return true;
+
+            bool matches = true;
+            for (u32 i = 0; i < memberCount; ++i)
+            {
+                const GLuint variableIndex = glGetProgramResourceIndex(program, GL_BUFFER_VARIABLE, members[i].name);
+                if (variableIndex == GL_INVALID_INDEX)
+                    continue;
+
+                const GLenum properties[] = { GL_OFFSET, GL_TOP_LEVEL_ARRAY_STRIDE };
+                GLint values[ARRAY_COUNT(properties)] = { -1, -1 };
+                glGetProgramResourceiv(program, GL_BUFFER_VARIABLE, variableIndex, ARRAY_COUNT(properties), properties, ARRAY_COUNT(values), nullptr, values);
+                if ((u32)values[0] != members[i].offset || (u32)values[1] != elementSize)
+                {
+                    ELOG("%s: %s.%s is at offset %d with stride %d, its struct puts it at %u with stride %u\n", programName, blockName,
+                        members[i].name, values[0], values[1], members[i].offset, elementSize);
+                    matches = false;
+                }
+            }
+            return matches;
+        }
+
+        const MemberOffset InstanceParamsMembers[] = {
+            { "uInstances[0].world", offsetof(InstanceData, world) },
+        };
+
+        const MemberOffset TileLightParamsMembers[] = {
+            { "uTiles[0].count", offsetof(TileLightList, count) },
+            { "uTiles[0].indices[0]", offsetof(TileLightList, indices) },
+        };
+
+        const MemberOffset TileClassCommandsMembers[] = {
+            { "uCommands[0].groupsX", offsetof(TileClassCommand, groupsX) },
+            { "uCommands[0].groupsZ", offsetof(TileClassCommand, groupsZ) },
+        };
+
+        const MemberOffset VisibilityDrawsMembers[] = {
+            { "uDraws[0].instanceIndex", offsetof(VisibilityDraw, instanceIndex) },
+            { "uDraws[0].bin", offsetof(VisibilityDraw, bin) },
+        };
+    }
+
+    bool CheckProgram(GLuint program, const char* programName)
+    {
+        bool matches = CheckBlock(program, programName, "FrameParams", sizeof(FrameParams), FrameParamsMembers, ARRAY_COUNT(FrameParamsMembers));
+        matches &= CheckStorageArray(program, programName, "InstanceParams", sizeof(InstanceData), InstanceParamsMembers, ARRAY_COUNT(InstanceParamsMembers));
+        matches &= CheckBlock(program, programName, "LightParams", sizeof(LightParams), LightParamsMembers, ARRAY_COUNT(LightParamsMembers));
+        matches &= CheckStorageArray(program, programName, "TileLightParams", sizeof(TileLightList), TileLightParamsMembers, ARRAY_COUNT(TileLightParamsMembers));
+        matches &= CheckStorageArray(program, programName, "TileClassCommands", sizeof(TileClassCommand), TileClassCommandsMembers, ARRAY_COUNT(TileClassCommandsMembers));
+        matches &= CheckStorageArray(program, programName, "VisibilityDraws", sizeof(VisibilityDraw), VisibilityDrawsMembers, ARRAY_COUNT(VisibilityDrawsMembers));
+        return matches;
+    }
+}
@@ -0,0 +1,226 @@
+#ifndef SHADER_LAYOUTS_FUNC
+#define SHADER_LAYOUTS_FUNC
+
+#include "Globals.h"
+
+#include <cstddef>
+#include <tuple>
+
+// Length of the uLight arrays of the shaders (LightParams)
+#define MAX_SHADER_LIGHTS 16
+// Entries of the instance buffer (InstanceParams), static and dynamic entities together
+#define MAX_SHADER_INSTANCES 65536
+// Visibility buffer ids: the triangle in the low bits, the draw index + 1 above it, 0 where nothing was drawn
+#define VISIBILITY_TRIANGLE_BITS 20
+#define VISIBILITY_MAX_TRIANGLES (1u << VISIBILITY_TRIANGLE_BITS) // Per submesh
+#define VISIBILITY_MAX_DRAWS 4095  // Entries of the uDraws array (VisibilityDraws), draw index + 1 takes the other 12 bits
+#define VISIBILITY_MAX_BINS 65535  // Submeshes of all the models, a bin is resolved at material depth (bin + 1) / 65536
+
+namespace ShaderLayouts
+{
+    enum Packing
+    {
+        PACKING_STD140, // Uniform blocks
+        PACKING_STD430  // Shader storage blocks
+    };
+
+    constexpr u32 AlignUp(u32 offset, u32 alignment)
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    /**
+     * Base alignment and size of a GLSL type under a packing. Structs describe their members
+     * with a Members alias of Layout, see LightData.
+     */
+    template <typename T, Packing P>
+    struct TypeLayout
+    {
+        static constexpr u32 alignment = T::template Members<P>::alignment;
+        static constexpr u32 size = T::template Members<P>::size;
+    };
+
+    template <Packing P> struct TypeLayout<u32, P> { static constexpr u32 alignment = 4; static constexpr u32 size = 4; };
+    template <Packing P> struct TypeLayout<i32, P> { static constexpr u32 alignment = 4; static constexpr u32 size = 4; };
+    template <Packing P> struct TypeLayout<f32, P> { static constexpr u32 alignment = 4; static constexpr u32 size = 4; };
+    template <Packing P> struct TypeLayout<vec2, P> { static constexpr u32 alignment = 8; static constexpr u32 size = 8; };
+    template <Packing P> struct TypeLayout<vec3, P> { static constexpr u32 alignment = 16; static constexpr u32 size = 12; };
+    template <Packing P> struct TypeLayout<vec4, P> { static constexpr u32 alignment = 16; static constexpr u32 size = 16; };
+    template <Packing P> struct TypeLayout<glm::mat4, P> { static constexpr u32 alignment = 16; static constexpr u32 size = 64; };
+
+    // Array member of a Layout. std140 rounds the element alignment and stride up to a vec4, std430 does not.
+    template <typename T, u32 Count>
+    struct Array
+    {
+    };
+
+    template <typename T, Packing P>
+    constexpr u32 ArrayStride()
+    {
+        return AlignUp(TypeLayout<T, P>::size, P == PACKING_STD140 ? AlignUp(TypeLayout<T, P>::alignment, 16) : TypeLayout<T, P>::alignment);
+    }
+
+    template <typename T, u32 Count, Packing P>
+    struct TypeLayout<Array<T, Count>, P>
+    {
+        static constexpr u32 alignment = P == PACKING_STD140 ? AlignUp(TypeLayout<T, P>::alignment, 16) : TypeLayout<T, P>::alignment;
+        static constexpr u32 size = ArrayStride<T, P>() * Count;
+    };
+
+    /**
+     * Offsets of the members of a block or struct, in declaration order, as the GLSL packing lays them out.
+     * Checked against the offsetof of the C++ struct written to the buffer with static_assert.
+     */
+    template <Packing P, typename... Types>
+    struct Layout
+    {
+        static constexpr u32 count = sizeof...(Types);
+
+        static constexpr u32 Offset(u32 index)
+        {
+            const u32 alignments[] = { TypeLayout<Types, P>::alignment... };
+            const u32 sizes[] = { TypeLayout<Types, P>::size... };
+
+            u32 offset = 0;
+            for (u32 i = 0; i < index; ++i)
+                offset = AlignUp(offset, alignments[i]) + sizes[i];
+            return AlignUp(offset, alignments[index]);
+        }
+
+        static constexpr u32 MaxAlignment()
+        {
+            const u32 alignments[] = { TypeLayout<Types, P>::alignment... };
+
+            u32 maxAlignment = 0;
+            for (u32 i = 0; i < count; ++i)
+                maxAlignment = alignments[i] > maxAlignment ? alignments[i] : maxAlignment;
+            return maxAlignment;
+        }
+
+        static constexpr u32 alignment = P == PACKING_STD140 ? AlignUp(MaxAlignment(), 16) : MaxAlignment();
+        static constexpr u32 size = AlignUp(Offset(count - 1) + TypeLayout<typename std::tuple_element<count - 1, std::tuple<Types...>>::type, P>::size, alignment);
+    };
+
+#define SHADER_LAYOUT_CHECK(Struct, member, index, packing) \
+    static_assert(offsetof(Struct, member) == Struct::Members<packing>::Offset(index), #Struct "::" #member " is not where the " #packing " packing puts it")
+
+#define SHADER_LAYOUT_CHECK_SIZE(Struct, packing) \
+    static_assert(sizeof(Struct) == Struct::Members<packing>::size, "sizeof(" #Struct ") is not its " #packing " size")
+
+    // struct Light of the shaders
+    struct LightData
+    {
+        template <Packing P> using Members = Layout<P, u32, vec3, vec3, vec3, f32>;
+
+        u32  type;
+        u32  pad0[3];
+        vec3 color;
+        f32  pad1;
+        vec3 direction;
+        f32  pad2;
+        vec3 position;
+        f32  intensity;
+    };
+    SHADER_LAYOUT_CHECK(LightData, type, 0, PACKING_STD140);
+    SHADER_LAYOUT_CHECK(LightData, color, 1, PACKING_STD140);
+    SHADER_LAYOUT_CHECK(LightData, direction, 2, PACKING_STD140);
+    SHADER_LAYOUT_CHECK(LightData, position, 3, PACKING_STD140);
+    SHADER_LAYOUT_CHECK(LightData, intensity, 4, PACKING_STD140);
+    SHADER_LAYOUT_CHECK_SIZE(LightData, PACKING_STD140);
+
+    // Uniform block FrameParams, binding 0, rewritten every frame
+    struct FrameParams
+    {
+        template <Packing P> using Members = Layout<P, glm::mat4, vec3>;
+
+        glm::mat4 viewProjection;
+        vec3      cameraPosition;
+        f32       pad0;
+    };
+    SHADER_LAYOUT_CHECK(FrameParams, viewProjection, 0, PACKING_STD140);
+    SHADER_LAYOUT_CHECK(FrameParams, cameraPosition, 1, PACKING_STD140);
+    SHADER_LAYOUT_CHECK_SIZE(FrameParams, PACKING_STD140);
+
+    // Element of the uInstances array of shader storage block InstanceParams, binding 1, one per entity
+    struct InstanceData
+    {
+        template <Packing P> using Members = Layout<P, glm::mat4>;
+
+        glm::mat4 world;
+    };
+    SHADER_LAYOUT_CHECK(InstanceData, world, 0, PACKING_STD430);
+    SHADER_LAYOUT_CHECK_SIZE(InstanceData, PACKING_STD430);
+    static_assert(sizeof(InstanceData) == ArrayStride<InstanceData, PACKING_STD430>(), "The uInstances array stride is not sizeof(InstanceData)");
+
+    // Uniform block LightParams, binding 2, rewritten when the lights change
+    struct LightParams
+    {
+        template <Packing P> using Members = Layout<P, u32, Array<LightData, MAX_SHADER_LIGHTS>>;
+
+        u32       lightCount;
+        u32       pad0[3];
+        LightData lights[MAX_SHADER_LIGHTS];
+    };
+    SHADER_LAYOUT_CHECK(LightParams, lightCount, 0, PACKING_STD140);
+    SHADER_LAYOUT_CHECK(LightParams, lights, 1, PACKING_STD140);
+    SHADER_LAYOUT_CHECK_SIZE(LightParams, PACKING_STD140);
+    static_assert(sizeof(LightData) == ArrayStride<LightData, PACKING_STD140>(), "The uLight array stride is not sizeof(LightData)");
+
+    // Element of the uTiles array of shader storage block TileLightParams, binding 2, one per screen tile
+    struct TileLightList
+    {
+        template <Packing P> using Members = Layout<P, u32, Array<u32, MAX_SHADER_LIGHTS>>;
+
+        u32 count;
+        u32 indices[MAX_SHADER_LIGHTS]; // Into uLight
+    };
+    SHADER_LAYOUT_CHECK(TileLightList, count, 0, PACKING_STD430);
+    SHADER_LAYOUT_CHECK(TileLightList, indices, 1, PACKING_STD430);
+    SHADER_LAYOUT_CHECK_SIZE(TileLightList, PACKING_STD430);
+    static_assert(sizeof(TileLightList) == ArrayStride<TileLightList, PACKING_STD430>(), "The uTiles array stride is not sizeof(TileLightList)");
+
+    // Element of the uCommands array of shader storage block TileClassCommands, binding 3, read by glDispatchComputeIndirect
+    struct TileClassCommand
+    {
+        template <Packing P> using Members = Layout<P, u32, u32, u32>;
+
+        u32 groupsX; // Tiles of the class, counted by TILE_CLASSIFY
+        u32 groupsY;
+        u32 groupsZ;
+    };
+    SHADER_LAYOUT_CHECK(TileClassCommand, groupsX, 0, PACKING_STD430);
+    SHADER_LAYOUT_CHECK(TileClassCommand, groupsY, 1, PACKING_STD430);
+    SHADER_LAYOUT_CHECK(TileClassCommand, groupsZ, 2, PACKING_STD430);
+    SHADER_LAYOUT_CHECK_SIZE(TileClassCommand, PACKING_STD430);
+    static_assert(sizeof(TileClassCommand) == ArrayStride<TileClassCommand, PACKING_STD430>(), "The uCommands array stride is not sizeof(TileClassCommand)");
+
+    // Element of the uDraws array of shader storage block VisibilityDraws, binding 5, one per submesh draw of the visibility pass
+    struct VisibilityDraw
+    {
+        template <Packing P> using Members = Layout<P, u32, u32>;
+
+        u32 instanceIndex; // Into uInstances
+        u32 bin;           // Model submesh, what the draw is resolved with
+    };
+    SHADER_LAYOUT_CHECK(VisibilityDraw, instanceIndex, 0, PACKING_STD430);
+    SHADER_LAYOUT_CHECK(VisibilityDraw, bin, 1, PACKING_STD430);
+    SHADER_LAYOUT_CHECK_SIZE(VisibilityDraw, PACKING_STD430);
+    static_assert(sizeof(VisibilityDraw) == ArrayStride<VisibilityDraw, PACKING_STD430>(), "The uDraws array stride is not sizeof(VisibilityDraw)");
+
+    /**
+     * Bytes of LightParams used by lightCount lights, what an upload has to copy.
+     */
+    inline u32 LightParamsSize(u32 lightCount)
+    {
+        return (u32)offsetof(LightParams, lights) + lightCount * (u32)sizeof(LightData);
+    }
+
+    /**
+     * Compares the offsets the linker gave the members of the blocks above, read with glGetActiveUniformsiv
+     * and glGetProgramResourceiv, with the C++ structs. Logs every mismatch and returns false if there was one. Blocks and members
+     * the program does not use are skipped.
+     */
+    bool CheckProgram(GLuint program, const char* programName);
+}
+
+#endif // !SHADER_LAYOUTS_FUNC
@@ -0,0 +1,771 @@
+#include "TextureCooker.h"
+#include "platform.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TEXTURE_COOKER_SSE2
+#endif
+
+namespace TextureCooker
+{
+    namespace
+    {
+        // DDS layout, see the DDS_HEADER and DDS_HEADER_DXT10 documentation
+        const u32 DDSMagic = 0x20534444; // "DDS "
+        const u32 DDSFourCCDX10 = 0x30315844; // "DX10"
+        const u32 DDSFlags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; // CAPS | HEIGHT | WIDTH | PIXELFORMAT | MIPMAPCOUNT | LINEARSIZE
+        const u32 DDSPixelFormatFourCC = 0x4;
+        const u32 DDSCaps = 0x1000 | 0x400000 | 0x8; // TEXTURE | MIPMAP | COMPLEX
+        const u32 DDSDimensionTexture2D = 3;
+
+        const u32 DXGIFormatBC4 = 80;
+        const u32 DXGIFormatBC5 = 83;
+        const u32 DXGIFormatBC7 = 98;
+
+        struct DDSPixelFormat
+        {
+            u32 size;
+            u32 flags;
+            u32 fourCC;
+            u32 rgbBitCount;
+            u32 rBitMask;
+            u32 gBitMask;
+            u32 bBitMask;
+            u32 aBitMask;
+        };
+
+        struct DDSHeader
+        {
+            u32            size;
+            u32            flags;
+            u32            height;
+            u32            width;
+            u32            pitchOrLinearSize;
+            u32            depth;
+            u32            mipMapCount;
+            u32            reserved1[11]; // [0] TEXTURE_COOKER_TAG, [1] TEXTURE_COOKER_VERSION, [2] TextureKind
+            DDSPixelFormat pixelFormat;
+            u32            caps;
+            u32            caps2;
+            u32            caps3;
+            u32            caps4;
+            u32            reserved2;
+        };
+
+        struct DDSHeaderDX10
+        {
+            u32 dxgiFormat;
+            u32 resourceDimension;
+            u32 miscFlag;
+            u32 arraySize;
+            u32 miscFlags2;
+        };
+
+        const u8 BC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+        struct BitWriter
+        {
+            u8* bytes;
+            u32 position;
+
+            void Write(u32 value, u32 bitCount)
+            {
+                for (u32 i = 0; i < bitCount; ++i, ++position)
+                {
+                    if ((value >> i) & 1)
+                        bytes[position >> 3] |= (u8)(1 << (position & 7));
+                }
+            }
+        };
+
+        // Rows of pixels or blocks, split over the job system
+        template <typename Function>
+        void ParallelFor(u32 count, const Function& function)
+        {
+            JobSystem::ParallelFor("Texture cook", count, 0, [&](u32 begin, u32 end)
+            {
+                for (u32 i = begin; i < end; ++i)
+                    function(i);
+            });
+        }
+
+        struct SrgbToLinear
+        {
+            f32 values[256];
+
+            SrgbToLinear()
+            {
+                for (u32 i = 0; i < 256; ++i)
+                {
+                    const f32 c = i / 255.0f;
+                    values[i] = c <= 0.04045f ? c / 12.92f : glm::pow((c + 0.055f) / 1.055f, 2.4f);
+                }
+            }
+        };
+
+        const f32* SrgbToLinearTable()
+        {
+            static const SrgbToLinear table;
+            return table.values;
+        }
+
+        u8 LinearToSrgb(f32 c)
+        {
+            c = glm::clamp(c, 0.0f, 1.0f);
+            const f32 s = c <= 0.0031308f ? c * 12.92f : 1.055f * glm::pow(c, 1.0f / 2.4f) - 0.055f;
+            return (u8)(s * 255.0f + 0.5f);
+        }
+
+        u8 UnitToByte(f32 c)
+        {
+            return (u8)(glm::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+
+        const char* KindName(TextureKind kind)
+        {
+            switch (kind)
+            {
+            case TEXTURE_KIND_NORMAL: return "normal";
+            case TEXTURE_KIND_SCALAR: return "scalar";
+            case TEXTURE_KIND_DATA: return "data";
+            default: return "color";
+            }
+        }
+
+        GLenum InternalFormat(TextureKind kind)
+        {
+            switch (kind)
+            {
+            case TEXTURE_KIND_NORMAL: return GL_COMPRESSED_RG_RGTC2;
+            case TEXTURE_KIND_SCALAR: return GL_COMPRESSED_RED_RGTC1;
+            default: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+            }
+        }
+
+        // Source pixel into the space mips are filtered in
+        vec4 DecodePixel(const u8* pixel, i32 nchannels, TextureKind kind)
+        {
+            const f32* srgbToLinear = SrgbToLinearTable();
+            const u8 r = pixel[0];
+            const u8 g = nchannels >= 3 ? pixel[1] : r;
+            const u8 b = nchannels >= 3 ? pixel[2] : r;
+            const u8 a = nchannels == 4 ? pixel[3] : nchannels == 2 ? pixel[1] : 255;
+
+            switch (kind)
+            {
+            case TEXTURE_KIND_NORMAL: return vec4(vec3(r, g, b) * (2.0f / 255.0f) - 1.0f, 1.0f);
+            case TEXTURE_KIND_SCALAR: return vec4(r / 255.0f, 0.0f, 0.0f, 1.0f);
+            case TEXTURE_KIND_DATA: return vec4(r, g, b, a) / 255.0f;
+            default: return vec4(srgbToLinear[r], srgbToLinear[g], srgbToLinear[b], a / 255.0f);
+            }
+        }
+
+        // Filtered pixel back to the bytes the encoders take
+        void EncodePixel(const vec4& pixel, TextureKind kind, u8 out[4])
+        {
+            switch (kind)
+            {
+            case TEXTURE_KIND_NORMAL:
+            {
+                const f32 length = glm::length(vec3(pixel));
+                const vec3 n = length > 0.0f ? vec3(pixel) / length : vec3(0.0f, 0.0f, 1.0f);
+                out[0] = UnitToByte(n.x * 0.5f + 0.5f);
+                out[1] = UnitToByte(n.y * 0.5f + 0.5f);
+                out[2] = 0;
+                out[3] = 255;
+                break;
+            }
+            case TEXTURE_KIND_SCALAR:
+                out[0] = UnitToByte(pixel.x);
+                out[1] = out[2] = 0;
+                out[3] = 255;
+                break;
+            case TEXTURE_KIND_DATA:
+                for (u32 c = 0; c < 4; ++c)
+                    out[c] = UnitToByte(pixel[c]);
+                break;
+            default:
+                out[0] = LinearToSrgb(pixel.x);
+                out[1] = LinearToSrgb(pixel.y);
+                out[2] = LinearToSrgb(pixel.z);
+                out[3] = UnitToByte(pixel.w);
+                break;
+            }
+        }
+
+        // Grayscale bump map to tangent space normals, Sobel slopes of the first channel with clamped edges
+        void HeightToNormals(const Image& image, std::vector<vec4>& outLevel)
+        {
+            const i32 width = image.size.x;
+            const i32 height = image.size.y;
+            const u8* pixels = (const u8*)image.pixels;
+            auto heightAt = [&](i32 x, i32 y)
+            {
+                x = glm::clamp(x, 0, width - 1);
+                y = glm::clamp(y, 0, height - 1);
+                return pixels[y * image.stride + x * image.nchannels] / 255.0f;
+            };
+
+            outLevel.resize(width * height);
+            ParallelFor(height, [&](u32 row)
+            {
+                const i32 y = (i32)row;
+                for (i32 x = 0; x < width; ++x)
+                {
+                    const f32 dx = (heightAt(x + 1, y - 1) + 2.0f * heightAt(x + 1, y) + heightAt(x + 1, y + 1)) -
+                        (heightAt(x - 1, y - 1) + 2.0f * heightAt(x - 1, y) + heightAt(x - 1, y + 1));
+                    const f32 dy = (heightAt(x - 1, y + 1) + 2.0f * heightAt(x, y + 1) + heightAt(x + 1, y + 1)) -
+                        (heightAt(x - 1, y - 1) + 2.0f * heightAt(x, y - 1) + heightAt(x + 1, y - 1));
+                    const vec3 n = glm::normalize(vec3(-dx * TEXTURE_COOKER_BUMP_STRENGTH, -dy * TEXTURE_COOKER_BUMP_STRENGTH, 1.0f));
+                    outLevel[y * width + x] = vec4(n, 1.0f);
+                }
+            });
+        }
+
+        // 2x2 box filter, the last row/column is repeated on odd sizes
+        void Downsample(const std::vector<vec4>& src, u32 width, u32 height, std::vector<vec4>& dst, u32 dstWidth, u32 dstHeight)
+        {
+            dst.resize(dstWidth * dstHeight);
+            ParallelFor(dstHeight, [&](u32 y)
+            {
+                const u32 y0 = glm::min(y * 2, height - 1);
+                const u32 y1 = glm::min(y * 2 + 1, height - 1);
+                for (u32 x = 0; x < dstWidth; ++x)
+                {
+                    const u32 x0 = glm::min(x * 2, width - 1);
+                    const u32 x1 = glm::min(x * 2 + 1, width - 1);
+#ifdef TEXTURE_COOKER_SSE2
+                    __m128 sum = _mm_add_ps(
+                        _mm_add_ps(_mm_loadu_ps(&src[y0 * width + x0].x), _mm_loadu_ps(&src[y0 * width + x1].x)),
+                        _mm_add_ps(_mm_loadu_ps(&src[y1 * width + x0].x), _mm_loadu_ps(&src[y1 * width + x1].x)));
+                    _mm_storeu_ps(&dst[y * dstWidth + x].x, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+                    dst[y * dstWidth + x] = (src[y0 * width + x0] + src[y0 * width + x1] + src[y1 * width + x0] + src[y1 * width + x1]) * 0.25f;
+#endif
+                }
+            });
+        }
+
+        void EncodeLevel(const std::vector<vec4>& pixels, u32 width, u32 height, TextureKind kind, std::vector<u8>& outData)
+        {
+            const u32 blocksX = (width + 3) / 4;
+            const u32 blocksY = (height + 3) / 4;
+            const u32 blockSize = BlockSize(InternalFormat(kind));
+            const u64 levelOffset = outData.size();
+            outData.resize(levelOffset + (u64)blocksX * blocksY * blockSize);
+
+            ParallelFor(blocksY, [&](u32 by)
+            {
+                u8 block[16][4];
+                for (u32 bx = 0; bx < blocksX; ++bx)
+                {
+                    // Blocks past the edge repeat the last row/column
+                    for (u32 i = 0; i < 16; ++i)
+                    {
+                        const u32 x = glm::min(bx * 4 + i % 4, width - 1);
+                        const u32 y = glm::min(by * 4 + i / 4, height - 1);
+                        EncodePixel(pixels[y * width + x], kind, block[i]);
+                    }
+
+                    u8* out = &outData[levelOffset + ((u64)by * blocksX + bx) * blockSize];
+                    if (InternalFormat(kind) == GL_COMPRESSED_RGBA_BPTC_UNORM)
+                    {
+                        EncodeBC7Block(block, out);
+                    }
+                    else
+                    {
+                        u8 xs[16], ys[16];
+                        for (u32 i = 0; i < 16; ++i)
+                        {
+                            xs[i] = block[i][0];
+                            ys[i] = block[i][1];
+                        }
+
+                        if (kind == TEXTURE_KIND_NORMAL)
+                            EncodeBC5Block(xs, ys, out);
+                        else
+                            EncodeBC4Block(xs, out);
+                    }
+                }
+            });
+        }
+
+        void QuantizeBC7Endpoint(const vec4& endpoint, u8 outQuantized[4], u8& outPBit)
+        {
+            f32 bestError = FLT_MAX;
+            for (u8 p = 0; p < 2; ++p)
+            {
+                u8 quantized[4];
+                f32 error = 0.0f;
+                for (u32 c = 0; c < 4; ++c)
+                {
+                    quantized[c] = (u8)glm::clamp((i32)glm::floor((endpoint[c] - p) * 0.5f + 0.5f), 0, 127);
+                    const f32 d = (f32)((quantized[c] << 1) | p) - endpoint[c];
+                    error += d * d;
+                }
+
+                if (error < bestError)
+                {
+                    bestError = error;
+                    memcpy(outQuantized, quantized, 4);
+                    outPBit = p;
+                }
+            }
+        }
+
+        u32 FindBC7Indices(const u8 pixels[16][4], const u8 e0[4], const u8 e1[4], u8 outIndices[16])
+        {
+            i32 palette[16][4];
+            for (u32 i = 0; i < 16; ++i)
+            {
+                for (u32 c = 0; c < 4; ++c)
+                    palette[i][c] = ((64 - BC7Weights4[i]) * e0[c] + BC7Weights4[i] * e1[c] + 32) >> 6;
+            }
+
+            u32 totalError = 0;
+            for (u32 p = 0; p < 16; ++p)
+            {
+                u32 bestError = UINT32_MAX;
+                for (u32 i = 0; i < 16; ++i)
+                {
+                    u32 error = 0;
+                    for (u32 c = 0; c < 4; ++c)
+                    {
+                        const i32 d = palette[i][c] - pixels[p][c];
+                        error += d * d;
+                    }
+
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        outIndices[p] = (u8)i;
+                    }
+                }
+                totalError += bestError;
+            }
+            return totalError;
+        }
+    }
+
+    std::string CookedPath(const std::string& sourcePath, TextureKind kind)
+    {
+        return sourcePath + "." + KindName(kind) + TEXTURE_COOKED_EXTENSION;
+    }
+
+    u32 BlockSize(GLenum internalFormat)
+    {
+        return internalFormat == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+    }
+
+    u32 LevelSize(GLenum internalFormat, u32 width, u32 height)
+    {
+        return ((width + 3) / 4) * ((height + 3) / 4) * BlockSize(internalFormat);
+    }
+
+    u32 LevelCount(u32 width, u32 height)
+    {
+        u32 levels = 1;
+        while ((width | height) > 1)
+        {
+            width >>= 1;
+            height >>= 1;
+            ++levels;
+        }
+        return levels;
+    }
+
+    void EncodeBC4Block(const u8 values[16], u8 outBlock[8])
+    {
+        u8 minValue = 255;
+        u8 maxValue = 0;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            minValue = glm::min(minValue, values[i]);
+            maxValue = glm::max(maxValue, values[i]);
+        }
+
+        memset(outBlock, 0, 8);
+        outBlock[0] = maxValue;
+        outBlock[1] = minValue;
+        if (maxValue == minValue)
+            return;
+
+        // red0 > red1 selects the 8 value palette
+        f32 palette[8];
+        palette[0] = maxValue;
+        palette[1] = minValue;
+        for (u32 i = 2; i < 8; ++i)
+            palette[i] = ((8 - i) * maxValue + (i - 1) * minValue) / 7.0f;
+
+        u64 bits = 0;
+        for (u32 p = 0; p < 16; ++p)
+        {
+            u32 bestIndex = 0;
+            f32 bestError = FLT_MAX;
+            for (u32 i = 0; i < 8; ++i)
+            {
+                const f32 error = glm::abs(palette[i] - values[p]);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    bestIndex = i;
+                }
+            }
+            bits |= (u64)bestIndex << (3 * p);
+        }
+
+        for (u32 b = 0; b < 6; ++b)
+            outBlock[2 + b] = (u8)(bits >> (8 * b));
+    }
+
+    void EncodeBC5Block(const u8 xs[16], const u8 ys[16], u8 outBlock[16])
+    {
+        EncodeBC4Block(xs, outBlock);
+        EncodeBC4Block(ys, outBlock + 8);
+    }
+
+    void EncodeBC7Block(const u8 pixels[16][4], u8 outBlock[16])
+    {
+        // Principal axis of the block colors
+        vec4 mean(0.0f);
+        vec4 minColor(255.0f);
+        vec4 maxColor(0.0f);
+        for (u32 i = 0; i < 16; ++i)
+        {
+            const vec4 color(pixels[i][0], pixels[i][1], pixels[i][2], pixels[i][3]);
+            mean += color;
+            minColor = glm::min(minColor, color);
+            maxColor = glm::max(maxColor, color);
+        }
+        mean /= 16.0f;
+
+        glm::mat4 covariance(0.0f);
+        for (u32 i = 0; i < 16; ++i)
+        {
+            const vec4 d = vec4(pixels[i][0], pixels[i][1], pixels[i][2], pixels[i][3]) - mean;
+            covariance += glm::outerProduct(d, d);
+        }
+
+        vec4 axis = maxColor - minColor;
+        for (u32 iteration = 0; iteration < 8 && glm::dot(axis, axis) > 0.0f; ++iteration)
+        {
+            const vec4 next = covariance * axis;
+            const f32 length = glm::length(next);
+            if (length <= 1e-6f)
+                break;
+            axis = next / length;
+        }
+        if (glm::dot(axis, axis) > 0.0f)
+            axis = glm::normalize(axis);
+
+        f32 tMin = 0.0f;
+        f32 tMax = 0.0f;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            const f32 t = glm::dot(vec4(pixels[i][0], pixels[i][1], pixels[i][2], pixels[i][3]) - mean, axis);
+            tMin = glm::min(tMin, t);
+            tMax = glm::max(tMax, t);
+        }
+
+        vec4 endpoints[2] = {
+            glm::clamp(mean + axis * tMin, vec4(0.0f), vec4(255.0f)),
+            glm::clamp(mean + axis * tMax, vec4(0.0f), vec4(255.0f)) };
+
+        // Alternate index search and least squares endpoint refits, keeping the best
+        u32 bestError = UINT32_MAX;
+        u8 bestQuantized[2][4] = {};
+        u8 bestPBits[2] = {};
+        u8 bestIndices[16] = {};
+        for (u32 iteration = 0; iteration < 3; ++iteration)
+        {
+            u8 quantized[2][4];
+            u8 pBits[2];
+            u8 expanded[2][4];
+            for (u32 e = 0; e < 2; ++e)
+            {
+                QuantizeBC7Endpoint(endpoints[e], quantized[e], pBits[e]);
+                for (u32 c = 0; c < 4; ++c)
+                    expanded[e][c] = (u8)((quantized[e][c] << 1) | pBits[e]);
+            }
+
+            u8 indices[16];
+            const u32 error = FindBC7Indices(pixels, expanded[0], expanded[1], indices);
+            if (error < bestError)
+            {
+                bestError = error;
+                memcpy(bestQuantized, quantized, sizeof(quantized));
+                memcpy(bestPBits, pBits, sizeof(pBits));
+                memcpy(bestIndices, indices, sizeof(indices));
+            }
+            if (error == 0)
+                break;
+
+            f32 a00 = 0.0f, a01 = 0.0f, a11 = 0.0f;
+            vec4 x0(0.0f), x1(0.0f);
+            for (u32 i = 0; i < 16; ++i)
+            {
+                const f32 w = BC7Weights4[indices[i]] / 64.0f;
+                const vec4 color(pixels[i][0], pixels[i][1], pixels[i][2], pixels[i][3]);
+                a00 += (1.0f - w) * (1.0f - w);
+                a01 += (1.0f - w) * w;
+                a11 += w * w;
+                x0 += (1.0f - w) * color;
+                x1 += w * color;
+            }
+
+            const f32 determinant = a00 * a11 - a01 * a01;
+            if (glm::abs(determinant) < 1e-6f)
+                break;
+
+            endpoints[0] = glm::clamp((a11 * x0 - a01 * x1) / determinant, vec4(0.0f), vec4(255.0f));
+            endpoints[1] = glm::clamp((a00 * x1 - a01 * x0) / determinant, vec4(0.0f), vec4(255.0f));
+        }
+
+        // The MSB of the first index is implicit 0, flip the endpoints if needed
+        if (bestIndices[0] & 8)
+        {
+            for (u32 c = 0; c < 4; ++c)
+                std::swap(bestQuantized[0][c], bestQuantized[1][c]);
+            std::swap(bestPBits[0], bestPBits[1]);
+            for (u32 i = 0; i < 16; ++i)
+                bestIndices[i] = 15 - bestIndices[i];
+        }
+
+        memset(outBlock, 0, 16);
+        BitWriter writer = { outBlock, 0 };
+        writer.Write(1 << 6, 7); // mode 6
+        for (u32 c = 0; c < 4; ++c)
+        {
+            writer.Write(bestQuantized[0][c], 7);
+            writer.Write(bestQuantized[1][c], 7);
+        }
+        writer.Write(bestPBits[0], 1);
+        writer.Write(bestPBits[1], 1);
+        writer.Write(bestIndices[0], 3);
+        for (u32 i = 1; i < 16; ++i)
+            writer.Write(bestIndices[i], 4);
+    }
+
+    void Cook(const Image& image, TextureKind kind, std::vector<u8>& outData, CookedTexture& outTexture)
+    {
+        u32 width = image.size.x;
+        u32 height = image.size.y;
+
+        // Grayscale bump maps are heights, the shaders read the normal slots as tangent space xy
+        std::vector<vec4> level;
+        if (kind == TEXTURE_KIND_NORMAL && image.nchannels < 3)
+        {
+            HeightToNormals(image, level);
+        }
+        else
+        {
+            level.resize(width * height);
+            ParallelFor(height, [&](u32 y)
+            {
+                const u8* row = (const u8*)image.pixels + y * image.stride;
+                for (u32 x = 0; x < width; ++x)
+                    level[y * width + x] = DecodePixel(row + x * image.nchannels, image.nchannels, kind);
+            });
+        }
+
+        const u32 levelCount = LevelCount(width, height);
+
+        u64 totalSize = 0;
+        for (u32 l = 0; l < levelCount; ++l)
+            totalSize += LevelSize(InternalFormat(kind), glm::max(width >> l, 1u), glm::max(height >> l, 1u));
+
+        outData.clear();
+        outData.reserve(totalSize);
+
+        std::vector<vec4> nextLevel;
+        for (u32 l = 0; l < levelCount; ++l)
+        {
+            EncodeLevel(level, width, height, kind, outData);
+
+            if (l + 1 < levelCount)
+            {
+                const u32 nextWidth = glm::max(width / 2, 1u);
+                const u32 nextHeight = glm::max(height / 2, 1u);
+                Downsample(level, width, height, nextLevel, nextWidth, nextHeight);
+                level.swap(nextLevel);
+                width = nextWidth;
+                height = nextHeight;
+            }
+        }
+
+        outTexture.kind = kind;
+        outTexture.internalFormat = InternalFormat(kind);
+        outTexture.width = image.size.x;
+        outTexture.height = image.size.y;
+        outTexture.levelCount = levelCount;
+        outTexture.data = outData.data();
+        outTexture.dataSize = outData.size();
+    }
+
+    void PackChannels(const Image* sources, const u8* constants, u32 channelCount, std::vector<u8>& outPixels, Image& outImage)
+    {
+        ivec2 size(1, 1);
+        for (u32 c = 0; c < channelCount; ++c)
+        {
+            if (sources[c].pixels)
+                size = glm::max(size, sources[c].size);
+        }
+
+        outPixels.resize(size.x * size.y * channelCount);
+        for (i32 y = 0; y < size.y; ++y)
+        {
+            for (i32 x = 0; x < size.x; ++x)
+            {
+                u8* packed = &outPixels[(y * size.x + x) * channelCount];
+                for (u32 c = 0; c < channelCount; ++c)
+                {
+                    const Image& source = sources[c];
+                    if (source.pixels)
+                    {
+                        const i32 sx = x * source.size.x / size.x;
+                        const i32 sy = y * source.size.y / size.y;
+                        packed[c] = ((const u8*)source.pixels)[sy * source.stride + sx * source.nchannels];
+                    }
+                    else
+                    {
+                        packed[c] = constants[c];
+                    }
+                }
+            }
+        }
+
+        outImage = {};
+        outImage.pixels = outPixels.data();
+        outImage.size = size;
+        outImage.nchannels = channelCount;
+        outImage.stride = size.x * channelCount;
+    }
+
+    bool WriteDDS(const char* filepath, const CookedTexture& texture)
+    {
+        DDSHeader header = {};
+        header.size = sizeof(DDSHeader);
+        header.flags = DDSFlags;
+        header.height = texture.height;
+        header.width = texture.width;
+        header.pitchOrLinearSize = LevelSize(texture.internalFormat, texture.width, texture.height);
+        header.mipMapCount = texture.levelCount;
+        header.reserved1[0] = TEXTURE_COOKER_TAG;
+        header.reserved1[1] = TEXTURE_COOKER_VERSION;
+        header.reserved1[2] = texture.kind;
+        header.pixelFormat.size = sizeof(DDSPixelFormat);
+        header.pixelFormat.flags = DDSPixelFormatFourCC;
+        header.pixelFormat.fourCC = DDSFourCCDX10;
+        header.caps = DDSCaps;
+
+        DDSHeaderDX10 headerDX10 = {};
+        headerDX10.dxgiFormat = texture.internalFormat == GL_COMPRESSED_RED_RGTC1 ? DXGIFormatBC4 :
+            texture.internalFormat == GL_COMPRESSED_RG_RGTC2 ? DXGIFormatBC5 : DXGIFormatBC7;
+        headerDX10.resourceDimension = DDSDimensionTexture2D;
+        headerDX10.arraySize = 1;
+
+        FILE* file = fopen(filepath, "wb");
+        if (!file)
+        {
+            ELOG("fopen() failed writing file %s", filepath);
+            return false;
+        }
+
+        fwrite(&DDSMagic, sizeof(u32), 1, file);
+        fwrite(&header, sizeof(DDSHeader), 1, file);
+        fwrite(&headerDX10, sizeof(DDSHeaderDX10), 1, file);
+        fwrite(texture.data, 1, texture.dataSize, file);
+        fclose(file);
+        return true;
+    }
+
+    bool ReadDDS(const u8* bytes, u64 size, TextureKind kind, CookedTexture& outTexture)
+    {
+        const u64 headersSize = sizeof(u32) + sizeof(DDSHeader) + sizeof(DDSHeaderDX10);
+        if (size < headersSize || *(const u32*)bytes != DDSMagic)
+            return false;
+
+        const DDSHeader& header = *(const DDSHeader*)(bytes + sizeof(u32));
+        const DDSHeaderDX10& headerDX10 = *(const DDSHeaderDX10*)(bytes + sizeof(u32) + sizeof(DDSHeader));
+        if (header.size != sizeof(DDSHeader) || header.pixelFormat.fourCC != DDSFourCCDX10 ||
+            header.reserved1[0] != TEXTURE_COOKER_TAG || header.reserved1[1] != TEXTURE_COOKER_VERSION || header.reserved1[2] != (u32)kind ||
+            headerDX10.resourceDimension != DDSDimensionTexture2D || headerDX10.arraySize != 1)
+            return false;
+
+        switch (headerDX10.dxgiFormat)
+        {
+        case DXGIFormatBC4: outTexture.internalFormat = GL_COMPRESSED_RED_RGTC1; break;
+        case DXGIFormatBC5: outTexture.internalFormat = GL_COMPRESSED_RG_RGTC2; break;
+        case DXGIFormatBC7: outTexture.internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM; break;
+        default: return false;
+        }
+
+        outTexture.kind = kind;
+        outTexture.width = header.width;
+        outTexture.height = header.height;
+        outTexture.levelCount = glm::max(header.mipMapCount, 1u);
+        outTexture.data = bytes + headersSize;
+        outTexture.dataSize = size - headersSize;
+
+        u64 expectedSize = 0;
+        for (u32 l = 0; l < outTexture.levelCount; ++l)
+            expectedSize += LevelSize(outTexture.internalFormat, glm::max(outTexture.width >> l, 1u), glm::max(outTexture.height >> l, 1u));
+
+        return expectedSize <= outTexture.dataSize;
+    }
+
+    GLuint CreateTexture2D(const CookedTexture& texture)
+    {
+        GLuint texHandle;
+        glGenTextures(1, &texHandle);
+        glBindTexture(GL_TEXTURE_2D, texHandle);
+
+        const u8* levelData = texture.data;
+        for (u32 l = 0; l < texture.levelCount; ++l)
+        {
+            const u32 width = glm::max(texture.width >> l, 1u);
+            const u32 height = glm::max(texture.height >> l, 1u);
+            const u32 levelSize = LevelSize(texture.internalFormat, width, height);
+            glCompressedTexImage2D(GL_TEXTURE_2D, l, texture.internalFormat, width, height, 0, levelSize, levelData);
+            levelData += levelSize;
+        }
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levelCount - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        return texHandle;
+    }
+
+    GLuint LoadCooked(const char* cookedPath, TextureKind kind, u64 sourceTimestamp)
+    {
+        GLuint handle = 0;
+        if (GetFileLastWriteTimestamp(cookedPath) >= sourceTimestamp)
+        {
+            MappedFile file = MapFile(cookedPath);
+            CookedTexture cooked = {};
+            if (file.data && ReadDDS(file.data, file.size, kind, cooked))
+                handle = CreateTexture2D(cooked);
+            UnmapFile(file);
+        }
+        return handle;
+    }
+
+    GLuint CookAndCreate(const Image& image, TextureKind kind, const char* cookedPath)
+    {
+        std::vector<u8> cookedData;
+        CookedTexture cooked = {};
+        Cook(image, kind, cookedData, cooked);
+        WriteDDS(cookedPath, cooked);
+        return CreateTexture2D(cooked);
+    }
+}
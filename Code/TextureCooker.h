@@ -0,0 +1,101 @@
+#ifndef TEXTURE_COOKER_FUNC
+#define TEXTURE_COOKER_FUNC
+
+#include "Globals.h"
+
+// Bump whenever the cooked data changes meaning (encoders, mip filters...)
+#define TEXTURE_COOKER_VERSION 3
+#define TEXTURE_COOKER_TAG 0x4B4F4F43 // "COOK", stored in the DDS reserved fields
+#define TEXTURE_COOKED_EXTENSION ".dds"
+// Slope scale of the normals cooked from grayscale bump maps
+#define TEXTURE_COOKER_BUMP_STRENGTH 2.0f
+
+enum TextureKind
+{
+    TEXTURE_KIND_COLOR,  // sRGB encoded color, BC7
+    TEXTURE_KIND_NORMAL, // Tangent space normal map, BC5 (xy, z is rebuilt in the shaders)
+    TEXTURE_KIND_SCALAR, // Single channel data such as metallic, roughness or AO, BC4
+    TEXTURE_KIND_DATA,   // Linear multi channel data such as packed ORM, BC7
+};
+
+namespace TextureCooker
+{
+    /**
+     * A cooked mip chain: every level of internalFormat blocks tightly packed one after
+     * the other, starting with the largest. Rows go bottom to top as OpenGL expects.
+     */
+    struct CookedTexture
+    {
+        TextureKind kind;
+        GLenum      internalFormat;
+        u32         width;
+        u32         height;
+        u32         levelCount;
+        const u8*   data;
+        u64         dataSize;
+    };
+
+    /**
+     * Path of the cooked file of a source. The kind is part of it, so a source used as two kinds
+     * gets a cooked file for each.
+     */
+    std::string CookedPath(const std::string& sourcePath, TextureKind kind);
+
+    u32 BlockSize(GLenum internalFormat);
+
+    u32 LevelSize(GLenum internalFormat, u32 width, u32 height);
+
+    u32 LevelCount(u32 width, u32 height);
+
+    void EncodeBC4Block(const u8 values[16], u8 outBlock[8]);
+
+    void EncodeBC5Block(const u8 xs[16], const u8 ys[16], u8 outBlock[16]);
+
+    /**
+     * Encodes an RGBA block in BC7 mode 6 (single subset, 7777 endpoints with p-bits, 4 bit indices).
+     */
+    void EncodeBC7Block(const u8 pixels[16][4], u8 outBlock[16]);
+
+    /**
+     * Builds the mip chain of an image (mips filtered in linear space, normals renormalized) and
+     * encodes every level. Rows and blocks are spread over all hardware threads.
+     * A normal texture with fewer than 3 channels is a bump map, its normals come from the height slopes.
+     */
+    void Cook(const Image& image, TextureKind kind, std::vector<u8>& outData, CookedTexture& outTexture);
+
+    /**
+     * Packs the first channel of each source into one image as large as the largest source.
+     * Smaller sources are point sampled up, missing ones (no pixels) take their constant.
+     */
+    void PackChannels(const Image* sources, const u8* constants, u32 channelCount, std::vector<u8>& outPixels, Image& outImage);
+
+    /**
+     * Writes a cooked texture as a DDS file with a DX10 header. The cooker version and the
+     * kind go in its reserved fields.
+     */
+    bool WriteDDS(const char* filepath, const CookedTexture& texture);
+
+    /**
+     * Reads the DDS written by WriteDDS from memory. data points into the given bytes.
+     * Fails when it was written by another cooker version or cooked as another kind.
+     */
+    bool ReadDDS(const u8* bytes, u64 size, TextureKind kind, CookedTexture& outTexture);
+
+    /**
+     * Creates a texture with every level of the cooked texture uploaded as is.
+     */
+    GLuint CreateTexture2D(const CookedTexture& texture);
+
+    /**
+     * Creates a texture from a cooked file if it exists and is not older than sourceTimestamp.
+     * Returns 0 when the texture has to be cooked again.
+     */
+    GLuint LoadCooked(const char* cookedPath, TextureKind kind, u64 sourceTimestamp);
+
+    /**
+     * Cooks an image, writes the result to cookedPath and creates its texture.
+     */
+    GLuint CookAndCreate(const Image& image, TextureKind kind, const char* cookedPath);
+}
+
+#endif // !TEXTURE_COOKER_FUNC
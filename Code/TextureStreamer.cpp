@@ -0,0 +1,503 @@
+#include "TextureStreamer.h"
+#include "ModelLoaderFuncs.h"
+
+#include <algorithm>
+
+namespace TextureStreamer
+{
+    namespace
+    {
+        // Source bytes, the constants baked in and the kind they are cooked as
+        void HashSources(Result& result)
+        {
+            const Request& request = result.request;
+
+            u64 parts[TEXTURE_STREAMER_MAX_SOURCES * 2 + 1] = {};
+            for (u32 i = 0; i < request.sourceCount; ++i)
+            {
+                if (!request.sources[i].empty())
+                {
+                    u64 size = 0;
+                    parts[i] = AssetRegistry::HashFile(request.sources[i].c_str(), &size);
+                    if (parts[i] == 0)
+                        return;
+                    result.sourceSize += size;
+                }
+                if (request.packChannels)
+                    parts[TEXTURE_STREAMER_MAX_SOURCES + i] = request.constants[i];
+            }
+            parts[TEXTURE_STREAMER_MAX_SOURCES * 2] = request.kind;
+            result.contentHash = AssetRegistry::Hash(parts, sizeof(parts));
+        }
+
+        // Job side: read the cooked file, or decode the sources and cook them
+        void Process(Result& result)
+        {
+            const Request& request = result.request;
+
+            HashSources(result);
+
+            u64 newestSource = 0;
+            for (u32 i = 0; i < request.sourceCount; ++i)
+            {
+                if (!request.sources[i].empty())
+                    newestSource = glm::max(newestSource, GetFileLastWriteTimestamp(request.sources[i].c_str()));
+            }
+
+            // The mapping stays alive as long as the texture streams, no copy on this side
+            if (GetFileLastWriteTimestamp(request.cookedPath.c_str()) >= newestSource)
+            {
+                result.file = MapFile(request.cookedPath.c_str());
+                if (result.file.data && TextureCooker::ReadDDS(result.file.data, result.file.size, request.kind, result.cooked))
+                    return;
+                UnmapFile(result.file);
+                result.cooked = {};
+            }
+
+            Image images[TEXTURE_STREAMER_MAX_SOURCES] = {};
+            for (u32 i = 0; i < request.sourceCount; ++i)
+            {
+                if (!request.sources[i].empty())
+                    images[i] = ModelLoader::LoadImage(request.sources[i].c_str());
+            }
+
+            Image image = images[0];
+            std::vector<u8> packedPixels;
+            if (request.packChannels)
+                TextureCooker::PackChannels(images, request.constants, request.sourceCount, packedPixels, image);
+
+            if (image.pixels)
+            {
+                TextureCooker::Cook(image, request.kind, result.cookedData, result.cooked);
+
+                // Map back what was just written, the pages can be dropped when memory is short
+                if (TextureCooker::WriteDDS(request.cookedPath.c_str(), result.cooked))
+                {
+                    result.file = MapFile(request.cookedPath.c_str());
+                    TextureCooker::CookedTexture mapped = {};
+                    if (result.file.data && TextureCooker::ReadDDS(result.file.data, result.file.size, request.kind, mapped))
+                    {
+                        result.cooked = mapped;
+                        std::vector<u8>().swap(result.cookedData);
+                    }
+                    else
+                    {
+                        UnmapFile(result.file);
+                    }
+                }
+            }
+
+            for (u32 i = 0; i < request.sourceCount; ++i)
+            {
+                if (images[i].pixels)
+                    ModelLoader::FreeImage(images[i]);
+            }
+        }
+
+        void Decode(Streamer* streamer, const Request& request)
+        {
+            if (streamer->quit)
+                return;
+
+            Result* result = new Result();
+            result->request = request;
+            Process(*result);
+
+            Result* head = streamer->completed.load(std::memory_order_relaxed);
+            do
+            {
+                result->next = head;
+            } while (!streamer->completed.compare_exchange_weak(head, result, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        u32 LevelWidth(const TextureCooker::CookedTexture& cooked, u32 level)
+        {
+            return glm::max(cooked.width >> level, 1u);
+        }
+
+        u32 LevelHeight(const TextureCooker::CookedTexture& cooked, u32 level)
+        {
+            return glm::max(cooked.height >> level, 1u);
+        }
+
+        u64 LevelOffset(const TextureCooker::CookedTexture& cooked, u32 level)
+        {
+            u64 offset = 0;
+            for (u32 l = 0; l < level; ++l)
+                offset += TextureCooker::LevelSize(cooked.internalFormat, LevelWidth(cooked, l), LevelHeight(cooked, l));
+            return offset;
+        }
+
+        GLuint CreateStorage(const TextureCooker::CookedTexture& cooked, u32 firstLevel)
+        {
+            GLuint handle;
+            glGenTextures(1, &handle);
+            glBindTexture(GL_TEXTURE_2D, handle);
+            glTexStorage2D(GL_TEXTURE_2D, cooked.levelCount - firstLevel, cooked.internalFormat, LevelWidth(cooked, firstLevel), LevelHeight(cooked, firstLevel));
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, cooked.levelCount - firstLevel - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            return handle;
+        }
+
+        void SwapHandle(Residency& residency, GLuint handle, std::vector<Texture>& textures)
+        {
+            Texture& texture = textures[residency.textureIdx];
+            if (residency.loaded)
+            {
+                glDeleteTextures(1, &texture.handle);
+            }
+            else if (residency.ownedPlaceholder != 0)
+            {
+                glDeleteTextures(1, &residency.ownedPlaceholder);
+                residency.ownedPlaceholder = 0;
+            }
+            texture.handle = handle;
+        }
+
+        void FinishUpload(Streamer* streamer, const Upload& upload, std::vector<Texture>& textures)
+        {
+            Residency& residency = streamer->residencies[upload.residencyIdx];
+            SwapHandle(residency, upload.handle, textures);
+            residency.uploading = false;
+
+            if (!residency.loaded)
+            {
+                residency.loaded = true;
+                streamer->stats.completed++;
+                streamer->stats.lastCompletionTime = glfwGetTime();
+            }
+        }
+
+        /**
+         * Moves a residency to levels [level, levelCount). Levels already in VRAM are copied on
+         * the GPU, dropping detail is done right away, adding detail goes through the uploads.
+         */
+        void SetResidentLevel(Streamer* streamer, u32 residencyIdx, u32 level, std::vector<Texture>& textures)
+        {
+            Residency& residency = streamer->residencies[residencyIdx];
+            const TextureCooker::CookedTexture& cooked = residency.cooked;
+
+            const GLuint handle = CreateStorage(cooked, level);
+            if (residency.loaded)
+            {
+                const GLuint oldHandle = textures[residency.textureIdx].handle;
+                for (u32 l = glm::max(level, residency.residentLevel); l < cooked.levelCount; ++l)
+                {
+                    glCopyImageSubData(oldHandle, GL_TEXTURE_2D, l - residency.residentLevel, 0, 0, 0,
+                        handle, GL_TEXTURE_2D, l - level, 0, 0, 0, LevelWidth(cooked, l), LevelHeight(cooked, l), 1);
+                }
+            }
+
+            streamer->residentBytes += ResidentSize(residency, level);
+            streamer->residentBytes -= ResidentSize(residency, residency.residentLevel);
+
+            const u32 endLevel = glm::min(residency.residentLevel, cooked.levelCount);
+            residency.residentLevel = level;
+
+            if (level >= endLevel)
+            {
+                SwapHandle(residency, handle, textures);
+                return;
+            }
+
+            Upload upload = {};
+            upload.residencyIdx = residencyIdx;
+            upload.handle = handle;
+            upload.firstLevel = level;
+            upload.endLevel = endLevel;
+            upload.level = level;
+            streamer->uploads.push_back(upload);
+            residency.uploading = true;
+        }
+
+        u32 WantedLevel(const Streamer* streamer, const Residency& residency)
+        {
+            return residency.lastUsedFrame + TEXTURE_UNUSED_FRAMES >= streamer->frame ? residency.wantedLevel : residency.tailLevel;
+        }
+
+        /**
+         * Drops levels nobody asked for, least recently used textures first, until bytes are freed.
+         */
+        u64 Evict(Streamer* streamer, u64 bytes, u32 keepResidencyIdx, std::vector<Texture>& textures)
+        {
+            std::vector<u32> candidates;
+            for (u32 i = 0; i < streamer->residencies.size(); ++i)
+            {
+                const Residency& residency = streamer->residencies[i];
+                if (i != keepResidencyIdx && residency.loaded && !residency.uploading && residency.residentLevel < WantedLevel(streamer, residency))
+                    candidates.push_back(i);
+            }
+            std::sort(candidates.begin(), candidates.end(), [streamer](u32 a, u32 b) {
+                return streamer->residencies[a].lastUsedFrame < streamer->residencies[b].lastUsedFrame;
+            });
+
+            u64 freed = 0;
+            for (u32 i = 0; i < candidates.size() && freed < bytes; ++i)
+            {
+                const u64 residentBytes = streamer->residentBytes;
+                SetResidentLevel(streamer, candidates[i], WantedLevel(streamer, streamer->residencies[candidates[i]]), textures);
+                freed += residentBytes - streamer->residentBytes;
+                streamer->stats.evictions++;
+            }
+            return freed;
+        }
+
+        void UpdateResidency(Streamer* streamer, std::vector<Texture>& textures)
+        {
+            if (streamer->residentBytes > streamer->vramBudget)
+                Evict(streamer, streamer->residentBytes - streamer->vramBudget, UINT32_MAX, textures);
+
+            // More detail where it was asked for, most recently used textures first
+            std::vector<u32> upgrades;
+            for (u32 i = 0; i < streamer->residencies.size(); ++i)
+            {
+                const Residency& residency = streamer->residencies[i];
+                if (residency.loaded && !residency.uploading && WantedLevel(streamer, residency) < residency.residentLevel)
+                    upgrades.push_back(i);
+            }
+            std::sort(upgrades.begin(), upgrades.end(), [streamer](u32 a, u32 b) {
+                return streamer->residencies[a].lastUsedFrame > streamer->residencies[b].lastUsedFrame;
+            });
+
+            for (u32 residencyIdx : upgrades)
+            {
+                if (streamer->uploads.size() >= TEXTURE_MAX_PENDING_UPLOADS)
+                    break;
+
+                const Residency& residency = streamer->residencies[residencyIdx];
+                const u64 residentSize = ResidentSize(residency, residency.residentLevel);
+                u32 level = WantedLevel(streamer, residency);
+                const u64 wantedBytes = streamer->residentBytes + ResidentSize(residency, level) - residentSize;
+                if (wantedBytes > streamer->vramBudget)
+                    Evict(streamer, wantedBytes - streamer->vramBudget, residencyIdx, textures);
+
+                // Settle for less detail when that is all the budget has left
+                while (level < residency.residentLevel && streamer->residentBytes + ResidentSize(residency, level) - residentSize > streamer->vramBudget)
+                    level++;
+                if (level == residency.residentLevel)
+                    continue;
+
+                SetResidentLevel(streamer, residencyIdx, level, textures);
+            }
+        }
+
+        void AddResidency(Streamer* streamer, Result* result, std::vector<Texture>& textures)
+        {
+            const Request& request = result->request;
+
+            Residency residency = {};
+            residency.textureIdx = request.textureIdx;
+            residency.cooked = result->cooked;
+            residency.cookedData.swap(result->cookedData);
+            residency.file = result->file;
+            residency.ownedPlaceholder = request.ownedPlaceholder;
+            residency.residentLevel = residency.cooked.levelCount;
+
+            residency.tailLevel = residency.cooked.levelCount - 1;
+            while (residency.tailLevel > 0 &&
+                glm::max(LevelWidth(residency.cooked, residency.tailLevel - 1), LevelHeight(residency.cooked, residency.tailLevel - 1)) <= TEXTURE_RESIDENT_TAIL_SIZE)
+                residency.tailLevel--;
+            residency.wantedLevel = residency.tailLevel;
+
+            const u32 residencyIdx = streamer->residencies.size();
+            streamer->residencies.push_back(residency);
+            if (streamer->residencyOfTexture.size() <= request.textureIdx)
+                streamer->residencyOfTexture.resize(request.textureIdx + 1, UINT32_MAX);
+            streamer->residencyOfTexture[request.textureIdx] = residencyIdx;
+
+            SetResidentLevel(streamer, residencyIdx, residency.tailLevel, textures);
+        }
+    }
+
+    Streamer* Create()
+    {
+        Streamer* streamer = new Streamer();
+        streamer->vramBudget = TEXTURE_VRAM_BUDGET;
+
+        for (u32 i = 0; i < TEXTURE_UPLOAD_BUFFER_COUNT; ++i)
+        {
+            glGenBuffers(1, &streamer->buffers[i].pbo);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, streamer->buffers[i].pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, TEXTURE_UPLOAD_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        return streamer;
+    }
+
+    void Destroy(Streamer* streamer)
+    {
+        // The jobs not started yet return at once
+        streamer->quit = true;
+        JobSystem::Wait(&streamer->decodeJobs);
+
+        Result* result = streamer->completed.exchange(nullptr);
+        while (result)
+        {
+            Result* next = result->next;
+            UnmapFile(result->file);
+            delete result;
+            result = next;
+        }
+
+        for (Upload& upload : streamer->uploads)
+            glDeleteTextures(1, &upload.handle);
+        for (Residency& residency : streamer->residencies)
+            UnmapFile(residency.file);
+
+        for (u32 i = 0; i < TEXTURE_UPLOAD_BUFFER_COUNT; ++i)
+        {
+            if (streamer->buffers[i].fence)
+                glDeleteSync(streamer->buffers[i].fence);
+            glDeleteBuffers(1, &streamer->buffers[i].pbo);
+        }
+
+        delete streamer;
+    }
+
+    void Enqueue(Streamer* streamer, const Request& request)
+    {
+        if (streamer->stats.requested == streamer->stats.completed)
+            streamer->stats.firstRequestTime = glfwGetTime();
+        streamer->stats.requested++;
+
+        JobSystem::Run(&streamer->decodeJobs, "Texture decode", [streamer, request]() { Decode(streamer, request); });
+    }
+
+    void RequestDetail(Streamer* streamer, u32 textureIdx, f32 uvPerPixel)
+    {
+        if (textureIdx >= streamer->residencyOfTexture.size() || streamer->residencyOfTexture[textureIdx] == UINT32_MAX)
+            return;
+
+        // The level where a texel covers about a pixel
+        Residency& residency = streamer->residencies[streamer->residencyOfTexture[textureIdx]];
+        const f32 texelsPerPixel = glm::max(residency.cooked.width, residency.cooked.height) * uvPerPixel;
+        const u32 level = texelsPerPixel > 1.0f ? glm::min((u32)log2f(texelsPerPixel), residency.tailLevel) : 0u;
+
+        if (residency.lastUsedFrame != streamer->frame)
+        {
+            residency.lastUsedFrame = streamer->frame;
+            residency.wantedLevel = level;
+        }
+        else
+        {
+            residency.wantedLevel = glm::min(residency.wantedLevel, level);
+        }
+    }
+
+    void Update(Streamer* streamer, std::vector<Texture>& textures, const MergeFunction& merge)
+    {
+        // The stack hands the results newest first, reverse it to load in request order
+        Result* completed = streamer->completed.exchange(nullptr, std::memory_order_acquire);
+        Result* ordered = nullptr;
+        while (completed)
+        {
+            Result* next = completed->next;
+            completed->next = ordered;
+            ordered = completed;
+            completed = next;
+        }
+        while (ordered)
+        {
+            Result* next = ordered->next;
+            if (ordered->cooked.levelCount > 0 && merge(ordered->request.textureIdx, ordered->contentHash, ordered->sourceSize) != ordered->request.textureIdx)
+            {
+                // A copy of a texture already streamed, whoever used this one uses that one now
+                UnmapFile(ordered->file);
+                streamer->stats.completed++;
+            }
+            else if (ordered->cooked.levelCount > 0)
+            {
+                AddResidency(streamer, ordered, textures);
+            }
+            else
+            {
+                ELOG("Could not load texture %s, keeping its placeholder", ordered->request.cookedPath.c_str());
+                streamer->stats.completed++;
+            }
+            delete ordered;
+            ordered = next;
+        }
+
+        UpdateResidency(streamer, textures);
+
+        u32 budget = TEXTURE_UPLOAD_BUDGET_PER_FRAME;
+        while (!streamer->uploads.empty() && budget > 0)
+        {
+            Upload& upload = streamer->uploads.front();
+            const TextureCooker::CookedTexture& cooked = streamer->residencies[upload.residencyIdx].cooked;
+
+            // Never wait for the GPU: if the next buffer is still being read, carry on next frame
+            UploadBuffer& buffer = streamer->buffers[streamer->nextBuffer];
+            if (buffer.fence)
+            {
+                if (glClientWaitSync(buffer.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                {
+                    streamer->stats.uploadStalls++;
+                    break;
+                }
+                glDeleteSync(buffer.fence);
+                buffer.fence = 0;
+            }
+
+            // Whole rows of blocks, as many as fit in one buffer
+            const u32 width = LevelWidth(cooked, upload.level);
+            const u32 height = LevelHeight(cooked, upload.level);
+            const u32 rowSize = ((width + 3) / 4) * TextureCooker::BlockSize(cooked.internalFormat);
+            const u32 blockRows = (height + 3) / 4;
+            const u32 rowCount = glm::min(blockRows - upload.blockRow, glm::max((u32)TEXTURE_UPLOAD_BUFFER_SIZE / rowSize, 1u));
+            const u32 chunkSize = rowCount * rowSize;
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.pbo);
+            void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, chunkSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            memcpy(mapped, cooked.data + LevelOffset(cooked, upload.level) + upload.blockRow * rowSize, chunkSize);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+            const u32 y = upload.blockRow * 4;
+            glBindTexture(GL_TEXTURE_2D, upload.handle);
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, upload.level - upload.firstLevel, 0, y, width, glm::min(rowCount * 4, height - y),
+                cooked.internalFormat, chunkSize, (const void*)0);
+            buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            streamer->nextBuffer = (streamer->nextBuffer + 1) % TEXTURE_UPLOAD_BUFFER_COUNT;
+
+            budget -= glm::min(budget, chunkSize);
+            streamer->stats.uploadedBytes += chunkSize;
+
+            upload.blockRow += rowCount;
+            if (upload.blockRow == blockRows)
+            {
+                upload.blockRow = 0;
+                upload.level++;
+            }
+            if (upload.level == upload.endLevel)
+            {
+                FinishUpload(streamer, upload, textures);
+                streamer->uploads.pop_front();
+            }
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        streamer->frame++;
+    }
+
+    u32 PendingCount(const Streamer* streamer)
+    {
+        return streamer->stats.requested - streamer->stats.completed;
+    }
+
+    u64 ResidentSize(const Residency& residency, u32 level)
+    {
+        const TextureCooker::CookedTexture& cooked = residency.cooked;
+        u64 size = 0;
+        for (u32 l = level; l < cooked.levelCount; ++l)
+            size += TextureCooker::LevelSize(cooked.internalFormat, LevelWidth(cooked, l), LevelHeight(cooked, l));
+        return size;
+    }
+}
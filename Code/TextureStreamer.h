@@ -0,0 +1,171 @@
+#ifndef TEXTURE_STREAMER_FUNC
+#define TEXTURE_STREAMER_FUNC
+
+#include "platform.h"
+#include "TextureCooker.h"
+#include "JobSystem.h"
+
+#include <atomic>
+#include <deque>
+#include <functional>
+
+#define TEXTURE_STREAMER_MAX_SOURCES 4
+#define TEXTURE_UPLOAD_BUFFER_COUNT 3
+#define TEXTURE_UPLOAD_BUFFER_SIZE MB(4)
+#define TEXTURE_UPLOAD_BUDGET_PER_FRAME MB(8)
+
+// Levels this size and smaller are always resident, they are what a texture starts with
+#define TEXTURE_RESIDENT_TAIL_SIZE 64
+#define TEXTURE_VRAM_BUDGET MB(256)
+// Textures not drawn for this many frames only need their tail
+#define TEXTURE_UNUSED_FRAMES 120
+#define TEXTURE_MAX_PENDING_UPLOADS 4
+
+namespace TextureStreamer
+{
+    /**
+     * A texture to read from its cooked file, or to decode and cook from its sources.
+     * With packChannels the first channel of every source is packed (missing sources take
+     * their constant), otherwise sources[0] is the image.
+     */
+    struct Request
+    {
+        u32         textureIdx;
+        TextureKind kind;
+        std::string cookedPath;
+        std::string sources[TEXTURE_STREAMER_MAX_SOURCES];
+        u8          constants[TEXTURE_STREAMER_MAX_SOURCES];
+        u32         sourceCount;
+        bool        packChannels;
+        GLuint      ownedPlaceholder; // Deleted once the texture is ready, 0 for the shared placeholders
+    };
+
+    /**
+     * A decoded texture, decode jobs push them to the completed stack for the GL thread.
+     */
+    struct Result
+    {
+        Request                      request;
+        TextureCooker::CookedTexture cooked;
+        std::vector<u8>              cookedData;  // Owns cooked.data when the cooked file could not be mapped back
+        MappedFile                   file;        // Owns cooked.data otherwise
+        u64                          contentHash; // Of the source bytes, the constants and the kind, 0 if a source could not be read
+        u64                          sourceSize;
+        Result*                      next;
+    };
+
+    /**
+     * A streamed texture. The GL texture only holds levels [residentLevel, levelCount) and is
+     * reallocated when that range changes, so what is not resident takes no VRAM at all.
+     * The whole cooked mip chain stays mapped to stream levels back in.
+     */
+    struct Residency
+    {
+        u32                          textureIdx;
+        TextureCooker::CookedTexture cooked;
+        std::vector<u8>              cookedData;
+        MappedFile                   file;
+        GLuint                       ownedPlaceholder;
+
+        u32  residentLevel; // Most detailed level in VRAM (once the pending upload is done), levelCount before the first one
+        u32  tailLevel;
+        u32  wantedLevel;   // Most detailed level asked for during lastUsedFrame
+        u64  lastUsedFrame;
+        bool uploading;
+        bool loaded;        // The texture replaced its placeholder
+    };
+
+    /**
+     * Levels [firstLevel, endLevel) of a residency going through the upload buffers into handle,
+     * a texture that holds levels [firstLevel, levelCount). The less detailed ones were copied already.
+     */
+    struct Upload
+    {
+        u32    residencyIdx;
+        GLuint handle;
+        u32    firstLevel;
+        u32    endLevel;
+        u32    level;
+        u32    blockRow;
+    };
+
+    struct UploadBuffer
+    {
+        GLuint pbo;
+        GLsync fence; // Signaled once the GPU consumed the last upload from pbo
+    };
+
+    struct Stats
+    {
+        u32 requested;
+        u32 completed;
+        u64 uploadedBytes;
+        u32 uploadStalls; // Frames that stopped early waiting for a pixel unpack buffer
+        u32 evictions;
+        f64 firstRequestTime;
+        f64 lastCompletionTime;
+    };
+
+    struct Streamer
+    {
+        JobSystem::TaskGroup     decodeJobs; // One job per request
+        std::atomic<bool>        quit;
+
+        std::atomic<Result*>     completed; // Lock-free stack, many jobs push, the GL thread takes all
+
+        // GL thread while the main thread waits for it (see UpdateRenderResources), main thread otherwise
+        std::vector<Residency>   residencies;
+        std::vector<u32>         residencyOfTexture; // UINT32_MAX for textures that are not streamed
+        std::deque<Upload>       uploads;
+
+        UploadBuffer             buffers[TEXTURE_UPLOAD_BUFFER_COUNT];
+        u32                      nextBuffer;
+
+        u64                      frame;
+        u64                      vramBudget;
+        u64                      residentBytes; // Streamed textures once the pending uploads are done
+
+        Stats                    stats;
+    };
+
+    /**
+     * Creates the upload buffers. Requests are decoded by jobs, see JobSystem.
+     */
+    Streamer* Create();
+
+    void Destroy(Streamer* streamer);
+
+    void Enqueue(Streamer* streamer, const Request& request);
+
+    /**
+     * Asks for enough detail on a texture for a surface where a pixel covers uvPerPixel UV
+     * units. Call for every texture drawn in a frame, the most detailed request wins.
+     */
+    void RequestDetail(Streamer* streamer, u32 textureIdx, f32 uvPerPixel);
+
+    /**
+     * Gets each decoded texture with its content hash and returns the texture that keeps its
+     * contents. When that is another one, the decoded texture is dropped.
+     */
+    typedef std::function<u32(u32 textureIdx, u64 contentHash, u64 sourceSize)> MergeFunction;
+
+    /**
+     * GL thread, once per frame. Turns the detail requests into residency changes, evicting the
+     * least recently used levels to stay within vramBudget, and uploads through the pixel unpack
+     * buffers until TEXTURE_UPLOAD_BUDGET_PER_FRAME bytes went out or every buffer is still in
+     * use by the GPU. A texture handle is swapped once all its new levels are in.
+     */
+    void Update(Streamer* streamer, std::vector<Texture>& textures, const MergeFunction& merge);
+
+    /**
+     * Requests not loaded yet.
+     */
+    u32 PendingCount(const Streamer* streamer);
+
+    /**
+     * VRAM taken by levels [level, levelCount) of a residency.
+     */
+    u64 ResidentSize(const Residency& residency, u32 level);
+}
+
+#endif // !TEXTURE_STREAMER_FUNC
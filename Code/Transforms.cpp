@@ -0,0 +1,345 @@
+#include "Transforms.h"
+#include "JobSystem.h"
+#include "platform.h"
+
+#include <chrono>
+#include <random>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#define TRANSFORMS_X64
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TRANSFORMS_AVX_FUNCTION
+#else
+#define TRANSFORMS_AVX_FUNCTION __attribute__((target("avx")))
+#endif
+#endif
+
+namespace Transforms
+{
+    namespace
+    {
+        const u32 BenchmarkSizes[TRANSFORM_BENCHMARK_SIZES] = { 1000, 10000, 100000, 1000000 };
+        // Matrices every kernel goes through per benchmark size, in as many runs as it takes
+        const u32 BenchmarkMatrices = 4000000;
+
+        f64 ElapsedMs(std::chrono::high_resolution_clock::time_point start)
+        {
+            return std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        glm::mat4 WorldMatrix(const vec3& position, const vec3& scale)
+        {
+            // translate(position) * scale(scale) without the two matrix products
+            glm::mat4 world(1.0f);
+            world[0][0] = scale.x;
+            world[1][1] = scale.y;
+            world[2][2] = scale.z;
+            world[3] = vec4(position, 1.0f);
+            return world;
+        }
+
+        glm::mat4& OutputAt(glm::mat4* out, u32 outStride, u32 index)
+        {
+            return *(glm::mat4*)((u8*)out + (u64)index * outStride);
+        }
+
+        void MarkDirty(Store& store, u32 index)
+        {
+            store.version++;
+            if (store.dirtySlots[index] == UINT32_MAX)
+            {
+                store.dirtySlots[index] = (u32)store.dirty.size();
+                store.dirty.push_back(index);
+            }
+        }
+
+        // Swap removes the entity from the dirty list, through its slot
+        void ClearDirty(Store& store, u32 index)
+        {
+            const u32 slot = store.dirtySlots[index];
+            const u32 moved = store.dirty.back();
+            store.dirty[slot] = moved;
+            store.dirtySlots[moved] = slot;
+            store.dirty.pop_back();
+            store.dirtySlots[index] = UINT32_MAX;
+        }
+
+        // Matrices of out that differ from reference by more than TRANSFORM_KERNEL_TOLERANCE
+        u32 CountMismatches(const std::vector<glm::mat4>& reference, const std::vector<glm::mat4>& out)
+        {
+            u32 mismatches = 0;
+            for (u32 i = 0; i < reference.size(); ++i)
+            {
+                for (u32 e = 0; e < 16; ++e)
+                {
+                    const f32 expected = (&reference[i][0][0])[e];
+                    const f32 actual = (&out[i][0][0])[e];
+                    if (glm::abs(actual - expected) > TRANSFORM_KERNEL_TOLERANCE * glm::max(1.0f, glm::abs(expected)))
+                    {
+                        mismatches++;
+                        break;
+                    }
+                }
+            }
+            return mismatches;
+        }
+
+        void KernelScalar(const glm::mat4& viewProjection, const glm::mat4* worlds, u32 count, glm::mat4* out, u32 outStride)
+        {
+            for (u32 i = 0; i < count; ++i)
+            {
+                OutputAt(out, outStride, i) = viewProjection * worlds[i];
+            }
+        }
+
+#ifdef TRANSFORMS_X64
+        // Every column of the result is the view projection columns weighted by the world column
+        void KernelSSE2(const glm::mat4& viewProjection, const glm::mat4* worlds, u32 count, glm::mat4* out, u32 outStride)
+        {
+            const __m128 c0 = _mm_loadu_ps(&viewProjection[0][0]);
+            const __m128 c1 = _mm_loadu_ps(&viewProjection[1][0]);
+            const __m128 c2 = _mm_loadu_ps(&viewProjection[2][0]);
+            const __m128 c3 = _mm_loadu_ps(&viewProjection[3][0]);
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                const f32* world = &worlds[i][0][0];
+                f32* result = &OutputAt(out, outStride, i)[0][0];
+                for (u32 column = 0; column < 4; ++column)
+                {
+                    const __m128 w = _mm_loadu_ps(world + column * 4);
+                    __m128 r = _mm_mul_ps(c0, _mm_shuffle_ps(w, w, _MM_SHUFFLE(0, 0, 0, 0)));
+                    r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_shuffle_ps(w, w, _MM_SHUFFLE(1, 1, 1, 1))));
+                    r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_shuffle_ps(w, w, _MM_SHUFFLE(2, 2, 2, 2))));
+                    r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_shuffle_ps(w, w, _MM_SHUFFLE(3, 3, 3, 3))));
+                    _mm_storeu_ps(result + column * 4, r);
+                }
+            }
+        }
+
+        // Same as KernelSSE2, two result columns at a time: each 128 bit lane holds one column
+        TRANSFORMS_AVX_FUNCTION
+        void KernelAVX(const glm::mat4& viewProjection, const glm::mat4* worlds, u32 count, glm::mat4* out, u32 outStride)
+        {
+            const __m256 c0 = _mm256_broadcast_ps((const __m128*)&viewProjection[0][0]);
+            const __m256 c1 = _mm256_broadcast_ps((const __m128*)&viewProjection[1][0]);
+            const __m256 c2 = _mm256_broadcast_ps((const __m128*)&viewProjection[2][0]);
+            const __m256 c3 = _mm256_broadcast_ps((const __m128*)&viewProjection[3][0]);
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                const f32* world = &worlds[i][0][0];
+                f32* result = &OutputAt(out, outStride, i)[0][0];
+
+                const __m256 w01 = _mm256_loadu_ps(world);
+                const __m256 w23 = _mm256_loadu_ps(world + 8);
+
+                __m256 r01 = _mm256_mul_ps(c0, _mm256_permute_ps(w01, 0x00));
+                __m256 r23 = _mm256_mul_ps(c0, _mm256_permute_ps(w23, 0x00));
+                r01 = _mm256_add_ps(r01, _mm256_mul_ps(c1, _mm256_permute_ps(w01, 0x55)));
+                r23 = _mm256_add_ps(r23, _mm256_mul_ps(c1, _mm256_permute_ps(w23, 0x55)));
+                r01 = _mm256_add_ps(r01, _mm256_mul_ps(c2, _mm256_permute_ps(w01, 0xAA)));
+                r23 = _mm256_add_ps(r23, _mm256_mul_ps(c2, _mm256_permute_ps(w23, 0xAA)));
+                r01 = _mm256_add_ps(r01, _mm256_mul_ps(c3, _mm256_permute_ps(w01, 0xFF)));
+                r23 = _mm256_add_ps(r23, _mm256_mul_ps(c3, _mm256_permute_ps(w23, 0xFF)));
+
+                _mm256_storeu_ps(result, r01);
+                _mm256_storeu_ps(result + 8, r23);
+            }
+        }
+
+        bool CPUHasAVX()
+        {
+#ifdef _MSC_VER
+            int info[4];
+            __cpuid(info, 1);
+            const bool osSavesYMM = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+            return osSavesYMM && (info[2] & (1 << 28)) != 0;
+#else
+            return __builtin_cpu_supports("avx");
+#endif
+        }
+#endif
+    }
+
+    u32 Add(Store& store, const vec3& position, const vec3& scale)
+    {
+        const u32 index = (u32)store.positions.size();
+        store.positions.push_back(position);
+        store.scales.push_back(scale);
+        store.worlds.push_back(glm::mat4(1.0f));
+        store.dirtySlots.push_back(UINT32_MAX);
+        MarkDirty(store, index);
+        return index;
+    }
+
+    void Remove(Store& store, u32 index)
+    {
+        const u32 last = (u32)store.positions.size() - 1;
+        store.version++;
+
+        // The last one leaves the dirty list, if it was in, and is back in it at its new index
+        const bool lastDirty = store.dirtySlots[last] != UINT32_MAX;
+        if (lastDirty)
+            ClearDirty(store, last);
+
+        store.positions[index] = store.positions[last];
+        store.scales[index] = store.scales[last];
+        store.worlds[index] = store.worlds[last];
+        store.positions.pop_back();
+        store.scales.pop_back();
+        store.worlds.pop_back();
+        store.dirtySlots.pop_back();
+
+        if (lastDirty && index != last)
+            MarkDirty(store, index);
+    }
+
+    void SetPosition(Store& store, u32 index, const vec3& position)
+    {
+        store.positions[index] = position;
+        MarkDirty(store, index);
+    }
+
+    void SetScale(Store& store, u32 index, const vec3& scale)
+    {
+        store.scales[index] = scale;
+        MarkDirty(store, index);
+    }
+
+    u32 UpdateWorlds(Store& store)
+    {
+        const u32 dirtyCount = (u32)store.dirty.size();
+        JobSystem::ParallelFor("Entity worlds", dirtyCount, TRANSFORM_JOB_GRAIN, [&store](u32 begin, u32 end)
+        {
+            for (u32 i = begin; i < end; ++i)
+            {
+                const u32 index = store.dirty[i];
+                store.worlds[index] = WorldMatrix(store.positions[index], store.scales[index]);
+                store.dirtySlots[index] = UINT32_MAX;
+            }
+        });
+        store.dirty.clear();
+        return dirtyCount;
+    }
+
+    Kernel BestKernel()
+    {
+#ifdef TRANSFORMS_X64
+        static const Kernel best = CPUHasAVX() ? KERNEL_AVX : KERNEL_SSE2;
+        return best;
+#else
+        return KERNEL_SCALAR;
+#endif
+    }
+
+    const char* KernelName(Kernel kernel)
+    {
+        static const char* names[KERNEL_COUNT] = { "Scalar", "SSE2", "AVX" };
+        return names[kernel];
+    }
+
+    void ComputeWorldViewProjections(Kernel kernel, const glm::mat4& viewProjection, const glm::mat4* worlds, u32 count,
+        glm::mat4* out, u32 outStride)
+    {
+        switch (kernel)
+        {
+#ifdef TRANSFORMS_X64
+        case KERNEL_AVX:
+            KernelAVX(viewProjection, worlds, count, out, outStride);
+            break;
+        case KERNEL_SSE2:
+            KernelSSE2(viewProjection, worlds, count, out, outStride);
+            break;
+#endif
+        default:
+            KernelScalar(viewProjection, worlds, count, out, outStride);
+        }
+    }
+
+    void ComputeWorldViewProjections(const glm::mat4& viewProjection, const glm::mat4* worlds, u32 count,
+        glm::mat4* out, u32 outStride)
+    {
+        const Kernel kernel = BestKernel();
+        JobSystem::ParallelFor("Entity world view projections", count, TRANSFORM_JOB_GRAIN, [&](u32 begin, u32 end)
+        {
+            ComputeWorldViewProjections(kernel, viewProjection, worlds + begin, end - begin, &OutputAt(out, outStride, begin), outStride);
+        });
+    }
+
+    void Benchmark(BenchmarkResult results[TRANSFORM_BENCHMARK_SIZES])
+    {
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<f32> position(-100.0f, 100.0f);
+        std::uniform_real_distribution<f32> scale(0.1f, 2.0f);
+
+        const glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f) *
+            glm::lookAt(vec3(0.0f, 10.0f, 50.0f), vec3(0.0f), vec3(0.0f, 1.0f, 0.0f));
+
+        for (u32 s = 0; s < TRANSFORM_BENCHMARK_SIZES; ++s)
+        {
+            const u32 entityCount = BenchmarkSizes[s];
+            const u32 runs = glm::max(BenchmarkMatrices / entityCount, 1u);
+
+            BenchmarkResult& result = results[s];
+            result = {};
+            result.entityCount = entityCount;
+
+            Store store;
+            for (u32 i = 0; i < entityCount; ++i)
+            {
+                Add(store, vec3(position(rng), position(rng), position(rng)), vec3(scale(rng)));
+            }
+
+            auto start = std::chrono::high_resolution_clock::now();
+            UpdateWorlds(store);
+            result.worldsMs = ElapsedMs(start);
+
+            for (u32 i = 0; i < entityCount; i += 10)
+            {
+                SetPosition(store, i, store.positions[i] + vec3(1.0f));
+            }
+            start = std::chrono::high_resolution_clock::now();
+            UpdateWorlds(store);
+            result.dirtyWorldsMs = ElapsedMs(start);
+
+            std::vector<glm::mat4> worldViewProjections(entityCount);
+            const u32 stride = sizeof(glm::mat4);
+
+            start = std::chrono::high_resolution_clock::now();
+            for (u32 run = 0; run < runs; ++run)
+                ComputeWorldViewProjections(KERNEL_SCALAR, viewProjection, store.worlds.data(), entityCount, worldViewProjections.data(), stride);
+            result.scalarMs = ElapsedMs(start) / runs;
+
+            start = std::chrono::high_resolution_clock::now();
+            for (u32 run = 0; run < runs; ++run)
+                ComputeWorldViewProjections(BestKernel(), viewProjection, store.worlds.data(), entityCount, worldViewProjections.data(), stride);
+            result.simdMs = ElapsedMs(start) / runs;
+
+            start = std::chrono::high_resolution_clock::now();
+            for (u32 run = 0; run < runs; ++run)
+                ComputeWorldViewProjections(viewProjection, store.worlds.data(), entityCount, worldViewProjections.data(), stride);
+            result.parallelMs = ElapsedMs(start) / runs;
+
+            // Every kernel up to the best one, then the parallel path, against the scalar output
+            std::vector<glm::mat4> reference(entityCount);
+            ComputeWorldViewProjections(KERNEL_SCALAR, viewProjection, store.worlds.data(), entityCount, reference.data(), stride);
+            for (u32 k = KERNEL_SCALAR + 1; k <= BestKernel(); ++k)
+            {
+                ComputeWorldViewProjections((Kernel)k, viewProjection, store.worlds.data(), entityCount, worldViewProjections.data(), stride);
+                const u32 mismatches = CountMismatches(reference, worldViewProjections);
+                if (mismatches > 0)
+                    ELOG("Transform benchmark: %u of %u %s world view projections differ from the scalar ones", mismatches, entityCount, KernelName((Kernel)k));
+                result.mismatches += mismatches;
+            }
+
+            ComputeWorldViewProjections(viewProjection, store.worlds.data(), entityCount, worldViewProjections.data(), stride);
+            const u32 mismatches = CountMismatches(reference, worldViewProjections);
+            if (mismatches > 0)
+                ELOG("Transform benchmark: %u of %u parallel world view projections differ from the scalar ones", mismatches, entityCount);
+            result.mismatches += mismatches;
+        }
+    }
+}
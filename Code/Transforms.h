@@ -0,0 +1,97 @@
+#ifndef TRANSFORMS_FUNC
+#define TRANSFORMS_FUNC
+
+#include "Globals.h"
+
+// Entities a world matrix or world view projection job covers
+#define TRANSFORM_JOB_GRAIN 1024
+// Entity counts the benchmark runs with, 1k to 1M
+#define TRANSFORM_BENCHMARK_SIZES 4
+// Largest difference from the scalar world view projections, relative to the element, a SIMD kernel may have
+#define TRANSFORM_KERNEL_TOLERANCE 1e-5f
+
+namespace Transforms
+{
+    /**
+     * Position and scale of every entity, stored by field, and the world matrices built from them.
+     * Setting a field marks the entity dirty, its world matrix is rebuilt by the next UpdateWorlds.
+     */
+    struct Store
+    {
+        std::vector<vec3>      positions;
+        std::vector<vec3>      scales;
+        std::vector<glm::mat4> worlds;     // Up to date for the entities not in dirty
+        std::vector<u32>       dirtySlots; // Index of the entity in dirty, UINT32_MAX while it is not in it
+        std::vector<u32>       dirty;      // Entities whose world matrix is out of date
+        u32                    version = 0; // Bumped by every change, tells when the worlds need uploading again
+    };
+
+    enum Kernel
+    {
+        KERNEL_SCALAR,
+        KERNEL_SSE2,
+        KERNEL_AVX,
+        KERNEL_COUNT
+    };
+
+    struct BenchmarkResult
+    {
+        u32 entityCount;
+        f64 worldsMs;         // Rebuilding every world matrix
+        f64 dirtyWorldsMs;    // Rebuilding the world matrices of one entity in ten
+        f64 scalarMs;         // World view projections one matrix at a time with glm, on one thread
+        f64 simdMs;           // Same with the best kernel, on one thread
+        f64 parallelMs;       // Same with the best kernel, on every job thread
+        u32 mismatches;       // Matrices of the SIMD kernels or the parallel path that differ from the scalar ones
+    };
+
+    /**
+     * Returns the index of the new entity transform, dirty until the next UpdateWorlds.
+     */
+    u32 Add(Store& store, const vec3& position, const vec3& scale);
+
+    /**
+     * Moves the last entity transform to index, as the entity component sets do.
+     */
+    void Remove(Store& store, u32 index);
+
+    void SetPosition(Store& store, u32 index, const vec3& position);
+
+    void SetScale(Store& store, u32 index, const vec3& scale);
+
+    /**
+     * Rebuilds the world matrices of the dirty entities, in parallel when there are many.
+     * Returns how many were rebuilt.
+     */
+    u32 UpdateWorlds(Store& store);
+
+    /**
+     * The best kernel the CPU runs, AVX is checked for at run time.
+     */
+    Kernel BestKernel();
+
+    const char* KernelName(Kernel kernel);
+
+    /**
+     * out[i] = viewProjection * worlds[i] for count matrices, with the given kernel on the calling
+     * thread. out is outStride bytes from one matrix to the next, so the results may go straight
+     * into an array of structs.
+     */
+    void ComputeWorldViewProjections(Kernel kernel, const glm::mat4& viewProjection, const glm::mat4* worlds, u32 count,
+        glm::mat4* out, u32 outStride);
+
+    /**
+     * Same as above with the best kernel, split across the job threads.
+     */
+    void ComputeWorldViewProjections(const glm::mat4& viewProjection, const glm::mat4* worlds, u32 count,
+        glm::mat4* out, u32 outStride);
+
+    /**
+     * Times the world matrices and world view projections of random entities,
+     * for 1k, 10k, 100k and 1M entities. The output of every SIMD kernel the CPU runs and of the
+     * parallel path is checked against the scalar one within TRANSFORM_KERNEL_TOLERANCE.
+     */
+    void Benchmark(BenchmarkResult results[TRANSFORM_BENCHMARK_SIZES]);
+}
+
+#endif // !TRANSFORMS_FUNC
@@ -0,0 +1,184 @@
+#include "VertexFormat.h"
+#include <glm/gtc/packing.hpp>
+
+namespace VertexFormat
+{
+    namespace
+    {
+        // Locations of the float tangent space written by ProcessAssimpMesh
+        const u8 FloatTangentLocation = 3;
+        const u8 FloatBitangentLocation = 4;
+
+        const VertexBufferAttribute* FindAttribute(const VertexBufferLayout& layout, u8 location)
+        {
+            for (const VertexBufferAttribute& attribute : layout.attributes)
+            {
+                if (attribute.location == location)
+                    return &attribute;
+            }
+            return nullptr;
+        }
+
+        vec3 ReadVec3(const float* vertex, const VertexBufferAttribute& attribute)
+        {
+            return glm::make_vec3(vertex + attribute.offset / sizeof(float));
+        }
+
+        vec2 SignNotZero(vec2 v)
+        {
+            return vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+        }
+
+        void PushAttribute(VertexBufferLayout& layout, u8 location, u8 componentCount, GLenum type, GLboolean normalized)
+        {
+            VertexBufferAttribute attribute = { location, componentCount, layout.stride, type, normalized };
+            layout.attributes.push_back(attribute);
+            layout.stride += AttributeSize(attribute);
+        }
+    }
+
+    u32 ComponentSize(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE: return 1;
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+        case GL_HALF_FLOAT: return 2;
+        default: return 4;
+        }
+    }
+
+    u32 AttributeSize(const VertexBufferAttribute& attribute)
+    {
+        // Packed formats hold all their components in a single 32 bit word
+        if (attribute.type == GL_INT_2_10_10_10_REV || attribute.type == GL_UNSIGNED_INT_2_10_10_10_REV)
+            return sizeof(u32);
+
+        return attribute.componentCount * ComponentSize(attribute.type);
+    }
+
+    vec2 OctahedralEncode(vec3 normal)
+    {
+        normal /= glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+        vec2 encoded(normal.x, normal.y);
+        if (normal.z < 0.0f)
+        {
+            encoded = (1.0f - glm::abs(vec2(encoded.y, encoded.x))) * SignNotZero(encoded);
+        }
+        return encoded;
+    }
+
+    glm::quat EncodeTangentFrame(vec3 normal, vec3 tangent, vec3 bitangent)
+    {
+        normal = glm::normalize(normal);
+
+        // Gram-Schmidt, falling back to any tangent perpendicular to the normal
+        tangent = tangent - normal * glm::dot(normal, tangent);
+        if (glm::dot(tangent, tangent) < 1e-12f)
+        {
+            tangent = glm::abs(normal.x) < 0.9f ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f);
+            tangent = tangent - normal * glm::dot(normal, tangent);
+        }
+        tangent = glm::normalize(tangent);
+
+        const vec3 rightHandedBitangent = glm::cross(normal, tangent);
+        const bool flipBitangent = glm::dot(rightHandedBitangent, bitangent) < 0.0f;
+
+        glm::quat frame = glm::normalize(glm::quat_cast(glm::mat3(tangent, rightHandedBitangent, normal)));
+        if (frame.w < 0.0f)
+        {
+            frame = -frame;
+        }
+
+        // Keep w away from zero so its sign survives snorm16 quantization
+        const f32 minW = 1.0f / 32767.0f;
+        if (frame.w < minW)
+        {
+            const f32 scale = glm::sqrt(1.0f - minW * minW);
+            frame = glm::quat(minW, frame.x * scale, frame.y * scale, frame.z * scale);
+        }
+
+        return flipBitangent ? -frame : frame;
+    }
+
+    void Compress(const std::vector<float>& vertices, const VertexBufferLayout& floatLayout, const AABB& bounds,
+        VertexStream outStreams[VERTEX_STREAM_COUNT])
+    {
+        const u32 floatStride = floatLayout.stride / sizeof(float);
+        const u32 vertexCount = vertices.size() / floatStride;
+
+        const VertexBufferAttribute* position = FindAttribute(floatLayout, ATTRIBUTE_POSITION);
+        const VertexBufferAttribute* normal = FindAttribute(floatLayout, ATTRIBUTE_NORMAL);
+        const VertexBufferAttribute* texCoord = FindAttribute(floatLayout, ATTRIBUTE_TEXCOORD);
+        const VertexBufferAttribute* tangent = FindAttribute(floatLayout, FloatTangentLocation);
+        const VertexBufferAttribute* bitangent = FindAttribute(floatLayout, FloatBitangentLocation);
+
+        // Unorm16 texture coordinates are more precise than halves, but only cover [0, 1]
+        bool texCoordsInUnitRange = true;
+        if (texCoord)
+        {
+            for (u32 v = 0; v < vertexCount; ++v)
+            {
+                const float* uv = &vertices[v * floatStride + texCoord->offset / sizeof(float)];
+                texCoordsInUnitRange &= uv[0] >= 0.0f && uv[0] <= 1.0f && uv[1] >= 0.0f && uv[1] <= 1.0f;
+            }
+        }
+
+        VertexStream& positionStream = outStreams[VERTEX_STREAM_POSITION];
+        positionStream.layout = {};
+        PushAttribute(positionStream.layout, ATTRIBUTE_POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE);
+
+        VertexStream& attributeStream = outStreams[VERTEX_STREAM_ATTRIBUTES];
+        attributeStream.layout = {};
+        PushAttribute(attributeStream.layout, ATTRIBUTE_NORMAL, 2, GL_SHORT, GL_TRUE);
+        if (texCoord)
+        {
+            PushAttribute(attributeStream.layout, ATTRIBUTE_TEXCOORD, 2, texCoordsInUnitRange ? GL_UNSIGNED_SHORT : GL_HALF_FLOAT, texCoordsInUnitRange ? GL_TRUE : GL_FALSE);
+        }
+        if (tangent && bitangent)
+        {
+            PushAttribute(attributeStream.layout, ATTRIBUTE_TANGENT_FRAME, 4, GL_SHORT, GL_TRUE);
+        }
+
+        const vec3 extent = bounds.max - bounds.min;
+        const vec3 invExtent = vec3(extent.x > 0.0f ? 1.0f / extent.x : 0.0f,
+            extent.y > 0.0f ? 1.0f / extent.y : 0.0f,
+            extent.z > 0.0f ? 1.0f / extent.z : 0.0f);
+
+        positionStream.data.resize(vertexCount * positionStream.layout.stride);
+        attributeStream.data.resize(vertexCount * attributeStream.layout.stride);
+        for (u32 v = 0; v < vertexCount; ++v)
+        {
+            const float* vertex = &vertices[v * floatStride];
+
+            const vec3 p = (ReadVec3(vertex, *position) - bounds.min) * invExtent;
+            const u64 packedPosition = glm::packUnorm4x16(vec4(p, 1.0f));
+            memcpy(&positionStream.data[v * positionStream.layout.stride], &packedPosition, sizeof(packedPosition));
+
+            u8* out = &attributeStream.data[v * attributeStream.layout.stride];
+
+            const vec3 n = glm::normalize(ReadVec3(vertex, *normal));
+            const u32 packedNormal = glm::packSnorm2x16(OctahedralEncode(n));
+            memcpy(out, &packedNormal, sizeof(packedNormal));
+            out += sizeof(packedNormal);
+
+            if (texCoord)
+            {
+                const vec2 uv = glm::make_vec2(vertex + texCoord->offset / sizeof(float));
+                const u32 packedTexCoord = texCoordsInUnitRange ? glm::packUnorm2x16(uv) : glm::packHalf2x16(uv);
+                memcpy(out, &packedTexCoord, sizeof(packedTexCoord));
+                out += sizeof(packedTexCoord);
+            }
+
+            if (tangent && bitangent)
+            {
+                const glm::quat frame = EncodeTangentFrame(n, ReadVec3(vertex, *tangent), ReadVec3(vertex, *bitangent));
+                const u64 packedFrame = glm::packSnorm4x16(vec4(frame.x, frame.y, frame.z, frame.w));
+                memcpy(out, &packedFrame, sizeof(packedFrame));
+                out += sizeof(packedFrame);
+            }
+        }
+    }
+}
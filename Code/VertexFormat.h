@@ -0,0 +1,43 @@
+#ifndef VERTEX_FORMAT_FUNC
+#define VERTEX_FORMAT_FUNC
+
+#include "Globals.h"
+#include <glm/gtc/quaternion.hpp>
+
+// Attribute locations shared by the import pipeline and the mesh shaders
+#define ATTRIBUTE_POSITION      0
+#define ATTRIBUTE_NORMAL        1
+#define ATTRIBUTE_TEXCOORD      2
+#define ATTRIBUTE_TANGENT_FRAME 3
+#define ATTRIBUTE_INSTANCE_INDEX 4 // Per instance, not in the meshes: index into the instance data of the shaders
+
+namespace VertexFormat
+{
+    u32 ComponentSize(GLenum type);
+
+    /**
+     * Size in bytes of one attribute of the given layout.
+     */
+    u32 AttributeSize(const VertexBufferAttribute& attribute);
+
+    vec2 OctahedralEncode(vec3 normal);
+
+    /**
+     * Builds the rotation taking the tangent space basis to (tangent, bitangent, normal).
+     * q and -q are the same rotation, so the sign of w is free to store the handedness
+     * of the original bitangent: w < 0 means the bitangent has to be flipped.
+     */
+    glm::quat EncodeTangentFrame(vec3 normal, vec3 tangent, vec3 bitangent);
+
+    /**
+     * Converts the float vertices laid out as floatLayout into the compressed streams:
+     * - position stream:  4 x unorm16 quantized against bounds
+     * - attribute stream: normal as 2 x snorm16 octahedral,
+     *                     texcoord as 2 x unorm16 when inside [0, 1], 2 x half otherwise,
+     *                     TBN as 4 x snorm16 quaternion with the handedness in the sign of w
+     */
+    void Compress(const std::vector<float>& vertices, const VertexBufferLayout& floatLayout, const AABB& bounds,
+        VertexStream outStreams[VERTEX_STREAM_COUNT]);
+}
+
+#endif // !VERTEX_FORMAT_FUNC
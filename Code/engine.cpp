@@ -7,14 +7,27 @@
 
 #include "engine.h"
 #include <imgui.h>
+#include <algorithm>
 //#include <stb_image.h>
 //#include <stb_image_write.h>
 //#include "Globals.h"
 #include "ModelLoaderFuncs.h"
+#include "RenderThread.h"
 
 #define MIPMAP_BASE_LEVEL 0
 #define MIPMAP_MAX_LEVEL 4
 
+// Entities per job when their transforms and bounds are updated
+#define ENTITY_JOB_GRAIN 256
+
+// Radiance below this value is considered to not affect a surface anymore
+#define LIGHT_ATTENUATION_CUTOFF 0.01f
+// Point light falloff of the non PBR lighting, 1 / (1 + linear * d + quadratic * d^2)
+#define BASIC_LIGHT_LINEAR 0.09f
+#define BASIC_LIGHT_QUADRATIC 0.032f
+// Ambient, diffuse and specular strength of the non PBR lighting added up, at most what a point light gives before the falloff
+#define BASIC_LIGHT_PEAK (0.2f + 1.0f + 0.1f)
+
 GLuint CreateProgramFromSource(String programSource, const char* shaderName)
 {
 	GLchar  infoLogBuffer[1024] = {};
@@ -103,6 +116,7 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
 	program.filepath = filepath;
 	program.programName = programName;
 	program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+	ShaderLayouts::CheckProgram(program.handle, programName);
 
 	GLint attributeCount = 0;
 	glGetProgramiv(program.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
@@ -129,20 +143,92 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
 	return app->programs.size() - 1;
 }
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
+GLuint CreateComputeProgramFromSource(String programSource, const char* shaderName)
 {
-	GLuint ReturnValue = 0;
+	GLchar  infoLogBuffer[1024] = {};
+	GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+	GLsizei infoLogSize;
+	GLint   success;
 
-	SubMesh& Submesh = mesh.submeshes[submeshIndex];
+	char versionString[] = "#version 430\n";
+	char shaderNameDefine[128];
+	sprintf(shaderNameDefine, "#define %s\n", shaderName);
+	char computeShaderDefine[] = "#define COMPUTE\n";
+
+	const GLchar* computeShaderSource[] = {
+		versionString,
+		shaderNameDefine,
+		computeShaderDefine,
+		programSource.str
+	};
+	const GLint computeShaderLengths[] = {
+		(GLint)strlen(versionString),
+		(GLint)strlen(shaderNameDefine),
+		(GLint)strlen(computeShaderDefine),
+		(GLint)programSource.len
+	};
+
+	GLuint cshader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(cshader, ARRAY_COUNT(computeShaderSource), computeShaderSource, computeShaderLengths);
+	glCompileShader(cshader);
+	glGetShaderiv(cshader, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(cshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+		ELOG("glCompileShader() failed with compute shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+	}
+
+	GLuint programHandle = glCreateProgram();
+	glAttachShader(programHandle, cshader);
+	glLinkProgram(programHandle);
+	glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+		ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+	}
+
+	glDetachShader(programHandle, cshader);
+	glDeleteShader(cshader);
+
+	return programHandle;
+}
+
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName)
+{
+	String programSource = ReadTextFile(filepath);
+
+	Program program = {};
+	program.handle = CreateComputeProgramFromSource(programSource, programName);
+	program.filepath = filepath;
+	program.programName = programName;
+	program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+	ShaderLayouts::CheckProgram(program.handle, programName);
+
+	app->programs.push_back(program);
+
+	return app->programs.size() - 1;
+}
+
+// The VAO of the submesh for the program, 0 when FindVAO did not create it yet. Makes no GL calls.
+GLuint LookupVAO(const Mesh& mesh, u32 submeshIndex, GLuint programHandle)
+{
+	const SubMesh& Submesh = mesh.submeshes[submeshIndex];
 	for (u32 i = 0; i < (u32)Submesh.vaos.size(); ++i)
 	{
-		if (Submesh.vaos[i].programHandle == program.handle)
+		if (Submesh.vaos[i].programHandle == programHandle)
 		{
-			ReturnValue = Submesh.vaos[i].handle;
-			break;
+			return Submesh.vaos[i].handle;
 		}
 	}
+	return 0;
+}
 
+GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program, GLuint instanceIndexBuffer)
+{
+	GLuint ReturnValue = LookupVAO(mesh, submeshIndex, program.handle);
+
+	SubMesh& Submesh = mesh.submeshes[submeshIndex];
 	if (ReturnValue == 0)
 	{
 		glGenVertexArrays(1, &ReturnValue);
@@ -151,29 +237,50 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
 		glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
 
+		// Only the streams holding attributes the program reads end up bound,
+		// so position only programs never touch the attribute stream
 		auto& ShaderLayout = program.shaderLayout.attributes;
 		for (auto ShaderIt = ShaderLayout.cbegin(); ShaderIt != ShaderLayout.cend(); ++ShaderIt)
 		{
+			// One index per instance, a draw starts reading it at its base instance
+			if (ShaderIt->location == ATTRIBUTE_INSTANCE_INDEX)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, instanceIndexBuffer);
+				glVertexAttribIPointer(ATTRIBUTE_INSTANCE_INDEX, 1, GL_UNSIGNED_INT, sizeof(u32), (void*)0);
+				glVertexAttribDivisor(ATTRIBUTE_INSTANCE_INDEX, 1);
+				glEnableVertexAttribArray(ATTRIBUTE_INSTANCE_INDEX);
+				glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
+				continue;
+			}
+
 			bool attributeWasLinked = false;
-			auto SubmeshLayout = Submesh.vertexBufferLayout.attributes;
-			for (auto SubmeshIt = SubmeshLayout.cbegin(); SubmeshIt != SubmeshLayout.cend(); ++SubmeshIt)
+			for (u32 stream = 0; stream < VERTEX_STREAM_COUNT && !attributeWasLinked; ++stream)
 			{
-				if (ShaderIt->location == SubmeshIt->location)
+				const VertexStream& SubmeshStream = Submesh.streams[stream];
+				auto& SubmeshLayout = SubmeshStream.layout.attributes;
+				for (auto SubmeshIt = SubmeshLayout.cbegin(); SubmeshIt != SubmeshLayout.cend(); ++SubmeshIt)
 				{
-					const u32 index = SubmeshIt->location;
-					const u32 ncomp = SubmeshIt->componentCount;
-					const u32 offset = SubmeshIt->offset + Submesh.vertexOffset;
-					const u32 stride = Submesh.vertexBufferLayout.stride;
-
-					glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)(offset));
-					glEnableVertexAttribArray(index);
-
-					attributeWasLinked = true;
-					break;
+					if (ShaderIt->location == SubmeshIt->location)
+					{
+						const u32 index = SubmeshIt->location;
+						const u32 ncomp = SubmeshIt->componentCount;
+						const u32 offset = SubmeshIt->offset + SubmeshStream.offset;
+						const u32 stride = SubmeshStream.layout.stride;
+
+						glVertexAttribPointer(index, ncomp, SubmeshIt->type, SubmeshIt->normalized, stride, (void*)(u64)(offset));
+						glEnableVertexAttribArray(index);
+
+						attributeWasLinked = true;
+						break;
+					}
 				}
 			}
 
-			assert(attributeWasLinked);
+			// Attributes the submesh does not provide (e.g. no tangent frame) read the generic value
+			if (!attributeWasLinked)
+			{
+				glDisableVertexAttribArray(ShaderIt->location);
+			}
 		}
 		glBindVertexArray(0);
 
@@ -184,11 +291,108 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
 	return ReturnValue;
 }
 
-glm::mat4 TransformPositionScale(const vec3& position, const vec3& scaleFactors)
+// Uniforms of a geometry program, located on the GL thread before recording
+struct GeometryUniforms
+{
+	bool  depthOnly; // Positions only, no material
+	GLint texture;
+	GLint normal;
+	GLint orm;
+	GLint emissive;
+	GLint useNormalTexture;
+	GLint useEmissive;
+	GLint usePBR;
+	GLint positionMin;
+	GLint positionExtent;
+	GLint drawIndex; // Visibility ids, from App::visibilityDrawBase
+};
+
+// Unfiltered texture to render into, size pixels
+GLuint CreateRenderTarget(ivec2 size, GLenum internalFormat, GLenum format, GLenum dataType)
+{
+	GLuint texturehandle = 0;
+	glGenTextures(1, &texturehandle);
+	glBindTexture(GL_TEXTURE_2D, texturehandle);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size.x, size.y, 0, format, dataType, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texturehandle;
+}
+
+// Entry of the entity in the instance buffer, the static entities come first
+u32 InstanceIndex(const App* app, const Renderable& renderable)
 {
-	glm::mat4 toReturn = glm::translate(position);
-	toReturn = glm::scale(toReturn, scaleFactors);
-	return toReturn;
+	return renderable.mobility == Entities::MOBILITY_STATIC ? renderable.transformIndex : app->staticInstanceCount + renderable.transformIndex;
+}
+
+// Any thread. Records the draws of the visible entities in [begin, end), the VAOs must exist already.
+void RecordGeometry(const App* app, const FramePacket& packet, const Program& program, const GeometryUniforms& uniforms,
+	u32 begin, u32 end, CommandList::List& list)
+{
+	CommandList::BindProgram(list, program.handle);
+	CommandList::BindBufferRange(list, GL_UNIFORM_BUFFER, BINDING(0), app->localUniformBuffer.handle, 0, app->frameParamsSize);
+	CommandList::BindBufferRange(list, GL_UNIFORM_BUFFER, BINDING(2), app->lightUniformBuffer.handle, 0, app->lightParamsSize);
+	CommandList::BindBufferRange(list, GL_SHADER_STORAGE_BUFFER, BINDING(1), app->instanceBuffer.handle, 0, app->instanceBuffer.size);
+	if (!uniforms.depthOnly)
+	{
+		CommandList::Uniform1i(list, uniforms.texture, 0);
+		CommandList::Uniform1i(list, uniforms.normal, 1);
+		CommandList::Uniform1i(list, uniforms.orm, 2);
+		CommandList::Uniform1i(list, uniforms.emissive, 5);
+		CommandList::Uniform1i(list, uniforms.usePBR, packet.pbr);
+	}
+
+	for (u32 v = begin; v < end; ++v)
+	{
+		const Renderable& renderable = packet.renderables[packet.visibleEntities[v]];
+		// The draws read the world matrix of the entity from the instance buffer, through the base instance
+		const u32 instanceIndex = InstanceIndex(app, renderable);
+
+		const Model& model = app->models[renderable.modelIndex];
+		const Mesh& mesh = app->meshes[model.meshIdx];
+
+		// Entities that did not fit in the draw table of the visibility buffer are left out
+		const u32 drawBase = uniforms.drawIndex != -1 ? app->visibilityDrawBase[v] : 0;
+		if (drawBase == UINT32_MAX)
+			continue;
+
+		for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+		{
+			CommandList::BindVertexArray(list, LookupVAO(mesh, i, program.handle));
+			if (uniforms.drawIndex != -1)
+				CommandList::Uniform1i(list, uniforms.drawIndex, drawBase + i);
+
+			if (!uniforms.depthOnly)
+			{
+				const Material& subMeshMaterial = app->materials[model.materialIdx[i]];
+
+				// Albedo
+				CommandList::BindTexture(list, 0, GL_TEXTURE_2D, app->textures[subMeshMaterial.albedoTextureIdx].handle);
+
+				// Normal
+				CommandList::Uniform1i(list, uniforms.useNormalTexture, subMeshMaterial.bumpTextureIdx != 0 ? 1 : 0);
+				CommandList::BindTexture(list, 1, GL_TEXTURE_2D, app->textures[subMeshMaterial.bumpTextureIdx].handle);
+
+				// Occlusion, roughness and metallic packed in one texture
+				CommandList::BindTexture(list, 2, GL_TEXTURE_2D, app->textures[subMeshMaterial.ormTextureIdx].handle);
+
+				// Turn On/Off emissive
+				CommandList::Uniform1i(list, uniforms.useEmissive, subMeshMaterial.emissiveTextureIdx != 0 ? 1 : 0);
+				CommandList::BindTexture(list, 5, GL_TEXTURE_2D, app->textures[subMeshMaterial.emissiveTextureIdx].handle);
+			}
+
+			// Positions are quantized against the submesh bounds
+			const SubMesh& submesh = mesh.submeshes[i];
+			CommandList::Uniform3f(list, uniforms.positionMin, submesh.bounds.min);
+			CommandList::Uniform3f(list, uniforms.positionExtent, submesh.bounds.max - submesh.bounds.min);
+
+			CommandList::DrawElementsInstanced(list, GL_TRIANGLES, submesh.indexCount, submesh.indexType, submesh.indexOffset, 1, instanceIndex);
+		}
+	}
 }
 
 glm::mat4 TranformScale(const vec3& scaleFactors)
@@ -196,15 +400,223 @@ glm::mat4 TranformScale(const vec3& scaleFactors)
 	return glm::scale(scaleFactors);
 }
 
+EntityHandle CreateEntity(App* app, const vec3& position, const vec3& scale, u32 modelIndex, Entities::Mobility mobility = Entities::MOBILITY_STATIC)
+{
+	const EntityHandle entity = Entities::Create(app->entities);
+	Entities::AddTransform(app->entities, entity, position, scale, mobility);
+	Entities::AddRender(app->entities, entity, modelIndex);
+	return entity;
+}
+
+// World bounds of a render component, its entity has a transform
+AABB EntityWorldBounds(App* app, u32 renderIdx)
+{
+	const Entities::Registry& registry = app->entities;
+	const Mesh& mesh = app->meshes[app->models[registry.renders[renderIdx].modelIndex].meshIdx];
+	Entities::Mobility mobility;
+	const u32 transformIdx = Entities::TransformOfOwner(registry, registry.renderSet, renderIdx, &mobility);
+	const vec3& position = registry.transforms[mobility].positions[transformIdx];
+	const vec3& scale = registry.transforms[mobility].scales[transformIdx];
+
+	// A negative scale mirrors the mesh, so the scaled corners swap per axis
+	const vec3 a = position + mesh.bounds.min * scale;
+	const vec3 b = position + mesh.bounds.max * scale;
+
+	AABB bounds;
+	bounds.min = glm::min(a, b);
+	bounds.max = glm::max(a, b);
+	return bounds;
+}
+
+// Distance past which a point light gives less than LIGHT_ATTENUATION_CUTOFF, with the falloff of the lighting in use
+float LightInfluenceRadius(const Light& light, bool pbr)
+{
+	const float maxComponent = glm::max(light.color.r, glm::max(light.color.g, light.color.b));
+	if (pbr)
+	{
+		// Inverse square falloff, so solve intensity * color / d^2 = cutoff
+		return sqrt(light.intensity * maxComponent / LIGHT_ATTENUATION_CUTOFF);
+	}
+
+	// The shaders scale by intensity / 2, so solve peak * intensity / 2 * color / (1 + linear * d + quadratic * d^2) = cutoff
+	const float falloff = BASIC_LIGHT_PEAK * light.intensity * 0.5f * maxComponent / LIGHT_ATTENUATION_CUTOFF;
+	if (falloff <= 1.0f)
+		return 0.0f;
+	return (-BASIC_LIGHT_LINEAR + sqrt(BASIC_LIGHT_LINEAR * BASIC_LIGHT_LINEAR + 4.0f * BASIC_LIGHT_QUADRATIC * (falloff - 1.0f))) / (2.0f * BASIC_LIGHT_QUADRATIC);
+}
+
+void UpdateSceneBVH(App* app)
+{
+	// The world bounds are computed in parallel, the tree is updated on this thread.
+	// Items are render components, their dense index changes when one is removed.
+	std::vector<AABB> bounds(app->entities.renders.size());
+	JobSystem::ParallelFor("Entity bounds", bounds.size(), ENTITY_JOB_GRAIN, [&](u32 begin, u32 end)
+	{
+		for (u32 i = begin; i < end; ++i)
+		{
+			bounds[i] = EntityWorldBounds(app, i);
+		}
+	});
+
+	if (app->sceneBVH.itemBounds.size() != bounds.size())
+	{
+		BVH::Build(app->sceneBVH, bounds);
+		return;
+	}
+
+	for (u32 i = 0; i < bounds.size(); ++i)
+	{
+		BVH::UpdateItem(app->sceneBVH, i, bounds[i]);
+	}
+	BVH::Maintain(app->sceneBVH);
+}
+
+void UpdateLightProxies(App* app)
+{
+	Entities::Registry& registry = app->entities;
+	for (u32 i = 0; i < registry.lightProxies.size(); ++i)
+	{
+		Entities::Mobility mobility;
+		const u32 transformIdx = Entities::TransformOfOwner(registry, registry.lightProxySet, i, &mobility);
+		const vec3& lightPosition = app->lights[registry.lightProxies[i].lightIndex].position;
+		if (transformIdx != UINT32_MAX && registry.transforms[mobility].positions[transformIdx] != lightPosition)
+		{
+			Transforms::SetPosition(registry.transforms[mobility], transformIdx, lightPosition);
+		}
+	}
+}
+
+void SelectLight(App* app, i32 lightIndex)
+{
+	app->selectedLight = lightIndex;
+	for (int i = 0; i < app->lights.size(); ++i)
+	{
+		app->lights[i].selected = (i == lightIndex);
+	}
+}
+
+void PickEntity(App* app)
+{
+	// Unproject the mouse position onto the near and far planes
+	const vec2 ndc(2.0f * app->input.mousePos.x / app->displaySize.x - 1.0f,
+		1.0f - 2.0f * app->input.mousePos.y / app->displaySize.y);
+	const glm::mat4 invViewProjection = glm::inverse(app->cam.projection * app->cam.view);
+	vec4 nearPoint = invViewProjection * vec4(ndc, -1.0f, 1.0f);
+	vec4 farPoint = invViewProjection * vec4(ndc, 1.0f, 1.0f);
+	nearPoint /= nearPoint.w;
+	farPoint /= farPoint.w;
+
+	BVH::Ray ray;
+	ray.origin = vec3(nearPoint);
+	ray.direction = glm::normalize(vec3(farPoint - nearPoint));
+
+	const u32 hit = BVH::QueryRay(app->sceneBVH, ray);
+	app->pickedEntity = hit == UINT32_MAX ? EntityHandle() : Entities::HandleOf(app->entities, app->entities.renderSet.owners[hit]);
+
+	// Picking the sphere of a point light selects it in the Lights panel
+	const u32 proxyIdx = Entities::LightProxyIndex(app->entities, app->pickedEntity);
+	if (proxyIdx != UINT32_MAX)
+	{
+		SelectLight(app, app->entities.lightProxies[proxyIdx].lightIndex);
+	}
+}
+
+void RequestTextureDetail(App* app)
+{
+	// Pixels covered by one world unit one unit away from the camera
+	const f32 pixelsPerUnit = app->displaySize.y * 0.5f * app->cam.projection[1][1];
+
+	const Entities::Registry& registry = app->entities;
+	for (u32 renderIdx : app->visibleEntities)
+	{
+		const Model& model = app->models[registry.renders[renderIdx].modelIndex];
+		const Mesh& mesh = app->meshes[model.meshIdx];
+
+		// The closest point of the entity needs the most detail
+		const AABB bounds = EntityWorldBounds(app, renderIdx);
+		const f32 distance = glm::max(glm::length(app->cam.position - glm::clamp(app->cam.position, bounds.min, bounds.max)), app->cam.zNear);
+		Entities::Mobility mobility;
+		const u32 transformIdx = Entities::TransformOfOwner(registry, registry.renderSet, renderIdx, &mobility);
+		const vec3& entityScale = registry.transforms[mobility].scales[transformIdx];
+		const f32 scale = glm::min(entityScale.x, glm::min(entityScale.y, entityScale.z));
+		const f32 modelUnitsPerPixel = distance / (pixelsPerUnit * scale);
+
+		for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+		{
+			const f32 uvPerPixel = mesh.submeshes[i].uvDensity * modelUnitsPerPixel;
+			if (uvPerPixel <= 0.0f)
+				continue;
+
+			const Material& material = app->materials[model.materialIdx[i]];
+			TextureStreamer::RequestDetail(app->textureStreamer, material.albedoTextureIdx, uvPerPixel);
+			TextureStreamer::RequestDetail(app->textureStreamer, material.emissiveTextureIdx, uvPerPixel);
+			TextureStreamer::RequestDetail(app->textureStreamer, material.normalsTextureIdx, uvPerPixel);
+			TextureStreamer::RequestDetail(app->textureStreamer, material.bumpTextureIdx, uvPerPixel);
+			TextureStreamer::RequestDetail(app->textureStreamer, material.ormTextureIdx, uvPerPixel);
+		}
+	}
+}
+
+u32 RequestModel(App* app, const char* filepath)
+{
+	const u32 modelIdx = ModelLoader::ReserveModel(app);
+	app->pendingModels.push_back({ filepath, modelIdx });
+	app->startup.modelsRequested++;
+	return modelIdx;
+}
+
+void UpdateStartup(App* app)
+{
+	// Nothing is loaded before the first frame is presented
+	if (app->frameCount == 0)
+		return;
+
+	if (app->startup.timeToFirstFrame == 0.0)
+	{
+		app->startup.timeToFirstFrame = glfwGetTime();
+		ILOG("Startup: first frame after %.3f s", app->startup.timeToFirstFrame);
+	}
+
+	// Every model imports at once in jobs, only the uploads are left to this thread
+	if (!app->pendingModels.empty() && !app->importBatch)
+	{
+		std::vector<std::string> filepaths;
+		std::vector<u32> modelIndices;
+		for (const PendingModel& pending : app->pendingModels)
+		{
+			filepaths.push_back(pending.filepath);
+			modelIndices.push_back(pending.modelIdx);
+		}
+		app->pendingModels.clear();
+
+		app->importBatch = ModelLoader::StartImport(app, filepaths, modelIndices);
+	}
+
+	if (app->startup.timeToFullyLoaded == 0.0 && app->startup.modelsLoaded == app->startup.modelsRequested && TextureStreamer::PendingCount(app->textureStreamer) == 0)
+	{
+		app->startup.timeToFullyLoaded = glfwGetTime();
+		ILOG("Startup: fully loaded after %.3f s", app->startup.timeToFullyLoaded);
+
+		const AssetRegistry::Stats& dedupe = app->registry.stats;
+		ILOG("Dedupe: %u texture requests, %u by path, %u by content (%.2f MB of sources not loaded again), %u/%u materials shared",
+			dedupe.textureRequests, dedupe.texturePathHits, dedupe.textureContentHits, dedupe.textureBytesSaved / (1024.0 * 1024.0),
+			dedupe.materialHits, dedupe.materialRequests);
+	}
+}
+
 void CreateLight(App* app, Light light)
 {
+	ASSERT(app->lights.size() < MAX_SHADER_LIGHTS, "The shaders do not take more lights");
 	app->lights.push_back(light);
+	app->lightsVersion++;
 
 	//If point light, create and relate a light
 	if (light.type == LightType_Point)
 	{
-		app->entities.push_back({ light.position, vec3(0.1), app->SphereModelIndex, 0, 0 });
-		app->lights[app->lights.size() - 1].sphere = app->entities.size() - 1;
+		// Dynamic, it follows the light when it is dragged around
+		const EntityHandle sphere = CreateEntity(app, light.position, vec3(0.1), app->SphereModelIndex, Entities::MOBILITY_DYNAMIC);
+		Entities::AddLightProxy(app->entities, sphere, app->lights.size() - 1);
+		app->lights.back().sphere = sphere;
 	}
 }
 
@@ -249,31 +661,52 @@ void Init(App* app)
 	app->framebufferToQuadShader = LoadProgram(app, "Shaders/FB_TO_BB.glsl", "FB_TO_BB");
 	//app->framebufferToQuadShader = LoadProgram(app, "Shaders/FB_TO_QUAD.glsl", "FB_TO_QUAD");
 
+	app->depthPrepassShader = LoadProgram(app, "Shaders/DEPTH_PREPASS.glsl", "DEPTH_PREPASS");
+	app->forwardPlusShader = LoadProgram(app, "Shaders/RENDER_TO_BB.glsl", "FORWARD_PLUS");
+	app->lightCullingShader = LoadComputeProgram(app, "Shaders/LIGHT_CULLING.glsl", "LIGHT_CULLING");
+
+	app->deferredDirectionalShader = LoadProgram(app, "Shaders/FB_TO_BB.glsl", "DEFERRED_DIRECTIONAL");
+	app->lightVolumeShader = LoadProgram(app, "Shaders/FB_TO_BB.glsl", "LIGHT_VOLUME");
+	app->lightVolumeStencilShader = LoadProgram(app, "Shaders/FB_TO_BB.glsl", "LIGHT_VOLUME_STENCIL");
+	app->deferredResolveShader = LoadProgram(app, "Shaders/FB_TO_BB.glsl", "DEFERRED_RESOLVE");
+
+	app->tileClassifyShader = LoadComputeProgram(app, "Shaders/TILE_CLASSIFY.glsl", "TILE_CLASSIFY");
+	app->tileShadeShaders[TILE_CLASS_EDGE][0] = LoadComputeProgram(app, "Shaders/FB_TO_BB.glsl", "TILE_SHADE_EDGE_BASIC");
+	app->tileShadeShaders[TILE_CLASS_EDGE][1] = LoadComputeProgram(app, "Shaders/FB_TO_BB.glsl", "TILE_SHADE_EDGE_PBR");
+	app->tileShadeShaders[TILE_CLASS_FULL][0] = LoadComputeProgram(app, "Shaders/FB_TO_BB.glsl", "TILE_SHADE_FULL_BASIC");
+	app->tileShadeShaders[TILE_CLASS_FULL][1] = LoadComputeProgram(app, "Shaders/FB_TO_BB.glsl", "TILE_SHADE_FULL_PBR");
+
+	app->visibilityShader = LoadProgram(app, "Shaders/DEPTH_PREPASS.glsl", "VISIBILITY");
+	app->visibilityMaterialDepthShader = LoadProgram(app, "Shaders/DEPTH_PREPASS.glsl", "VISIBILITY_MATERIAL_DEPTH");
+	app->visibilityShadeShader = LoadProgram(app, "Shaders/RENDER_TO_BB.glsl", "VISIBILITY_SHADE");
+
 	// Load bloom shaders
 	app->blitBrightestPixelsShader = LoadProgram(app, "Shaders/PASS_BLIT_BRIGHT.glsl", "PASS_BLIT_BRIGHT");
 	app->blurShader = LoadProgram(app, "Shaders/BLUR.glsl", "BLUR");
 	app->bloomShader = LoadProgram(app, "Shaders/BLOOM.glsl", "BLOOM");
 
-	const Program& texturedMeshProgram = app->programs[app->renderToBackBufferShader];
-	app->texturedMeshProgram_uTexture = glGetUniformLocation(texturedMeshProgram.handle, "uTexture");
-	app->texturedMeshProgram_uMetallic = glGetUniformLocation(texturedMeshProgram.handle, "uMetallic");
-	app->texturedMeshProgram_uRoughness = glGetUniformLocation(texturedMeshProgram.handle, "uRoughness");
-	app->texturedMeshProgram_uAO = glGetUniformLocation(texturedMeshProgram.handle, "uAO");
-	app->texturedMeshProgram_uNormal = glGetUniformLocation(texturedMeshProgram.handle, "uNormal");
-	app->texturedMeshProgram_uEmissive = glGetUniformLocation(texturedMeshProgram.handle, "uEmissive");
-
-	//u32 PatrickModelIndex = ModelLoader::LoadModel(app, "Models/Patrick/Patrick.obj");
-	//u32 GroundModelIndex = ModelLoader::LoadModel(app, "Models/Ground/ground.obj");
-	//u32 GoombaModelIndex = ModelLoader::LoadModel(app, "Models/Goomba/goomba.obj");
-	app->SphereModelIndex = ModelLoader::LoadModel(app, "Models/Sphere/sphere.obj");
-	//u32 ChestModelIndex = ModelLoader::LoadModel(app, "Models/Chest/Chest.obj");
-
-	u32 CarModelIndex = ModelLoader::LoadModel(app, "Models/Car/Car.obj");
-	u32 Car2ModelIndex = ModelLoader::LoadModel(app, "Models/Car2/Plane Car.obj");
-	//u32 RavineModelIndex = ModelLoader::LoadModel(app, "Models/Ravine/canyondesert-asset-library.obj");
-	//u32 CathedralModelIndex = ModelLoader::LoadModel(app, "Models/Cathedral/Cathedral.obj");
-
-	//u32 StreetIndex = ModelLoader::LoadModel(app, "Models/Street/PGA-Street.obj");
+	// Placeholders first, streamed textures show them until they are uploaded.
+	// Texture 0 is then white, which unset material slots already index.
+	app->textureStreamer = TextureStreamer::Create();
+	app->whiteTexIdx = ModelLoader::LoadTexture2D(app, "color_white.png");
+	app->blackTexIdx = ModelLoader::LoadTexture2D(app, "color_black.png");
+	app->normalTexIdx = ModelLoader::LoadTexture2D(app, "color_normal.png", TEXTURE_KIND_NORMAL);
+	app->magentaTexIdx = ModelLoader::LoadTexture2D(app, "color_magenta.png");
+
+	// Models are only registered here, the main loop loads them once the first frame is out.
+	// Until then their entities have an empty mesh and draw nothing.
+	//u32 PatrickModelIndex = RequestModel(app, "Models/Patrick/Patrick.obj");
+	//u32 GroundModelIndex = RequestModel(app, "Models/Ground/ground.obj");
+	//u32 GoombaModelIndex = RequestModel(app, "Models/Goomba/goomba.obj");
+	app->SphereModelIndex = RequestModel(app, "Models/Sphere/sphere.obj");
+	//u32 ChestModelIndex = RequestModel(app, "Models/Chest/Chest.obj");
+
+	u32 CarModelIndex = RequestModel(app, "Models/Car/Car.obj");
+	u32 Car2ModelIndex = RequestModel(app, "Models/Car2/Plane Car.obj");
+	//u32 RavineModelIndex = RequestModel(app, "Models/Ravine/canyondesert-asset-library.obj");
+	//u32 CathedralModelIndex = RequestModel(app, "Models/Cathedral/Cathedral.obj");
+
+	//u32 StreetIndex = RequestModel(app, "Models/Street/PGA-Street.obj");
 
 	VertexBufferLayout vertexBufferLayout = {};
 	vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
@@ -286,22 +719,32 @@ void Init(App* app)
 	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &app->maxUniformBufferSize);
 	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBlockAlignment);
 
-	app->localUniformBuffer = CreateConstantBuffer(app->maxUniformBufferSize);
+	app->localUniformBuffer = CreateConstantBuffer(sizeof(ShaderLayouts::FrameParams));
+	app->lightUniformBuffer = CreateDynamicConstantBuffer(sizeof(ShaderLayouts::LightParams));
+	app->instanceBuffer = CreateStorageBuffer(MAX_SHADER_INSTANCES * sizeof(EntityTransform));
+
+	std::vector<u32> instanceIndices(MAX_SHADER_INSTANCES);
+	for (u32 i = 0; i < MAX_SHADER_INSTANCES; ++i)
+	{
+		instanceIndices[i] = i;
+	}
+	app->instanceIndexBuffer = CreateStaticVertexBuffer(MAX_SHADER_INSTANCES * sizeof(u32));
+	BufferManager::UploadData(app->instanceIndexBuffer, 0, instanceIndices.data(), MAX_SHADER_INSTANCES * sizeof(u32));
 
-	//app->entities.push_back({ vec3(0.0, 0.0, 0.0), vec3(0.45), PatrickModelIndex, 0, 0});
-	//app->entities.push_back({ vec3(2.35, 0.0, 0.0), vec3(0.45), PatrickModelIndex, 0, 0 });
-	//app->entities.push_back({ vec3(-2.35, 0.0, 0.0), vec3(0.45), PatrickModelIndex, 0, 0 });
+	//CreateEntity(app, vec3(0.0, 0.0, 0.0), vec3(0.45), PatrickModelIndex);
+	//CreateEntity(app, vec3(2.35, 0.0, 0.0), vec3(0.45), PatrickModelIndex);
+	//CreateEntity(app, vec3(-2.35, 0.0, 0.0), vec3(0.45), PatrickModelIndex);
 
-	app->entities.push_back({ vec3(-1.0, -3.65, 0.0), vec3(0.01), CarModelIndex, 0, 0 });
-	app->entities.push_back({ vec3(1.0, -3.65, 0.0), vec3(0.5), Car2ModelIndex, 0, 0 });
-	//app->entities.push_back({ vec3(0.0, -1.0, 0.0), vec3(0.50), RavineModelIndex, 0, 0 });
-	//app->entities.push_back({ vec3(0.0, 0.0, 0.0), vec3(1.00), StreetIndex, 0, 0 });
+	CreateEntity(app, vec3(-1.0, -3.65, 0.0), vec3(0.01), CarModelIndex);
+	CreateEntity(app, vec3(1.0, -3.65, 0.0), vec3(0.5), Car2ModelIndex);
+	//CreateEntity(app, vec3(0.0, -1.0, 0.0), vec3(0.50), RavineModelIndex);
+	//CreateEntity(app, vec3(0.0, 0.0, 0.0), vec3(1.00), StreetIndex);
 
-	//app->entities.push_back({ vec3(0, -1.55, 0.0), vec3(5, 5, 5), GroundModelIndex, 0, 0 });
+	//CreateEntity(app, vec3(0, -1.55, 0.0), vec3(5, 5, 5), GroundModelIndex);
 
-	// app->entities.push_back({ vec3(2.5, -1, 2.5), vec3(0.03), GoombaModelIndex, 0, 0 });
+	// CreateEntity(app, vec3(2.5, -1, 2.5), vec3(0.03), GoombaModelIndex);
 
-	//app->entities.push_back({ vec3(0, 0, 0), vec3(1), ChestModelIndex, 0, 0 });
+	//CreateEntity(app, vec3(0, 0, 0), vec3(1), ChestModelIndex);
 
 	CreateLight(app, { LightType::LightType_Directional, vec3(1.0, 1.0, 1.0), vec3(-0.70, 0.0, -0.2), vec3(0.0, 0.0, 0.0), 1.0f });
 	//CreateLight(app, { LightType::LightType_Directional, vec3(1.0, 0.0, 1.0), vec3(-1.0, 1.0, -1.0), vec3(0.0, 0.0, 0.0), 1.0f});
@@ -322,6 +765,23 @@ void Init(App* app)
 
 
 	app->ConfigureFrameBuffer(app->defferedFrameBuffer);
+	app->ConfigureForwardFrameBuffer(app->forwardFrameBuffer);
+	app->ConfigureLightAccumFrameBuffer(app->lightAccumFrameBuffer, app->defferedFrameBuffer.depthHandle);
+
+	glGenQueries(FORWARD_QUERY_LATENCY, app->forwardQueries.samples);
+	glGenQueries(FORWARD_QUERY_LATENCY, app->forwardQueries.prepassTime);
+	glGenQueries(FORWARD_QUERY_LATENCY, app->forwardQueries.shadingTime);
+
+	LightCulling::Resize(app->lightGrid, app->displaySize);
+	app->tileLightBuffer = CreateStorageBuffer(app->lightGrid.tiles.size() * sizeof(ShaderLayouts::TileLightList));
+
+	app->tileCountX = (app->displaySize.x + DEFERRED_TILE_SIZE - 1) / DEFERRED_TILE_SIZE;
+	app->tileCountY = (app->displaySize.y + DEFERRED_TILE_SIZE - 1) / DEFERRED_TILE_SIZE;
+	app->tileClassCommandBuffer = CreateStorageBuffer(TILE_CLASS_COUNT * sizeof(ShaderLayouts::TileClassCommand));
+	app->tileClassListBuffer = CreateStorageBuffer(TILE_CLASS_COUNT * app->tileCountX * app->tileCountY * sizeof(u32));
+
+	app->ConfigureVisibilityFrameBuffers(app->visibilityTargets, app->displaySize);
+	app->visibilityDrawBuffer = CreateStorageBuffer(VISIBILITY_MAX_DRAWS * sizeof(ShaderLayouts::VisibilityDraw));
 
 	app->mode = Mode_Forward;
 
@@ -329,7 +789,17 @@ void Init(App* app)
 
 	app->InitBloomEffect();
 
-	app->bloom.active = false;
+	app->bloomSettings.active = false;
+
+	// Created once at display size, the render thread copies the frame into it and the Gui shows it
+	glGenTextures(1, &app->prefinalTextureID);
+	glBindTexture(GL_TEXTURE_2D, app->prefinalTextureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void Gui(App* app)
@@ -344,10 +814,236 @@ void Gui(App* app)
 	ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Direction");
 	ImGui::Text("(%.3f, %.3f, %.3f)", app->cam.direction.x, app->cam.direction.y, app->cam.direction.z);
 
+	ImGui::Dummy(ImVec2(10, 10));
+	ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Scene BVH");
+	ImGui::Text("Nodes: %u  Visible entities: %u/%u", (u32)app->sceneBVH.nodes.size(), (u32)app->visibleEntities.size(), (u32)app->entities.renders.size());
+	ImGui::Text("SAH cost: %.2f (built %.2f)", app->sceneBVH.cost, app->sceneBVH.builtCost);
+	const u32 pickedRenderIdx = Entities::RenderIndex(app->entities, app->pickedEntity);
+	if (pickedRenderIdx != UINT32_MAX)
+	{
+		ImGui::Text("Picked entity: %u (generation %u)", app->pickedEntity.index, app->pickedEntity.generation);
+
+		// Lights whose influence sphere reaches the picked entity
+		std::string affectingLights;
+		std::vector<u32> affected;
+		for (int i = 0; i < app->lights.size(); ++i)
+		{
+			const Light& light = app->lights[i];
+			if (light.type == LightType_Directional)
+			{
+				affectingLights += std::to_string(i) + " ";
+				continue;
+			}
+
+			affected.clear();
+			BVH::QuerySphere(app->sceneBVH, light.position, LightInfluenceRadius(light, app->pbr), affected);
+			if (std::find(affected.begin(), affected.end(), pickedRenderIdx) != affected.end())
+			{
+				affectingLights += std::to_string(i) + " ";
+			}
+		}
+		ImGui::Text("Affected by lights: %s", affectingLights.c_str());
+	}
+	else
+	{
+		ImGui::Text("Left click an entity to pick it");
+	}
+
+	if (ImGui::Button("Run BVH benchmark (100k entities)"))
+	{
+		app->bvhBenchmark = BVH::Benchmark(100000);
+		ILOG("BVH benchmark: %u items, build %.2f ms, refit %.2f ms, frustum %.4f ms, ray %.4f ms, sphere %.4f ms",
+			app->bvhBenchmark.itemCount, app->bvhBenchmark.buildMs, app->bvhBenchmark.refitMs,
+			app->bvhBenchmark.frustumQueryMs, app->bvhBenchmark.rayQueryMs, app->bvhBenchmark.sphereQueryMs);
+		if (app->bvhBenchmark.mismatches > 0)
+			ELOG("BVH benchmark: %u queries disagree with brute force", app->bvhBenchmark.mismatches);
+	}
+	if (app->bvhBenchmark.itemCount > 0)
+	{
+		ImGui::Text("%u items, %u nodes", app->bvhBenchmark.itemCount, app->bvhBenchmark.nodeCount);
+		ImGui::Text("Build: %.2f ms  Refit: %.2f ms", app->bvhBenchmark.buildMs, app->bvhBenchmark.refitMs);
+		ImGui::Text("Per query - frustum: %.4f ms  ray: %.4f ms  sphere: %.4f ms",
+			app->bvhBenchmark.frustumQueryMs, app->bvhBenchmark.rayQueryMs, app->bvhBenchmark.sphereQueryMs);
+		ImGui::Text("Brute force mismatches: %u", app->bvhBenchmark.mismatches);
+	}
+
+	ImGui::Text("World matrices rebuilt: %u/%u (%s kernel)", app->rebuiltWorlds,
+		(u32)(app->entities.transforms[Entities::MOBILITY_STATIC].positions.size() + app->entities.transforms[Entities::MOBILITY_DYNAMIC].positions.size()),
+		Transforms::KernelName(Transforms::BestKernel()));
+	if (ImGui::Button("Run transform benchmark (1k to 1M entities)"))
+	{
+		Transforms::Benchmark(app->transformBenchmark);
+		for (const Transforms::BenchmarkResult& result : app->transformBenchmark)
+		{
+			ILOG("Transform benchmark: %u entities, worlds %.3f ms, dirty worlds %.3f ms, WVP scalar %.3f ms, %s %.3f ms, parallel %.3f ms",
+				result.entityCount, result.worldsMs, result.dirtyWorldsMs, result.scalarMs,
+				Transforms::KernelName(Transforms::BestKernel()), result.simdMs, result.parallelMs);
+		}
+	}
+	if (app->transformBenchmark[0].entityCount > 0)
+	{
+		ImGui::Text("%8s %9s %9s %9s %9s %9s %10s", "Entities", "Worlds", "Dirty", "Scalar", "SIMD", "Parallel", "Mismatches");
+		for (const Transforms::BenchmarkResult& result : app->transformBenchmark)
+		{
+			ImGui::Text("%8u %9.3f %9.3f %9.3f %9.3f %9.3f %10u", result.entityCount, result.worldsMs, result.dirtyWorldsMs,
+				result.scalarMs, result.simdMs, result.parallelMs, result.mismatches);
+		}
+	}
+
+	// Reimports the startup models from their sources, so only once they are all in
+	if (app->startup.timeToFullyLoaded > 0.0 && app->importBatch && ImGui::Button("Run import benchmark (startup models)"))
+	{
+		std::vector<std::string> filepaths;
+		for (const ModelLoader::ImportedModel& imported : app->importBatch->models)
+			filepaths.push_back(imported.filepath);
+
+		ImportBenchmarkResult& result = app->importBenchmark;
+		result = ModelLoader::BenchmarkImport(filepaths);
+		for (u32 i = 0; i < result.runCount; ++i)
+		{
+			ILOG("Import benchmark: %u models, %u meshes, %u threads: %.2f ms (%.2fx)", result.modelCount, result.meshCount,
+				result.threadCounts[i], result.importMs[i], result.importMs[0] / result.importMs[i]);
+		}
+	}
+	for (u32 i = 0; i < app->importBenchmark.runCount; ++i)
+	{
+		const ImportBenchmarkResult& result = app->importBenchmark;
+		ImGui::Text("%2u threads: %8.2f ms  %.2fx", result.threadCounts[i], result.importMs[i], result.importMs[0] / result.importMs[i]);
+	}
+
+	ImGui::Dummy(ImVec2(10, 10));
+	ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Texture streaming");
+	const TextureStreamer::Stats& streamingStats = app->textureStreamer->stats;
+	ImGui::Text("Loaded: %u/%u  Uploaded: %.1f MB  Stalled frames: %u", streamingStats.completed, streamingStats.requested,
+		streamingStats.uploadedBytes / (1024.0 * 1024.0), streamingStats.uploadStalls);
+	if (TextureStreamer::PendingCount(app->textureStreamer) == 0 && streamingStats.completed > 0)
+		ImGui::Text("All textures in %.2f s", streamingStats.lastCompletionTime - streamingStats.firstRequestTime);
+
+	ImGui::End();
+
+	ImGui::Begin("Jobs");
+	const JobSystem::FrameProfile& jobProfile = JobSystem::LastFrameProfile();
+	const f64 profileLength = glm::max(jobProfile.end - jobProfile.start, 1e-6);
+	ImGui::Text("%u threads, %u jobs last frame (%.2f ms)", jobProfile.threadCount, (u32)jobProfile.markers.size(), profileLength * 1000.0);
+
+	// One row per thread, every job is a bar over the frame coloured by its name
+	const f32 rowHeight = ImGui::GetTextLineHeight();
+	const ImVec2 timelineOrigin = ImGui::GetCursorScreenPos();
+	const f32 timelineWidth = glm::max(ImGui::GetContentRegionAvail().x, 1.0f);
+	ImDrawList* drawList = ImGui::GetWindowDrawList();
+	std::vector<f64> busyMs(jobProfile.threadCount, 0.0);
+	for (const JobSystem::ProfileMarker& marker : jobProfile.markers)
+	{
+		const f64 start = glm::max(marker.start, jobProfile.start);
+		const f32 x0 = timelineOrigin.x + timelineWidth * (f32)((start - jobProfile.start) / profileLength);
+		const f32 x1 = timelineOrigin.x + timelineWidth * (f32)((marker.end - jobProfile.start) / profileLength);
+		const f32 y0 = timelineOrigin.y + marker.threadIndex * (rowHeight + 2.0f);
+		const f32 hue = (f32)(((size_t)marker.name >> 3) % 64) / 64.0f;
+		drawList->AddRectFilled(ImVec2(x0, y0), ImVec2(glm::max(x1, x0 + 1.0f), y0 + rowHeight), ImColor::HSV(hue, 0.6f, 0.8f));
+		busyMs[marker.threadIndex] += (marker.end - start) * 1000.0;
+	}
+	ImGui::Dummy(ImVec2(timelineWidth, jobProfile.threadCount * (rowHeight + 2.0f)));
+
+	for (u32 i = 0; i < jobProfile.threadCount; ++i)
+	{
+		ImGui::Text("%-6s %2u: %6.2f ms busy", jobProfile.threadNames[i], i, busyMs[i]);
+	}
+	ImGui::End();
+
+	ImGui::Begin("Texture Residency");
+	TextureStreamer::Streamer* streamer = app->textureStreamer;
+	i32 budgetMB = (i32)(streamer->vramBudget / MB(1));
+	if (ImGui::SliderInt("VRAM budget (MB)", &budgetMB, 16, 4096))
+		streamer->vramBudget = (u64)budgetMB * MB(1);
+	char residentText[64];
+	sprintf(residentText, "%.1f / %d MB", streamer->residentBytes / (1024.0 * 1024.0), budgetMB);
+	ImGui::ProgressBar(streamer->vramBudget > 0 ? (f32)streamer->residentBytes / streamer->vramBudget : 0.0f, ImVec2(-1.0f, 0.0f), residentText);
+	ImGui::Text("Evictions: %u  Uploads pending: %u", streamer->stats.evictions, (u32)streamer->uploads.size());
+	ImGui::Separator();
+	ImGui::Columns(4);
+	ImGui::Text("Texture"); ImGui::NextColumn();
+	ImGui::Text("Resident"); ImGui::NextColumn();
+	ImGui::Text("Wanted"); ImGui::NextColumn();
+	ImGui::Text("Last used"); ImGui::NextColumn();
+	for (const TextureStreamer::Residency& residency : streamer->residencies)
+	{
+		const TextureCooker::CookedTexture& cooked = residency.cooked;
+		const u32 level = glm::min(residency.residentLevel, cooked.levelCount - 1);
+		ImGui::Text("%s", app->textures[residency.textureIdx].filepath.c_str()); ImGui::NextColumn();
+		ImGui::Text("%ux%u %.0f KB%s", glm::max(cooked.width >> level, 1u), glm::max(cooked.height >> level, 1u),
+			TextureStreamer::ResidentSize(residency, residency.residentLevel) / 1024.0, residency.uploading ? " ..." : ""); ImGui::NextColumn();
+		ImGui::Text("%ux%u", glm::max(cooked.width >> residency.wantedLevel, 1u), glm::max(cooked.height >> residency.wantedLevel, 1u)); ImGui::NextColumn();
+		ImGui::Text("%llu frames ago", (unsigned long long)(streamer->frame - residency.lastUsedFrame)); ImGui::NextColumn();
+	}
+	ImGui::Columns(1);
 	ImGui::End();
 
 	ImGui::Begin("Info");
 	ImGui::Text("FPS: %f", 1.0f / app->deltaTime);
+
+	// The render thread draws a frame while this one updates the next, see RenderThread
+	const char* pacings[] = { "Low latency", "Throughput" };
+	i32 pacing = RenderThread::GetPacing();
+	if (ImGui::Combo("Frame pacing", &pacing, pacings, RenderThread::PACING_COUNT))
+		RenderThread::SetPacing((RenderThread::Pacing)pacing);
+	const RenderThread::Stats renderStats = RenderThread::GetStats();
+	ImGui::Text("Main waits %.2f ms  Frames in flight %u", renderStats.mainWaitMs, renderStats.framesInFlight);
+	ImGui::Text("Render thread: resources %.2f ms, draw %.2f ms, GPU wait %.2f ms, idle %.2f ms",
+		renderStats.resourcesMs, renderStats.renderMs, renderStats.gpuWaitMs, renderStats.packetWaitMs);
+	const UploadStats& uploads = renderStats.uploads;
+	ImGui::Text("Uploaded: %u bytes (camera %u, dynamic %u, static %u, lights %u)",
+		uploads.frameBytes + uploads.dynamicBytes + uploads.staticBytes + uploads.lightBytes,
+		uploads.frameBytes, uploads.dynamicBytes, uploads.staticBytes, uploads.lightBytes);
+	const CommandList::Stats& commandStats = renderStats.commands;
+	ImGui::Text("Commands: record %.3f ms, replay %.3f ms (%u lists, %u commands, %.1f KB, %u draws, %u binds skipped)",
+		commandStats.recordMs, commandStats.replayMs, commandStats.lists, commandStats.commands,
+		commandStats.bytes / 1024.0f, commandStats.draws, commandStats.skippedBinds);
+	const ForwardPassStats& forwardStats = renderStats.forwardPasses;
+	if (forwardStats.shadedSamples > 0)
+	{
+		ImGui::Text("Forward: %.2f shaded fragments per pixel, prepass %.3f ms, shading %.3f ms (%s prepass)", forwardStats.overdraw,
+			forwardStats.prepassMs, forwardStats.shadingMs, forwardStats.prepass ? "with" : "without");
+	}
+	const LightCulling::Stats& cullingStats = renderStats.lightCulling;
+	if (cullingStats.tileCount > 0)
+	{
+		if (cullingStats.binner == LightCulling::BINNER_CPU)
+			ImGui::Text("Forward+: %u tiles, %.2f lights per tile, binned in %.3f ms", cullingStats.tileCount,
+				(f32)cullingStats.lightRefs / cullingStats.tileCount, cullingStats.binMs);
+		else
+			ImGui::Text("Forward+: %u tiles, culled by the compute shader", cullingStats.tileCount);
+	}
+	if (ImGui::Button("Run visibility buffer benchmark (1080p, 4K)"))
+	{
+		app->visibilityBenchmarkRequested = true;
+	}
+	const VisibilityBenchmarkResult& visibilityResult = renderStats.visibilityBenchmark;
+	for (u32 i = 0; i < VISIBILITY_BENCHMARK_SIZES && visibilityResult.frames > 0; ++i)
+	{
+		ImGui::Text("%dx%d: deferred %.3f ms, visibility buffer %.3f ms", visibilityResult.sizes[i].x, visibilityResult.sizes[i].y,
+			visibilityResult.deferredMs[i], visibilityResult.visibilityMs[i]);
+	}
+
+	const StartupMetrics& startup = app->startup;
+	if (startup.timeToFullyLoaded == 0.0)
+	{
+		const TextureStreamer::Stats& textureStats = app->textureStreamer->stats;
+		const u32 loaded = startup.modelsLoaded + textureStats.completed;
+		const u32 requested = startup.modelsRequested + textureStats.requested;
+		char overlay[64];
+		sprintf(overlay, "Models %u/%u  Textures %u/%u", startup.modelsLoaded, startup.modelsRequested, textureStats.completed, textureStats.requested);
+		ImGui::ProgressBar(requested > 0 ? (f32)loaded / requested : 0.0f, ImVec2(-1.0f, 0.0f), overlay);
+	}
+	else
+	{
+		ImGui::Text("First frame: %.3f s  Fully loaded: %.3f s", startup.timeToFirstFrame, startup.timeToFullyLoaded);
+
+		const AssetRegistry::Stats& dedupe = app->registry.stats;
+		ImGui::Text("Textures shared: %u by path, %u by content (%.2f MB saved)", dedupe.texturePathHits, dedupe.textureContentHits,
+			dedupe.textureBytesSaved / (1024.0 * 1024.0));
+		ImGui::Text("Materials shared: %u/%u", dedupe.materialHits, dedupe.materialRequests);
+	}
+
 	ImGui::Text("%s", app->openglDebugInfo.c_str());
 	ImGui::Text("Made By Zhida Chen & Robert Recorda");
 
@@ -355,22 +1051,22 @@ void Gui(App* app)
 
 	ImGui::Checkbox("PBR", &app->pbr);
 
-	ImGui::Checkbox("Bloom", &app->bloom.active);
-	ImGui::Checkbox("Show brightest", &app->bloom.showBrightest);
-	ImGui::SliderFloat("Bloom threshold", &app->bloom.threshold, 0, 1);
-	ImGui::SliderInt("kerner Radius", &app->bloom.kernerRadius, 1, 24);
+	ImGui::Checkbox("Bloom", &app->bloomSettings.active);
+	ImGui::Checkbox("Show brightest", &app->bloomSettings.showBrightest);
+	ImGui::SliderFloat("Bloom threshold", &app->bloomSettings.threshold, 0, 1);
+	ImGui::SliderInt("kerner Radius", &app->bloomSettings.kernerRadius, 1, 24);
 
 	for(int i = 0; i < 5; ++i)
 	{
 		std::string label = "Lod intensity " + std::to_string(i);
-		ImGui::SliderFloat(label.c_str(), &app->bloom.lodIntensity[i], 0, 1);
+		ImGui::SliderFloat(label.c_str(), &app->bloomSettings.lodIntensity[i], 0, 1);
 	}
 
 	ImGui::Image((ImTextureID)app->bloom.rtBloomH, ImVec2(320, 180), ImVec2(0, 1), ImVec2(1, 0));
 	ImGui::Image((ImTextureID)app->bloom.rtBright, ImVec2(320, 180), ImVec2(0, 1), ImVec2(1, 0));
 	ImGui::Image((ImTextureID)app->prefinalTextureID, ImVec2(320, 180), ImVec2(0, 1), ImVec2(1, 0));
 
-	const char* RenderModes[] = { "FORWARD", "DEFERRED", "DEPTH", "ALBEDO", "NORMALS", "POSITION", "VIEW DIRECTION", "METALLIC", "ROUGHNESS", "AMBIENT OCCLUSSION", "EMISSIVE" };
+	const char* RenderModes[] = { "FORWARD", "DEFERRED", "DEPTH", "ALBEDO", "NORMALS", "POSITION", "VIEW DIRECTION", "METALLIC", "ROUGHNESS", "AMBIENT OCCLUSSION", "EMISSIVE", "FORWARD+", "VISIBILITY" };
 	if (ImGui::BeginCombo("Render Mode", RenderModes[app->mode]))
 	{
 		for (size_t i = 0; i < ARRAY_COUNT(RenderModes); ++i)
@@ -384,7 +1080,32 @@ void Gui(App* app)
 		ImGui::EndCombo();
 	}
 
-	if (app->mode != Mode::Mode_Forward)
+	if (app->mode == Mode_Forward)
+	{
+		ImGui::Checkbox("Depth prepass", &app->depthPrepass);
+	}
+
+	if (app->mode == Mode_Deferred)
+	{
+		int lighting = app->deferredLighting;
+		const char* lightings[DEFERRED_LIGHTING_COUNT] = { "Full screen quad", "Light volumes", "Tile classification" };
+		if (ImGui::Combo("Lighting", &lighting, lightings, DEFERRED_LIGHTING_COUNT))
+		{
+			app->deferredLighting = (DeferredLighting)lighting;
+		}
+	}
+
+	if (app->mode == Mode_ForwardPlus)
+	{
+		int binner = app->lightBinner;
+		const char* binners[LightCulling::BINNER_COUNT] = { LightCulling::BinnerName(LightCulling::BINNER_GPU), LightCulling::BinnerName(LightCulling::BINNER_CPU) };
+		if (ImGui::Combo("Light culling", &binner, binners, LightCulling::BINNER_COUNT))
+		{
+			app->lightBinner = (LightCulling::Binner)binner;
+		}
+	}
+
+	if (app->mode != Mode::Mode_Forward && app->mode != Mode_ForwardPlus && app->mode != Mode_Visibility)
 	{
 		ImGui::TextColored(ImVec4(1.0f, 1.0f, 1.0f, 1.0f), "G-Buffer textures");
 		ImGui::Dummy(ImVec2(20.0f, 20.0f));
@@ -402,8 +1123,6 @@ void Gui(App* app)
 
 	// LIGHTS
 
-	static int auxIndex = -1;
-	static std::string auxSelectedName = "";
 	std::string name = "";
 
 	ImGui::Begin("Lights");
@@ -424,35 +1143,29 @@ void Gui(App* app)
 
 		if (ImGui::Selectable(name.c_str(), &app->lights[i].selected))
 		{
-			auxIndex = i;
-			auxSelectedName = name + " is selected!";
+			SelectLight(app, app->lights[i].selected ? i : -1);
 		}
 	}
 
 	ImGui::Dummy(ImVec2(10, 10));
+	i32 auxIndex = app->selectedLight;
 	if (auxIndex > -1)
 	{
 		if (app->lights[auxIndex].selected)
 		{
-			//Deselect others
-			for (int k = 0; k < app->lights.size(); k++) {
-				app->lights[k].selected = (k == auxIndex);
-			}
-
 			//Modify
+			std::string auxSelectedName = (app->lights[auxIndex].type == LightType_Directional ? "Directional Light " : "Point Light ") + std::to_string(auxIndex) + " is selected!";
 			ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), auxSelectedName.c_str());
 			ImGui::Spacing();
 
-			if (ImGui::DragFloat3("Position", &app->lights[auxIndex].position.x, 0.1f))
+			bool changed = ImGui::DragFloat3("Position", &app->lights[auxIndex].position.x, 0.1f);
+			changed |= ImGui::DragFloat3("Direction", &app->lights[auxIndex].direction.x, 0.1f, -1.0f, 1.0f);
+			changed |= ImGui::DragFloat("Intensity", &app->lights[auxIndex].intensity);
+			changed |= ImGui::ColorPicker3("Color", &app->lights[auxIndex].color.x);
+			if (changed)
 			{
-				if (app->lights[auxIndex].sphere != -1)
-				{
-					app->entities[app->lights[auxIndex].sphere].position = app->lights[auxIndex].position;
-				}
+				app->lightsVersion++;
 			}
-			ImGui::DragFloat3("Direction", &app->lights[auxIndex].direction.x, 0.1f, -1.0f, 1.0f);
-			ImGui::DragFloat("Intensity", &app->lights[auxIndex].intensity);
-			ImGui::ColorPicker3("Color", &app->lights[auxIndex].color.x);
 		}
 	}
 
@@ -494,15 +1207,100 @@ void Update(App* app)
 
 	// Apply
 	app->cam.UpdateViewProjection();
+
+	UpdateStartup(app);
+
+	// Entities may have moved (e.g. light spheres dragged from the Lights panel)
+	UpdateLightProxies(app);
+	UpdateSceneBVH(app);
+
+	if (app->input.mouseButtons[LEFT] == BUTTON_PRESS)
+	{
+		PickEntity(app);
+	}
+
+	// Frustum culling
+	app->visibleEntities.clear();
+	BVH::QueryFrustum(app->sceneBVH, BVH::ExtractFrustum(app->cam.projection * app->cam.view), app->visibleEntities);
+
+	// Mip levels the visible entities need, streamed in when the render thread takes the frame
+	RequestTextureDetail(app);
+}
+
+void BuildFramePacket(App* app, FramePacket& packet)
+{
+	packet.displaySize = app->displaySize;
+	packet.cameraPosition = app->cam.position;
+	packet.viewProjection = app->cam.projection * app->cam.view;
+
+	// Only the entities that moved get a new world matrix, every one needs the new view projection
+	Entities::Registry& registry = app->entities;
+	const Transforms::Store& statics = registry.transforms[Entities::MOBILITY_STATIC];
+	const Transforms::Store& dynamics = registry.transforms[Entities::MOBILITY_DYNAMIC];
+	app->rebuiltWorlds = Transforms::UpdateWorlds(registry.transforms[Entities::MOBILITY_STATIC]);
+	app->rebuiltWorlds += Transforms::UpdateWorlds(registry.transforms[Entities::MOBILITY_DYNAMIC]);
+
+	// Dynamic entities go in every packet, static ones only after an edit
+	packet.dynamicTransforms.resize(dynamics.worlds.size());
+	JobSystem::ParallelFor("Entity transforms", dynamics.worlds.size(), TRANSFORM_JOB_GRAIN, [&](u32 begin, u32 end)
+	{
+		memcpy(&packet.dynamicTransforms[begin], &dynamics.worlds[begin], (end - begin) * sizeof(EntityTransform));
+	});
+
+	packet.staticTransformsChanged = statics.version != app->sentStaticVersion;
+	packet.staticTransforms.clear();
+	if (packet.staticTransformsChanged)
+	{
+		packet.staticTransforms.resize(statics.worlds.size());
+		memcpy(packet.staticTransforms.data(), statics.worlds.data(), statics.worlds.size() * sizeof(EntityTransform));
+		app->sentStaticVersion = statics.version;
+	}
+
+	packet.renderables.resize(registry.renders.size());
+	for (u32 i = 0; i < registry.renders.size(); ++i)
+	{
+		Renderable& renderable = packet.renderables[i];
+		renderable.modelIndex = registry.renders[i].modelIndex;
+		renderable.transformIndex = Entities::TransformOfOwner(registry, registry.renderSet, i, &renderable.mobility);
+	}
+
+	packet.visibleEntities = app->visibleEntities;
+	packet.lights = app->lights;
+	packet.lightsVersion = app->lightsVersion;
+
+	packet.mode = app->mode;
+	packet.pbr = app->pbr;
+	packet.depthPrepass = app->depthPrepass;
+	packet.deferredLighting = app->deferredLighting;
+	packet.lightBinner = app->lightBinner;
+	packet.visibilityBenchmark = app->visibilityBenchmarkRequested;
+	app->visibilityBenchmarkRequested = false;
+	packet.bloom = app->bloomSettings;
+}
+
+void UpdateRenderResources(App* app)
+{
+	JobSystem::RunGLThreadJobs(JOB_GL_THREAD_BUDGET_MS);
+
+	TextureStreamer::Update(app->textureStreamer, app->textures, [app](u32 textureIdx, u64 contentHash, u64 sourceSize)
+	{
+		return AssetRegistry::MergeTexture(app, textureIdx, contentHash, sourceSize);
+	});
 }
 
-void Render(App* app)
+void Render(App* app, const FramePacket& packet)
 {
-	app->UpdateEntityBuffer();
+	app->commandStats = {};
+	app->uploadStats = {};
+	app->lightCullingStats = {};
+	app->UpdateEntityBuffer(packet);
 
-	GLubyte* pixels = new GLubyte[app->displaySize.x * app->displaySize.y * 4];
+	if (packet.visibilityBenchmark)
+	{
+		app->RunVisibilityBenchmark(packet);
+	}
 
-	switch (app->mode)
+	switch (packet.mode)
 	{
 	case  Mode_Forward:
 	{
@@ -511,16 +1309,49 @@ void Render(App* app)
 		//glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+		glViewport(0, 0, packet.displaySize.x, packet.displaySize.y);
+
+		app->CollectForwardQueries();
+		if (packet.depthPrepass)
+		{
+			app->DepthPrepass(packet);
+		}
 
 		const Program& forwardProgram = app->programs[app->renderToBackBufferShader];
 		glUseProgram(forwardProgram.handle);
 
 		//BufferManager::BindBuffer(app->localUnfiromBuffer);
-		app->RenderGeometry(forwardProgram);
+		app->ShadeForward(packet, forwardProgram, packet.depthPrepass);
 		//BufferManager::UnmapBuffer(app->localUnfiromBuffer);
 	}
 	break;
+	case  Mode_ForwardPlus:
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, app->forwardFrameBuffer.fbHandle);
+		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		glViewport(0, 0, packet.displaySize.x, packet.displaySize.y);
+
+		// Depth prepass, the light culling needs it
+		app->CollectForwardQueries();
+		app->DepthPrepass(packet);
+
+		app->CullLights(packet);
+
+		const Program& forwardPlusProgram = app->programs[app->forwardPlusShader];
+		glUseProgram(forwardPlusProgram.handle);
+		glUniform1ui(glGetUniformLocation(forwardPlusProgram.handle, "uTileCountX"), app->lightGrid.tileCountX);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(2), app->tileLightBuffer.handle, 0, app->tileLightBuffer.size);
+
+		app->ShadeForward(packet, forwardPlusProgram, true);
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, app->forwardFrameBuffer.fbHandle);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, packet.displaySize.x, packet.displaySize.y, 0, 0, packet.displaySize.x, packet.displaySize.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	break;
 	case  Mode_Albedo:
 	case  Mode_Deferred:
 	case  Mode_Normals:
@@ -535,142 +1366,78 @@ void Render(App* app)
 		//Render to FB ColorAtt.
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-		glBindFramebuffer(GL_FRAMEBUFFER, app->defferedFrameBuffer.fbHandle);
-		glDrawBuffers(app->defferedFrameBuffer.colorAttachment.size(), app->defferedFrameBuffer.colorAttachment.data());
-		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		app->RenderGBuffer(packet, app->defferedFrameBuffer, packet.displaySize);
 
-		const Program& deferredProgram = app->programs[app->renderToFrameBufferShader];
-		glUseProgram(deferredProgram.handle);
-		app->RenderGeometry(deferredProgram);
+		// The light volumes need the sphere mesh, which loads after the first frame
+		const Mesh& sphereMesh = app->meshes[app->models[app->SphereModelIndex].meshIdx];
+		if (packet.mode == Mode_Deferred && packet.deferredLighting == DEFERRED_LIGHTING_VOLUMES && !sphereMesh.submeshes.empty())
+		{
+			app->ShadeLightVolumes(packet);
+			break;
+		}
+		if (packet.mode == Mode_Deferred && packet.deferredLighting == DEFERRED_LIGHTING_TILES)
+		{
+			app->ShadeTiles(packet);
+			break;
+		}
 
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		//Render to BB from ColorAtt.
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-
-		const Program& FBToBB = app->programs[app->framebufferToQuadShader];
-		glUseProgram(FBToBB.handle);
-
-		//Render Quad
-		glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, app->defferedFrameBuffer.colorAttachment[0]);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "uAlbedo"), 0);
-
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, app->defferedFrameBuffer.colorAttachment[1]);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "uNormals"), 1);
-
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, app->defferedFrameBuffer.colorAttachment[2]);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "uPosition"), 2);
-
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D, app->defferedFrameBuffer.colorAttachment[3]);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "uViewDir"), 3);
+		glViewport(0, 0, packet.displaySize.x, packet.displaySize.y);
 
-		// Metallic
-		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D, app->defferedFrameBuffer.colorAttachment[4]);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "uMetallic"), 4);
-
-		// Roughness
-		glActiveTexture(GL_TEXTURE5);
-		glBindTexture(GL_TEXTURE_2D, app->defferedFrameBuffer.colorAttachment[5]);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "uRoughness"), 5);
-
-		// AO
-		glActiveTexture(GL_TEXTURE6);
-		glBindTexture(GL_TEXTURE_2D, app->defferedFrameBuffer.colorAttachment[6]);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "uAO"), 6);
-
-		// Emissive
-		glActiveTexture(GL_TEXTURE7);
-		glBindTexture(GL_TEXTURE_2D, app->defferedFrameBuffer.colorAttachment[7]);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "uEmissive"), 7);
-
-		// Depth
-		glActiveTexture(GL_TEXTURE8);
-		glBindTexture(GL_TEXTURE_2D, app->defferedFrameBuffer.depthHandle);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "uDepth"), 8);
-
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "showAlbedo"), app->mode == Mode_Albedo ? 1 : 0);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "showNormals"), app->mode == Mode_Normals ? 1 : 0);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "showPosition"), app->mode == Mode_Position ? 1 : 0);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "showViewDir"), app->mode == Mode_ViewDirection ? 1 : 0);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "showDepth"), app->mode == Mode_Depth ? 1 : 0);
-
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "showMetallic"), app->mode == Mode_Metallic ? 1 : 0);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "showRoughness"), app->mode == Mode_Roughness ? 1 : 0);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "showAo"), app->mode == Mode_Ao ? 1 : 0);
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "showEmissive"), app->mode == Mode_Emissive ? 1 : 0);
-
-		glUniform1i(glGetUniformLocation(FBToBB.handle, "usePBR"), app->pbr);
-
-		glBindVertexArray(app->vao);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-
-		glBindVertexArray(0);
-		glUseProgram(0);
+		app->LightGBufferQuad(packet, app->defferedFrameBuffer, packet.mode);
 	}
 	break;
-	default:;
-	}
-
-#pragma region Get screen info
-	// get final render and save in texture
-	glReadPixels(0, 0, app->displaySize.x, app->displaySize.y, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-
-	//Clean previous
-	if (app->prefinalTextureID != 0)
+	case  Mode_Visibility:
 	{
-		glDeleteTextures(1, &app->prefinalTextureID);
-		app->prefinalTextureID = 0;
-	}
+		app->RenderVisibility(packet, app->visibilityTargets, packet.displaySize);
 
-	glGenTextures(1, &app->prefinalTextureID);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, app->visibilityTargets.shade.fbHandle);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, packet.displaySize.x, packet.displaySize.y, 0, 0, packet.displaySize.x, packet.displaySize.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	break;
+	default:;
+	}
 
+#pragma region Get screen info
+	// Copy the final render into its texture on the GPU, without a round trip through client memory
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
 	glBindTexture(GL_TEXTURE_2D, app->prefinalTextureID);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, app->displaySize.x, app->displaySize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, packet.displaySize.x, packet.displaySize.y);
+	glBindTexture(GL_TEXTURE_2D, 0);
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 #pragma endregion
 
 	// bloom efect
-	if (app->bloom.active)
+	if (packet.bloom.active)
 	{
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 		const vec2 horizontal(1.0, 0.0);
 		const vec2 vertical(0.0, 1.0);
 
-		app->PassBlitBrightPixels(app->bloom.fbBloom[0], app->prefinalTextureID, app->bloom.threshold);
+		app->PassBlitBrightPixels(packet, app->bloom.fbBloom[0], app->prefinalTextureID);
 
 		glBindTexture(GL_TEXTURE_2D, app->bloom.rtBright);
 		glGenerateMipmap(GL_TEXTURE_2D);
 
-		app->PassBlur(app->bloom.fbBloom[0], vec2(app->displaySize.x / 2, app->displaySize.y / 2), GL_COLOR_ATTACHMENT1, app->bloom.rtBright, 0, horizontal);
-		app->PassBlur(app->bloom.fbBloom[1], vec2(app->displaySize.x / 4, app->displaySize.y / 4), GL_COLOR_ATTACHMENT1, app->bloom.rtBright, 1, horizontal);
-		app->PassBlur(app->bloom.fbBloom[2], vec2(app->displaySize.x / 8, app->displaySize.y / 8), GL_COLOR_ATTACHMENT1, app->bloom.rtBright, 2, horizontal);
-		app->PassBlur(app->bloom.fbBloom[3], vec2(app->displaySize.x / 16, app->displaySize.y / 16), GL_COLOR_ATTACHMENT1, app->bloom.rtBright, 3, horizontal);
-		app->PassBlur(app->bloom.fbBloom[4], vec2(app->displaySize.x / 32, app->displaySize.y / 32), GL_COLOR_ATTACHMENT1, app->bloom.rtBright, 4, horizontal);
+		app->PassBlur(packet, app->bloom.fbBloom[0], vec2(packet.displaySize.x / 2, packet.displaySize.y / 2), GL_COLOR_ATTACHMENT1, app->bloom.rtBright, 0, horizontal);
+		app->PassBlur(packet, app->bloom.fbBloom[1], vec2(packet.displaySize.x / 4, packet.displaySize.y / 4), GL_COLOR_ATTACHMENT1, app->bloom.rtBright, 1, horizontal);
+		app->PassBlur(packet, app->bloom.fbBloom[2], vec2(packet.displaySize.x / 8, packet.displaySize.y / 8), GL_COLOR_ATTACHMENT1, app->bloom.rtBright, 2, horizontal);
+		app->PassBlur(packet, app->bloom.fbBloom[3], vec2(packet.displaySize.x / 16, packet.displaySize.y / 16), GL_COLOR_ATTACHMENT1, app->bloom.rtBright, 3, horizontal);
+		app->PassBlur(packet, app->bloom.fbBloom[4], vec2(packet.displaySize.x / 32, packet.displaySize.y / 32), GL_COLOR_ATTACHMENT1, app->bloom.rtBright, 4, horizontal);
 
-		app->PassBlur(app->bloom.fbBloom[0], vec2(app->displaySize.x / 2, app->displaySize.y / 2), GL_COLOR_ATTACHMENT0, app->bloom.rtBloomH, 0, vertical);
-		app->PassBlur(app->bloom.fbBloom[1], vec2(app->displaySize.x / 4, app->displaySize.y / 4), GL_COLOR_ATTACHMENT0, app->bloom.rtBloomH, 1, vertical);
-		app->PassBlur(app->bloom.fbBloom[2], vec2(app->displaySize.x / 8, app->displaySize.y / 8), GL_COLOR_ATTACHMENT0, app->bloom.rtBloomH, 2, vertical);
-		app->PassBlur(app->bloom.fbBloom[3], vec2(app->displaySize.x / 16, app->displaySize.y / 16), GL_COLOR_ATTACHMENT0, app->bloom.rtBloomH, 3, vertical);
-		app->PassBlur(app->bloom.fbBloom[4], vec2(app->displaySize.x / 32, app->displaySize.y / 32), GL_COLOR_ATTACHMENT0, app->bloom.rtBloomH, 4, vertical);
+		app->PassBlur(packet, app->bloom.fbBloom[0], vec2(packet.displaySize.x / 2, packet.displaySize.y / 2), GL_COLOR_ATTACHMENT0, app->bloom.rtBloomH, 0, vertical);
+		app->PassBlur(packet, app->bloom.fbBloom[1], vec2(packet.displaySize.x / 4, packet.displaySize.y / 4), GL_COLOR_ATTACHMENT0, app->bloom.rtBloomH, 1, vertical);
+		app->PassBlur(packet, app->bloom.fbBloom[2], vec2(packet.displaySize.x / 8, packet.displaySize.y / 8), GL_COLOR_ATTACHMENT0, app->bloom.rtBloomH, 2, vertical);
+		app->PassBlur(packet, app->bloom.fbBloom[3], vec2(packet.displaySize.x / 16, packet.displaySize.y / 16), GL_COLOR_ATTACHMENT0, app->bloom.rtBloomH, 3, vertical);
+		app->PassBlur(packet, app->bloom.fbBloom[4], vec2(packet.displaySize.x / 32, packet.displaySize.y / 32), GL_COLOR_ATTACHMENT0, app->bloom.rtBloomH, 4, vertical);
 
-		app->PassBloom(GL_COLOR_ATTACHMENT3, app->bloom.rtBright, 5);
+		app->PassBloom(packet, GL_COLOR_ATTACHMENT3, app->bloom.rtBright, 5);
 
 		/*
 		//app->PassBlur(app->bloom.fbBloom[0], vec2(app->displaySize.x, app->displaySize.y), GL_COLOR_ATTACHMENT0, app->bloom.rtBright, 0, vertical);
@@ -711,72 +1478,93 @@ void Render(App* app)
 		*/
 	}
 
-	delete[] pixels;
+	app->frameCount++;
 }
 
-void App::UpdateEntityBuffer()
+void Shutdown(App* app)
 {
-	BufferManager::MapBuffer(localUniformBuffer, GL_WRITE_ONLY);
+	ModelLoader::DestroyImport(app->importBatch);
+	app->importBatch = nullptr;
 
-	PushVec3(localUniformBuffer, cam.position);
-	PushUInt(localUniformBuffer, lights.size());
+	TextureStreamer::Destroy(app->textureStreamer);
+	app->textureStreamer = nullptr;
+}
 
-	//Light
-	for (int i = 0; i < lights.size(); ++i)
+void App::UpdateEntityBuffer(const FramePacket& packet)
+{
+	// Lights, only when they changed
+	if (packet.lightsVersion != uploadedLightsVersion)
 	{
-		BufferManager::AlignHead(localUniformBuffer, sizeof(vec4));
-
-		Light& light = lights[i];
-		PushUInt(localUniformBuffer, light.type);
-		PushVec3(localUniformBuffer, light.color);
+		ShaderLayouts::LightParams lightParams = {};
+		lightParams.lightCount = (u32)packet.lights.size();
+		for (u32 i = 0; i < lightParams.lightCount; ++i)
+		{
+			const Light& light = packet.lights[i];
+			ShaderLayouts::LightData& data = lightParams.lights[i];
+			data.type = light.type;
+			data.color = light.color;
+			data.direction = light.direction;
+			data.position = light.position;
+			data.intensity = light.intensity;
+		}
+		lightParamsSize = ShaderLayouts::LightParamsSize(lightParams.lightCount);
 
-		PushVec3(localUniformBuffer, light.direction);
-		PushVec3(localUniformBuffer, light.position);
+		BufferManager::MapBuffer(lightUniformBuffer, GL_WRITE_ONLY);
+		memcpy(lightUniformBuffer.data, &lightParams, lightParamsSize);
+		lightUniformBuffer.head = lightParamsSize;
+		BufferManager::UnmapBuffer(lightUniformBuffer);
 
-		PushFloat(localUniformBuffer, light.intensity);
+		uploadedLightsVersion = packet.lightsVersion;
+		uploadStats.lightBytes = lightParamsSize;
 	}
-	globalParamsSize = localUniformBuffer.head - globalParamsOffset;
 
-	//Entities
-	u32 iteration = 0;
-	for (auto it = entities.begin(); it != entities.end(); ++it)
+	// Static entities, only when one of them was edited. They go first so their instance indices are the transform indices.
+	if (packet.staticTransformsChanged)
 	{
-		glm::mat4 world = TransformPositionScale(it->position, it->scale);
-		glm::mat4 WVP = cam.projection * cam.view * world;
-
-		Buffer& localBuffer = localUniformBuffer;
-		BufferManager::AlignHead(localBuffer, uniformBlockAlignment);
-		it->localParamsOffset = localBuffer.head;
-		PushMat4(localBuffer, world);
-		PushMat4(localBuffer, WVP);
-		it->localParamsSize = localBuffer.head - it->localParamsOffset;
+		staticInstanceCount = (u32)packet.staticTransforms.size();
+		ASSERT(staticInstanceCount <= MAX_SHADER_INSTANCES, "The static entities do not fit in the instance buffer");
 
-		++iteration;
+		uploadStats.staticBytes = staticInstanceCount * sizeof(EntityTransform);
+		BufferManager::UploadData(instanceBuffer, 0, packet.staticTransforms.data(), uploadStats.staticBytes);
 	}
+
+	// Every frame: camera and dynamic entities
+	ShaderLayouts::FrameParams frameParams = {};
+	frameParams.viewProjection = packet.viewProjection;
+	frameParams.cameraPosition = packet.cameraPosition;
+	frameParamsSize = sizeof(frameParams);
+
+	BufferManager::MapBuffer(localUniformBuffer, GL_WRITE_ONLY);
+	memcpy(localUniformBuffer.data, &frameParams, frameParamsSize);
+	localUniformBuffer.head = frameParamsSize;
+	uploadStats.frameBytes = frameParamsSize;
+
 	BufferManager::UnmapBuffer(localUniformBuffer);
+
+	const u32 dynamicCount = (u32)packet.dynamicTransforms.size();
+	ASSERT(staticInstanceCount + dynamicCount <= MAX_SHADER_INSTANCES, "The dynamic entities do not fit in the instance buffer");
+	uploadStats.dynamicBytes = dynamicCount * sizeof(EntityTransform);
+	BufferManager::UploadData(instanceBuffer, staticInstanceCount * sizeof(EntityTransform), packet.dynamicTransforms.data(), uploadStats.dynamicBytes);
 }
 
 void App::ConfigureFrameBuffer(FrameBuffer& aConfigFB)
 {
-	aConfigFB.colorAttachment.push_back(CreateTexture());
-	aConfigFB.colorAttachment.push_back(CreateTexture(true));
-	aConfigFB.colorAttachment.push_back(CreateTexture(true));
-	aConfigFB.colorAttachment.push_back(CreateTexture(true));
+	ConfigureFrameBuffer(aConfigFB, displaySize);
+}
 
-	aConfigFB.colorAttachment.push_back(CreateTexture(true)); // oMetallic
-	aConfigFB.colorAttachment.push_back(CreateTexture(true)); // oRoughness
-	aConfigFB.colorAttachment.push_back(CreateTexture(true)); // oAo
-	aConfigFB.colorAttachment.push_back(CreateTexture(true)); // oEmissive
+void App::ConfigureFrameBuffer(FrameBuffer& aConfigFB, ivec2 size)
+{
+	aConfigFB.colorAttachment.push_back(CreateTexture(size, false));
+	aConfigFB.colorAttachment.push_back(CreateTexture(size, true));
+	aConfigFB.colorAttachment.push_back(CreateTexture(size, true));
+	aConfigFB.colorAttachment.push_back(CreateTexture(size, true));
 
-	glGenTextures(1, &aConfigFB.depthHandle);
-	glBindTexture(GL_TEXTURE_2D, aConfigFB.depthHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, displaySize.x, displaySize.y, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	aConfigFB.colorAttachment.push_back(CreateTexture(size, true)); // oMetallic
+	aConfigFB.colorAttachment.push_back(CreateTexture(size, true)); // oRoughness
+	aConfigFB.colorAttachment.push_back(CreateTexture(size, true)); // oAo
+	aConfigFB.colorAttachment.push_back(CreateTexture(size, true)); // oEmissive
+
+	aConfigFB.depthHandle = CreateDepthTexture(size, true);
 
 	glGenFramebuffers(1, &aConfigFB.fbHandle);
 	glBindFramebuffer(GL_FRAMEBUFFER, aConfigFB.fbHandle);
@@ -789,7 +1577,7 @@ void App::ConfigureFrameBuffer(FrameBuffer& aConfigFB)
 		drawBuffers.push_back(position);
 	}
 
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, aConfigFB.depthHandle, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, aConfigFB.depthHandle, 0);
 	glDrawBuffers(drawBuffers.size(), drawBuffers.data());
 
 	GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
@@ -800,87 +1588,771 @@ void App::ConfigureFrameBuffer(FrameBuffer& aConfigFB)
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void App::RenderGeometry(const Program aBindedProgram)
+void App::ConfigureForwardFrameBuffer(FrameBuffer& aConfigFB)
 {
-	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, globalParamsOffset, globalParamsSize);
-	for (auto it = entities.begin(); it != entities.end(); ++it)
+	aConfigFB.colorAttachment.push_back(CreateTexture());
+	aConfigFB.depthHandle = CreateDepthTexture();
+
+	glGenFramebuffers(1, &aConfigFB.fbHandle);
+	glBindFramebuffer(GL_FRAMEBUFFER, aConfigFB.fbHandle);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, aConfigFB.colorAttachment[0], 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, aConfigFB.depthHandle, 0);
+
+	const GLenum drawBuffer = GL_COLOR_ATTACHMENT0;
+	glDrawBuffers(1, &drawBuffer);
+
+	GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
 	{
-		glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), localUniformBuffer.handle, it->localParamsOffset, it->localParamsSize);
+		ELOG("Forward framebuffer incomplete: 0x%x\n", framebufferStatus);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-		Model& model = models[it->modelIndex];
-		Mesh& mesh = meshes[model.meshIdx];
+void App::ConfigureLightAccumFrameBuffer(FrameBuffer& aConfigFB, GLuint depthStencilHandle)
+{
+	aConfigFB.colorAttachment.push_back(CreateTexture(true));
+	aConfigFB.depthHandle = depthStencilHandle;
+
+	glGenFramebuffers(1, &aConfigFB.fbHandle);
+	glBindFramebuffer(GL_FRAMEBUFFER, aConfigFB.fbHandle);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, aConfigFB.colorAttachment[0], 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, aConfigFB.depthHandle, 0);
+
+	const GLenum drawBuffer = GL_COLOR_ATTACHMENT0;
+	glDrawBuffers(1, &drawBuffer);
+
+	GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
+	{
+		ELOG("Light accumulation framebuffer incomplete: 0x%x\n", framebufferStatus);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void App::ConfigureVisibilityFrameBuffers(VisibilityTargets& targets, ivec2 size)
+{
+	// Ids, cleared to 0 where no geometry is
+	targets.ids.colorAttachment.push_back(CreateRenderTarget(size, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT));
+	targets.ids.depthHandle = CreateDepthTexture(size, false);
+
+	glGenFramebuffers(1, &targets.ids.fbHandle);
+	glBindFramebuffer(GL_FRAMEBUFFER, targets.ids.fbHandle);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, targets.ids.colorAttachment[0], 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, targets.ids.depthHandle, 0);
+
+	const GLenum drawBuffer = GL_COLOR_ATTACHMENT0;
+	glDrawBuffers(1, &drawBuffer);
+
+	GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
+	{
+		ELOG("Visibility id framebuffer incomplete: 0x%x\n", framebufferStatus);
+	}
+
+	// Float depth, the material depth written and the one of the resolve quads compare equal without a conversion
+	targets.shade.colorAttachment.push_back(CreateTexture(size, false));
+	targets.shade.depthHandle = CreateRenderTarget(size, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT);
+
+	glGenFramebuffers(1, &targets.shade.fbHandle);
+	glBindFramebuffer(GL_FRAMEBUFFER, targets.shade.fbHandle);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, targets.shade.colorAttachment[0], 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, targets.shade.depthHandle, 0);
+	glDrawBuffers(1, &drawBuffer);
+
+	framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
+	{
+		ELOG("Visibility shade framebuffer incomplete: 0x%x\n", framebufferStatus);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void App::DestroyFrameBuffer(FrameBuffer& aConfigFB)
+{
+	glDeleteFramebuffers(1, &aConfigFB.fbHandle);
+	glDeleteTextures((GLsizei)aConfigFB.colorAttachment.size(), aConfigFB.colorAttachment.data());
+	glDeleteTextures(1, &aConfigFB.depthHandle);
+	aConfigFB = {};
+}
+
+void App::RenderGBuffer(const FramePacket& packet, const FrameBuffer& gBuffer, ivec2 size)
+{
+	glViewport(0, 0, size.x, size.y);
+	glBindFramebuffer(GL_FRAMEBUFFER, gBuffer.fbHandle);
+	glDrawBuffers(gBuffer.colorAttachment.size(), gBuffer.colorAttachment.data());
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glStencilMask(0xFF);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+	// Marks the pixels with geometry, the light volume passes skip the background
+	glEnable(GL_STENCIL_TEST);
+	glStencilFunc(GL_ALWAYS, STENCIL_GEOMETRY_BIT, STENCIL_GEOMETRY_BIT);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+	glStencilMask(STENCIL_GEOMETRY_BIT);
+
+	const Program& deferredProgram = programs[renderToFrameBufferShader];
+	glUseProgram(deferredProgram.handle);
+	RenderGeometry(packet, deferredProgram);
+
+	glStencilMask(0xFF);
+	glDisable(GL_STENCIL_TEST);
+}
+
+void App::BindGBuffer(const Program& program, const FrameBuffer& gBuffer)
+{
+	static const char* samplers[] = { "uAlbedo", "uNormals", "uPosition", "uViewDir", "uMetallic", "uRoughness", "uAO", "uEmissive" };
+	for (u32 i = 0; i < ARRAY_COUNT(samplers); ++i)
+	{
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, gBuffer.colorAttachment[i]);
+		glUniform1i(glGetUniformLocation(program.handle, samplers[i]), i);
+	}
+
+	// Depth, the light passes do not sample it while it is attached to their framebuffer
+	const GLint depthLocation = glGetUniformLocation(program.handle, "uDepth");
+	if (depthLocation != -1)
+	{
+		glActiveTexture(GL_TEXTURE8);
+		glBindTexture(GL_TEXTURE_2D, gBuffer.depthHandle);
+		glUniform1i(depthLocation, 8);
+	}
+}
+
+void App::LightGBufferQuad(const FramePacket& packet, const FrameBuffer& gBuffer, Mode mode)
+{
+	const Program& FBToBB = programs[framebufferToQuadShader];
+	glUseProgram(FBToBB.handle);
+
+	//Render Quad
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, 0, frameParamsSize);
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(2), lightUniformBuffer.handle, 0, lightParamsSize);
+
+	BindGBuffer(FBToBB, gBuffer);
+
+	glUniform1i(glGetUniformLocation(FBToBB.handle, "showAlbedo"), mode == Mode_Albedo ? 1 : 0);
+	glUniform1i(glGetUniformLocation(FBToBB.handle, "showNormals"), mode == Mode_Normals ? 1 : 0);
+	glUniform1i(glGetUniformLocation(FBToBB.handle, "showPosition"), mode == Mode_Position ? 1 : 0);
+	glUniform1i(glGetUniformLocation(FBToBB.handle, "showViewDir"), mode == Mode_ViewDirection ? 1 : 0);
+	glUniform1i(glGetUniformLocation(FBToBB.handle, "showDepth"), mode == Mode_Depth ? 1 : 0);
+
+	glUniform1i(glGetUniformLocation(FBToBB.handle, "showMetallic"), mode == Mode_Metallic ? 1 : 0);
+	glUniform1i(glGetUniformLocation(FBToBB.handle, "showRoughness"), mode == Mode_Roughness ? 1 : 0);
+	glUniform1i(glGetUniformLocation(FBToBB.handle, "showAo"), mode == Mode_Ao ? 1 : 0);
+	glUniform1i(glGetUniformLocation(FBToBB.handle, "showEmissive"), mode == Mode_Emissive ? 1 : 0);
+
+	glUniform1i(glGetUniformLocation(FBToBB.handle, "usePBR"), packet.pbr);
+
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+void App::ShadeLightVolumes(const FramePacket& packet)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, lightAccumFrameBuffer.fbHandle);
+	glViewport(0, 0, packet.displaySize.x, packet.displaySize.y);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, 0, frameParamsSize);
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(2), lightUniformBuffer.handle, 0, lightParamsSize);
+
+	glEnable(GL_BLEND);
+	glBlendEquation(GL_FUNC_ADD);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glEnable(GL_STENCIL_TEST);
+	glDepthMask(GL_FALSE);
+
+	// Ambient, emissive and directional lights, on the pixels with geometry
+	const Program& directionalProgram = programs[deferredDirectionalShader];
+	glUseProgram(directionalProgram.handle);
+	BindGBuffer(directionalProgram, defferedFrameBuffer);
+	glUniform1i(glGetUniformLocation(directionalProgram.handle, "usePBR"), packet.pbr);
+
+	glDisable(GL_DEPTH_TEST);
+	glStencilMask(0x00);
+	glStencilFunc(GL_EQUAL, STENCIL_GEOMETRY_BIT, STENCIL_GEOMETRY_BIT);
+	glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+
+	// Point lights, each on its bounding sphere
+	Mesh& sphereMesh = meshes[models[SphereModelIndex].meshIdx];
+	const Program& stencilProgram = programs[lightVolumeStencilShader];
+	const Program& volumeProgram = programs[lightVolumeShader];
+	const vec3 sphereExtent = sphereMesh.bounds.max - sphereMesh.bounds.min;
+	const f32 sphereRadius = 0.5f * glm::max(sphereExtent.x, glm::max(sphereExtent.y, sphereExtent.z));
+
+	glUseProgram(volumeProgram.handle);
+	BindGBuffer(volumeProgram, defferedFrameBuffer);
+	glUniform1i(glGetUniformLocation(volumeProgram.handle, "usePBR"), packet.pbr);
+	glUniform2f(glGetUniformLocation(volumeProgram.handle, "uDisplaySize"), (f32)packet.displaySize.x, (f32)packet.displaySize.y);
+
+	const GLint stencilVolume = glGetUniformLocation(stencilProgram.handle, "uLightVolume");
+	const GLint stencilPositionMin = glGetUniformLocation(stencilProgram.handle, "uPositionMin");
+	const GLint stencilPositionExtent = glGetUniformLocation(stencilProgram.handle, "uPositionExtent");
+	const GLint volume = glGetUniformLocation(volumeProgram.handle, "uLightVolume");
+	const GLint volumePositionMin = glGetUniformLocation(volumeProgram.handle, "uPositionMin");
+	const GLint volumePositionExtent = glGetUniformLocation(volumeProgram.handle, "uPositionExtent");
+	const GLint volumeLightIndex = glGetUniformLocation(volumeProgram.handle, "uLightIndex");
+
+	glStencilMask(STENCIL_VOLUME_MASK);
+	for (u32 l = 0; l < packet.lights.size(); ++l)
+	{
+		const Light& light = packet.lights[l];
+		if (light.type != LightType_Point)
+			continue;
+
+		// Sized for the falloff of the lighting in use, so the volume ends where the full screen quad path fades out too
+		const float influenceRadius = LightInfluenceRadius(light, packet.pbr);
+		if (influenceRadius <= 0.0f)
+			continue;
+
+		const vec4 lightVolume(light.position, influenceRadius * LIGHT_VOLUME_SCALE / sphereRadius);
+
+		// Back faces behind the surface count up, front faces behind it count down: nonzero inside the sphere.
+		// Faces clipped by the near plane do not count, so this holds with the camera inside the sphere too.
+		glUseProgram(stencilProgram.handle);
+		glUniform4fv(stencilVolume, 1, glm::value_ptr(lightVolume));
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glEnable(GL_DEPTH_TEST);
+		glDisable(GL_CULL_FACE);
+		glStencilFunc(GL_ALWAYS, 0, 0);
+		glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+		glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+		for (u32 i = 0; i < sphereMesh.submeshes.size(); ++i)
+		{
+			const SubMesh& submesh = sphereMesh.submeshes[i];
+			glBindVertexArray(FindVAO(sphereMesh, i, stencilProgram, instanceIndexBuffer.handle));
+			glUniform3fv(stencilPositionMin, 1, glm::value_ptr(submesh.bounds.min));
+			glUniform3fv(stencilPositionExtent, 1, glm::value_ptr(submesh.bounds.max - submesh.bounds.min));
+			glDrawElements(GL_TRIANGLES, submesh.indexCount, submesh.indexType, (void*)(u64)submesh.indexOffset);
+		}
+
+		// Back faces, not depth tested, so the sphere is lit with the camera inside it. Clears the count for the next light.
+		glUseProgram(volumeProgram.handle);
+		glUniform4fv(volume, 1, glm::value_ptr(lightVolume));
+		glUniform1ui(volumeLightIndex, l);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDisable(GL_DEPTH_TEST);
+		glEnable(GL_CULL_FACE);
+		glCullFace(GL_FRONT);
+		glStencilFunc(GL_NOTEQUAL, 0, STENCIL_VOLUME_MASK);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+		for (u32 i = 0; i < sphereMesh.submeshes.size(); ++i)
+		{
+			const SubMesh& submesh = sphereMesh.submeshes[i];
+			glBindVertexArray(FindVAO(sphereMesh, i, volumeProgram, instanceIndexBuffer.handle));
+			glUniform3fv(volumePositionMin, 1, glm::value_ptr(submesh.bounds.min));
+			glUniform3fv(volumePositionExtent, 1, glm::value_ptr(submesh.bounds.max - submesh.bounds.min));
+			glDrawElements(GL_TRIANGLES, submesh.indexCount, submesh.indexType, (void*)(u64)submesh.indexOffset);
+		}
+		glCullFace(GL_BACK);
+	}
+
+	glStencilMask(0xFF);
+	glDisable(GL_STENCIL_TEST);
+	glDisable(GL_BLEND);
+	glDepthMask(GL_TRUE);
 
+	ResolveLightAccumulation(packet);
+}
+
+void App::ShadeTiles(const FramePacket& packet)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, lightAccumFrameBuffer.fbHandle);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// Every class starts with no tiles
+	const u32 tileCapacity = tileCountX * tileCountY;
+	ShaderLayouts::TileClassCommand commands[TILE_CLASS_COUNT];
+	for (u32 c = 0; c < TILE_CLASS_COUNT; ++c)
+	{
+		commands[c] = { 0, 1, 1 };
+	}
+	BufferManager::UploadData(tileClassCommandBuffer, 0, commands, sizeof(commands));
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, 0, frameParamsSize);
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(2), lightUniformBuffer.handle, 0, lightParamsSize);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(3), tileClassCommandBuffer.handle);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(4), tileClassListBuffer.handle);
+
+	const Program& classifyProgram = programs[tileClassifyShader];
+	glUseProgram(classifyProgram.handle);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, defferedFrameBuffer.depthHandle);
+	glUniform1i(glGetUniformLocation(classifyProgram.handle, "uDepth"), 0);
+	glUniform2i(glGetUniformLocation(classifyProgram.handle, "uDisplaySize"), packet.displaySize.x, packet.displaySize.y);
+	glUniform1ui(glGetUniformLocation(classifyProgram.handle, "uTileCapacity"), tileCapacity);
+	glDispatchCompute(tileCountX, tileCountY, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+	// Only as many work groups as the class has tiles, the count never comes back to the CPU
+	glBindImageTexture(0, lightAccumFrameBuffer.colorAttachment[0], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, tileClassCommandBuffer.handle);
+	for (u32 c = TILE_CLASS_EMPTY + 1; c < TILE_CLASS_COUNT; ++c)
+	{
+		const Program& shadeProgram = programs[tileShadeShaders[c][packet.pbr ? 1 : 0]];
+		glUseProgram(shadeProgram.handle);
+		BindGBuffer(shadeProgram, defferedFrameBuffer);
+		glUniform1i(glGetUniformLocation(shadeProgram.handle, "uLightAccumulation"), 0);
+		glUniform2i(glGetUniformLocation(shadeProgram.handle, "uTileDisplaySize"), packet.displaySize.x, packet.displaySize.y);
+		glUniform1ui(glGetUniformLocation(shadeProgram.handle, "uClassOffset"), c * tileCapacity);
+		glDispatchComputeIndirect(c * sizeof(ShaderLayouts::TileClassCommand));
+	}
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	ResolveLightAccumulation(packet);
+}
+
+void App::ResolveLightAccumulation(const FramePacket& packet)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glDisable(GL_DEPTH_TEST);
+
+	const Program& resolveProgram = programs[deferredResolveShader];
+	glUseProgram(resolveProgram.handle);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, lightAccumFrameBuffer.colorAttachment[0]);
+	glUniform1i(glGetUniformLocation(resolveProgram.handle, "uLightAccumulation"), 0);
+	glUniform1i(glGetUniformLocation(resolveProgram.handle, "usePBR"), packet.pbr);
+
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+	glEnable(GL_DEPTH_TEST);
+
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+void App::RenderVisibility(const FramePacket& packet, const VisibilityTargets& targets, ivec2 size)
+{
+	// A bin per submesh of every model, the models past VISIBILITY_MAX_BINS are left out
+	visibilityBinBase.resize(models.size());
+	u32 binCount = 0;
+	for (u32 m = 0; m < models.size(); ++m)
+	{
+		const u32 submeshCount = (u32)meshes[models[m].meshIdx].submeshes.size();
+		visibilityBinBase[m] = binCount + submeshCount <= VISIBILITY_MAX_BINS ? binCount : UINT32_MAX;
+		binCount += submeshCount;
+	}
+	visibilityBinUsed.assign(std::min(binCount, (u32)VISIBILITY_MAX_BINS), 0);
+
+	// A draw per submesh of every visible entity, its index goes in the ids
+	visibilityDraws.clear();
+	visibilityDrawBase.resize(packet.visibleEntities.size());
+	for (u32 v = 0; v < packet.visibleEntities.size(); ++v)
+	{
+		const Renderable& renderable = packet.renderables[packet.visibleEntities[v]];
+		const Mesh& mesh = meshes[models[renderable.modelIndex].meshIdx];
+		const u32 binBase = visibilityBinBase[renderable.modelIndex];
+
+		bool fits = binBase != UINT32_MAX && visibilityDraws.size() + mesh.submeshes.size() <= VISIBILITY_MAX_DRAWS;
+		for (const SubMesh& submesh : mesh.submeshes)
+			fits = fits && submesh.indexCount / 3 <= VISIBILITY_MAX_TRIANGLES;
+		if (!fits)
+		{
+			visibilityDrawBase[v] = UINT32_MAX;
+			continue;
+		}
+
+		visibilityDrawBase[v] = (u32)visibilityDraws.size();
 		for (u32 i = 0; i < mesh.submeshes.size(); ++i)
 		{
-			GLuint vao = FindVAO(mesh, i, aBindedProgram);
-			glBindVertexArray(vao);
+			visibilityDraws.push_back({ InstanceIndex(this, renderable), binBase + i });
+			visibilityBinUsed[binBase + i] = 1;
+		}
+	}
+	BufferManager::UploadData(visibilityDrawBuffer, 0, visibilityDraws.data(), (u32)visibilityDraws.size() * sizeof(ShaderLayouts::VisibilityDraw));
+
+	// Ids, the only thing the geometry writes
+	glBindFramebuffer(GL_FRAMEBUFFER, targets.ids.fbHandle);
+	glViewport(0, 0, size.x, size.y);
+	const GLuint noDraw[4] = { 0, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, noDraw);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	const Program& idProgram = programs[visibilityShader];
+	glUseProgram(idProgram.handle);
+	RenderGeometry(packet, idProgram, true);
+
+	// Material depth of every pixel, the background keeps the cleared 1.0 no bin has
+	glBindFramebuffer(GL_FRAMEBUFFER, targets.shade.fbHandle);
+	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(5), visibilityDrawBuffer.handle, 0, visibilityDrawBuffer.size);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, targets.ids.colorAttachment[0]);
+
+	const Program& materialDepthProgram = programs[visibilityMaterialDepthShader];
+	glUseProgram(materialDepthProgram.handle);
+	glUniform1i(glGetUniformLocation(materialDepthProgram.handle, "uVisibility"), 3);
+
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthFunc(GL_ALWAYS);
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+	// Resolve, a full screen quad per bin on screen at its material depth
+	glDepthFunc(GL_EQUAL);
+	glDepthMask(GL_FALSE);
+
+	const Program& shadeProgram = programs[visibilityShadeShader];
+	const GLuint handle = shadeProgram.handle;
+	glUseProgram(handle);
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, 0, frameParamsSize);
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(2), lightUniformBuffer.handle, 0, lightParamsSize);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(1), instanceBuffer.handle, 0, instanceBuffer.size);
+
+	glUniform1i(glGetUniformLocation(handle, "uVisibility"), 3);
+	glUniform2f(glGetUniformLocation(handle, "uDisplaySize"), (f32)size.x, (f32)size.y);
+	glUniform1i(glGetUniformLocation(handle, "uTexture"), 0);
+	glUniform1i(glGetUniformLocation(handle, "uNormal"), 1);
+	glUniform1i(glGetUniformLocation(handle, "uORM"), 2);
+	glUniform1i(glGetUniformLocation(handle, "uEmissive"), 5);
+	glUniform1i(glGetUniformLocation(handle, "usePBR"), packet.pbr);
+
+	const GLint materialDepthLocation = glGetUniformLocation(handle, "uMaterialDepth");
+	const GLint useNormalTextureLocation = glGetUniformLocation(handle, "useNormalTexture");
+	const GLint useEmissiveLocation = glGetUniformLocation(handle, "useEmissive");
+	const GLint positionMinLocation = glGetUniformLocation(handle, "uPositionMin");
+	const GLint positionExtentLocation = glGetUniformLocation(handle, "uPositionExtent");
+	const GLint indexOffsetLocation = glGetUniformLocation(handle, "uIndexOffset");
+	const GLint shortIndicesLocation = glGetUniformLocation(handle, "uShortIndices");
+	const GLint positionOffsetLocation = glGetUniformLocation(handle, "uPositionOffset");
+	const GLint attributeOffsetLocation = glGetUniformLocation(handle, "uAttributeOffset");
+	const GLint attributeStrideLocation = glGetUniformLocation(handle, "uAttributeStride");
+	const GLint normalOffsetLocation = glGetUniformLocation(handle, "uNormalOffset");
+	const GLint texCoordOffsetLocation = glGetUniformLocation(handle, "uTexCoordOffset");
+	const GLint halfTexCoordsLocation = glGetUniformLocation(handle, "uHalfTexCoords");
+	const GLint tangentFrameOffsetLocation = glGetUniformLocation(handle, "uTangentFrameOffset");
+
+	for (u32 m = 0; m < models.size(); ++m)
+	{
+		if (visibilityBinBase[m] == UINT32_MAX)
+			continue;
 
-			u32 subMeshmaterialIdx = model.materialIdx[i];
-			Material& subMeshMaterial = materials[subMeshmaterialIdx];
+		const Model& model = models[m];
+		const Mesh& mesh = meshes[model.meshIdx];
+		for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+		{
+			const u32 bin = visibilityBinBase[m] + i;
+			if (!visibilityBinUsed[bin])
+				continue;
+
+			// The triangles of the ids are fetched from the mesh buffers
+			const SubMesh& submesh = mesh.submeshes[i];
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(6), mesh.vertexBufferHandle);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(7), mesh.indexBufferHandle);
+
+			const VertexStream& positionStream = submesh.streams[VERTEX_STREAM_POSITION];
+			const VertexStream& attributeStream = submesh.streams[VERTEX_STREAM_ATTRIBUTES];
+			glUniform3fv(positionMinLocation, 1, glm::value_ptr(submesh.bounds.min));
+			glUniform3fv(positionExtentLocation, 1, glm::value_ptr(submesh.bounds.max - submesh.bounds.min));
+			glUniform1ui(indexOffsetLocation, submesh.indexOffset);
+			glUniform1i(shortIndicesLocation, submesh.indexType == GL_UNSIGNED_SHORT ? 1 : 0);
+			glUniform1ui(positionOffsetLocation, positionStream.offset);
+			glUniform1ui(attributeOffsetLocation, attributeStream.offset);
+			glUniform1ui(attributeStrideLocation, attributeStream.layout.stride);
+
+			i32 normalOffset = 0;
+			i32 texCoordOffset = -1;
+			i32 tangentFrameOffset = -1;
+			bool halfTexCoords = false;
+			for (const VertexBufferAttribute& attribute : attributeStream.layout.attributes)
+			{
+				if (attribute.location == ATTRIBUTE_NORMAL)
+					normalOffset = attribute.offset;
+				else if (attribute.location == ATTRIBUTE_TEXCOORD)
+				{
+					texCoordOffset = attribute.offset;
+					halfTexCoords = attribute.type == GL_HALF_FLOAT;
+				}
+				else if (attribute.location == ATTRIBUTE_TANGENT_FRAME)
+					tangentFrameOffset = attribute.offset;
+			}
+			glUniform1ui(normalOffsetLocation, normalOffset);
+			glUniform1i(texCoordOffsetLocation, texCoordOffset);
+			glUniform1i(halfTexCoordsLocation, halfTexCoords ? 1 : 0);
+			glUniform1i(tangentFrameOffsetLocation, tangentFrameOffset);
 
-			// Albedo
+			// Same material bindings as RecordGeometry
+			const Material& subMeshMaterial = materials[model.materialIdx[i]];
 			glActiveTexture(GL_TEXTURE0);
 			glBindTexture(GL_TEXTURE_2D, textures[subMeshMaterial.albedoTextureIdx].handle);
-			glUniform1i(texturedMeshProgram_uTexture, 0);
-
-			// Normal
-			bool useNormalTexture = subMeshMaterial.bumpTextureIdx != 0 ? 1 : 0;
-			glUniform1i(glGetUniformLocation(aBindedProgram.handle, "useNormalTexture"), useNormalTexture);
+			glUniform1i(useNormalTextureLocation, subMeshMaterial.bumpTextureIdx != 0 ? 1 : 0);
 			glActiveTexture(GL_TEXTURE1);
 			glBindTexture(GL_TEXTURE_2D, textures[subMeshMaterial.bumpTextureIdx].handle);
-			glUniform1i(texturedMeshProgram_uNormal, 1);
-
-			// Metallic
 			glActiveTexture(GL_TEXTURE2);
-			glBindTexture(GL_TEXTURE_2D, textures[subMeshMaterial.specularTextureIdx].handle);
-			glUniform1i(texturedMeshProgram_uMetallic, 2);
+			glBindTexture(GL_TEXTURE_2D, textures[subMeshMaterial.ormTextureIdx].handle);
+			glUniform1i(useEmissiveLocation, subMeshMaterial.emissiveTextureIdx != 0 ? 1 : 0);
+			glActiveTexture(GL_TEXTURE5);
+			glBindTexture(GL_TEXTURE_2D, textures[subMeshMaterial.emissiveTextureIdx].handle);
 
-			//// Roughness
-			//glActiveTexture(GL_TEXTURE3);
-			//glBindTexture(GL_TEXTURE_2D, textures[subMeshMaterial.shininessTextureIdx].handle);
-			//glUniform1i(texturedMeshProgram_uRoughness, 3);
+			glUniform1f(materialDepthLocation, (bin + 1) / 65536.0f);
+			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+		}
+	}
 
-			// AO
-			glActiveTexture(GL_TEXTURE4);
-			glBindTexture(GL_TEXTURE_2D, textures[subMeshMaterial.aoTextureIdx].handle);
-			glUniform1i(texturedMeshProgram_uAO, 4);
+	glDepthMask(GL_TRUE);
+	glDepthFunc(GL_LESS);
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
 
-			// Turn On/Off emissive
-			bool useEmissive = subMeshMaterial.emissiveTextureIdx != 0 ? 1 : 0;
-			glUniform1i(glGetUniformLocation(aBindedProgram.handle, "useEmissive"), useEmissive);
+void App::RunVisibilityBenchmark(const FramePacket& packet)
+{
+	const ivec2 sizes[VISIBILITY_BENCHMARK_SIZES] = { ivec2(1920, 1080), ivec2(3840, 2160) };
 
-			// Emissive
-			glActiveTexture(GL_TEXTURE5);
-			glBindTexture(GL_TEXTURE_2D, textures[subMeshMaterial.emissiveTextureIdx].handle);
-			glUniform1i(texturedMeshProgram_uEmissive, 5);
+	GLuint queries[2];
+	glGenQueries(2, queries);
+
+	for (u32 s = 0; s < VISIBILITY_BENCHMARK_SIZES; ++s)
+	{
+		const ivec2 size = sizes[s];
+		FrameBuffer gBuffer = {};
+		ConfigureFrameBuffer(gBuffer, size);
+		VisibilityTargets targets = {};
+		ConfigureVisibilityFrameBuffers(targets, size);
+
+		// The first frame of each is not timed, the targets are new. The deferred lighting goes to the shade target too.
+		for (u32 f = 0; f <= VISIBILITY_BENCHMARK_FRAMES; ++f)
+		{
+			if (f == 1)
+				glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+
+			RenderGBuffer(packet, gBuffer, size);
+			glBindFramebuffer(GL_FRAMEBUFFER, targets.shade.fbHandle);
+			glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			LightGBufferQuad(packet, gBuffer, Mode_Deferred);
+		}
+		glEndQuery(GL_TIME_ELAPSED);
+
+		for (u32 f = 0; f <= VISIBILITY_BENCHMARK_FRAMES; ++f)
+		{
+			if (f == 1)
+				glBeginQuery(GL_TIME_ELAPSED, queries[1]);
+
+			RenderVisibility(packet, targets, size);
+		}
+		glEndQuery(GL_TIME_ELAPSED);
+
+		GLuint64 deferredNs = 0;
+		GLuint64 visibilityNs = 0;
+		glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &deferredNs);
+		glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &visibilityNs);
+
+		visibilityBenchmark.sizes[s] = size;
+		visibilityBenchmark.deferredMs[s] = deferredNs / 1000000.0 / VISIBILITY_BENCHMARK_FRAMES;
+		visibilityBenchmark.visibilityMs[s] = visibilityNs / 1000000.0 / VISIBILITY_BENCHMARK_FRAMES;
+		ILOG("Visibility buffer benchmark %dx%d: deferred %.3f ms, visibility buffer %.3f ms", size.x, size.y,
+			visibilityBenchmark.deferredMs[s], visibilityBenchmark.visibilityMs[s]);
+
+		DestroyFrameBuffer(gBuffer);
+		DestroyFrameBuffer(targets.ids);
+		DestroyFrameBuffer(targets.shade);
+	}
+
+	visibilityBenchmark.frames = VISIBILITY_BENCHMARK_FRAMES;
+	glDeleteQueries(2, queries);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, packet.displaySize.x, packet.displaySize.y);
+}
+
+void App::CollectForwardQueries()
+{
+	ForwardPassQueries& queries = forwardQueries;
+	const u32 slot = queries.next;
+	if (queries.issued[slot])
+	{
+		GLuint64 samples = 0;
+		GLuint64 shadingNs = 0;
+		GLuint64 prepassNs = 0;
+		glGetQueryObjectui64v(queries.samples[slot], GL_QUERY_RESULT, &samples);
+		glGetQueryObjectui64v(queries.shadingTime[slot], GL_QUERY_RESULT, &shadingNs);
+		if (queries.prepass[slot])
+			glGetQueryObjectui64v(queries.prepassTime[slot], GL_QUERY_RESULT, &prepassNs);
+
+		forwardPassStats.prepass = queries.prepass[slot];
+		forwardPassStats.shadedSamples = samples;
+		forwardPassStats.overdraw = queries.pixels[slot] > 0 ? (f32)samples / queries.pixels[slot] : 0.0f;
+		forwardPassStats.prepassMs = prepassNs / 1000000.0;
+		forwardPassStats.shadingMs = shadingNs / 1000000.0;
+	}
+	queries.issued[slot] = false;
+	queries.prepass[slot] = false;
+}
+
+void App::DepthPrepass(const FramePacket& packet)
+{
+	const u32 slot = forwardQueries.next;
+	forwardQueries.prepass[slot] = true;
+
+	glBeginQuery(GL_TIME_ELAPSED, forwardQueries.prepassTime[slot]);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	RenderGeometry(packet, programs[depthPrepassShader], true);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glEndQuery(GL_TIME_ELAPSED);
+}
+
+void App::ShadeForward(const FramePacket& packet, const Program& program, bool afterPrepass)
+{
+	const u32 slot = forwardQueries.next;
+
+	// The prepass left the nearest depth, only the fragments at it pass and are shaded
+	if (afterPrepass)
+	{
+		glDepthFunc(GL_LEQUAL);
+		glDepthMask(GL_FALSE);
+	}
+
+	glBeginQuery(GL_TIME_ELAPSED, forwardQueries.shadingTime[slot]);
+	glBeginQuery(GL_SAMPLES_PASSED, forwardQueries.samples[slot]);
+	RenderGeometry(packet, program);
+	glEndQuery(GL_SAMPLES_PASSED);
+	glEndQuery(GL_TIME_ELAPSED);
+
+	if (afterPrepass)
+	{
+		glDepthMask(GL_TRUE);
+		glDepthFunc(GL_LESS);
+	}
+
+	forwardQueries.issued[slot] = true;
+	forwardQueries.pixels[slot] = packet.displaySize.x * packet.displaySize.y;
+	forwardQueries.next = (slot + 1) % FORWARD_QUERY_LATENCY;
+}
 
+void App::CullLights(const FramePacket& packet)
+{
+	LightCulling::Resize(lightGrid, packet.displaySize);
+	const u32 tileBytes = (u32)lightGrid.tiles.size() * sizeof(ShaderLayouts::TileLightList);
 
-			glUniform1i(glGetUniformLocation(aBindedProgram.handle, "usePBR"), pbr);
+	lightCullingStats.binner = packet.lightBinner;
+	lightCullingStats.tileCount = (u32)lightGrid.tiles.size();
 
-			SubMesh& submesh = mesh.submeshes[i];
-			glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+	if (packet.lightBinner == LightCulling::BINNER_CPU)
+	{
+		std::vector<LightCulling::LightBounds> bounds(packet.lights.size());
+		for (u32 i = 0; i < bounds.size(); ++i)
+		{
+			const Light& light = packet.lights[i];
+			bounds[i].center = light.position;
+			bounds[i].radius = light.type == LightType_Point ? LightInfluenceRadius(light, packet.pbr) : -1.0f;
 		}
+
+		LightCulling::BinLights(lightGrid, packet.viewProjection, packet.displaySize, bounds.data(), (u32)bounds.size(), &lightCullingStats);
+		BufferManager::UploadData(tileLightBuffer, 0, lightGrid.tiles.data(), tileBytes);
+		return;
+	}
+
+	const Program& lightCullingProgram = programs[lightCullingShader];
+	glUseProgram(lightCullingProgram.handle);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, forwardFrameBuffer.depthHandle);
+	glUniform1i(glGetUniformLocation(lightCullingProgram.handle, "uDepth"), 0);
+	glUniformMatrix4fv(glGetUniformLocation(lightCullingProgram.handle, "uInverseViewProjection"), 1, GL_FALSE, glm::value_ptr(glm::inverse(packet.viewProjection)));
+	glUniform2i(glGetUniformLocation(lightCullingProgram.handle, "uDisplaySize"), packet.displaySize.x, packet.displaySize.y);
+
+	// The radii of the lighting in use, the shader does not know which one that is
+	f32 radii[MAX_SHADER_LIGHTS] = {};
+	for (u32 i = 0; i < packet.lights.size(); ++i)
+	{
+		const Light& light = packet.lights[i];
+		radii[i] = light.type == LightType_Point ? LightInfluenceRadius(light, packet.pbr) : -1.0f;
 	}
+	glUniform1fv(glGetUniformLocation(lightCullingProgram.handle, "uLightRadius"), MAX_SHADER_LIGHTS, radii);
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(2), lightUniformBuffer.handle, 0, lightParamsSize);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, BINDING(2), tileLightBuffer.handle, 0, tileBytes);
+
+	glDispatchCompute(lightGrid.tileCountX, lightGrid.tileCountY, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	glUseProgram(0);
+}
+
+void App::RenderGeometry(const FramePacket& packet, const Program aBindedProgram, bool depthOnly)
+{
+	// What the recording jobs cannot do without GL calls: create the missing VAOs and locate the uniforms
+	for (const Model& model : models)
+	{
+		Mesh& mesh = meshes[model.meshIdx];
+		for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+			FindVAO(mesh, i, aBindedProgram, instanceIndexBuffer.handle);
+	}
+
+	GeometryUniforms uniforms;
+	uniforms.depthOnly = depthOnly;
+	uniforms.texture = glGetUniformLocation(aBindedProgram.handle, "uTexture");
+	uniforms.normal = glGetUniformLocation(aBindedProgram.handle, "uNormal");
+	uniforms.orm = glGetUniformLocation(aBindedProgram.handle, "uORM");
+	uniforms.emissive = glGetUniformLocation(aBindedProgram.handle, "uEmissive");
+	uniforms.useNormalTexture = glGetUniformLocation(aBindedProgram.handle, "useNormalTexture");
+	uniforms.useEmissive = glGetUniformLocation(aBindedProgram.handle, "useEmissive");
+	uniforms.usePBR = glGetUniformLocation(aBindedProgram.handle, "usePBR");
+	uniforms.positionMin = glGetUniformLocation(aBindedProgram.handle, "uPositionMin");
+	uniforms.positionExtent = glGetUniformLocation(aBindedProgram.handle, "uPositionExtent");
+	uniforms.drawIndex = glGetUniformLocation(aBindedProgram.handle, "uDrawIndex");
+
+	// One list per slice of the visible entities, recorded by the job threads and replayed here in order
+	const u32 visibleCount = (u32)packet.visibleEntities.size();
+	const u32 listCount = (visibleCount + COMMAND_RECORD_GRAIN - 1) / COMMAND_RECORD_GRAIN;
+	if (geometryCommands.size() < listCount)
+		geometryCommands.resize(listCount);
+
+	const f64 recordStart = glfwGetTime();
+	JobSystem::ParallelFor("Record commands", visibleCount, COMMAND_RECORD_GRAIN, [&](u32 begin, u32 end)
+	{
+		CommandList::List& list = geometryCommands[begin / COMMAND_RECORD_GRAIN];
+		CommandList::Clear(list);
+		RecordGeometry(this, packet, aBindedProgram, uniforms, begin, end, list);
+	});
+	const f64 replayStart = glfwGetTime();
+
+	CommandList::Replay(geometryCommands.data(), listCount, &commandStats);
+	const f64 replayEnd = glfwGetTime();
+
+	JobSystem::RecordMarker("Replay commands", replayStart, replayEnd);
+	commandStats.recordMs += (replayStart - recordStart) * 1000.0;
+	commandStats.replayMs += (replayEnd - replayStart) * 1000.0;
+}
+
+const GLuint App::CreateDepthTexture(const bool withStencil)
+{
+	return CreateDepthTexture(displaySize, withStencil);
+}
+
+const GLuint App::CreateDepthTexture(ivec2 size, const bool withStencil)
+{
+	if (withStencil)
+		return CreateRenderTarget(size, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+	return CreateRenderTarget(size, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE);
 }
 
 const GLuint App::CreateTexture(const bool isFloatingPoint)
 {
-	GLuint texturehandle = 0;
+	return CreateTexture(displaySize, isFloatingPoint);
+}
 
+const GLuint App::CreateTexture(ivec2 size, const bool isFloatingPoint)
+{
 	GLenum internalFormat = isFloatingPoint ? GL_RGBA16F : GL_RGBA8;
 	GLenum format = GL_RGBA;
 	GLenum dataType = isFloatingPoint ? GL_FLOAT : GL_UNSIGNED_BYTE;
 
-	glGenTextures(1, &texturehandle);
-	glBindTexture(GL_TEXTURE_2D, texturehandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, displaySize.x, displaySize.y, 0, format, dataType, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	return texturehandle;
+	return CreateRenderTarget(size, internalFormat, format, dataType);
 }
 
 void App::InitBloomEffect()
@@ -957,9 +2429,11 @@ void App::InitBloomEffect()
 	}
 }
 
-void App::PassBlitBrightPixels(FrameBuffer& fb, GLuint inputTexture, float threshold)
+void App::PassBlitBrightPixels(const FramePacket& packet, FrameBuffer& fb, GLuint inputTexture)
 {
-	if (bloom.showBrightest)
+	const ivec2& displaySize = packet.displaySize;
+
+	if (packet.bloom.showBrightest)
 	{
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
@@ -981,7 +2455,7 @@ void App::PassBlitBrightPixels(FrameBuffer& fb, GLuint inputTexture, float thres
 	glBindTexture(GL_TEXTURE_2D, inputTexture);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glUniform1i(glGetUniformLocation(blitBrightestProgram.handle, "colorTexture"), 0);
-	glUniform1f(glGetUniformLocation(blitBrightestProgram.handle, "threshold"), threshold);
+	glUniform1f(glGetUniformLocation(blitBrightestProgram.handle, "threshold"), packet.bloom.threshold);
 
 	// Render the square
 	glDrawArrays(GL_TRIANGLES, 0, 4);
@@ -1018,7 +2492,7 @@ void App::PassBlitBrightPixels(FrameBuffer& fb, GLuint inputTexture, float thres
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void App::PassBlur(FrameBuffer& fb, vec2 viewportSize, GLenum colorAttachment, GLuint inputTexture, GLuint lod, vec2 direction)
+void App::PassBlur(const FramePacket& packet, FrameBuffer& fb, vec2 viewportSize, GLenum colorAttachment, GLuint inputTexture, GLuint lod, vec2 direction)
 {
 	glBindFramebuffer(GL_FRAMEBUFFER, fb.fbHandle);
 	glDrawBuffer(colorAttachment);
@@ -1039,7 +2513,7 @@ void App::PassBlur(FrameBuffer& fb, vec2 viewportSize, GLenum colorAttachment, G
 
 	glUniform1i(glGetUniformLocation(blurProgram.handle, "colorMap"), 0);
 	glUniform1i(glGetUniformLocation(blurProgram.handle, "inputLod"), lod);
-	glUniform1i(glGetUniformLocation(blurProgram.handle, "kernelRadius"), bloom.kernerRadius);
+	glUniform1i(glGetUniformLocation(blurProgram.handle, "kernelRadius"), packet.bloom.kernerRadius);
 	glUniform2f(glGetUniformLocation(blurProgram.handle, "direction"), direction.x, direction.y);
 
 	// Render the square
@@ -1064,8 +2538,10 @@ void App::PassBlur(FrameBuffer& fb, vec2 viewportSize, GLenum colorAttachment, G
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void App::PassBloom(GLenum colorAttachment, GLuint inputTexture, GLuint maxLod)
+void App::PassBloom(const FramePacket& packet, GLenum colorAttachment, GLuint inputTexture, GLuint maxLod)
 {
+	const ivec2& displaySize = packet.displaySize;
+
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	glDrawBuffer(GL_COLOR_ATTACHMENT0);
 
@@ -1081,7 +2557,7 @@ void App::PassBloom(GLenum colorAttachment, GLuint inputTexture, GLuint maxLod)
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, inputTexture);
 	glUniform1i(glGetUniformLocation(program.handle, "colorMap"), 0);
-	glUniform1fv(glGetUniformLocation(program.handle, "lodIntensity"), 5, bloom.lodIntensity);
+	glUniform1fv(glGetUniformLocation(program.handle, "lodIntensity"), 5, packet.bloom.lodIntensity);
 	glUniform1i(glGetUniformLocation(program.handle, "maxLod"), maxLod);
 
 	// Render the square
@@ -6,9 +6,20 @@
 
 #include "platform.h"
 #include "BufferSuppFuncs.h"
+#include "BVH.h"
+#include "TextureStreamer.h"
+#include "AssetRegistry.h"
+#include "JobSystem.h"
+#include "CommandList.h"
+#include "Entities.h"
+#include "ShaderLayouts.h"
+#include "LightCulling.h"
 //#include "ModelLoaderFuncs.h"
 #include "Globals.h"
 
+#include <imgui.h>
+#include <atomic>
+
 const VertexV3V2 vertices[] = {
     {glm::vec3(-1.0,-1.0,0.0), glm::vec2(0.0,0.0)},
     {glm::vec3(1.0,-1.0,0.0), glm::vec2(1.0,0.0)},
@@ -22,13 +33,17 @@ const u16 indices[] =
     0,2,3
 };
 
-struct Bloom
+struct BloomSettings
 {
     bool active = false;
     bool showBrightest = false;
     int kernerRadius = 8;
     float threshold = 1.0;
     float lodIntensity[5] = { 1.0 };
+};
+
+struct Bloom
+{
     GLuint rtBright; // For blitting brightest pixels and vertical blur
     GLuint rtBloomH; // For first pass horizontal blur
     std::vector<FrameBuffer>fbBloom;
@@ -63,23 +78,269 @@ struct Camera
     void LookAround(float xoffset, float yoffset);
 };
 
+// A model registered by Init and loaded by the main loop once the first frame is out
+struct PendingModel
+{
+    std::string filepath;
+    u32         modelIdx;
+};
+
+struct StartupMetrics
+{
+    f64 timeToFirstFrame;  // Seconds from startup until the first frame was presented
+    f64 timeToFullyLoaded; // Seconds from startup until every model and texture was in
+    u32 modelsRequested;
+    u32 modelsLoaded;
+};
+
+// Milliseconds to import the startup models from their sources, by thread count
+struct ImportBenchmarkResult
+{
+    u32 modelCount;
+    u32 meshCount;
+    u32 runCount;
+    u32 threadCounts[16];
+    f64 importMs[16];
+};
+
+namespace ModelLoader
+{
+    struct ImportBatch;
+}
+
+// World matrix of an entity, its entry in the instance buffer. The shaders apply the view projection.
+typedef ShaderLayouts::InstanceData EntityTransform;
+
+// Render component of an entity, as the render thread needs it
+struct Renderable
+{
+    u32                modelIndex;
+    u32                transformIndex; // Into the transforms of its mobility
+    Entities::Mobility mobility;
+};
+
+// Stencil bits of the G-buffer depth: set where geometry was drawn, and the face count of the light volume being lit
+#define STENCIL_GEOMETRY_BIT 0x80
+#define STENCIL_VOLUME_MASK 0x7F
+// The faces of the 8x8 sphere mesh come in to cos(pi/8)^2 of its radius, a light volume is scaled up to contain the sphere
+#define LIGHT_VOLUME_SCALE 1.18f
+// Side in pixels of the screen tiles TILE_CLASSIFY sorts, the local size of it and of the TILE_SHADE programs
+#define DEFERRED_TILE_SIZE 16
+
+// How Mode_Deferred lights the G-buffer
+enum DeferredLighting
+{
+    DEFERRED_LIGHTING_QUAD,    // FB_TO_BB on one full screen quad, every pixel against every light
+    DEFERRED_LIGHTING_VOLUMES, // Point lights on their bounding spheres, stencil masked
+    DEFERRED_LIGHTING_TILES,   // Screen tiles sorted by what they cover, every class shaded by its own compute program
+    DEFERRED_LIGHTING_COUNT
+};
+
+// What the pixels of a screen tile hold, the index of its dispatch in tileClassCommandBuffer
+enum TileClass
+{
+    TILE_CLASS_EMPTY, // No geometry, not shaded
+    TILE_CLASS_EDGE,  // Geometry and background, every pixel tests its depth
+    TILE_CLASS_FULL,  // Geometry everywhere
+    TILE_CLASS_COUNT
+};
+
+// Frames the forward pass queries are read back late by, so the render thread never waits on them
+#define FORWARD_QUERY_LATENCY 3
+
+// Shading work of the forward modes, from queries FORWARD_QUERY_LATENCY frames old
+struct ForwardPassStats
+{
+    bool prepass;
+    u64  shadedSamples; // Samples that passed the depth test in the shading pass, each one ran the lighting
+    f32  overdraw;      // shadedSamples per pixel of the display
+    f64  prepassMs;     // GPU time
+    f64  shadingMs;     // GPU time
+};
+
+struct ForwardPassQueries
+{
+    GLuint samples[FORWARD_QUERY_LATENCY];     // GL_SAMPLES_PASSED of the shading pass
+    GLuint prepassTime[FORWARD_QUERY_LATENCY]; // GL_TIME_ELAPSED
+    GLuint shadingTime[FORWARD_QUERY_LATENCY]; // GL_TIME_ELAPSED
+    bool   issued[FORWARD_QUERY_LATENCY];
+    bool   prepass[FORWARD_QUERY_LATENCY];
+    u32    pixels[FORWARD_QUERY_LATENCY];
+    u32    next;
+};
+
+// Render targets of Mode_Visibility
+struct VisibilityTargets
+{
+    FrameBuffer ids;   // R32UI ids over the depth of the geometry
+    FrameBuffer shade; // RGBA8 over the material depth (D32F) the resolve of every bin tests against
+};
+
+// Frames timed per pipeline and resolution by the visibility buffer benchmark
+#define VISIBILITY_BENCHMARK_FRAMES 16
+#define VISIBILITY_BENCHMARK_SIZES 2
+
+// GPU milliseconds per frame of the visible entities at 1080p and 4K, offscreen with the camera of the frame
+struct VisibilityBenchmarkResult
+{
+    u32   frames; // 0 until a run finished
+    ivec2 sizes[VISIBILITY_BENCHMARK_SIZES];
+    f64   deferredMs[VISIBILITY_BENCHMARK_SIZES];   // G-buffer and full screen quad lighting
+    f64   visibilityMs[VISIBILITY_BENCHMARK_SIZES]; // Ids, material depth and the resolve of every bin
+};
+
+// Bytes written to uniform buffers by the render thread in a frame, alignment padding included
+struct UploadStats
+{
+    u32 frameBytes;   // Camera, every frame
+    u32 dynamicBytes; // Dynamic entity instance data, every frame
+    u32 staticBytes;  // Static entity instance data, when one was edited
+    u32 lightBytes;   // Lights, when they changed
+};
+
+/**
+ * Everything the render thread draws a frame from. The main thread fills it in (see BuildFramePacket)
+ * and leaves it alone from the moment it is submitted until the frame is rendered.
+ */
+struct FramePacket
+{
+    ivec2                        displaySize;
+
+    vec3                         cameraPosition;
+    glm::mat4                    viewProjection;
+
+    std::vector<EntityTransform> dynamicTransforms;       // By dynamic transform index
+    std::vector<EntityTransform> staticTransforms;        // By static transform index, only when staticTransformsChanged
+    bool                         staticTransformsChanged;
+    std::vector<Renderable>      renderables;             // By render component index
+    std::vector<u32>             visibleEntities;         // Into renderables
+    std::vector<Light>           lights;
+    u32                          lightsVersion;
+
+    Mode                         mode;
+    bool                         pbr;
+    bool                         depthPrepass; // Mode_Forward, Mode_ForwardPlus always has one
+    DeferredLighting             deferredLighting; // Mode_Deferred
+    LightCulling::Binner         lightBinner;  // Mode_ForwardPlus
+    bool                         visibilityBenchmark; // Run RunVisibilityBenchmark before the frame
+    BloomSettings                bloom;
+
+    ImDrawData                   imguiDrawData; // Points to copies of the ImGui draw lists, see RenderThread
+};
+
 struct App
 {
-    void UpdateEntityBuffer();
+    void UpdateEntityBuffer(const FramePacket& packet);
 
     void ConfigureFrameBuffer(FrameBuffer& aConfigFB);
 
-    void RenderGeometry(const Program aBindedProgram);
+    void ConfigureFrameBuffer(FrameBuffer& aConfigFB, ivec2 size);
+
+    void ConfigureForwardFrameBuffer(FrameBuffer& aConfigFB);
+
+    /**
+     * One color target, RGBA16F, over the depth and stencil of the G-buffer.
+     */
+    void ConfigureLightAccumFrameBuffer(FrameBuffer& aConfigFB, GLuint depthStencilHandle);
+
+    /**
+     * The ids and shade framebuffers of the visibility buffer, size pixels.
+     */
+    void ConfigureVisibilityFrameBuffers(VisibilityTargets& targets, ivec2 size);
+
+    /**
+     * Deletes the framebuffer and its attachments.
+     */
+    void DestroyFrameBuffer(FrameBuffer& aConfigFB);
+
+    const GLuint CreateDepthTexture(const bool withStencil = false);
+
+    const GLuint CreateDepthTexture(ivec2 size, const bool withStencil);
+
+    /**
+     * Draws the visible entities with the program. Depth only draws skip the material textures and uniforms.
+     */
+    void RenderGeometry(const FramePacket& packet, const Program aBindedProgram, bool depthOnly = false);
+
+    /**
+     * Reads the forward pass queries issued FORWARD_QUERY_LATENCY frames ago into forwardPassStats,
+     * before DepthPrepass and ShadeForward reuse them.
+     */
+    void CollectForwardQueries();
+
+    /**
+     * Depth only draw of the visible entities with a position only program.
+     */
+    void DepthPrepass(const FramePacket& packet);
+
+    /**
+     * Lit draw of the visible entities, after a prepass it only shades the fragments at the depth the prepass left.
+     */
+    void ShadeForward(const FramePacket& packet, const Program& program, bool afterPrepass);
+
+    /**
+     * Fills in tileLightBuffer for Mode_ForwardPlus, the depth prepass must be in forwardFrameBuffer.
+     */
+    void CullLights(const FramePacket& packet);
+
+    /**
+     * Draws the visible entities into the G-buffer and marks their pixels with STENCIL_GEOMETRY_BIT.
+     */
+    void RenderGBuffer(const FramePacket& packet, const FrameBuffer& gBuffer, ivec2 size);
+
+    /**
+     * Binds the G-buffer attachments to texture units 0-8 and points the samplers of FB_TO_BB at them, the depth only if the program samples it.
+     */
+    void BindGBuffer(const Program& program, const FrameBuffer& gBuffer);
+
+    /**
+     * Lights the G-buffer with FB_TO_BB on a full screen quad, into the bound framebuffer. The G-buffer modes show the attachment of the mode instead.
+     */
+    void LightGBufferQuad(const FramePacket& packet, const FrameBuffer& gBuffer, Mode mode);
+
+    /**
+     * Lights the G-buffer into lightAccumFrameBuffer: ambient and directional lights on a full screen quad, every
+     * point light on its bounding sphere, stencil masked to the pixels inside it. Then tonemaps it to the back buffer.
+     * The G-buffer pass must have marked its pixels with STENCIL_GEOMETRY_BIT.
+     */
+    void ShadeLightVolumes(const FramePacket& packet);
+
+    /**
+     * Lights the G-buffer into lightAccumFrameBuffer with compute: TILE_CLASSIFY sorts the screen tiles into
+     * per class lists and counts them into the indirect dispatches, then every class but TILE_CLASS_EMPTY is
+     * shaded by the TILE_SHADE program made for it. Then tonemaps it to the back buffer.
+     */
+    void ShadeTiles(const FramePacket& packet);
+
+    /**
+     * Tonemaps lightAccumFrameBuffer to the back buffer.
+     */
+    void ResolveLightAccumulation(const FramePacket& packet);
+
+    /**
+     * Draws the visible entities into the ids of the visibility buffer, then resolves it into the shade framebuffer:
+     * every pixel gets the depth of its bin (model submesh), then every bin on screen is shaded on a full screen
+     * quad at that depth, fetching the vertices of its triangles from the mesh buffers.
+     */
+    void RenderVisibility(const FramePacket& packet, const VisibilityTargets& targets, ivec2 size);
+
+    /**
+     * Times Mode_Deferred with the full screen quad lighting against Mode_Visibility at 1920x1080 and 3840x2160,
+     * offscreen and VISIBILITY_BENCHMARK_FRAMES frames each, into visibilityBenchmark. Waits for the GPU.
+     */
+    void RunVisibilityBenchmark(const FramePacket& packet);
 
     const GLuint CreateTexture(const bool isFloatingPoint = false);
 
+    const GLuint CreateTexture(ivec2 size, const bool isFloatingPoint);
+
     void InitBloomEffect();
 
-    void PassBlitBrightPixels(FrameBuffer& fb, GLuint inputTexture, float threshold);
+    void PassBlitBrightPixels(const FramePacket& packet, FrameBuffer& fb, GLuint inputTexture);
 
-    void PassBlur(FrameBuffer& fb,vec2 viewportSize, GLenum colorAttachment, GLuint inputTexture, GLuint lod, vec2 direction);
+    void PassBlur(const FramePacket& packet, FrameBuffer& fb,vec2 viewportSize, GLenum colorAttachment, GLuint inputTexture, GLuint lod, vec2 direction);
 
-    void PassBloom(GLenum colorAttachment, GLuint inputTexture, GLuint maxLod);
+    void PassBloom(const FramePacket& packet, GLenum colorAttachment, GLuint inputTexture, GLuint maxLod);
 
     // Loop
     f32  deltaTime;
@@ -99,6 +360,7 @@ struct App
 
     std::vector<Texture>    textures;
     std::vector<Material>   materials;
+    AssetRegistry::Registry registry; // Finds loaded textures and materials
     std::vector<Mesh>       meshes;
     std::vector<Model>      models;
     std::vector<Program>    programs;
@@ -112,18 +374,42 @@ struct App
     GLuint renderToFrameBufferShaderNoPBR;
     GLuint framebufferToQuadShaderNoPBR;
     
+    // Forward+
+    GLuint depthPrepassShader;
+    GLuint forwardPlusShader;
+    GLuint lightCullingShader; // Compute
+
+    // Deferred light volumes
+    GLuint deferredDirectionalShader;
+    GLuint lightVolumeShader;
+    GLuint lightVolumeStencilShader;
+    GLuint deferredResolveShader;
+
+    // Deferred tile classification
+    GLuint tileClassifyShader; // Compute
+    GLuint tileShadeShaders[TILE_CLASS_COUNT][2]; // Compute, by class and usePBR, none for TILE_CLASS_EMPTY
+
+    // Visibility buffer
+    GLuint visibilityShader;
+    GLuint visibilityMaterialDepthShader;
+    GLuint visibilityShadeShader;
+
     // for bloom
     GLuint blitBrightestPixelsShader;
     GLuint blurShader;
     GLuint bloomShader;
 
     //u32 patricioModel = 0;
-    GLuint texturedMeshProgram_uTexture;
-    GLuint texturedMeshProgram_uMetallic;
-    GLuint texturedMeshProgram_uRoughness;
-    GLuint texturedMeshProgram_uAO;
-    GLuint texturedMeshProgram_uNormal;
-    GLuint texturedMeshProgram_uEmissive;
+
+    // Decodes and uploads the material textures in the background
+    TextureStreamer::Streamer* textureStreamer;
+
+    // Progressive startup, the pending models are imported by importBatch after the first frame
+    std::deque<PendingModel> pendingModels;
+    ModelLoader::ImportBatch* importBatch = nullptr;
+    ImportBenchmarkResult importBenchmark = {};
+    StartupMetrics startup = {};
+    std::atomic<u64> frameCount; // Frames rendered by the render thread
 
     // texture indices
     u32 diceTexIdx;
@@ -153,26 +439,95 @@ struct App
 
     GLint maxUniformBufferSize;
     GLint uniformBlockAlignment;
-    Buffer localUniformBuffer;
-    std::vector<Entity> entities;
+    Buffer localUniformBuffer;  // Camera, rewritten every frame
+    Buffer lightUniformBuffer;  // Rewritten when the lights change
+    Buffer instanceBuffer;      // InstanceParams: the static entities, rewritten when one of them is edited, then the dynamic ones
+    Buffer instanceIndexBuffer; // 0 to MAX_SHADER_INSTANCES - 1, the per instance aInstanceIndex attribute reads it from the base instance on
+    u32 staticInstanceCount = 0; // Render thread, static entities in instanceBuffer, the dynamic ones follow
+    u32 uploadedLightsVersion = UINT32_MAX; // Render thread, lights version in lightUniformBuffer
+    UploadStats uploadStats = {};           // Render thread, of the frame being rendered
+    std::vector<CommandList::List> geometryCommands; // Render thread, recorded by RenderGeometry, reused every frame
+    CommandList::Stats commandStats = {};            // Render thread, of the frame being rendered
+    Entities::Registry entities; // Entities and their transform, render and light proxy components
+    u32 rebuiltWorlds = 0;       // World matrices rebuilt by the last BuildFramePacket
+    u32 sentStaticVersion = UINT32_MAX; // Static transforms version last put in a packet
+    u32 lightsVersion = 0;              // Bumped whenever a light changes
     std::vector<Light> lights;
 
-    FrameBuffer defferedFrameBuffer;
+    // Scene acceleration structure over the entity world bounds (item id = render component index)
+    BVH::Tree sceneBVH;
+    std::vector<u32> visibleEntities; // Render component indices
+    EntityHandle pickedEntity;
+    i32 selectedLight = -1;
+    BVH::BenchmarkResult bvhBenchmark = {};
+    Transforms::BenchmarkResult transformBenchmark[TRANSFORM_BENCHMARK_SIZES] = {};
 
-    GLuint globalParamsOffset;
-    GLuint globalParamsSize;
+    FrameBuffer defferedFrameBuffer;
+    FrameBuffer forwardFrameBuffer; // Mode_ForwardPlus, color and a depth texture the light culling reads
+    FrameBuffer lightAccumFrameBuffer; // Mode_Deferred light volumes, HDR
+
+    DeferredLighting deferredLighting = DEFERRED_LIGHTING_VOLUMES; // Mode_Deferred
+    u32 tileCountX = 0;
+    u32 tileCountY = 0;
+    Buffer tileClassCommandBuffer; // TileClassCommands, the indirect dispatch of every class
+    Buffer tileClassListBuffer;    // TileClassLists
+
+    VisibilityTargets visibilityTargets; // Mode_Visibility
+    Buffer visibilityDrawBuffer;         // VisibilityDraws
+    std::vector<ShaderLayouts::VisibilityDraw> visibilityDraws; // Render thread, of the frame being rendered
+    std::vector<u32> visibilityDrawBase; // Render thread, draw index of the first submesh of every visible entity, UINT32_MAX when left out
+    std::vector<u32> visibilityBinBase;  // Render thread, bin of the first submesh of every model, UINT32_MAX past VISIBILITY_MAX_BINS
+    std::vector<u8> visibilityBinUsed;   // Render thread, bins on screen
+    bool visibilityBenchmarkRequested = false;          // Main thread, until the next packet
+    VisibilityBenchmarkResult visibilityBenchmark = {}; // Render thread
+
+    LightCulling::Binner lightBinner = LightCulling::BINNER_GPU;
+    LightCulling::Grid lightGrid;         // Render thread, CPU binner
+    Buffer tileLightBuffer;               // TileLightParams
+    LightCulling::Stats lightCullingStats = {}; // Render thread, of the frame being rendered
+
+    bool depthPrepass = false; // Mode_Forward
+    ForwardPassQueries forwardQueries = {}; // Render thread
+    ForwardPassStats forwardPassStats = {}; // Render thread, kept until newer query results come in
+
+    GLuint frameParamsSize;
+    GLuint lightParamsSize;
 
     GLuint prefinalTextureID = 0;
 
     Bloom bloom;
+    BloomSettings bloomSettings;
 
     bool pbr = false;
 };
 
+/**
+ * Runs before the render thread starts, with the GL context on the calling thread.
+ */
 void Init(App* app);
 
 void Gui(App* app);
 
 void Update(App* app);
 
-void Render(App* app);
+/**
+ * Main thread, after Update. Fills in the packet the render thread draws the frame from.
+ */
+void BuildFramePacket(App* app, FramePacket& packet);
+
+/**
+ * Render thread, while the main thread waits for it to take the packet. The GL thread jobs (model
+ * uploads) and the texture streamer change the meshes, materials and textures here, the main
+ * thread and the rendering only read them.
+ */
+void UpdateRenderResources(App* app);
+
+/**
+ * Render thread. Draws the frame of the packet.
+ */
+void Render(App* app, const FramePacket& packet);
+
+/**
+ * Runs once the render thread stopped, with the GL context back on the calling thread.
+ */
+void Shutdown(App* app);
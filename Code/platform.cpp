@@ -12,10 +12,13 @@
 #else
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
 #include "engine.h"
+#include "RenderThread.h"
 #include <stdio.h>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
@@ -165,7 +168,7 @@ int main()
     io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;       // Enable Keyboard Controls
     //io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;      // Enable Gamepad Controls
     io.ConfigFlags |= ImGuiConfigFlags_DockingEnable;           // Enable Docking
-    io.ConfigFlags |= ImGuiConfigFlags_ViewportsEnable;         // Enable Multi-Viewport / Platform Windows
+    //io.ConfigFlags |= ImGuiConfigFlags_ViewportsEnable;       // Platform windows would need GL on the render thread but the windows made on this one
     //io.ConfigViewportsNoAutoMerge = true;
     //io.ConfigViewportsNoTaskBarIcon = true;
 
@@ -193,19 +196,30 @@ int main()
         return -1;
     }
 
+    // Device objects and font atlas now, the render thread only draws
+    ImGui_ImplOpenGL3_NewFrame();
+
     f64 lastFrameTime = glfwGetTime();
 
     GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
 
+    // One worker per core, this thread is the main one
+    JobSystem::Init();
+
     Init(&app);
 
+    // The GL context belongs to the render thread from here on
+    RenderThread::Start(window, &app);
+
     while (app.isRunning)
     {
+        // Wait for a free frame packet before reading the input, so it is as recent as the pacing allows
+        FramePacket& packet = RenderThread::BeginFrame();
+
         // Tell GLFW to call platform callbacks
         glfwPollEvents();
 
         // ImGui
-        ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
         Gui(&app);
@@ -236,20 +250,9 @@ int main()
 
         app.input.mouseDelta = glm::vec2(0.0f, 0.0f);
 
-        // Render
-        Render(&app);
-
-        // ImGui Render
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable) {
-            GLFWwindow* backup_current_context = glfwGetCurrentContext();
-            ImGui::UpdatePlatformWindows();
-            ImGui::RenderPlatformWindowsDefault();
-            glfwMakeContextCurrent(backup_current_context);
-        }
-
-        // Present image on screen
-        glfwSwapBuffers(window);
+        // Render, the render thread draws and presents the packet while the next frame is updated
+        BuildFramePacket(&app, packet);
+        RenderThread::SubmitFrame(ImGui::GetDrawData());
 
         // Frame time
         f64 currentFrameTime = glfwGetTime();
@@ -258,8 +261,16 @@ int main()
 
         // Reset frame allocator
         GlobalFrameArenaHead = 0;
+
+        JobSystem::EndFrame();
     }
 
+    RenderThread::Stop();
+
+    Shutdown(&app);
+
+    JobSystem::Shutdown();
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
@@ -397,6 +408,81 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
     return 0;
 }
 
+MappedFile MapFile(const char* filepath)
+{
+    MappedFile mappedFile = {};
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return mappedFile;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return mappedFile;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        CloseHandle(file);
+        return mappedFile;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == NULL)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return mappedFile;
+    }
+
+    mappedFile.data = (const u8*)view;
+    mappedFile.size = (u64)size.QuadPart;
+    mappedFile.fileHandle = file;
+    mappedFile.mappingHandle = mapping;
+#else
+    int file = open(filepath, O_RDONLY);
+    if (file < 0)
+        return mappedFile;
+
+    struct stat attrib;
+    if (fstat(file, &attrib) != 0 || attrib.st_size == 0)
+    {
+        close(file);
+        return mappedFile;
+    }
+
+    void* view = mmap(NULL, attrib.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (view == MAP_FAILED)
+        return mappedFile;
+
+    mappedFile.data = (const u8*)view;
+    mappedFile.size = (u64)attrib.st_size;
+#endif
+
+    return mappedFile;
+}
+
+void UnmapFile(MappedFile& file)
+{
+    if (file.data == NULL)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(file.data);
+    CloseHandle((HANDLE)file.mappingHandle);
+    CloseHandle((HANDLE)file.fileHandle);
+#else
+    munmap((void*)file.data, file.size);
+#endif
+
+    file = {};
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
@@ -33,6 +33,22 @@ String ReadTextFile(const char* filepath);
  */
 u64 GetFileLastWriteTimestamp(const char* filepath);
 
+struct MappedFile
+{
+    const u8* data;
+    u64       size;
+    void*     fileHandle;
+    void*     mappingHandle;
+};
+
+/**
+ * Maps a whole file read-only into the address space, so its contents are paged
+ * in on demand instead of being copied. data is NULL if the file could not be mapped.
+ */
+MappedFile MapFile(const char* filepath);
+
+void UnmapFile(MappedFile& file);
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+// VISIBILITY is the same pass, writing which triangle of which draw covers the pixel
+#if defined(DEPTH_PREPASS) || defined(VISIBILITY)
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+// Positions only, the VAOs of this program never bind the attribute stream
+layout(location = 0) in vec4 aPosition;     // unorm16 quantized against the submesh bounds
+layout(location = 4) in uint aInstanceIndex; // Per instance, from the base instance of the draw on
+
+uniform vec3 uPositionMin;
+uniform vec3 uPositionExtent;
+
+layout(binding=0, std140) uniform FrameParams
+{
+	mat4 uViewProjection;
+	vec3 uCameraPosition;
+};
+
+struct InstanceData
+{
+	mat4 world;
+};
+
+layout(binding=1, std430) readonly buffer InstanceParams
+{
+	InstanceData uInstances[];
+};
+
+// Same expression as the shading passes, so they hit exactly the depth written here
+invariant gl_Position;
+
+void main()
+{
+	vec3 position = uPositionMin + aPosition.xyz * uPositionExtent;
+	mat4 world = uInstances[aInstanceIndex].world;
+	vec3 worldPosition = vec3(world * vec4(position, 1.0));
+
+	gl_Position = uViewProjection * vec4(worldPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) && defined(VISIBILITY) ////////////////////////
+
+#define VISIBILITY_TRIANGLE_BITS 20 // VISIBILITY_TRIANGLE_BITS
+
+uniform int uDrawIndex; // Into uDraws (VisibilityDraws)
+
+layout(location = 0) out uint oVisibility;
+
+void main()
+{
+	oVisibility = (uint(uDrawIndex + 1) << VISIBILITY_TRIANGLE_BITS) | uint(gl_PrimitiveID);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+void main()
+{
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+// Full screen, writes the depth of the bin of the draw in every pixel of the visibility buffer.
+// The resolve of a bin then only runs on its pixels, with an equal depth test.
+#ifdef VISIBILITY_MATERIAL_DEPTH
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+
+void main()
+{
+	gl_Position = vec4(aPosition.xy, 0.0, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+#define VISIBILITY_TRIANGLE_BITS 20 // VISIBILITY_TRIANGLE_BITS
+
+struct VisibilityDraw
+{
+	uint instanceIndex;
+	uint bin;
+};
+
+layout(binding=5, std430) readonly buffer VisibilityDraws
+{
+	VisibilityDraw uDraws[];
+};
+
+uniform usampler2D uVisibility;
+
+void main()
+{
+	uint id = texelFetch(uVisibility, ivec2(gl_FragCoord.xy), 0).r;
+	if (id == 0u)
+	{
+		discard;
+	}
+
+	// Dyadic, the resolve quad of the bin lands on exactly this depth
+	uint draw = (id >> VISIBILITY_TRIANGLE_BITS) - 1u;
+	gl_FragDepth = float(uDraws[draw].bin + 1u) / 65536.0;
+}
+
+#endif
+#endif
@@ -1,10 +1,49 @@
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
-#ifdef FB_TO_BB
+// DEFERRED_DIRECTIONAL and LIGHT_VOLUME split the lighting of FB_TO_BB into additive passes over an HDR target:
+// the ambient, emissive and directional lights on a full screen quad, then every point light on its bounding
+// sphere. LIGHT_VOLUME_STENCIL marks the pixels inside a sphere first, DEFERRED_RESOLVE tonemaps the sum.
+
+// TILE_SHADE_* are compute variants writing the whole lighting of the tiles TILE_CLASSIFY put in a class,
+// specialized for the class and the lighting model so they carry neither branch
+#if defined(TILE_SHADE_EDGE_PBR) || defined(TILE_SHADE_EDGE_BASIC)
+#define TILE_SHADE
+#define TILE_EDGE // Some pixels of the tile have no geometry
+#endif
+#if defined(TILE_SHADE_FULL_PBR) || defined(TILE_SHADE_FULL_BASIC)
+#define TILE_SHADE
+#endif
+#if defined(TILE_SHADE_EDGE_PBR) || defined(TILE_SHADE_FULL_PBR)
+#define TILE_PBR
+#endif
+
+#if defined(FB_TO_BB) || defined(DEFERRED_DIRECTIONAL) || defined(LIGHT_VOLUME) || defined(LIGHT_VOLUME_STENCIL) || defined(TILE_SHADE)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
+#if defined(LIGHT_VOLUME) || defined(LIGHT_VOLUME_STENCIL)
+
+layout(location = 0) in vec4 aPosition; // unorm16 quantized against the submesh bounds
+
+layout(binding = 0, std140) uniform FrameParams
+{
+	mat4 uViewProjection;
+	vec3 uCameraPosition;
+};
+
+uniform vec3 uPositionMin;
+uniform vec3 uPositionExtent;
+uniform vec4 uLightVolume; // Center and scale of the sphere mesh
+
+void main()
+{
+	vec3 position = uPositionMin + aPosition.xyz * uPositionExtent;
+	gl_Position = uViewProjection * vec4(uLightVolume.xyz + position * uLightVolume.w, 1.0);
+}
+
+#else
+
 layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec2 aTexCoord;
 
@@ -16,7 +55,18 @@ void main()
 	gl_Position = vec4(aPosition, 1.0);
 }
 
-#elif defined(FRAGMENT) ///////////////////////////////////////////////
+#endif
+
+#elif defined(FRAGMENT) || defined(COMPUTE) ///////////////////////////
+
+#if defined(LIGHT_VOLUME_STENCIL)
+
+// Depth tested only, the stencil operations do the work
+void main()
+{
+}
+
+#else
 
 struct Light
 {
@@ -27,28 +77,54 @@ struct Light
 	float intensity;
 };
 
-layout(binding = 0, std140) uniform GlobalParams
+layout(binding = 0, std140) uniform FrameParams
 {
+	mat4 uViewProjection;
 	vec3 uCameraPosition;
+};
+
+layout(binding = 2, std140) uniform LightParams
+{
 	uint uLightCount;
 	Light uLight[16];
 };
 
+#if defined(LIGHT_VOLUME)
+uniform vec2 uDisplaySize;
+uniform uint uLightIndex;
+
+vec2 vTexCoord; // Of the G-buffer texel under the fragment, set in main
+#elif defined(TILE_SHADE)
+vec2 vTexCoord; // Of the pixel of the invocation, set in main
+#else
 in vec2 vTexCoord;
+#endif
 
 uniform sampler2D uAlbedo;
 uniform sampler2D uNormals;
 uniform sampler2D uPosition;
 uniform sampler2D uViewDir;
-uniform sampler2D uDepth;
+#if defined(FB_TO_BB) || defined(TILE_SHADE)
+uniform sampler2D uDepth; // Not in the light passes, their framebuffer has it attached
+#endif
 
+#if defined(TILE_SHADE)
+vec4 oColor;
+#else
 layout(location = 0) out vec4 oColor;
+#endif
 
 const float PI = 3.14159265359;
 
 uniform bool useEmissive;
 
+#if defined(TILE_PBR)
+const bool usePBR = true;
+#elif defined(TILE_SHADE)
+const bool usePBR = false;
+#else
 uniform bool usePBR;
+#endif
 
 // Samplers
 uniform sampler2D uMetallic; // Metallic sampler
@@ -90,7 +166,9 @@ void SamplerAllTextures()
 
 	vPosition = texture(uPosition, vTexCoord).rgb;
 	vViewDir = texture(uViewDir, vTexCoord).rgb;
+#if defined(FB_TO_BB) || defined(TILE_SHADE)
 	vDepth = texture(uDepth, vTexCoord).r;
+#endif
 }
 
 // SAMPLER FILTER
@@ -191,7 +269,8 @@ vec3 fresnelSchlick(float cosTheta, vec3 F0)
 	return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(1.0 - cosTheta, 5.0);
 }
 
-void CalculatePBRLightning()
+// Reflectance equation term of one light
+vec3 PBRLightRadiance(Light light)
 {
 	vec3 N = normalize(normal); //vNormal
 	vec3 V = normalize(vViewDir - vPosition); 
@@ -199,55 +278,63 @@ void CalculatePBRLightning()
 	vec3 F0 = vec3(0.04);
 	F0 = mix(F0, albedo, metallic);
 
-	//Reflectance equation
-	vec3 Lo = vec3(0.0);
-	for (int i = 0; i < uLightCount; ++i)
-	{
-		vec3 L = vec3(0.0); 
-		vec3 radiance = vec3(0.0); 
+	vec3 L = vec3(0.0); 
+	vec3 radiance = vec3(0.0); 
 
-		if (uLight[i].type == 0)
-		{
-			// Directional light
-			L = normalize(-uLight[i].direction);
-			radiance = uLight[i].color * uLight[i].intensity;
-		} 
-		else 
-		{
-			// Point light
-			L = normalize(uLight[i].position - vPosition);
-			float distance = length(uLight[i].position - vPosition);
-			float attenuation = 1.0 / (distance * distance);
-			radiance = uLight[i].color * (uLight[i].intensity * attenuation);
-		}
-			
-		vec3 H = normalize(V + L);
+	if (light.type == 0)
+	{
+		// Directional light
+		L = normalize(-light.direction);
+		radiance = light.color * light.intensity;
+	} 
+	else 
+	{
+		// Point light
+		L = normalize(light.position - vPosition);
+		float distance = length(light.position - vPosition);
+		float attenuation = 1.0 / (distance * distance);
+		radiance = light.color * (light.intensity * attenuation);
+	}
+		
+	vec3 H = normalize(V + L);
 
-		float NDF = DistributionGGX(N, H, roughness);
-		float G = GeometrySmith(N, V, L, roughness);
-		vec3 F = fresnelSchlick(max(dot(H, V), 0.0), F0);
+	float NDF = DistributionGGX(N, H, roughness);
+	float G = GeometrySmith(N, V, L, roughness);
+	vec3 F = fresnelSchlick(max(dot(H, V), 0.0), F0);
 
-		vec3 kS = F;
-		vec3 kD = vec3(1.0) - kS;
-		kD *= 1.0 - metallic;
+	vec3 kS = F;
+	vec3 kD = vec3(1.0) - kS;
+	kD *= 1.0 - metallic;
 
-		vec3 numerator = NDF * G * F;
-		float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.0001;
-		vec3 specular = numerator / denominator;
+	vec3 numerator = NDF * G * F;
+	float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.0001;
+	vec3 specular = numerator / denominator;
 
-		float NdotL = max(dot(N, L), 0.0);
-		Lo += (kD * albedo / PI + specular) * radiance * NdotL;
-			
-	}
+	float NdotL = max(dot(N, L), 0.0);
+	return (kD * albedo / PI + specular) * radiance * NdotL;
+}
 
+vec3 PBRAmbient()
+{
 	vec3 ambient = vec3(0.03) * albedo * ao;
-	vec3 color = ambient + Lo;
-		
 	if (useEmissive)
 	{
-		color += emissive;
+		ambient += emissive;
+	}
+	return ambient;
+}
+
+void CalculatePBRLightning()
+{
+	//Reflectance equation
+	vec3 Lo = vec3(0.0);
+	for (int i = 0; i < uLightCount; ++i)
+	{
+		Lo += PBRLightRadiance(uLight[i]);
 	}
 
+	vec3 color = PBRAmbient() + Lo;
+
 	color = color / (color + vec3(1.0));
 	color = pow(color, vec3(1.0/2.2));
 
@@ -272,6 +359,36 @@ void CalculateBlitVars(in Light light, out vec3 ambient, out vec3 diffuse, out v
 	specular = specularStrength * spec * light.color;
 }
 
+// OLD LIGHTNING OF ONE LIGHT (NON PBR)
+vec4 BasicLightColor(Light light, vec4 textureColor)
+{
+	vec3 lightResult = vec3(0.0f);
+	vec3 ambient = vec3(0.0f);
+	vec3 diffuse = vec3(0.0f);
+	vec3 specular = vec3(0.0f);
+
+	if (light.type == 0)
+	{
+		//Directional
+		CalculateBlitVars(light, ambient, diffuse, specular);
+
+		lightResult = ambient + diffuse + specular;
+	}
+	else
+	{
+		float constant = 1.0f;
+		float linear = 0.09f;
+		float quadratic = 0.032f;
+		float distance = length(light.position - vPosition);
+		float attenuation = 1.0f / (constant + linear * distance + quadratic * (distance*distance));
+
+		CalculateBlitVars(light, ambient, diffuse, specular);
+		lightResult = (ambient * attenuation) + (diffuse * attenuation) + (specular * attenuation);
+	}
+
+	return vec4(lightResult, 1.0) * textureColor * (light.intensity/2);
+}
+
 // MAIN OLD LIGHTNING (NON PBR)
 void CalculateBasicLightning()
 {
@@ -279,40 +396,92 @@ void CalculateBasicLightning()
 	vec4 finalColor = vec4(0.0f);
 	for (int i = 0; i < uLightCount; ++i)
 	{
-		vec3 lightResult = vec3(0.0f);
-		vec3 ambient = vec3(0.0f);
-		vec3 diffuse = vec3(0.0f);
-		vec3 specular = vec3(0.0f);
+		finalColor += BasicLightColor(uLight[i], textureColor);
+	}
+
+	oColor = finalColor;
+}
+
+#if defined(DEFERRED_DIRECTIONAL)
 
+// Linear, added to by the light volumes
+void main()
+{
+	SamplerAllTextures();
+
+	vec4 textureColor = texture(uAlbedo, vTexCoord);
+	vec4 color = usePBR ? vec4(PBRAmbient(), 0.0) : vec4(0.0);
+	for (int i = 0; i < uLightCount; ++i)
+	{
 		if (uLight[i].type == 0)
 		{
-			//Directional
-			Light light = uLight[i];
+			color += usePBR ? vec4(PBRLightRadiance(uLight[i]), 0.0) : BasicLightColor(uLight[i], textureColor);
+		}
+	}
 
-			CalculateBlitVars(light, ambient, diffuse, specular);
+	oColor = vec4(color.rgb, 1.0);
+}
 
-			lightResult = ambient + diffuse + specular;
-			finalColor += vec4(lightResult, 1.0) * textureColor * (light.intensity/2);
-		}
-		else
-		{
-			Light light = uLight[i];
+#elif defined(LIGHT_VOLUME)
 
-			float constant = 1.0f;
-			float linear = 0.09f;
-			float quadratic = 0.032f;
-			float distance = length(light.position - vPosition);
-			float attenuation = 1.0f / (constant + linear * distance + quadratic * (distance*distance));
+// Linear, blended additively, the stencil leaves the pixels inside the sphere only
+void main()
+{
+	vTexCoord = gl_FragCoord.xy / uDisplaySize;
+	SamplerAllTextures();
 
-			CalculateBlitVars(light, ambient, diffuse, specular);
-			lightResult = (ambient * attenuation) + (diffuse * attenuation) + (specular * attenuation);
-			finalColor += vec4(lightResult, 1.0) * textureColor * (light.intensity/2);
-		}
+	Light light = uLight[uLightIndex];
+	vec3 color = usePBR ? PBRLightRadiance(light) : BasicLightColor(light, texture(uAlbedo, vTexCoord)).rgb;
+
+	oColor = vec4(color, 1.0);
+}
+
+#elif defined(TILE_SHADE)
+
+// One work group per tile of the class (DEFERRED_TILE_SIZE), through glDispatchComputeIndirect
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(binding=4, std430) readonly buffer TileClassLists
+{
+	uint uTileLists[]; // x | y << 16
+};
+
+layout(binding=0, rgba16f) writeonly uniform image2D uLightAccumulation;
+uniform ivec2 uTileDisplaySize;
+uniform uint uClassOffset; // Where the list of the class starts in uTileLists
+
+// Linear, DEFERRED_RESOLVE tonemaps it. Pixels without geometry keep the clear color.
+void main()
+{
+	uint tile = uTileLists[uClassOffset + gl_WorkGroupID.x];
+	ivec2 pixel = ivec2(tile & 0xFFFFu, tile >> 16) * ivec2(gl_WorkGroupSize.xy) + ivec2(gl_LocalInvocationID.xy);
+	if (any(greaterThanEqual(pixel, uTileDisplaySize)))
+	{
+		return;
 	}
 
-	oColor = finalColor;
+#if defined(TILE_EDGE)
+	if (texelFetch(uDepth, pixel, 0).r >= 1.0)
+	{
+		return;
+	}
+#endif
+
+	vTexCoord = (vec2(pixel) + 0.5) / vec2(uTileDisplaySize);
+	SamplerAllTextures();
+
+	vec4 textureColor = texture(uAlbedo, vTexCoord);
+	vec3 color = usePBR ? PBRAmbient() : vec3(0.0);
+	for (int i = 0; i < uLightCount; ++i)
+	{
+		color += usePBR ? PBRLightRadiance(uLight[i]) : BasicLightColor(uLight[i], textureColor).rgb;
+	}
+
+	imageStore(uLightAccumulation, pixel, vec4(color, 1.0));
 }
 
+#else
+
 void main()
 {
 	SamplerAllTextures();
@@ -330,6 +499,49 @@ void main()
 	}
 }
 
+#endif
+#endif // LIGHT_VOLUME_STENCIL
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+#ifdef DEFERRED_RESOLVE
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec2 aTexCoord;
+
+out vec2 vTexCoord;
+
+void main()
+{
+	vTexCoord = aTexCoord;
+	gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+in vec2 vTexCoord;
+
+uniform sampler2D uLightAccumulation;
+uniform bool usePBR;
+
+layout(location = 0) out vec4 oColor;
+
+// Same tonemapping and gamma as the PBR path of FB_TO_BB, the old lighting is written as it is
+void main()
+{
+	vec3 color = texture(uLightAccumulation, vTexCoord).rgb;
+	if (usePBR)
+	{
+		color = color / (color + vec3(1.0));
+		color = pow(color, vec3(1.0/2.2));
+	}
+
+	oColor = vec4(color, 1.0);
+}
+
 #endif
 #endif
 
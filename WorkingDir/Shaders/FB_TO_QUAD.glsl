@@ -24,11 +24,17 @@ struct Light
     vec3 color;
     vec3 direction;
     vec3 position;
+    float intensity;
 };
 
-layout(binding = 0, std140) uniform GlobalsParams
+layout(binding = 0, std140) uniform FrameParams
+{
+    mat4 uViewProjection;
+    vec3 uCameraPosition;
+};
+
+layout(binding = 2, std140) uniform LightParams
 {
-    vec3 uCamPosition;
     uint uLightCount;
     Light uLight[16];
 };
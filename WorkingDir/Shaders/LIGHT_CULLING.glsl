@@ -0,0 +1,120 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#ifdef LIGHT_CULLING
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// One work group per screen tile, one invocation per pixel (LIGHT_TILE_SIZE)
+#define TILE_SIZE 16u
+#define MAX_LIGHTS 16
+
+layout(local_size_x = 16, local_size_y = 16) in;
+
+struct Light
+{
+	uint type;
+	vec3 color;
+	vec3 direction;
+	vec3 position;
+	float intensity;
+};
+
+layout(binding=2, std140) uniform LightParams
+{
+	uint uLightCount;
+	Light uLight[MAX_LIGHTS];
+};
+
+struct TileLights
+{
+	uint count;
+	uint indices[MAX_LIGHTS];
+};
+
+layout(binding=2, std430) writeonly buffer TileLightParams
+{
+	TileLights uTiles[];
+};
+
+uniform sampler2D uDepth; // Depth prepass
+uniform mat4 uInverseViewProjection;
+uniform ivec2 uDisplaySize;
+uniform float uLightRadius[MAX_LIGHTS]; // LightInfluenceRadius, negative for directional lights
+
+shared uint sMinDepth;
+shared uint sMaxDepth;
+shared uint sLightCount;
+shared uint sLightIndices[MAX_LIGHTS];
+
+void main()
+{
+	uint thread = gl_LocalInvocationIndex;
+	if (thread == 0u)
+	{
+		sMinDepth = 0xFFFFFFFFu;
+		sMaxDepth = 0u;
+		sLightCount = 0u;
+	}
+	barrier();
+
+	// Depths are positive, their bits sort like them
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	if (all(lessThan(pixel, uDisplaySize)))
+	{
+		uint depthBits = floatBitsToUint(texelFetch(uDepth, pixel, 0).r);
+		atomicMin(sMinDepth, depthBits);
+		atomicMax(sMaxDepth, depthBits);
+	}
+	barrier();
+
+	float minDepth = uintBitsToFloat(sMinDepth);
+	float maxDepth = uintBitsToFloat(sMaxDepth);
+
+	// World space box around the part of the view frustum the tile sees between its depth bounds
+	vec2 tileMin = vec2(gl_WorkGroupID.xy * TILE_SIZE) / vec2(uDisplaySize) * 2.0 - 1.0;
+	vec2 tileMax = min(vec2((gl_WorkGroupID.xy + 1u) * TILE_SIZE) / vec2(uDisplaySize), 1.0) * 2.0 - 1.0;
+	vec3 boxMin = vec3(1e30);
+	vec3 boxMax = vec3(-1e30);
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		vec4 ndc = vec4((corner & 1) != 0 ? tileMax.x : tileMin.x,
+			(corner & 2) != 0 ? tileMax.y : tileMin.y,
+			((corner & 4) != 0 ? maxDepth : minDepth) * 2.0 - 1.0,
+			1.0);
+		vec4 world = uInverseViewProjection * ndc;
+		boxMin = min(boxMin, world.xyz / world.w);
+		boxMax = max(boxMax, world.xyz / world.w);
+	}
+
+	// One light per invocation, tiles with nothing drawn (cleared depth) get none
+	if (thread < uLightCount && minDepth < 1.0)
+	{
+		bool affects = true;
+		if (uLight[thread].type != 0u)
+		{
+			float radius = uLightRadius[thread];
+			vec3 toBox = clamp(uLight[thread].position, boxMin, boxMax) - uLight[thread].position;
+			affects = dot(toBox, toBox) <= radius * radius;
+		}
+
+		if (affects)
+		{
+			sLightIndices[atomicAdd(sLightCount, 1u)] = thread;
+		}
+	}
+	barrier();
+
+	uint tile = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+	if (thread == 0u)
+	{
+		uTiles[tile].count = sLightCount;
+	}
+	if (thread < sLightCount)
+	{
+		uTiles[tile].indices[thread] = sLightIndices[thread];
+	}
+}
+
+#endif
+#endif
@@ -1,13 +1,52 @@
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
-#ifdef RENDER_TO_BB
+// FORWARD_PLUS is the same program, lit by the lights of the screen tile only.
+// VISIBILITY_SHADE too, on a full screen quad, rebuilding what the vertex shader outputs from the visibility buffer.
+#if defined(RENDER_TO_BB) || defined(FORWARD_PLUS) || defined(VISIBILITY_SHADE)
 
-#if defined(VERTEX) ///////////////////////////////////////////////////
+vec3 DecodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+	{
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
+
+mat3 DecodeTangentFrame(vec4 frame)
+{
+	float handedness = frame.w < 0.0 ? -1.0 : 1.0;
+	vec4 q = normalize(frame) * handedness;
+	vec3 t = vec3(1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y));
+	vec3 b = vec3(2.0 * (q.x * q.y - q.w * q.z), 1.0 - 2.0 * (q.x * q.x + q.z * q.z), 2.0 * (q.y * q.z + q.w * q.x));
+	vec3 n = vec3(2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y));
+	return mat3(t, b * handedness, n);
+}
 
+#if defined(VERTEX) && defined(VISIBILITY_SHADE) /////////////////////
+
+// Full screen at the material depth of the bin, only its pixels pass the equal depth test
 layout(location = 0) in vec3 aPosition;
-layout(location = 1) in vec3 aNormal;
+
+uniform float uMaterialDepth;
+
+void main()
+{
+	gl_Position = vec4(aPosition.xy, uMaterialDepth * 2.0 - 1.0, 1.0);
+}
+
+#elif defined(VERTEX) /////////////////////////////////////////////////
+
+layout(location = 0) in vec4 aPosition;     // unorm16 quantized against the submesh bounds
+layout(location = 1) in vec2 aNormal;       // snorm16 octahedral
 layout(location = 2) in vec2 aTexCoord;
+layout(location = 3) in vec4 aTangentFrame; // snorm16 quaternion, w < 0 flips the bitangent
+layout(location = 4) in uint aInstanceIndex; // Per instance, from the base instance of the draw on
+
+uniform vec3 uPositionMin;
+uniform vec3 uPositionExtent;
 
 struct Light
 {
@@ -18,9 +57,14 @@ struct Light
 	float intensity;
 };
 
-layout(binding=0, std140) uniform GlobalParams
+layout(binding=0, std140) uniform FrameParams
 {
+	mat4 uViewProjection;
 	vec3 uCameraPosition;
+};
+
+layout(binding=2, std140) uniform LightParams
+{
 	uint uLightCount;
 	Light uLight[16];
 };
@@ -29,23 +73,35 @@ out vec2 vTexCoord;
 out vec3 vPosition;
 out vec3 vNormal;
 out vec3 vViewDir;
-out mat4 vWorldMatrix;
+out mat3 vTBN;
 
-layout(binding=1, std140) uniform LocalParams
+struct InstanceData
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	mat4 world;
 };
 
+layout(binding=1, std430) readonly buffer InstanceParams
+{
+	InstanceData uInstances[];
+};
+
+// Same expression as DEPTH_PREPASS, so the depth test passes with the depth written there
+invariant gl_Position;
+
 void main()
 {
+	vec3 position = uPositionMin + aPosition.xyz * uPositionExtent;
+	vec3 normal = DecodeOctahedral(aNormal);
+	mat3 tangentFrame = DecodeTangentFrame(aTangentFrame);
+	mat4 world = uInstances[aInstanceIndex].world;
+
 	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
+	vPosition = vec3(world * vec4(position, 1.0));
 	vViewDir = uCameraPosition - vPosition;
-	vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
-	vWorldMatrix = uWorldMatrix;
+	vNormal = vec3(world * vec4(normal, 0.0));
+	vTBN = mat3(world) * mat3(tangentFrame[0], tangentFrame[1], normal);
 
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0f);
+	gl_Position = uViewProjection * vec4(vPosition, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -59,22 +115,257 @@ struct Light
 	float intensity;
 };
 
-layout(binding=0, std140) uniform GlobalParams
+layout(binding=0, std140) uniform FrameParams
 {
+	mat4 uViewProjection;
 	vec3 uCameraPosition;
+};
+
+layout(binding=2, std140) uniform LightParams
+{
 	uint uLightCount;
 	Light uLight[16];
 };
 
+#ifdef FORWARD_PLUS
+#define TILE_SIZE 16u // LIGHT_TILE_SIZE
+
+struct TileLights
+{
+	uint count;
+	uint indices[16];
+};
+
+layout(binding=2, std430) readonly buffer TileLightParams
+{
+	TileLights uTiles[];
+};
+
+uniform uint uTileCountX;
+
+uint TileIndex()
+{
+	uvec2 tile = uvec2(gl_FragCoord.xy) / TILE_SIZE;
+	return tile.y * uTileCountX + tile.x;
+}
+
+uint LightCount()
+{
+	return uTiles[TileIndex()].count;
+}
+
+uint LightIndex(uint l)
+{
+	return uTiles[TileIndex()].indices[l];
+}
+#else
+uint LightCount()
+{
+	return uLightCount;
+}
+
+uint LightIndex(uint l)
+{
+	return l;
+}
+#endif
+
 layout(location = 0) out vec4 oColor;
 
 const float PI = 3.14159265359;
 
+#if defined(VISIBILITY_SHADE)
+#define VISIBILITY_TRIANGLE_BITS 20 // VISIBILITY_TRIANGLE_BITS
+
+// The pixels of the other bins fail the equal depth test before the shader runs
+layout(early_fragment_tests) in;
+
+struct VisibilityDraw
+{
+	uint instanceIndex;
+	uint bin;
+};
+
+layout(binding=5, std430) readonly buffer VisibilityDraws
+{
+	VisibilityDraw uDraws[];
+};
+
+struct InstanceData
+{
+	mat4 world;
+};
+
+layout(binding=1, std430) readonly buffer InstanceParams
+{
+	InstanceData uInstances[];
+};
+
+// Vertex and index buffers of the mesh of the bin as 32 bit words, its streams and index ranges are 4 byte aligned
+layout(binding=6, std430) readonly buffer MeshVertices
+{
+	uint uVertexWords[];
+};
+
+layout(binding=7, std430) readonly buffer MeshIndices
+{
+	uint uIndexWords[];
+};
+
+uniform usampler2D uVisibility;
+uniform vec2 uDisplaySize;
+
+// Submesh of the bin, offsets in bytes
+uniform vec3 uPositionMin;
+uniform vec3 uPositionExtent;
+uniform uint uIndexOffset;
+uniform bool uShortIndices;
+uniform uint uPositionOffset;     // 4 x unorm16 per vertex
+uniform uint uAttributeOffset;
+uniform uint uAttributeStride;
+uniform uint uNormalOffset;       // In the attribute stream
+uniform int  uTexCoordOffset;     // In the attribute stream, -1 without texture coordinates
+uniform bool uHalfTexCoords;      // 2 x half, 2 x unorm16 otherwise
+uniform int  uTangentFrameOffset; // In the attribute stream, -1 without tangent frame
+
+// The vertex outputs of the other programs, interpolated here over the triangle of the pixel
+vec2 vTexCoord; // Texture Coords
+vec3 vPosition; // World Position
+vec3 vNormal; // Normal
+vec3 vViewDir; // View Direction // Camera Position
+mat3 vTBN; // Tangent space to world
+
+// Change of vTexCoord a pixel right and up. The pixels of a quad may be on different triangles, the texture lookups cannot take it from them.
+vec2 vTexCoordDdx;
+vec2 vTexCoordDdy;
+
+#define SAMPLE_MATERIAL(sampler) textureGrad(sampler, vTexCoord, vTexCoordDdx, vTexCoordDdy)
+
+uint LoadIndex(uint i)
+{
+	if (uShortIndices)
+	{
+		uint word = uIndexWords[uIndexOffset / 4u + i / 2u];
+		return (i & 1u) == 0u ? word & 0xFFFFu : word >> 16;
+	}
+	return uIndexWords[uIndexOffset / 4u + i];
+}
+
+vec3 LoadPosition(uint v)
+{
+	uint word = (uPositionOffset + v * 8u) / 4u;
+	vec2 xy = unpackUnorm2x16(uVertexWords[word]);
+	float z = unpackUnorm2x16(uVertexWords[word + 1u]).x;
+	return uPositionMin + vec3(xy, z) * uPositionExtent;
+}
+
+uint LoadAttributeWord(uint v, uint offset)
+{
+	return uVertexWords[(uAttributeOffset + v * uAttributeStride + offset) / 4u];
+}
+
+struct Barycentrics
+{
+	vec3 lambda;
+	vec3 ddx; // Change a pixel right
+	vec3 ddy; // Change a pixel up
+};
+
+// Perspective correct barycentrics of the pixel at ndc in the triangle of the clip space positions
+Barycentrics ComputeBarycentrics(vec4 clip0, vec4 clip1, vec4 clip2, vec2 ndc)
+{
+	vec3 invW = 1.0 / vec3(clip0.w, clip1.w, clip2.w);
+	vec2 ndc0 = clip0.xy * invW.x;
+	vec2 ndc1 = clip1.xy * invW.y;
+	vec2 ndc2 = clip2.xy * invW.z;
+
+	// Barycentrics over w are linear on screen, so are their derivatives in NDC
+	float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+	vec3 ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+	vec3 ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+	float ddxSum = dot(ddx, vec3(1.0));
+	float ddySum = dot(ddy, vec3(1.0));
+
+	vec2 delta = ndc - ndc0;
+	float interpolatedInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+
+	Barycentrics b;
+	b.lambda = (vec3(invW.x, 0.0, 0.0) + delta.x * ddx + delta.y * ddy) / interpolatedInvW;
+
+	// A pixel is 2 / size in NDC, the barycentrics there are the ones of the neighbour pixels
+	vec2 pixel = 2.0 / uDisplaySize;
+	b.ddx = (b.lambda * interpolatedInvW + ddx * pixel.x) / (interpolatedInvW + ddxSum * pixel.x) - b.lambda;
+	b.ddy = (b.lambda * interpolatedInvW + ddy * pixel.y) / (interpolatedInvW + ddySum * pixel.y) - b.lambda;
+	return b;
+}
+
+void ReconstructSurface()
+{
+	uint id = texelFetch(uVisibility, ivec2(gl_FragCoord.xy), 0).r;
+	uint triangle = id & ((1u << VISIBILITY_TRIANGLE_BITS) - 1u);
+	mat4 world = uInstances[uDraws[(id >> VISIBILITY_TRIANGLE_BITS) - 1u].instanceIndex].world;
+
+	uint indices[3];
+	vec3 positions[3];
+	vec4 clips[3];
+	for (uint k = 0u; k < 3u; ++k)
+	{
+		indices[k] = LoadIndex(triangle * 3u + k);
+		positions[k] = vec3(world * vec4(LoadPosition(indices[k]), 1.0));
+		clips[k] = uViewProjection * vec4(positions[k], 1.0);
+	}
+
+	Barycentrics b = ComputeBarycentrics(clips[0], clips[1], clips[2], gl_FragCoord.xy / uDisplaySize * 2.0 - 1.0);
+
+	// Attributes the submesh does not have read what the vertex shader gets from the generic (0, 0, 0, 1)
+	vec3 normal = vec3(0.0);
+	vec3 tangent = vec3(0.0);
+	vec3 bitangent = vec3(0.0);
+	vec2 texCoords[3];
+	for (uint k = 0u; k < 3u; ++k)
+	{
+		uint v = indices[k];
+		vec3 vertexNormal = DecodeOctahedral(unpackSnorm2x16(LoadAttributeWord(v, uNormalOffset)));
+
+		vec4 frame = vec4(0.0, 0.0, 0.0, 1.0);
+		if (uTangentFrameOffset >= 0)
+		{
+			frame.xy = unpackSnorm2x16(LoadAttributeWord(v, uint(uTangentFrameOffset)));
+			frame.zw = unpackSnorm2x16(LoadAttributeWord(v, uint(uTangentFrameOffset) + 4u));
+		}
+		mat3 tangentFrame = DecodeTangentFrame(frame);
+
+		texCoords[k] = vec2(0.0);
+		if (uTexCoordOffset >= 0)
+		{
+			uint word = LoadAttributeWord(v, uint(uTexCoordOffset));
+			texCoords[k] = uHalfTexCoords ? unpackHalf2x16(word) : unpackUnorm2x16(word);
+		}
+
+		normal += vertexNormal * b.lambda[k];
+		tangent += tangentFrame[0] * b.lambda[k];
+		bitangent += tangentFrame[1] * b.lambda[k];
+	}
+
+	mat3x2 texCoordMatrix = mat3x2(texCoords[0], texCoords[1], texCoords[2]);
+	vTexCoord = texCoordMatrix * b.lambda;
+	vTexCoordDdx = texCoordMatrix * b.ddx;
+	vTexCoordDdy = texCoordMatrix * b.ddy;
+
+	vPosition = mat3(positions[0], positions[1], positions[2]) * b.lambda;
+	vViewDir = uCameraPosition - vPosition;
+	vNormal = mat3(world) * normal;
+	vTBN = mat3(world) * mat3(tangent, bitangent, normal);
+}
+#else
 in vec2 vTexCoord; // Texture Coords
 in vec3 vPosition; // World Position
 in vec3 vNormal; // Normal
 in vec3 vViewDir; // View Direction // Camera Position
-in mat4 vWorldMatrix;
+in mat3 vTBN; // Tangent space to world
+
+#define SAMPLE_MATERIAL(sampler) texture(sampler, vTexCoord)
+#endif
 
 uniform bool useEmissive;
 uniform bool useNormalTexture;
@@ -83,9 +374,7 @@ uniform bool usePBR;
 
 // Samplers
 uniform sampler2D uTexture; // Albedo sampler
-uniform sampler2D uMetallic; // Metallic sampler
-uniform sampler2D uRoughness; // Roughness sampler
-uniform sampler2D uAO; // Ambient Occlusion sampler
+uniform sampler2D uORM; // Occlusion (R), roughness (G) and metallic (B) sampler
 uniform sampler2D uNormal; // Normal sampler
 uniform sampler2D uEmissive; // Emissive sampler
 
@@ -101,20 +390,22 @@ vec3 normal;
 // SAMPLE TEXTURES
 void SamplerAllTextures()
 {
-	albedo = texture(uTexture, vTexCoord).rgb;
+	albedo = SAMPLE_MATERIAL(uTexture).rgb;
 	
 	if (usePBR)
 	{
-		metallic = texture(uMetallic, vTexCoord).r;
-		roughness = texture(uRoughness, vTexCoord).r;
-		ao = texture(uAO, vTexCoord).r;
-		emissive = texture(uEmissive, vTexCoord).rgb;
+		vec3 orm = SAMPLE_MATERIAL(uORM).rgb;
+		ao = orm.r;
+		roughness = orm.g;
+		metallic = orm.b;
+		emissive = SAMPLE_MATERIAL(uEmissive).rgb;
 
 		// Sample normal texture if there is one
 		if(useNormalTexture)
 		{
-			normal = texture(uNormal, vTexCoord).rgb;
-			normal = vec3(vWorldMatrix * vec4(normal, 0.0f));
+			// BC5 normal maps only store xy
+			vec2 normalXY = SAMPLE_MATERIAL(uNormal).rg * 2.0 - 1.0;
+			normal = vTBN * vec3(normalXY, sqrt(max(0.0, 1.0 - dot(normalXY, normalXY))));
 		}
 		else
 		{
@@ -181,8 +472,10 @@ void CalculatePBRLightning()
 
 	//Reflectance equation
 	vec3 Lo = vec3(0.0);
-	for (int i = 0; i < uLightCount; ++i)
+	uint lightCount = LightCount();
+	for (uint l = 0u; l < lightCount; ++l)
 	{
+		uint i = LightIndex(l);
 		vec3 L = vec3(0.0); 
         vec3 radiance = vec3(0.0); 
 
@@ -254,10 +547,12 @@ void CalculateBlitVars(in Light light, out vec3 ambient, out vec3 diffuse, out v
 // MAIN OLD LIGHTNING (NON PBR)
 void CalculateBasicLightning()
 {
-	vec4 textureColor = texture(uTexture, vTexCoord);
+	vec4 textureColor = SAMPLE_MATERIAL(uTexture);
 	vec4 finalColor = vec4(0.0f);
-	for (int i = 0; i < uLightCount; ++i)
+	uint lightCount = LightCount();
+	for (uint l = 0u; l < lightCount; ++l)
 	{
+		uint i = LightIndex(l);
 		vec3 lightResult = vec3(0.0f);
 		vec3 ambient = vec3(0.0f);
 		vec3 diffuse = vec3(0.0f);
@@ -294,6 +589,9 @@ void CalculateBasicLightning()
 
 void main()
 {
+#if defined(VISIBILITY_SHADE)
+	ReconstructSurface();
+#endif
 	SamplerAllTextures();
 	
 	if (usePBR)
@@ -5,9 +5,34 @@
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
-layout(location = 0) in vec3 aPosition;
-layout(location = 1) in vec3 aNormal;
+layout(location = 0) in vec4 aPosition;     // unorm16 quantized against the submesh bounds
+layout(location = 1) in vec2 aNormal;       // snorm16 octahedral
 layout(location = 2) in vec2 aTexCoord;
+layout(location = 3) in vec4 aTangentFrame; // snorm16 quaternion, w < 0 flips the bitangent
+layout(location = 4) in uint aInstanceIndex; // Per instance, from the base instance of the draw on
+
+uniform vec3 uPositionMin;
+uniform vec3 uPositionExtent;
+
+vec3 DecodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+	{
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
+
+mat3 DecodeTangentFrame(vec4 frame)
+{
+	float handedness = frame.w < 0.0 ? -1.0 : 1.0;
+	vec4 q = normalize(frame) * handedness;
+	vec3 t = vec3(1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y));
+	vec3 b = vec3(2.0 * (q.x * q.y - q.w * q.z), 1.0 - 2.0 * (q.x * q.x + q.z * q.z), 2.0 * (q.y * q.z + q.w * q.x));
+	vec3 n = vec3(2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y));
+	return mat3(t, b * handedness, n);
+}
 
 struct Light
 {
@@ -18,32 +43,48 @@ struct Light
 	float intensity;
 };
 
-layout(binding=0, std140) uniform GlobalParams
+layout(binding=0, std140) uniform FrameParams
+{
+	mat4 uViewProjection;
+	vec3 uCameraPosition;
+};
+
+layout(binding=2, std140) uniform LightParams
 {
-	vec3 uCamPosition;
 	uint uLightCount;
 	Light uLight[16];
 };
 
-layout(binding=1, std140) uniform LocalParams
+struct InstanceData
+{
+	mat4 world;
+};
+
+layout(binding=1, std430) readonly buffer InstanceParams
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	InstanceData uInstances[];
 };
 
 out vec2 vTexCoord;
 out vec3 vPosition;
 out vec3 vNormal;
 out vec3 vViewDir;
+out mat3 vTBN;
 
 void main()
 {
+	vec3 position = uPositionMin + aPosition.xyz * uPositionExtent;
+	vec3 normal = DecodeOctahedral(aNormal);
+	mat3 tangentFrame = DecodeTangentFrame(aTangentFrame);
+	mat4 world = uInstances[aInstanceIndex].world;
+
 	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-	vViewDir = uCamPosition - vPosition;
-	vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
+	vPosition = vec3(world * vec4(position, 1.0));
+	vViewDir = uCameraPosition - vPosition;
+	vNormal = vec3(world * vec4(normal, 0.0));
+	vTBN = mat3(world) * mat3(tangentFrame[0], tangentFrame[1], normal);
 
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	gl_Position = uViewProjection * vec4(vPosition, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -57,9 +98,14 @@ struct Light
 	float intensity;
 };
 
-layout(binding=0, std140) uniform GlobalParams
+layout(binding=0, std140) uniform FrameParams
+{
+	mat4 uViewProjection;
+	vec3 uCameraPosition;
+};
+
+layout(binding=2, std140) uniform LightParams
 {
-	vec3 uCamPosition;
 	uint uLightCount;
 	Light uLight[16];
 };
@@ -68,14 +114,13 @@ in vec2 vTexCoord;
 in vec3 vPosition;
 in vec3 vNormal;
 in vec3 vViewDir;
+in mat3 vTBN;
 
 uniform bool useNormalTexture;
 uniform sampler2D uNormal;
 
 uniform sampler2D uTexture;
-uniform sampler2D uMetallic;
-uniform sampler2D uRoughness;
-uniform sampler2D uAO;
+uniform sampler2D uORM; // Occlusion (R), roughness (G) and metallic (B)
 uniform sampler2D uEmissive;
 
 uniform bool usePBR;
@@ -101,12 +146,15 @@ void main()
 	{
 		if(useNormalTexture)
 		{
-			oNormals = vec4(texture(uNormal, vTexCoord).rgb, 0.0f);
+			// BC5 normal maps only store xy
+			vec2 normalXY = texture(uNormal, vTexCoord).rg * 2.0 - 1.0;
+			oNormals = vec4(normalize(vTBN * vec3(normalXY, sqrt(max(0.0, 1.0 - dot(normalXY, normalXY))))), 0.0f);
 		}
 
-		oMetallic = vec4(vec3(texture(uMetallic, vTexCoord).r), 1.0f);
-		oRoughness = vec4(vec3(texture(uRoughness, vTexCoord).r), 1.0f);
-		oAo = vec4(vec3(texture(uAO, vTexCoord).r), 1.0f);
+		vec3 orm = texture(uORM, vTexCoord).rgb;
+		oMetallic = vec4(vec3(orm.b), 1.0f);
+		oRoughness = vec4(vec3(orm.g), 1.0f);
+		oAo = vec4(vec3(orm.r), 1.0f);
 		oEmissive = vec4(texture(uEmissive, vTexCoord).rgb, 1.0f);
 	}
 }
@@ -0,0 +1,74 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#ifdef TILE_CLASSIFY
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// One work group per screen tile, one invocation per pixel (DEFERRED_TILE_SIZE)
+layout(local_size_x = 16, local_size_y = 16) in;
+
+// TileClass
+#define TILE_CLASS_EMPTY 0u
+#define TILE_CLASS_EDGE 1u
+#define TILE_CLASS_FULL 2u
+
+struct DispatchCommand
+{
+	uint groupsX;
+	uint groupsY;
+	uint groupsZ;
+};
+
+layout(binding=3, std430) buffer TileClassCommands
+{
+	DispatchCommand uCommands[];
+};
+
+layout(binding=4, std430) writeonly buffer TileClassLists
+{
+	uint uTileLists[]; // x | y << 16, the list of class c from c * uTileCapacity on
+};
+
+uniform sampler2D uDepth; // G-buffer, 1.0 where nothing was drawn
+uniform ivec2 uDisplaySize;
+uniform uint uTileCapacity;
+
+shared uint sGeometry;
+shared uint sEmpty;
+
+void main()
+{
+	uint thread = gl_LocalInvocationIndex;
+	if (thread == 0u)
+	{
+		sGeometry = 0u;
+		sEmpty = 0u;
+	}
+	barrier();
+
+	// Pixels past the edge of the display count as neither
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	if (all(lessThan(pixel, uDisplaySize)))
+	{
+		if (texelFetch(uDepth, pixel, 0).r < 1.0)
+		{
+			atomicOr(sGeometry, 1u);
+		}
+		else
+		{
+			atomicOr(sEmpty, 1u);
+		}
+	}
+	barrier();
+
+	if (thread == 0u)
+	{
+		uint tileClass = sGeometry == 0u ? TILE_CLASS_EMPTY : (sEmpty == 0u ? TILE_CLASS_FULL : TILE_CLASS_EDGE);
+		uint index = atomicAdd(uCommands[tileClass].groupsX, 1u);
+		uTileLists[tileClass * uTileCapacity + index] = gl_WorkGroupID.x | (gl_WorkGroupID.y << 16);
+	}
+}
+
+#endif
+#endif